@@ -56,20 +56,46 @@ macx {
 }
 
 SOURCES += \
+    audio/audioringbuffer.cpp \
+    audio/backgroundjob.cpp \
+    audio/dspchain.cpp \
+    audio/fingerprinter.cpp \
+    audio/fingerprintjob.cpp \
+    audio/gaplessplayer.cpp \
+    audio/loudnessanalysisjob.cpp \
+    audio/loudnessmeter.cpp \
+    audio/prefetchcache.cpp \
+    audio/prefetchmediaio.cpp \
+    audio/seekindex.cpp \
+    audio/seekindexjob.cpp \
+    audio/splicedmediaio.cpp \
+    audio/trackdecoder.cpp \
+    audio/transcodingjob.cpp \
+    audio/waveformcache.cpp \
+    audio/waveformjob.cpp \
     musiclocationsmodel.cpp \
     musicsearchengine.cpp \
     filehelper.cpp \
     cover.cpp \
+    coverprobe.cpp \
     model/genericdao.cpp \
+    model/librarynotifier.cpp \
+    model/playhistory.cpp \
     model/playlistdao.cpp \
+    model/smartplaylistmodel.cpp \
+    model/smartplaylistrule.cpp \
     model/sqldatabase.cpp \
     model/trackdao.cpp \
+    playlistfile.cpp \
     settings.cpp \
     settingsprivate.cpp \
+    thumbnailcache.cpp \
+    thumbnailjob.cpp \
     library/libraryfilterproxymodel.cpp \
     library/libraryitemmodel.cpp \
     library/miamitemmodel.cpp \
     library/miamsortfilterproxymodel.cpp \
+    library/searchindex.cpp \
     library/separatoritem.cpp \
     library/trackitem.cpp \
     library/albumitem.cpp \
@@ -77,21 +103,47 @@ SOURCES += \
     library/yearitem.cpp
 
 HEADERS += \
+    audio/audioringbuffer.h \
+    audio/backgroundjob.h \
+    audio/dspchain.h \
+    audio/fingerprinter.h \
+    audio/fingerprintjob.h \
+    audio/gaplessplayer.h \
+    audio/loudnessanalysisjob.h \
+    audio/loudnessmeter.h \
+    audio/prefetchcache.h \
+    audio/prefetchmediaio.h \
+    audio/seekindex.h \
+    audio/seekindexjob.h \
+    audio/splicedmediaio.h \
+    audio/trackdecoder.h \
+    audio/transcodingjob.h \
+    audio/waveformcache.h \
+    audio/waveformjob.h \
     miamcore_global.h \
     musiclocationsmodel.h \
     musicsearchengine.h \
     filehelper.h \
     cover.h \
+    coverprobe.h \
     model/genericdao.h \
+    model/librarynotifier.h \
+    model/playhistory.h \
     model/playlistdao.h \
+    model/smartplaylistmodel.h \
+    model/smartplaylistrule.h \
     model/sqldatabase.h \
     model/trackdao.h \
+    playlistfile.h \
     settings.h \
     settingsprivate.h \
+    thumbnailcache.h \
+    thumbnailjob.h \
     library/libraryfilterproxymodel.h \
     library/libraryitemmodel.h \
     library/miamitemmodel.h \
     library/miamsortfilterproxymodel.h \
+    library/searchindex.h \
     library/separatoritem.h \
     library/trackitem.h \
     library/albumitem.h \
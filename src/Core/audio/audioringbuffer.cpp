@@ -0,0 +1,172 @@
+#include "audioringbuffer.h"
+
+#include <cstring>
+
+AudioRingBuffer::AudioRingBuffer(int capacity, int frameSize)
+	: _capacity(0)
+	, _frameSize(1)
+	, _readIndex(0)
+	, _writeIndex(0)
+	, _isEndOfStream(false)
+	, _producerStalls(0)
+	, _underruns(0)
+	, _isFull(false)
+	, _isStarved(true)
+	, _isConsumerSleeping(false)
+	, _isWakeUpPending(false)
+{
+	this->reset(capacity, frameSize);
+}
+
+/** Bytes which can be read by the consumer. */
+int AudioRingBuffer::bytesAvailable() const
+{
+	return static_cast<int>(_writeIndex.load(std::memory_order_acquire) - _readIndex.load(std::memory_order_acquire));
+}
+
+/** Bytes which can be written by the producer. */
+int AudioRingBuffer::bytesFree() const
+{
+	return _capacity.load() - this->bytesAvailable();
+}
+
+/** Consumer side. Returns the number of bytes which were copied to data, a multiple of the frame size. */
+int AudioRingBuffer::read(char *data, int maxSize)
+{
+	const int capacity = _capacity.load(std::memory_order_relaxed);
+	const quint64 readIndex = _readIndex.load(std::memory_order_relaxed);
+	const int available = static_cast<int>(_writeIndex.load(std::memory_order_acquire) - readIndex);
+	int size = qMin(maxSize, available);
+	size -= size % _frameSize;
+
+	if (size < maxSize && !_isEndOfStream.load(std::memory_order_acquire)) {
+		if (!_isStarved) {
+			_isStarved = true;
+			_underruns.fetch_add(1, std::memory_order_relaxed);
+		}
+	} else {
+		_isStarved = false;
+	}
+	if (size <= 0) {
+		return 0;
+	}
+
+	// Capacity is a power of two
+	const int start = static_cast<int>(readIndex & (capacity - 1));
+	const int first = qMin(size, capacity - start);
+	std::memcpy(data, _buffer.constData() + start, first);
+	std::memcpy(data + first, _buffer.constData(), size - first);
+	_readIndex.store(readIndex + size, std::memory_order_release);
+	return size;
+}
+
+/** Empties the buffer, and changes its capacity (rounded to a power of two). Neither thread should use it meanwhile. */
+void AudioRingBuffer::reset(int capacity, int frameSize)
+{
+	int roundedCapacity = 1;
+	while (roundedCapacity < capacity) {
+		roundedCapacity <<= 1;
+	}
+	if (_buffer.size() != roundedCapacity) {
+		_buffer = QByteArray(roundedCapacity, 0);
+	}
+	_capacity.store(capacity > 0 ? roundedCapacity : 0);
+	_frameSize = qMax(1, frameSize);
+	_readIndex.store(0);
+	_writeIndex.store(0);
+	_isEndOfStream.store(false);
+	_isFull = false;
+
+	// Nothing was written yet: this is not an underrun
+	_isStarved = true;
+}
+
+/** Producer side. */
+void AudioRingBuffer::setEndOfStream(bool isEndOfStream)
+{
+	_isEndOfStream.store(isEndOfStream, std::memory_order_release);
+
+	// The consumer may have to flush the device
+	if (isEndOfStream) {
+		this->wakeConsumer();
+	}
+}
+
+/** Can be called from any thread. */
+AudioRingBuffer::Stats AudioRingBuffer::stats() const
+{
+	Stats stats;
+	stats.capacity = _capacity.load();
+	stats.bytesAvailable = this->bytesAvailable();
+	stats.producerStalls = _producerStalls.load(std::memory_order_relaxed);
+	stats.underruns = _underruns.load(std::memory_order_relaxed);
+	return stats;
+}
+
+/** Consumer side. Sleeps until at least one frame can be read, at most timeout ms. Returns false if the buffer is still empty. */
+bool AudioRingBuffer::waitForData(int timeout)
+{
+	QMutexLocker locker(&_wakeUpMutex);
+	_isConsumerSleeping.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (this->bytesAvailable() < _frameSize && !_isWakeUpPending) {
+		_wakeUp.wait(&_wakeUpMutex, timeout);
+	}
+	_isConsumerSleeping.store(false, std::memory_order_relaxed);
+	_isWakeUpPending = false;
+	return this->bytesAvailable() >= _frameSize;
+}
+
+/** Consumer side. Sleeps until wakeConsumer() is called, at most timeout ms. */
+void AudioRingBuffer::waitForWakeUp(int timeout)
+{
+	QMutexLocker locker(&_wakeUpMutex);
+	if (!_isWakeUpPending) {
+		_wakeUp.wait(&_wakeUpMutex, timeout);
+	}
+	_isWakeUpPending = false;
+}
+
+/** Can be called from any thread, to interrupt a sleep of the consumer. */
+void AudioRingBuffer::wakeConsumer()
+{
+	QMutexLocker locker(&_wakeUpMutex);
+	_isWakeUpPending = true;
+	_wakeUp.wakeAll();
+}
+
+/** Producer side. Returns the number of bytes which were copied from data, a multiple of the frame size. */
+int AudioRingBuffer::write(const char *data, int size)
+{
+	const int capacity = _capacity.load(std::memory_order_relaxed);
+	const quint64 writeIndex = _writeIndex.load(std::memory_order_relaxed);
+	const int free = capacity - static_cast<int>(writeIndex - _readIndex.load(std::memory_order_acquire));
+	int written = qMin(size, free);
+	written -= written % _frameSize;
+
+	if (written < size) {
+		if (!_isFull) {
+			_isFull = true;
+			_producerStalls.fetch_add(1, std::memory_order_relaxed);
+		}
+	} else {
+		_isFull = false;
+	}
+	if (written <= 0) {
+		return 0;
+	}
+
+	const int start = static_cast<int>(writeIndex & (capacity - 1));
+	const int first = qMin(written, capacity - start);
+	char *buffer = _buffer.data();
+	std::memcpy(buffer + start, data, first);
+	std::memcpy(buffer, data + first, written - first);
+	_writeIndex.store(writeIndex + written, std::memory_order_release);
+
+	// Pairs with the fence in waitForData(): either the consumer sees the new index, or this side sees it's sleeping
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (_isConsumerSleeping.load(std::memory_order_relaxed)) {
+		this->wakeConsumer();
+	}
+	return written;
+}
@@ -0,0 +1,115 @@
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+
+#include "miamcore_global.h"
+
+/**
+ * \brief		The AudioRingBuffer class passes PCM samples from one producer thread to one consumer thread, without locks.
+ * \details		Indexes are only increasing, the producer owns the write index and the consumer owns the read index. Each side publishes
+ *				its index with a release store, and reads the other one with an acquire load, so a real-time consumer never waits.
+ *				Samples are written and read by whole frames (one sample for each channel).
+ *				When the buffer is empty, the consumer can sleep until the producer writes again: only then a lock is taken, and the
+ *				producer takes it only if the consumer is sleeping.
+ *				Samples are never dropped: a producer stall is counted when the producer has to wait for free space, and an underrun
+ *				when the consumer cannot read as much as it needs before the end of the stream. Each stall is counted once, not every
+ *				retry.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY AudioRingBuffer
+{
+public:
+	struct Stats
+	{
+		int capacity;
+		int bytesAvailable;
+		/** Times the producer had to wait for the consumer. */
+		quint64 producerStalls;
+		quint64 underruns;
+	};
+
+private:
+	QByteArray _buffer;
+
+	std::atomic<int> _capacity;
+
+	int _frameSize;
+
+	std::atomic<quint64> _readIndex;
+
+	std::atomic<quint64> _writeIndex;
+
+	std::atomic<bool> _isEndOfStream;
+
+	std::atomic<quint64> _producerStalls;
+
+	std::atomic<quint64> _underruns;
+
+	/** Only used by the producer. */
+	bool _isFull;
+
+	/** Only used by the consumer. */
+	bool _isStarved;
+
+	/** Protects nothing but the sleep of the consumer. */
+	QMutex _wakeUpMutex;
+
+	QWaitCondition _wakeUp;
+
+	std::atomic<bool> _isConsumerSleeping;
+
+	/** A wake up which was sent while the consumer wasn't sleeping yet. Protected by the mutex. */
+	bool _isWakeUpPending;
+
+public:
+	explicit AudioRingBuffer(int capacity = 0, int frameSize = 1);
+
+	/** Bytes which can be read by the consumer. */
+	int bytesAvailable() const;
+
+	/** Bytes which can be written by the producer. */
+	int bytesFree() const;
+
+	inline int capacity() const { return _capacity.load(); }
+
+	/** True if the producer has written its last samples. Reading less than requested is not an underrun then. */
+	inline bool isEndOfStream() const { return _isEndOfStream.load(std::memory_order_acquire); }
+
+	/** Consumer side. Returns the number of bytes which were copied to data, a multiple of the frame size. */
+	int read(char *data, int maxSize);
+
+	/** Empties the buffer, and changes its capacity (rounded to a power of two). Neither thread should use it meanwhile. */
+	void reset(int capacity, int frameSize);
+
+	/** Producer side. */
+	void setEndOfStream(bool isEndOfStream);
+
+	/** Can be called from any thread. */
+	Stats stats() const;
+
+	/** Bytes read since the last reset. */
+	inline quint64 totalRead() const { return _readIndex.load(std::memory_order_acquire); }
+
+	/** Bytes written since the last reset. */
+	inline quint64 totalWritten() const { return _writeIndex.load(std::memory_order_acquire); }
+
+	/** Consumer side. Sleeps until at least one frame can be read, at most timeout ms. Returns false if the buffer is still empty. */
+	bool waitForData(int timeout);
+
+	/** Consumer side. Sleeps until wakeConsumer() is called, at most timeout ms. */
+	void waitForWakeUp(int timeout);
+
+	/** Can be called from any thread, to interrupt a sleep of the consumer. */
+	void wakeConsumer();
+
+	/** Producer side. Returns the number of bytes which were copied from data, a multiple of the frame size. */
+	int write(const char *data, int size);
+};
+
+#endif // AUDIORINGBUFFER_H
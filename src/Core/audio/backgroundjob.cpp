@@ -0,0 +1,98 @@
+#include "backgroundjob.h"
+
+#include "model/sqldatabase.h"
+
+#include <QRunnable>
+#include <QTimer>
+
+BackgroundJob::BackgroundJob(QObject *parent)
+	: QObject(parent)
+	, _db(nullptr)
+	, _timer(new QTimer(this))
+	, _isCanceled(false)
+	, _remainingTasks(0)
+	, _totalTracks(0)
+{
+	_pool.setMaxThreadCount(QThread::idealThreadCount());
+	_timer->setInterval(1000);
+	connect(_timer, &QTimer::timeout, this, &BackgroundJob::update);
+}
+
+/** Subclasses must cancel the job in their destructor, while flushResults() can still be called. */
+BackgroundJob::~BackgroundJob()
+{
+	delete _db;
+}
+
+bool BackgroundJob::isRunning() const
+{
+	return _timer->isActive();
+}
+
+/** Number of parallel tasks, one per core by default. */
+void BackgroundJob::setThreadCount(int threadCount)
+{
+	_pool.setMaxThreadCount(threadCount > 0 ? threadCount : QThread::idealThreadCount());
+}
+
+/** Connection to the database in the thread of the job, opened the first time. */
+SqlDatabase* BackgroundJob::database()
+{
+	if (_db == nullptr) {
+		_db = new SqlDatabase;
+	}
+	return _db;
+}
+
+/** Tracks which were processed, for progress. */
+int BackgroundJob::finishedTracks() const
+{
+	return _totalTracks - _remainingTasks.load();
+}
+
+/** True if tasks have sent results which weren't saved yet. */
+bool BackgroundJob::hasPendingResults() const
+{
+	return false;
+}
+
+/** Starts one task per track. The job takes ownership of tasks. */
+void BackgroundJob::startTasks(const QList<QRunnable*> &tasks)
+{
+	if (!this->isRunning()) {
+		_isCanceled = false;
+		_totalTracks = 0;
+		_timer->start();
+	}
+	_totalTracks += tasks.size();
+	_remainingTasks += tasks.size();
+	for (QRunnable *task : tasks) {
+		_pool.start(task);
+	}
+}
+
+void BackgroundJob::update()
+{
+	this->flushResults();
+	emit progressChanged(qBound(0, this->finishedTracks(), _totalTracks), _totalTracks);
+
+	// Tasks which have nothing to do don't send results
+	if (_remainingTasks <= 0 && _pool.activeThreadCount() == 0 && !this->hasPendingResults()) {
+		_timer->stop();
+		emit finished();
+	}
+}
+
+void BackgroundJob::cancel()
+{
+	if (!this->isRunning()) {
+		return;
+	}
+	_isCanceled = true;
+	_pool.clear();
+	_pool.waitForDone();
+	_remainingTasks = 0;
+
+	// Results which were sent are kept
+	this->update();
+}
@@ -0,0 +1,92 @@
+#ifndef BACKGROUNDJOB_H
+#define BACKGROUNDJOB_H
+
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+
+#include <atomic>
+
+#include "miamcore_global.h"
+
+/// Forward declarations
+class QRunnable;
+class QTimer;
+class SqlDatabase;
+
+/**
+ * \brief		The BackgroundJob class runs one task per track in its own thread pool, and collects their results every second.
+ * \details		Tasks send their results to the job from any thread, under a lock, and the job saves them in the thread where it lives,
+ *				in flushResults(), with its own connection to the database. Progress is reported at the same time, and the job is
+ *				finished when every task has finished and every result was saved.
+ *				Tasks are started with startTasks(), even while the job is running. When the job is canceled, tasks which haven't
+ *				started are discarded, running tasks are expected to check isCanceled(), and results which were sent are still saved.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY BackgroundJob : public QObject
+{
+	Q_OBJECT
+private:
+	SqlDatabase *_db;
+
+	QTimer *_timer;
+
+protected:
+	QThreadPool _pool;
+
+	/** Protects results which are sent by tasks. */
+	mutable QMutex _mutex;
+
+	std::atomic<bool> _isCanceled;
+
+	std::atomic<int> _remainingTasks;
+
+	int _totalTracks;
+
+public:
+	explicit BackgroundJob(QObject *parent = nullptr);
+
+	/** Subclasses must cancel the job in their destructor, while flushResults() can still be called. */
+	virtual ~BackgroundJob();
+
+	/** Called by tasks, from any thread. */
+	inline bool isCanceled() const { return _isCanceled.load(); }
+
+	bool isRunning() const;
+
+	/** Number of parallel tasks, one per core by default. */
+	void setThreadCount(int threadCount);
+
+	/** Called by tasks, from any thread. */
+	inline void taskHasFinished() { _remainingTasks--; }
+
+protected:
+	/** Connection to the database in the thread of the job, opened the first time. */
+	SqlDatabase* database();
+
+	/** Tracks which were processed, for progress. */
+	virtual int finishedTracks() const;
+
+	/** Saves results which were sent by tasks since the last call. */
+	virtual void flushResults() = 0;
+
+	/** True if tasks have sent results which weren't saved yet. */
+	virtual bool hasPendingResults() const;
+
+	/** Starts one task per track. The job takes ownership of tasks. */
+	void startTasks(const QList<QRunnable*> &tasks);
+
+private slots:
+	void update();
+
+public slots:
+	void cancel();
+
+signals:
+	void finished();
+
+	void progressChanged(int finishedTracks, int totalTracks);
+};
+
+#endif // BACKGROUNDJOB_H
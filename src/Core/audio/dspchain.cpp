@@ -0,0 +1,681 @@
+#include "dspchain.h"
+
+#include <QElapsedTimer>
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIAM_DSP_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled for this target only, and selected at runtime
+#if defined(MIAM_DSP_SSE2) && (defined(__GNUC__) || defined(_MSC_VER))
+#define MIAM_DSP_AVX2
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define MIAM_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#include <intrin.h>
+#define MIAM_TARGET_AVX2
+#endif
+#endif
+
+using namespace QtAV;
+
+namespace {
+
+typedef void (*Deinterleave)(const float *in, float *out, int stride, int channels, int frames, float gain);
+typedef void (*Interleave)(const float *in, int stride, char *out, int channels, int frames);
+typedef void (*Crossfade)(float *samples, const float *fadeOut, const float *curveIn, const float *curveOut, int frames);
+typedef void (*Biquads)(float *planar, int stride, int channels, int frames, const float *coefficients, const int *bands,
+						int bandCount, float *states, float *lanes);
+
+struct Kernels
+{
+	Deinterleave deinterleave;
+	Interleave interleaveFloat;
+	Interleave interleaveS16;
+	Crossfade crossfade;
+	Biquads biquads;
+};
+
+/** States of each band are padded to 8 channels. */
+inline int paddedChannels(int channels)
+{
+	return (channels + 7) & ~7;
+}
+
+inline qint16 toS16(float sample)
+{
+	return static_cast<qint16>(qRound(qBound(-1.0f, sample, 1.0f) * 32767.0f));
+}
+
+void deinterleaveScalar(const float *in, float *out, int stride, int channels, int frames, float gain)
+{
+	for (int c = 0; c < channels; c++) {
+		float *channel = out + c * stride;
+		for (int i = 0; i < frames; i++) {
+			channel[i] = in[i * channels + c] * gain;
+		}
+	}
+}
+
+void interleaveFloatScalar(const float *in, int stride, char *out, int channels, int frames)
+{
+	float *samples = reinterpret_cast<float*>(out);
+	for (int c = 0; c < channels; c++) {
+		const float *channel = in + c * stride;
+		for (int i = 0; i < frames; i++) {
+			samples[i * channels + c] = channel[i];
+		}
+	}
+}
+
+void interleaveS16Scalar(const float *in, int stride, char *out, int channels, int frames)
+{
+	qint16 *samples = reinterpret_cast<qint16*>(out);
+	for (int c = 0; c < channels; c++) {
+		const float *channel = in + c * stride;
+		for (int i = 0; i < frames; i++) {
+			samples[i * channels + c] = toS16(channel[i]);
+		}
+	}
+}
+
+void crossfadeScalar(float *samples, const float *fadeOut, const float *curveIn, const float *curveOut, int frames)
+{
+	for (int i = 0; i < frames; i++) {
+		samples[i] = samples[i] * curveIn[i] + fadeOut[i] * curveOut[i];
+	}
+}
+
+/** Transposed direct form II, band after band on the whole block. */
+void biquadsScalar(float *planar, int stride, int channels, int frames, const float *coefficients, const int *bands,
+				   int bandCount, float *states, float *)
+{
+	const int padded = paddedChannels(channels);
+	for (int c = 0; c < channels; c++) {
+		float *samples = planar + c * stride;
+		for (int j = 0; j < bandCount; j++) {
+			const int b = bands[j];
+			const float *k = coefficients + 5 * b;
+			float z1 = states[2 * b * padded + c];
+			float z2 = states[(2 * b + 1) * padded + c];
+			for (int i = 0; i < frames; i++) {
+				const float x = samples[i];
+				const float y = k[0] * x + z1;
+				z1 = k[1] * x - k[3] * y + z2;
+				z2 = k[2] * x - k[4] * y;
+				samples[i] = y;
+			}
+			states[2 * b * padded + c] = z1;
+			states[(2 * b + 1) * padded + c] = z2;
+		}
+	}
+}
+
+#if defined(MIAM_DSP_SSE2)
+void deinterleaveSse2(const float *in, float *out, int stride, int channels, int frames, float gain)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	int i = 0;
+	if (channels == 1) {
+		for (; i + 4 <= frames; i += 4) {
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+		}
+		for (; i < frames; i++) {
+			out[i] = in[i] * gain;
+		}
+	} else if (channels == 2) {
+		float *left = out;
+		float *right = out + stride;
+		for (; i + 4 <= frames; i += 4) {
+			const __m128 a = _mm_loadu_ps(in + 2 * i);
+			const __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+			_mm_storeu_ps(left + i, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), g));
+			_mm_storeu_ps(right + i, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), g));
+		}
+		for (; i < frames; i++) {
+			left[i] = in[2 * i] * gain;
+			right[i] = in[2 * i + 1] * gain;
+		}
+	} else {
+		deinterleaveScalar(in, out, stride, channels, frames, gain);
+	}
+}
+
+void interleaveFloatSse2(const float *in, int stride, char *out, int channels, int frames)
+{
+	if (channels != 2) {
+		interleaveFloatScalar(in, stride, out, channels, frames);
+		return;
+	}
+	float *samples = reinterpret_cast<float*>(out);
+	const float *left = in;
+	const float *right = in + stride;
+	int i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		const __m128 l = _mm_loadu_ps(left + i);
+		const __m128 r = _mm_loadu_ps(right + i);
+		_mm_storeu_ps(samples + 2 * i, _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps(samples + 2 * i + 4, _mm_unpackhi_ps(l, r));
+	}
+	for (; i < frames; i++) {
+		samples[2 * i] = left[i];
+		samples[2 * i + 1] = right[i];
+	}
+}
+
+void interleaveS16Sse2(const float *in, int stride, char *out, int channels, int frames)
+{
+	if (channels != 2) {
+		interleaveS16Scalar(in, stride, out, channels, frames);
+		return;
+	}
+	qint16 *samples = reinterpret_cast<qint16*>(out);
+	const float *left = in;
+	const float *right = in + stride;
+	const __m128 low = _mm_set1_ps(-1.0f);
+	const __m128 high = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(32767.0f);
+	int i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		const __m128 l = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(left + i), low), high), scale);
+		const __m128 r = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(right + i), low), high), scale);
+		const __m128i first = _mm_cvtps_epi32(_mm_unpacklo_ps(l, r));
+		const __m128i second = _mm_cvtps_epi32(_mm_unpackhi_ps(l, r));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(samples + 2 * i), _mm_packs_epi32(first, second));
+	}
+	for (; i < frames; i++) {
+		samples[2 * i] = toS16(left[i]);
+		samples[2 * i + 1] = toS16(right[i]);
+	}
+}
+
+void crossfadeSse2(float *samples, const float *fadeOut, const float *curveIn, const float *curveOut, int frames)
+{
+	int i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		const __m128 in = _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_loadu_ps(curveIn + i));
+		const __m128 out = _mm_mul_ps(_mm_loadu_ps(fadeOut + i), _mm_loadu_ps(curveOut + i));
+		_mm_storeu_ps(samples + i, _mm_add_ps(in, out));
+	}
+	crossfadeScalar(samples + i, fadeOut + i, curveIn + i, curveOut + i, frames - i);
+}
+
+/** Up to 4 channels in the lanes of one register: samples are gathered once, then go through every band. */
+void biquadsSse2(float *planar, int stride, int channels, int frames, const float *coefficients, const int *bands,
+				 int bandCount, float *states, float *lanes)
+{
+	const int padded = paddedChannels(channels);
+	for (int c = 0; c < channels; c += 4) {
+		const int used = qMin(4, channels - c);
+		for (int i = 0; i < frames; i++) {
+			for (int l = 0; l < 4; l++) {
+				lanes[4 * i + l] = l < used ? planar[(c + l) * stride + i] : 0.0f;
+			}
+		}
+		for (int j = 0; j < bandCount; j++) {
+			const int b = bands[j];
+			const float *k = coefficients + 5 * b;
+			const __m128 b0 = _mm_set1_ps(k[0]);
+			const __m128 b1 = _mm_set1_ps(k[1]);
+			const __m128 b2 = _mm_set1_ps(k[2]);
+			const __m128 a1 = _mm_set1_ps(k[3]);
+			const __m128 a2 = _mm_set1_ps(k[4]);
+			__m128 z1 = _mm_loadu_ps(states + 2 * b * padded + c);
+			__m128 z2 = _mm_loadu_ps(states + (2 * b + 1) * padded + c);
+			for (int i = 0; i < frames; i++) {
+				const __m128 x = _mm_loadu_ps(lanes + 4 * i);
+				const __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+				z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+				z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+				_mm_storeu_ps(lanes + 4 * i, y);
+			}
+			_mm_storeu_ps(states + 2 * b * padded + c, z1);
+			_mm_storeu_ps(states + (2 * b + 1) * padded + c, z2);
+		}
+		for (int l = 0; l < used; l++) {
+			float *channel = planar + (c + l) * stride;
+			for (int i = 0; i < frames; i++) {
+				channel[i] = lanes[4 * i + l];
+			}
+		}
+	}
+}
+#endif
+
+#if defined(MIAM_DSP_AVX2)
+MIAM_TARGET_AVX2 void deinterleaveAvx2(const float *in, float *out, int stride, int channels, int frames, float gain)
+{
+	if (channels != 2) {
+		deinterleaveSse2(in, out, stride, channels, frames, gain);
+		return;
+	}
+	const __m256 g = _mm256_set1_ps(gain);
+	const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	float *left = out;
+	float *right = out + stride;
+	int i = 0;
+	for (; i + 8 <= frames; i += 8) {
+		const __m256 a = _mm256_permutevar8x32_ps(_mm256_loadu_ps(in + 2 * i), order);
+		const __m256 b = _mm256_permutevar8x32_ps(_mm256_loadu_ps(in + 2 * i + 8), order);
+		_mm256_storeu_ps(left + i, _mm256_mul_ps(_mm256_permute2f128_ps(a, b, 0x20), g));
+		_mm256_storeu_ps(right + i, _mm256_mul_ps(_mm256_permute2f128_ps(a, b, 0x31), g));
+	}
+	for (; i < frames; i++) {
+		left[i] = in[2 * i] * gain;
+		right[i] = in[2 * i + 1] * gain;
+	}
+}
+
+MIAM_TARGET_AVX2 void crossfadeAvx2(float *samples, const float *fadeOut, const float *curveIn, const float *curveOut, int frames)
+{
+	int i = 0;
+	for (; i + 8 <= frames; i += 8) {
+		const __m256 in = _mm256_mul_ps(_mm256_loadu_ps(samples + i), _mm256_loadu_ps(curveIn + i));
+		const __m256 out = _mm256_mul_ps(_mm256_loadu_ps(fadeOut + i), _mm256_loadu_ps(curveOut + i));
+		_mm256_storeu_ps(samples + i, _mm256_add_ps(in, out));
+	}
+	crossfadeScalar(samples + i, fadeOut + i, curveIn + i, curveOut + i, frames - i);
+}
+
+/** Same as SSE2 with 8 lanes, which only helps with more than 4 channels. */
+MIAM_TARGET_AVX2 void biquadsAvx2(float *planar, int stride, int channels, int frames, const float *coefficients, const int *bands,
+								  int bandCount, float *states, float *lanes)
+{
+	if (channels <= 4) {
+		biquadsSse2(planar, stride, channels, frames, coefficients, bands, bandCount, states, lanes);
+		return;
+	}
+	const int padded = paddedChannels(channels);
+	for (int c = 0; c < channels; c += 8) {
+		const int used = qMin(8, channels - c);
+		for (int i = 0; i < frames; i++) {
+			for (int l = 0; l < 8; l++) {
+				lanes[8 * i + l] = l < used ? planar[(c + l) * stride + i] : 0.0f;
+			}
+		}
+		for (int j = 0; j < bandCount; j++) {
+			const int b = bands[j];
+			const float *k = coefficients + 5 * b;
+			const __m256 b0 = _mm256_set1_ps(k[0]);
+			const __m256 b1 = _mm256_set1_ps(k[1]);
+			const __m256 b2 = _mm256_set1_ps(k[2]);
+			const __m256 a1 = _mm256_set1_ps(k[3]);
+			const __m256 a2 = _mm256_set1_ps(k[4]);
+			__m256 z1 = _mm256_loadu_ps(states + 2 * b * padded + c);
+			__m256 z2 = _mm256_loadu_ps(states + (2 * b + 1) * padded + c);
+			for (int i = 0; i < frames; i++) {
+				const __m256 x = _mm256_loadu_ps(lanes + 8 * i);
+				const __m256 y = _mm256_add_ps(_mm256_mul_ps(b0, x), z1);
+				z1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, x), _mm256_mul_ps(a1, y)), z2);
+				z2 = _mm256_sub_ps(_mm256_mul_ps(b2, x), _mm256_mul_ps(a2, y));
+				_mm256_storeu_ps(lanes + 8 * i, y);
+			}
+			_mm256_storeu_ps(states + 2 * b * padded + c, z1);
+			_mm256_storeu_ps(states + (2 * b + 1) * padded + c, z2);
+		}
+		for (int l = 0; l < used; l++) {
+			float *channel = planar + (c + l) * stride;
+			for (int i = 0; i < frames; i++) {
+				channel[i] = lanes[8 * i + l];
+			}
+		}
+	}
+}
+
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#else
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	// The OS must also save YMM registers
+	__cpuid(info, 1);
+	const bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+	const bool hasAvx = (info[2] & (1 << 28)) != 0;
+	if (!hasOsxsave || !hasAvx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#endif
+}
+#endif
+
+const Kernels &kernels(DspChain::Instructions instructions)
+{
+	static const Kernels scalar = { deinterleaveScalar, interleaveFloatScalar, interleaveS16Scalar, crossfadeScalar, biquadsScalar };
+#if defined(MIAM_DSP_AVX2)
+	static const Kernels avx2 = { deinterleaveAvx2, interleaveFloatSse2, interleaveS16Sse2, crossfadeAvx2, biquadsAvx2 };
+	if (instructions == DspChain::AVX2) {
+		return avx2;
+	}
+#endif
+#if defined(MIAM_DSP_SSE2)
+	static const Kernels sse2 = { deinterleaveSse2, interleaveFloatSse2, interleaveS16Sse2, crossfadeSse2, biquadsSse2 };
+	if (instructions >= DspChain::SSE2) {
+		return sse2;
+	}
+#endif
+	Q_UNUSED(instructions);
+	return scalar;
+}
+
+}
+
+DspChain::DspChain()
+	: _preamp(0.0)
+	, _isEqualizerEnabled(false)
+	, _requestedInstructions(AVX2)
+	, _sampleRate(44100)
+	, _isChanged(true)
+	, _instructions(Scalar)
+	, _channels(2)
+	, _outputSampleFormat(AudioFormat::SampleFormat_Float)
+	, _preampGain(1.0f)
+	, _capacity(0)
+	, _fadeFrames(0)
+	, _fadePosition(0)
+	, _blocks(0)
+	, _frames(0)
+	, _totalNs(0)
+	, _maxNs(0)
+{
+	// One octave between bands
+	static const qreal frequencies[bandCount] = { 31, 62, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+	for (qreal frequency : frequencies) {
+		_bands.append({ frequency, M_SQRT2, 0.0 });
+	}
+	_states.fill(0.0f, 2 * bandCount * paddedChannels(_channels));
+}
+
+DspChain::Band DspChain::band(int index) const
+{
+	QMutexLocker locker(&_mutex);
+	return _bands.value(index);
+}
+
+/** Processes noise in blocks, with every band of the equalizer and a crossfade, and returns the time spent. */
+DspChain::Stats DspChain::benchmark(Instructions instructions, int channels, int sampleRate, int blockFrames, int blockCount)
+{
+	AudioFormat format;
+	format.setChannels(channels);
+	format.setSampleRate(sampleRate);
+	format.setSampleFormat(AudioFormat::SampleFormat_Signed16);
+
+	DspChain chain;
+	chain.setInstructions(instructions);
+	chain.setEqualizerEnabled(true);
+	for (int i = 0; i < bandCount; i++) {
+		Band band = chain.band(i);
+		band.gain = (i % 2 == 0) ? 6.0 : -6.0;
+		chain.setBand(i, band);
+	}
+	chain.setFormat(format);
+
+	// White noise from a linear congruential generator, so results can be compared between runs
+	QByteArray block(blockFrames * channels * int(sizeof(float)), Qt::Uninitialized);
+	float *samples = reinterpret_cast<float*>(block.data());
+	quint32 seed = 1;
+	for (int i = 0; i < blockFrames * channels; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		samples[i] = (seed >> 8) / float(1 << 24) * 2.0f - 1.0f;
+	}
+
+	// First block allocates buffers
+	chain.process(block, 0.5);
+	chain.resetStats();
+	chain.beginCrossfade(block, 0.5);
+	for (int i = 0; i < blockCount; i++) {
+		chain.process(block, 0.5);
+	}
+	return chain.stats();
+}
+
+/** Mixes the next frames with this tail of the previous track (packed float), until the tail has faded out. */
+void DspChain::beginCrossfade(const QByteArray &tail, qreal gain)
+{
+	this->applyChanges();
+	const int frames = tail.size() / (_channels * int(sizeof(float)));
+	_fadeOut.resize(frames * _channels);
+	kernels(_instructions).deinterleave(reinterpret_cast<const float*>(tail.constData()), _fadeOut.data(), frames, _channels,
+										frames, float(gain) * _preampGain);
+	_fadeFrames = frames;
+	_fadePosition = 0;
+
+	// Equal-power curves: the sum of the powers of both tracks stays constant
+	_curveIn.resize(frames);
+	_curveOut.resize(frames);
+	for (int i = 0; i < frames; i++) {
+		const float theta = float(M_PI_2) * (i + 0.5f) / frames;
+		_curveIn[i] = std::sin(theta);
+		_curveOut[i] = std::cos(theta);
+	}
+}
+
+/** Returns the rest of the tail of the previous track, faded out over silence. */
+QByteArray DspChain::finishCrossfade()
+{
+	if (!this->isCrossfading()) {
+		return QByteArray();
+	}
+	return this->process(QByteArray((_fadeFrames - _fadePosition) * _channels * int(sizeof(float)), 0));
+}
+
+/** Instructions used by kernels, which can be lower than the requested ones. */
+DspChain::Instructions DspChain::instructions() const
+{
+	QMutexLocker locker(&_mutex);
+	return static_cast<Instructions>(qMin<int>(_requestedInstructions, supportedInstructions()));
+}
+
+bool DspChain::isEqualizerEnabled() const
+{
+	QMutexLocker locker(&_mutex);
+	return _isEqualizerEnabled;
+}
+
+qreal DspChain::preamp() const
+{
+	QMutexLocker locker(&_mutex);
+	return _preamp;
+}
+
+/** Processes packed float frames, and returns them in the format of the device. Gain is linear. */
+QByteArray DspChain::process(const QByteArray &frame, qreal gain)
+{
+	QElapsedTimer timer;
+	timer.start();
+	this->applyChanges();
+
+	const int frames = frame.size() / (_channels * int(sizeof(float)));
+	if (frames == 0) {
+		return QByteArray();
+	}
+	this->reserve(frames);
+	const Kernels &k = kernels(_instructions);
+	float *planar = _planar.data();
+	k.deinterleave(reinterpret_cast<const float*>(frame.constData()), planar, _capacity, _channels, frames, float(gain) * _preampGain);
+
+	if (this->isCrossfading()) {
+		const int n = qMin(frames, _fadeFrames - _fadePosition);
+		for (int c = 0; c < _channels; c++) {
+			k.crossfade(planar + c * _capacity, _fadeOut.constData() + c * _fadeFrames + _fadePosition,
+						_curveIn.constData() + _fadePosition, _curveOut.constData() + _fadePosition, n);
+		}
+		_fadePosition += n;
+		if (!this->isCrossfading()) {
+			_fadeOut.clear();
+			_curveIn.clear();
+			_curveOut.clear();
+			_fadeFrames = 0;
+			_fadePosition = 0;
+		}
+	}
+
+	if (!_activeBands.isEmpty()) {
+		k.biquads(planar, _capacity, _channels, frames, _coefficients.constData(), _activeBands.constData(), _activeBands.size(),
+				  _states.data(), _lanes.data());
+	}
+
+	QByteArray output;
+	if (_outputSampleFormat == AudioFormat::SampleFormat_Signed16) {
+		output.resize(frames * _channels * int(sizeof(qint16)));
+		k.interleaveS16(planar, _capacity, output.data(), _channels, frames);
+	} else {
+		output.resize(frames * _channels * int(sizeof(float)));
+		k.interleaveFloat(planar, _capacity, output.data(), _channels, frames);
+	}
+
+	const qint64 elapsed = timer.nsecsElapsed();
+	_blocks++;
+	_frames += frames;
+	_totalNs += elapsed;
+	if (elapsed > _maxNs.load()) {
+		_maxNs.store(elapsed);
+	}
+	return output;
+}
+
+void DspChain::resetStats()
+{
+	_blocks.store(0);
+	_frames.store(0);
+	_totalNs.store(0);
+	_maxNs.store(0);
+}
+
+/** Can be called from any thread. */
+void DspChain::setBand(int index, const Band &band)
+{
+	QMutexLocker locker(&_mutex);
+	if (index >= 0 && index < _bands.size()) {
+		_bands[index] = band;
+		_isChanged.store(true);
+	}
+}
+
+void DspChain::setEqualizerEnabled(bool enabled)
+{
+	QMutexLocker locker(&_mutex);
+	_isEqualizerEnabled = enabled;
+	_isChanged.store(true);
+}
+
+/** Channels and sample rate of the decoder, and sample format of the device (float or signed 16 bits). Resets filters. */
+void DspChain::setFormat(const AudioFormat &format)
+{
+	_channels = qMax(1, format.channels());
+	_outputSampleFormat = format.sampleFormat() == AudioFormat::SampleFormat_Signed16 ? AudioFormat::SampleFormat_Signed16
+																					   : AudioFormat::SampleFormat_Float;
+	_capacity = 0;
+	_planar.clear();
+	_lanes.clear();
+	_fadeOut.clear();
+	_curveIn.clear();
+	_curveOut.clear();
+	_fadeFrames = 0;
+	_fadePosition = 0;
+	_states.fill(0.0f, 2 * bandCount * paddedChannels(_channels));
+
+	// Coefficients depend on the sample rate
+	QMutexLocker locker(&_mutex);
+	_sampleRate = format.sampleRate();
+	_isChanged.store(true);
+}
+
+/** For benchmarks: instructions which are not supported by the CPU are ignored. */
+void DspChain::setInstructions(Instructions instructions)
+{
+	QMutexLocker locker(&_mutex);
+	_requestedInstructions = instructions;
+	_isChanged.store(true);
+}
+
+/** In dB, applied to every track. */
+void DspChain::setPreamp(qreal preamp)
+{
+	QMutexLocker locker(&_mutex);
+	_preamp = preamp;
+	_isChanged.store(true);
+}
+
+/** Can be called from any thread. */
+DspChain::Stats DspChain::stats() const
+{
+	QMutexLocker locker(&_mutex);
+	return { _blocks.load(), _frames.load(), _totalNs.load(), _maxNs.load(), _sampleRate };
+}
+
+/** Best instructions supported by the CPU and by the compiler. */
+DspChain::Instructions DspChain::supportedInstructions()
+{
+#if defined(MIAM_DSP_AVX2)
+	static const bool hasAvx2 = cpuHasAvx2();
+	if (hasAvx2) {
+		return AVX2;
+	}
+#endif
+#if defined(MIAM_DSP_SSE2)
+	return SSE2;
+#else
+	return Scalar;
+#endif
+}
+
+/** Computes coefficients of changed parameters, before a block. */
+void DspChain::applyChanges()
+{
+	if (!_isChanged.exchange(false)) {
+		return;
+	}
+	QMutexLocker locker(&_mutex);
+	_instructions = static_cast<Instructions>(qMin<int>(_requestedInstructions, supportedInstructions()));
+	_preampGain = float(qPow(10.0, _preamp / 20.0));
+
+	const int padded = paddedChannels(_channels);
+	_coefficients.fill(0.0f, 5 * bandCount);
+	_activeBands.clear();
+	for (int b = 0; b < bandCount; b++) {
+		const Band &band = _bands.at(b);
+		if (!_isEqualizerEnabled || qAbs(band.gain) < 0.01 || band.q <= 0.0 || band.frequency <= 0.0 ||
+				band.frequency >= 0.49 * _sampleRate) {
+			// A band which is enabled again starts from silence
+			std::fill(_states.begin() + 2 * b * padded, _states.begin() + 2 * (b + 1) * padded, 0.0f);
+			continue;
+		}
+
+		// Peaking filter of the Audio EQ Cookbook, by Robert Bristow-Johnson
+		const double a = qPow(10.0, band.gain / 40.0);
+		const double w0 = 2.0 * M_PI * band.frequency / _sampleRate;
+		const double alpha = qSin(w0) / (2.0 * band.q);
+		const double a0 = 1.0 + alpha / a;
+		float *k = _coefficients.data() + 5 * b;
+		k[0] = float((1.0 + alpha * a) / a0);
+		k[1] = float(-2.0 * qCos(w0) / a0);
+		k[2] = float((1.0 - alpha * a) / a0);
+		k[3] = k[1];
+		k[4] = float((1.0 - alpha / a) / a0);
+		_activeBands.append(b);
+	}
+}
+
+void DspChain::reserve(int frames)
+{
+	if (frames <= _capacity) {
+		return;
+	}
+	_capacity = frames;
+	_planar.resize(_capacity * _channels);
+	_lanes.resize(_capacity * 8);
+}
@@ -0,0 +1,179 @@
+#ifndef DSPCHAIN_H
+#define DSPCHAIN_H
+
+#include <QMutex>
+#include <QVector>
+
+#include <QtAV/AudioFormat.h>
+
+#include <atomic>
+
+#include "miamcore_global.h"
+
+/**
+ * \brief		The DspChain class processes decoded samples before they are written to the device: gain, crossfade and equalizer.
+ * \details		Frames of the decoder (packed float) are split into one buffer per channel, then the replay gain of the track and the
+ *				preamp are applied, the tail of the previous track is mixed with equal-power curves if a crossfade was started, and
+ *				the signal goes through 10 peaking biquads. Samples are finally interleaved in the format of the device.
+ *				Kernels are written for SSE2 and AVX2, with a scalar fallback. AVX2 is only used if the CPU supports it. Biquads are
+ *				recursive, so they are vectorized across channels instead of samples.
+ *				The time spent in each block is measured, so the load of the chain can be checked on slow computers, and benchmark()
+ *				runs the whole chain on noise, without any device.
+ *				Parameters can be changed from any thread, they are applied by the processing thread before its next block.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY DspChain
+{
+public:
+	/** Peaking filter of the equalizer. Gain is in dB. */
+	struct Band
+	{
+		qreal frequency;
+		qreal q;
+		qreal gain;
+	};
+
+	enum Instructions : int
+	{
+		Scalar	= 0,
+		SSE2	= 1,
+		AVX2	= 2
+	};
+
+	struct Stats
+	{
+		quint64 blocks;
+		quint64 frames;
+		qint64 totalNs;
+		qint64 maxNs;
+		int sampleRate;
+
+		inline qint64 averageNs() const { return blocks == 0 ? 0 : totalNs / qint64(blocks); }
+
+		/** Processing time relative to the duration of processed audio. Above 1, the chain is slower than real time. */
+		inline double load() const { return frames == 0 || sampleRate == 0 ? 0.0 : totalNs / (frames * 1e9 / sampleRate); }
+	};
+
+	static const int bandCount = 10;
+
+private:
+	/** Protects parameters which are set from other threads. */
+	mutable QMutex _mutex;
+
+	QVector<Band> _bands;
+
+	qreal _preamp;
+
+	bool _isEqualizerEnabled;
+
+	Instructions _requestedInstructions;
+
+	int _sampleRate;
+
+	/** Parameters have changed since the last block. */
+	std::atomic<bool> _isChanged;
+
+	// Everything below is owned by the processing thread
+
+	Instructions _instructions;
+
+	int _channels;
+
+	QtAV::AudioFormat::SampleFormat _outputSampleFormat;
+
+	float _preampGain;
+
+	/** Normalized coefficients b0, b1, b2, a1, a2 of each band. */
+	QVector<float> _coefficients;
+
+	/** Bands which are not flat. */
+	QVector<int> _activeBands;
+
+	/** z1 and z2 of each band, for each channel. Channels are padded to 8, so vector kernels can load them. */
+	QVector<float> _states;
+
+	/** One buffer for each channel, of _capacity frames. */
+	QVector<float> _planar;
+
+	int _capacity;
+
+	/** Samples of up to 8 channels, interleaved for vector biquads. */
+	QVector<float> _lanes;
+
+	/** One buffer for each channel, with the tail of the previous track. */
+	QVector<float> _fadeOut;
+
+	int _fadeFrames;
+
+	int _fadePosition;
+
+	/** Gains of the next track and of the tail for each frame of the crossfade, computed when it begins. */
+	QVector<float> _curveIn;
+
+	QVector<float> _curveOut;
+
+	std::atomic<quint64> _blocks;
+
+	std::atomic<quint64> _frames;
+
+	std::atomic<qint64> _totalNs;
+
+	std::atomic<qint64> _maxNs;
+
+public:
+	DspChain();
+
+	Band band(int index) const;
+
+	/** Processes noise in blocks, with every band of the equalizer and a crossfade, and returns the time spent. */
+	static Stats benchmark(Instructions instructions, int channels, int sampleRate, int blockFrames, int blockCount);
+
+	/** Mixes the next frames with this tail of the previous track (packed float), until the tail has faded out. */
+	void beginCrossfade(const QByteArray &tail, qreal gain);
+
+	/** Returns the rest of the tail of the previous track, faded out over silence. */
+	QByteArray finishCrossfade();
+
+	/** Instructions used by kernels, which can be lower than the requested ones. */
+	Instructions instructions() const;
+
+	inline bool isCrossfading() const { return _fadePosition < _fadeFrames; }
+
+	bool isEqualizerEnabled() const;
+
+	qreal preamp() const;
+
+	/** Processes packed float frames, and returns them in the format of the device. Gain is linear. */
+	QByteArray process(const QByteArray &frame, qreal gain = 1.0);
+
+	void resetStats();
+
+	/** Can be called from any thread. */
+	void setBand(int index, const Band &band);
+
+	void setEqualizerEnabled(bool enabled);
+
+	/** Channels and sample rate of the decoder, and sample format of the device (float or signed 16 bits). Resets filters. */
+	void setFormat(const QtAV::AudioFormat &format);
+
+	/** For benchmarks: instructions which are not supported by the CPU are ignored. */
+	void setInstructions(Instructions instructions);
+
+	/** In dB, applied to every track. */
+	void setPreamp(qreal preamp);
+
+	/** Can be called from any thread. */
+	Stats stats() const;
+
+	/** Best instructions supported by the CPU and by the compiler. */
+	static Instructions supportedInstructions();
+
+private:
+	/** Computes coefficients of changed parameters, before a block. */
+	void applyChanges();
+
+	void reserve(int frames);
+};
+
+#endif // DSPCHAIN_H
@@ -0,0 +1,243 @@
+#include "fingerprinter.h"
+
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+const int frameSize = 4096;
+const int hopSize = 2048;
+const int analyzedSeconds = 120;
+
+const double minimumFrequency = 28.0;
+const double maximumFrequency = 3520.0;
+
+/** Mean square of a frame, in the range of chroma, below which it's silent (about -70 dB). */
+const float silence = 1e-7f;
+
+const int smoothedFrames = 3;
+const int melodyDistance = 4;
+const int shingleDistance = 2;
+
+/** Melody bits are dropped from shingles, they change more with the encoding. */
+const int harmonyShift = 12;
+
+/** Up to 10 seconds between the beginning of two copies of the same recording. */
+const int maxOffset = 54;
+
+inline quint64 mix(quint64 x)
+{
+	x ^= x >> 33;
+	x *= Q_UINT64_C(0xff51afd7ed558ccd);
+	x ^= x >> 33;
+	x *= Q_UINT64_C(0xc4ceb9fe1a85ec53);
+	x ^= x >> 33;
+	return x;
+}
+
+}
+
+Fingerprinter::Fingerprinter()
+	: _window(frameSize)
+	, _pitchClasses(frameSize / 2 + 1, -1)
+	, _bitReversal(frameSize)
+	, _twiddles(frameSize / 2)
+	, _spectrum(frameSize)
+	, _maxFrames(analyzedSeconds * sampleRate / hopSize)
+{
+	for (int i = 0; i < frameSize; i++) {
+		_window[i] = float(0.5 - 0.5 * qCos(2.0 * M_PI * i / (frameSize - 1)));
+	}
+
+	// Each bin goes to the closest note, A0 is 27.5 Hz
+	for (int k = 1; k <= frameSize / 2; k++) {
+		double frequency = double(k) * sampleRate / frameSize;
+		if (frequency >= minimumFrequency && frequency <= maximumFrequency) {
+			int note = qRound(12.0 * std::log2(frequency / 27.5));
+			_pitchClasses[k] = note % 12;
+		}
+	}
+
+	int bits = 0;
+	while ((1 << bits) < frameSize) {
+		bits++;
+	}
+	for (int i = 0; i < frameSize; i++) {
+		int reversed = 0;
+		for (int b = 0; b < bits; b++) {
+			reversed |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		_bitReversal[i] = reversed;
+	}
+	for (int i = 0; i < frameSize / 2; i++) {
+		_twiddles[i] = std::polar(1.0f, float(-2.0 * M_PI * i / frameSize));
+	}
+}
+
+/** One 32-bit word for each frame. */
+QVector<quint32> Fingerprinter::fingerprint() const
+{
+	const int frames = _energies.size();
+	QVector<quint32> fingerprint(frames, 0);
+	QVector<float> smoothed(frames * 12, 0.0f);
+	for (int i = 0; i < frames; i++) {
+		float *s = smoothed.data() + 12 * i;
+		float energy = 0.0f;
+		for (int j = qMax(0, i - smoothedFrames + 1); j <= i; j++) {
+			energy += _energies.at(j);
+			for (int m = 0; m < 12; m++) {
+				s[m] += _chroma.at(12 * j + m);
+			}
+		}
+		if (energy < silence * qMin(i + 1, smoothedFrames)) {
+			std::fill(s, s + 12, 0.0f);
+			continue;
+		}
+
+		// Harmony: the two strongest pitch classes, and each pitch class against its neighbour
+		int strongest = 0;
+		int second = 1;
+		for (int m = 0; m < 12; m++) {
+			if (s[m] > s[strongest]) {
+				second = strongest;
+				strongest = m;
+			} else if (m != strongest && s[m] > s[second]) {
+				second = m;
+			}
+		}
+		quint32 word = (quint32(strongest) << 4) | quint32(second);
+		for (int m = 0; m < 12; m++) {
+			word = (word << 1) | (s[m] > s[(m + 1) % 12] ? 1 : 0);
+		}
+
+		// Melody: each pitch class against itself a little earlier
+		const float *p = i >= melodyDistance ? smoothed.constData() + 12 * (i - melodyDistance) : s;
+		for (int m = 0; m < 12; m++) {
+			word = (word << 1) | (s[m] > p[m] ? 1 : 0);
+		}
+
+		// Silence is 0, so a word which is 0 by chance is changed
+		fingerprint[i] = word == 0 ? 1 : word;
+	}
+	return fingerprint;
+}
+
+/** Buckets for each band of the MinHash signature. Empty if the track is silent. */
+QVector<qint64> Fingerprinter::lshBuckets(const QVector<quint32> &fingerprint)
+{
+	// Shingles of the harmony of two frames: the two strongest pitch classes and each pitch class against its neighbour.
+	// The strongest pitch classes alone have so few values that common chords put thousands of tracks in the same buckets
+	QVector<quint32> signature(bandCount * rowsPerBand, std::numeric_limits<quint32>::max());
+	bool isEmpty = true;
+	for (int i = 0; i + shingleDistance < fingerprint.size(); i++) {
+		const quint32 first = fingerprint.at(i);
+		const quint32 second = fingerprint.at(i + shingleDistance);
+		if (first == 0 || second == 0) {
+			continue;
+		}
+		isEmpty = false;
+		const quint64 shingle = (quint64(first >> harmonyShift) << (32 - harmonyShift)) | (second >> harmonyShift);
+		for (int h = 0; h < signature.size(); h++) {
+			const quint32 value = quint32(mix(shingle ^ (Q_UINT64_C(0x9e3779b97f4a7c15) * (h + 1))));
+			signature[h] = qMin(signature.at(h), value);
+		}
+	}
+
+	QVector<qint64> buckets;
+	if (isEmpty) {
+		return buckets;
+	}
+	for (int band = 0; band < bandCount; band++) {
+		quint64 hash = mix(band + 1);
+		for (int row = 0; row < rowsPerBand; row++) {
+			hash = mix(hash ^ signature.at(band * rowsPerBand + row));
+		}
+		buckets.append(qint64(hash));
+	}
+	return buckets;
+}
+
+/** Adds mono samples, in floating point. */
+void Fingerprinter::process(const float *samples, int count)
+{
+	int i = 0;
+	while (i < count && !this->isComplete()) {
+		const int n = qMin(count - i, frameSize - _samples.size());
+		for (int j = 0; j < n; j++) {
+			_samples.append(samples[i + j]);
+		}
+		i += n;
+		if (_samples.size() == frameSize) {
+			this->addFrame();
+			_samples.remove(0, hopSize);
+		}
+	}
+}
+
+/** Ratio of equal bits at the best offset, from 0 to 1. 0 if fingerprints don't overlap enough. */
+qreal Fingerprinter::similarity(const QVector<quint32> &a, const QVector<quint32> &b)
+{
+	// At least half of the shortest track must be compared
+	const int minimumOverlap = qMax(8, qMin(a.size(), b.size()) / 2);
+	qreal best = 0.0;
+	for (int offset = -maxOffset; offset <= maxOffset; offset++) {
+		int compared = 0;
+		int differentBits = 0;
+		for (int i = qMax(0, -offset); i < a.size() && i + offset < b.size(); i++) {
+			const quint32 x = a.at(i);
+			const quint32 y = b.at(i + offset);
+			if (x != 0 && y != 0) {
+				compared++;
+				differentBits += qPopulationCount(x ^ y);
+			}
+		}
+		if (compared >= minimumOverlap) {
+			best = qMax(best, 1.0 - differentBits / (32.0 * compared));
+		}
+	}
+	return best;
+}
+
+/** Adds the chroma of the first frame of samples. */
+void Fingerprinter::addFrame()
+{
+	for (int i = 0; i < frameSize; i++) {
+		_spectrum[_bitReversal.at(i)] = std::complex<float>(_samples.at(i) * _window.at(i), 0.0f);
+	}
+
+	// Iterative radix-2 FFT
+	for (int size = 2; size <= frameSize; size *= 2) {
+		const int half = size / 2;
+		const int step = frameSize / size;
+		for (int start = 0; start < frameSize; start += size) {
+			for (int k = 0; k < half; k++) {
+				const std::complex<float> t = _twiddles.at(k * step) * _spectrum.at(start + k + half);
+				const std::complex<float> u = _spectrum.at(start + k);
+				_spectrum[start + k] = u + t;
+				_spectrum[start + k + half] = u - t;
+			}
+		}
+	}
+
+	float chroma[12] = { 0.0f };
+	float energy = 0.0f;
+	for (int k = 1; k <= frameSize / 2; k++) {
+		const int pitchClass = _pitchClasses.at(k);
+		if (pitchClass >= 0) {
+			const float power = std::norm(_spectrum.at(k));
+			chroma[pitchClass] += power;
+			energy += power;
+		}
+	}
+
+	// Classes are normalized, so the fingerprint doesn't depend on the volume
+	const float norm = std::sqrt(std::inner_product(chroma, chroma + 12, chroma, 0.0f));
+	for (int m = 0; m < 12; m++) {
+		_chroma.append(norm > 0.0f ? chroma[m] / norm : 0.0f);
+	}
+	_energies.append(energy / (float(frameSize) * frameSize));
+}
@@ -0,0 +1,82 @@
+#ifndef FINGERPRINTER_H
+#define FINGERPRINTER_H
+
+#include <QVector>
+
+#include <complex>
+
+#include "miamcore_global.h"
+
+/**
+ * \brief		The Fingerprinter class computes an acoustic fingerprint of a track, which doesn't depend on its encoding.
+ * \details		Like Chromaprint, the first 2 minutes of a track are downmixed to mono at 11025 Hz, and the spectrum of each frame is
+ *				folded into 12 pitch classes (chroma), from 28 Hz to 3.5 kHz. Chroma are smoothed over 3 frames, then each frame gives a
+ *				32-bit word: the two strongest pitch classes (8 bits), each pitch class against its neighbour (12 bits), and each pitch
+ *				class against itself 4 frames earlier (12 bits). Silent frames give 0, and are ignored by comparisons.
+ *				Two fingerprints are compared with the ratio of equal bits, at the best offset up to 10 seconds.
+ *				To find duplicates without comparing every pair of tracks, the harmony bits of frames (20 bits) are paired into
+ *				shingles, and MinHash signatures of these sets are cut into bands (locality-sensitive hashing): tracks which share a
+ *				bucket for one band are candidates. With 16 bands of 5 rows, two tracks with a Jaccard similarity of 0.5 share at least
+ *				one bucket 40% of the time, 0.7 gives 95%, and unrelated tracks (around 0.05) almost never share one.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY Fingerprinter
+{
+public:
+	/** Input samples must be mono, at this rate. */
+	static const int sampleRate = 11025;
+
+	static const int bandCount = 16;
+
+	static const int rowsPerBand = 5;
+
+	/** Changes when buckets are computed differently, so saved buckets are computed again from saved fingerprints. */
+	static const int bucketsVersion = 2;
+
+private:
+	QVector<float> _window;
+
+	/** Pitch class of each bin of the spectrum, or -1 outside of the range. */
+	QVector<int> _pitchClasses;
+
+	QVector<int> _bitReversal;
+
+	QVector<std::complex<float>> _twiddles;
+
+	QVector<std::complex<float>> _spectrum;
+
+	/** Samples which don't fill a frame yet. */
+	QVector<float> _samples;
+
+	/** 12 values for each frame, and its energy. */
+	QVector<float> _chroma;
+
+	QVector<float> _energies;
+
+	int _maxFrames;
+
+public:
+	Fingerprinter();
+
+	/** One 32-bit word for each frame. */
+	QVector<quint32> fingerprint() const;
+
+	/** Enough samples were processed, the rest of the track can be skipped. */
+	inline bool isComplete() const { return _energies.size() >= _maxFrames; }
+
+	/** Buckets for each band of the MinHash signature. Empty if the track is silent. */
+	static QVector<qint64> lshBuckets(const QVector<quint32> &fingerprint);
+
+	/** Adds mono samples, in floating point. */
+	void process(const float *samples, int count);
+
+	/** Ratio of equal bits at the best offset, from 0 to 1. 0 if fingerprints don't overlap enough. */
+	static qreal similarity(const QVector<quint32> &a, const QVector<quint32> &b);
+
+private:
+	/** Adds the chroma of the first frame of samples. */
+	void addFrame();
+};
+
+#endif // FINGERPRINTER_H
@@ -0,0 +1,321 @@
+#include "fingerprintjob.h"
+#include "fingerprinter.h"
+#include "trackdecoder.h"
+
+#include "model/sqldatabase.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSet>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include <QtDebug>
+
+#include <algorithm>
+
+const qreal FingerprintJob::defaultThreshold = 0.8;
+
+namespace {
+
+QByteArray packFingerprint(const QVector<quint32> &fingerprint)
+{
+	QByteArray bytes;
+	QDataStream stream(&bytes, QIODevice::WriteOnly);
+	stream << fingerprint;
+	return bytes;
+}
+
+QVector<quint32> unpackFingerprint(const QByteArray &blob)
+{
+	QVector<quint32> fingerprint;
+	QDataStream stream(blob);
+	stream >> fingerprint;
+	return fingerprint;
+}
+
+/** Root of the cluster of a track, with path halving. */
+quint32 findCluster(QHash<quint32, quint32> &parents, quint32 id)
+{
+	if (!parents.contains(id)) {
+		parents.insert(id, id);
+		return id;
+	}
+	while (parents.value(id) != id) {
+		quint32 grandParent = parents.value(parents.value(id));
+		parents[id] = grandParent;
+		id = grandParent;
+	}
+	return id;
+}
+
+/** Decodes and fingerprints one track. */
+class FingerprintTask : public QRunnable
+{
+private:
+	FingerprintJob *_job;
+	QString _uri;
+	qint64 _lastFingerprinted;
+	bool _areBucketsOutdated;
+	/** Saved fingerprint of the track, only if its buckets are outdated. */
+	QByteArray _savedFingerprint;
+
+public:
+	FingerprintTask(FingerprintJob *job, const QString &uri, qint64 lastFingerprinted, bool areBucketsOutdated,
+					const QByteArray &savedFingerprint)
+		: QRunnable()
+		, _job(job)
+		, _uri(uri)
+		, _lastFingerprinted(lastFingerprinted)
+		, _areBucketsOutdated(areBucketsOutdated)
+		, _savedFingerprint(savedFingerprint)
+	{}
+
+	virtual void run() override
+	{
+		this->fingerprint();
+		_job->taskHasFinished();
+	}
+
+private:
+	void fingerprint()
+	{
+		QFileInfo fileInfo(_uri);
+		if (_job->isCanceled() || !fileInfo.exists()) {
+			return;
+		}
+		FingerprintJob::Result result;
+		result.uri = _uri;
+		result.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+		if (result.lastModified == _lastFingerprinted) {
+			if (_areBucketsOutdated) {
+				result.fingerprint = unpackFingerprint(_savedFingerprint);
+				result.buckets = Fingerprinter::lshBuckets(result.fingerprint);
+				_job->addResult(result);
+			}
+			return;
+		}
+
+		// Decoder downmixes and resamples
+		QtAV::AudioFormat format;
+		format.setSampleFormat(QtAV::AudioFormat::SampleFormat_Float);
+		format.setChannels(1);
+		format.setSampleRate(Fingerprinter::sampleRate);
+		TrackDecoder decoder(_uri, format);
+		if (decoder.open()) {
+			Fingerprinter fingerprinter;
+			while (!decoder.atEnd() && !fingerprinter.isComplete()) {
+				if (_job->isCanceled()) {
+					return;
+				}
+				const QByteArray frame = decoder.decode();
+				fingerprinter.process(reinterpret_cast<const float*>(frame.constData()), frame.size() / int(sizeof(float)));
+			}
+			result.fingerprint = fingerprinter.fingerprint();
+			result.buckets = Fingerprinter::lshBuckets(result.fingerprint);
+		}
+		// Tracks which can't be decoded are saved too, they won't be decoded again until they change
+		_job->addResult(result);
+	}
+};
+
+}
+
+FingerprintJob::FingerprintJob(QObject *parent)
+	: BackgroundJob(parent)
+	, _skippedBuckets(0)
+{}
+
+FingerprintJob::~FingerprintJob()
+{
+	this->cancel();
+}
+
+/** Called by tasks, from any thread. */
+void FingerprintJob::addResult(const Result &result)
+{
+	QMutexLocker locker(&_mutex);
+	_results.append(result);
+}
+
+/** Groups of tracks which are the same recording, the largest groups first. */
+QList<QStringList> FingerprintJob::duplicates(qreal threshold)
+{
+	SqlDatabase *db = this->database();
+
+	// Tracks which share a bucket are candidates. Buckets are read in order, so only one of them is in memory
+	QSet<quint64> candidates;
+	QVector<quint32> members;
+	_skippedBuckets = 0;
+	auto addCandidates = [this, &candidates, &members] () {
+		if (members.size() > maxBucketSize) {
+			_skippedBuckets++;
+		} else if (members.size() >= 2) {
+			for (int i = 0; i < members.size(); i++) {
+				for (int j = i + 1; j < members.size(); j++) {
+					quint32 a = qMin(members.at(i), members.at(j));
+					quint32 b = qMax(members.at(i), members.at(j));
+					candidates.insert((quint64(a) << 32) | b);
+				}
+			}
+		}
+		members.clear();
+	};
+	QSqlQuery selectBuckets(*db);
+	selectBuckets.setForwardOnly(true);
+	if (!selectBuckets.exec("SELECT bucket, fingerprintId FROM fingerprintBuckets ORDER BY bucket")) {
+		qDebug() << Q_FUNC_INFO << selectBuckets.lastError();
+		return QList<QStringList>();
+	}
+	qint64 bucket = 0;
+	while (selectBuckets.next()) {
+		qint64 b = selectBuckets.value(0).toLongLong();
+		if (!members.isEmpty() && b != bucket) {
+			addCandidates();
+		}
+		bucket = b;
+		members.append(selectBuckets.value(1).toUInt());
+	}
+	addCandidates();
+	if (_skippedBuckets > 0) {
+		qDebug() << Q_FUNC_INFO << _skippedBuckets << "buckets have more than" << maxBucketSize << "tracks and were skipped";
+	}
+
+	// Candidates are compared only if they're not in the same cluster yet
+	QHash<quint32, quint32> parents;
+	QHash<quint32, QVector<quint32>> fingerprints;
+	QSqlQuery selectFingerprint(*db);
+	selectFingerprint.prepare("SELECT fingerprint FROM fingerprints WHERE rowid = ?");
+	auto fingerprint = [&fingerprints, &selectFingerprint] (quint32 id) -> QVector<quint32> {
+		if (!fingerprints.contains(id)) {
+			selectFingerprint.addBindValue(id);
+			if (selectFingerprint.exec() && selectFingerprint.next()) {
+				fingerprints.insert(id, unpackFingerprint(selectFingerprint.value(0).toByteArray()));
+			}
+			selectFingerprint.finish();
+		}
+		return fingerprints.value(id);
+	};
+	for (quint64 candidate : candidates) {
+		quint32 a = findCluster(parents, quint32(candidate >> 32));
+		quint32 b = findCluster(parents, quint32(candidate & 0xffffffff));
+		if (a != b && Fingerprinter::similarity(fingerprint(quint32(candidate >> 32)), fingerprint(quint32(candidate & 0xffffffff))) >= threshold) {
+			parents[a] = b;
+		}
+	}
+
+	QHash<quint32, QList<quint32>> clusters;
+	for (quint32 id : parents.keys()) {
+		clusters[findCluster(parents, id)].append(id);
+	}
+	QList<QStringList> groups;
+	QSqlQuery selectUri(*db);
+	selectUri.prepare("SELECT uri FROM fingerprints WHERE rowid = ?");
+	for (const QList<quint32> &cluster : clusters) {
+		if (cluster.size() < 2) {
+			continue;
+		}
+		QStringList uris;
+		for (quint32 id : cluster) {
+			selectUri.addBindValue(id);
+			if (selectUri.exec() && selectUri.next()) {
+				uris.append(selectUri.value(0).toString());
+			}
+			selectUri.finish();
+		}
+		uris.sort();
+		groups.append(uris);
+	}
+	std::stable_sort(groups.begin(), groups.end(), [] (const QStringList &a, const QStringList &b) {
+		return a.size() > b.size();
+	});
+	return groups;
+}
+
+void FingerprintJob::start()
+{
+	if (this->isRunning()) {
+		return;
+	}
+	SqlDatabase *db = this->database();
+	_isCanceled = false;
+
+	// Tracks which were removed from the library
+	db->transaction();
+	db->exec("DELETE FROM fingerprintBuckets WHERE fingerprintId IN " \
+			 "(SELECT rowid FROM fingerprints WHERE uri NOT IN (SELECT uri FROM cache))");
+	db->exec("DELETE FROM fingerprints WHERE uri NOT IN (SELECT uri FROM cache)");
+	db->commit();
+
+	// Fingerprints are read only if their buckets are outdated
+	QSqlQuery selectTracks(*db);
+	selectTracks.setForwardOnly(true);
+	selectTracks.prepare("SELECT c.uri, f.lastModified, f.bucketsVersion IS NOT ?, " \
+						 "CASE WHEN f.bucketsVersion IS NOT ? THEN f.fingerprint END " \
+						 "FROM cache c LEFT JOIN fingerprints f ON c.uri = f.uri WHERE c.host IS NULL OR c.host = ''");
+	selectTracks.addBindValue(Fingerprinter::bucketsVersion);
+	selectTracks.addBindValue(Fingerprinter::bucketsVersion);
+	selectTracks.exec();
+	QList<QRunnable*> tasks;
+	while (selectTracks.next()) {
+		qint64 lastFingerprinted = selectTracks.value(1).isNull() ? -1 : selectTracks.value(1).toLongLong();
+		tasks.append(new FingerprintTask(this, selectTracks.value(0).toString(), lastFingerprinted, selectTracks.value(2).toBool(),
+										 selectTracks.value(3).toByteArray()));
+	}
+	this->startTasks(tasks);
+}
+
+/** Saves results of tasks in one transaction. */
+void FingerprintJob::flushResults()
+{
+	QList<Result> results;
+	_mutex.lock();
+	results.swap(_results);
+	_mutex.unlock();
+
+	if (!results.isEmpty()) {
+		SqlDatabase *db = this->database();
+		db->transaction();
+		QSqlQuery selectId(*db);
+		selectId.prepare("SELECT rowid FROM fingerprints WHERE uri = ?");
+		QSqlQuery deleteBuckets(*db);
+		deleteBuckets.prepare("DELETE FROM fingerprintBuckets WHERE fingerprintId = ?");
+		QSqlQuery insertFingerprint(*db);
+		insertFingerprint.prepare("INSERT OR REPLACE INTO fingerprints (uri, lastModified, fingerprint, bucketsVersion) VALUES (?, ?, ?, ?)");
+		QSqlQuery insertBucket(*db);
+		insertBucket.prepare("INSERT INTO fingerprintBuckets (bucket, fingerprintId) VALUES (?, ?)");
+		for (const Result &result : results) {
+			// Buckets of the previous fingerprint of a modified track
+			selectId.addBindValue(result.uri);
+			if (selectId.exec() && selectId.next()) {
+				deleteBuckets.addBindValue(selectId.value(0));
+				deleteBuckets.exec();
+			}
+			selectId.finish();
+
+			insertFingerprint.addBindValue(result.uri);
+			insertFingerprint.addBindValue(result.lastModified);
+			insertFingerprint.addBindValue(result.fingerprint.isEmpty() ? QByteArray() : packFingerprint(result.fingerprint));
+			insertFingerprint.addBindValue(Fingerprinter::bucketsVersion);
+			if (!insertFingerprint.exec()) {
+				qDebug() << Q_FUNC_INFO << insertFingerprint.lastError();
+				continue;
+			}
+			const QVariant fingerprintId = insertFingerprint.lastInsertId();
+			for (qint64 bucket : result.buckets) {
+				insertBucket.addBindValue(bucket);
+				insertBucket.addBindValue(fingerprintId);
+				insertBucket.exec();
+			}
+		}
+		db->commit();
+	}
+}
+
+bool FingerprintJob::hasPendingResults() const
+{
+	QMutexLocker locker(&_mutex);
+	return !_results.isEmpty();
+}
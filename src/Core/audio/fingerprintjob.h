@@ -0,0 +1,71 @@
+#ifndef FINGERPRINTJOB_H
+#define FINGERPRINTJOB_H
+
+#include <QStringList>
+#include <QVector>
+
+#include "backgroundjob.h"
+
+/**
+ * \brief		The FingerprintJob class computes acoustic fingerprints of the whole library, and finds tracks which are the same recording.
+ * \details		Each track is decoded and fingerprinted by a task of the pool of the job, with one thread per core. Results are saved in
+ *				tables "fingerprints" and "fingerprintBuckets" every second, in a single transaction, so the job can be interrupted
+ *				at any time: next time, only tracks which are new or modified are decoded again. When buckets are computed differently
+ *				by a new version, they are computed again from saved fingerprints, without decoding.
+ *				Duplicates are found from buckets only: tracks which share a bucket are compared, and similar tracks are merged into
+ *				clusters. The number of comparisons grows with the number of duplicates, not with the square of the number of tracks.
+ *				Buckets which are too large (like very common chords) are skipped, and counted.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY FingerprintJob : public BackgroundJob
+{
+	Q_OBJECT
+public:
+	/** Fingerprint of one track, sent by tasks to the job. */
+	struct Result
+	{
+		QString uri;
+		qint64 lastModified;
+		/** Empty if the track can't be decoded. */
+		QVector<quint32> fingerprint;
+		QVector<qint64> buckets;
+	};
+
+	/** Ratio of equal bits above which two tracks are the same recording. */
+	static const qreal defaultThreshold;
+
+	/** Buckets with more tracks are not specific enough to find duplicates. */
+	static const int maxBucketSize = 200;
+
+private:
+	QList<Result> _results;
+
+	/** Buckets which were skipped by the last search of duplicates. */
+	int _skippedBuckets;
+
+public:
+	explicit FingerprintJob(QObject *parent = nullptr);
+
+	virtual ~FingerprintJob();
+
+	/** Called by tasks, from any thread. */
+	void addResult(const Result &result);
+
+	/** Groups of tracks which are the same recording, the largest groups first. */
+	QList<QStringList> duplicates(qreal threshold = defaultThreshold);
+
+	/** Buckets with more than maxBucketSize tracks, which were skipped by the last search of duplicates. */
+	inline int skippedBuckets() const { return _skippedBuckets; }
+
+protected:
+	/** Saves results of tasks in one transaction. */
+	virtual void flushResults() override;
+
+	virtual bool hasPendingResults() const override;
+
+public slots:
+	void start();
+};
+
+#endif // FINGERPRINTJOB_H
@@ -0,0 +1,728 @@
+#include "gaplessplayer.h"
+#include "prefetchcache.h"
+#include "seekindex.h"
+#include "trackdecoder.h"
+
+#include "model/playhistory.h"
+#include "model/sqldatabase.h"
+
+#include <QtAV/AudioOutput.h>
+
+#include <QDateTime>
+#include <QSqlQuery>
+#include <QtMath>
+#include <QUrl>
+#include <QVector>
+
+#include <QtDebug>
+
+using namespace QtAV;
+
+/**
+ * \brief		The AudioSink class reads the ring buffer and writes samples to the device.
+ * \details		It never locks a mutex while playing: pause and volume are atomic flags of the player, and samples are read from the
+ *				lock-free buffer. When the buffer is empty or the player is paused, the sink sleeps until the player wakes it up, and
+ *				the device plays what it already has.
+ *				Chunks are recycled: the device keeps at most bufferCount() of them, so a chunk is released before it's filled again.
+ */
+class AudioSink : public QThread
+{
+private:
+	GaplessPlayer *_player;
+
+	AudioOutput *_output;
+
+	std::atomic<bool> _isAborting;
+
+public:
+	/** Milliseconds of sleep before the sink checks its flags again, if no one wakes it up. */
+	static const int idleTimeout = 100;
+
+	AudioSink(GaplessPlayer *player, AudioOutput *output)
+		: QThread()
+		, _player(player)
+		, _output(output)
+		, _isAborting(false)
+	{}
+
+	inline void abort()
+	{
+		_isAborting.store(true);
+		_player->_ringBuffer.wakeConsumer();
+	}
+
+protected:
+	virtual void run() override
+	{
+		const int chunkSize = _output->bufferSize();
+		QVector<QByteArray> chunks(_output->bufferCount() + 1);
+		for (QByteArray &chunk : chunks) {
+			chunk.resize(chunkSize);
+		}
+		int chunkIndex = 0;
+		qreal volume = -1;
+		bool isFlushed = false;
+		while (!_isAborting.load()) {
+			if (_player->_isPaused.load()) {
+				_player->_ringBuffer.waitForWakeUp(idleTimeout);
+				continue;
+			}
+			if (_player->_volume.load() != volume) {
+				volume = _player->_volume.load();
+				_output->setVolume(volume);
+			}
+
+			// Shrinking and growing again a chunk which isn't shared keeps its allocation
+			QByteArray &chunk = chunks[chunkIndex];
+			chunk.resize(chunkSize);
+			int bytes = _player->_ringBuffer.read(chunk.data(), chunkSize);
+			if (bytes > 0) {
+				chunk.resize(bytes);
+				_output->play(chunk);
+				chunkIndex = (chunkIndex + 1) % chunks.size();
+				isFlushed = false;
+			} else {
+				if (!isFlushed && _player->_ringBuffer.isEndOfStream()) {
+					_output->flush();
+					isFlushed = true;
+				}
+				_player->_ringBuffer.waitForData(idleTimeout);
+			}
+		}
+	}
+};
+
+GaplessPlayer::GaplessPlayer(QObject *parent)
+	: QThread(parent)
+	, _requestedPosition(-1)
+	, _bufferDepth(2000)
+	, _crossfadeDuration(0)
+	, _replayGainMode(NoReplayGain)
+	, _isAborting(false)
+	, _isStopRequested(false)
+	, _preloadSeconds(5)
+	, _isPaused(false)
+	, _volume(1.0)
+	, _db(nullptr)
+	, _current(nullptr)
+	, _next(nullptr)
+	, _currentGain(1.0)
+	, _nextGain(1.0)
+	, _tailBytes(0)
+	, _bytesPerSecond(0)
+	, _lastPosition(-1)
+	, _history(nullptr)
+	, _playedTrackDuration(0)
+	, _playStarted(0)
+	, _playedBytes(0)
+	, _lastRead(0)
+	, _sink(nullptr)
+{}
+
+GaplessPlayer::~GaplessPlayer()
+{
+	_mutex.lock();
+	_isAborting = true;
+	_condition.wakeAll();
+	_mutex.unlock();
+	this->wait();
+}
+
+/** Milliseconds of decoded audio between the decoder and the device. */
+int GaplessPlayer::bufferDepth() const
+{
+	QMutexLocker locker(&_mutex);
+	return _bufferDepth;
+}
+
+/** Producer stalls, underruns and filling of the buffer between the decoder and the device. */
+AudioRingBuffer::Stats GaplessPlayer::bufferStats() const
+{
+	return _ringBuffer.stats();
+}
+
+void GaplessPlayer::clearQueue()
+{
+	// A preloaded track which is not in the queue anymore is discarded at the end of the current one
+	_mutex.lock();
+	_queue.clear();
+	_mutex.unlock();
+	PrefetchCache::instance()->clearQueue();
+}
+
+/** Milliseconds of overlap between two tracks in the queue, or 0 for gapless playback. */
+int GaplessPlayer::crossfadeDuration() const
+{
+	QMutexLocker locker(&_mutex);
+	return _crossfadeDuration;
+}
+
+void GaplessPlayer::enqueue(const QString &uri)
+{
+	_mutex.lock();
+	_queue.append(uri);
+	_mutex.unlock();
+
+	// Tracks on network shares are copied before they're played
+	QUrl url(uri);
+	PrefetchCache::instance()->prefetch(url.isLocalFile() ? url.toLocalFile() : uri);
+}
+
+/** Plays a track immediately. Tracks in the queue are played after this one. */
+void GaplessPlayer::play(const QString &uri)
+{
+	QMutexLocker locker(&_mutex);
+	_requestedUri = uri;
+	_requestedPosition = -1;
+	_isPaused.store(false);
+	_isStopRequested = false;
+	_condition.wakeAll();
+	if (!this->isRunning()) {
+		this->start();
+	}
+}
+
+/** Seconds before the end of the current track when the next one is opened and decoded. */
+int GaplessPlayer::preloadSeconds() const
+{
+	QMutexLocker locker(&_mutex);
+	return _preloadSeconds;
+}
+
+QStringList GaplessPlayer::queue() const
+{
+	QMutexLocker locker(&_mutex);
+	return _queue;
+}
+
+/** Moves in the current track, in ms. Seek indexes are used when they were built by the scanner. */
+void GaplessPlayer::seek(qint64 position)
+{
+	QMutexLocker locker(&_mutex);
+	_requestedPosition = qMax<qint64>(0, position);
+	_condition.wakeAll();
+}
+
+/** Applied the next time the device is opened. */
+void GaplessPlayer::setAudioBackends(const QStringList &backends)
+{
+	QMutexLocker locker(&_mutex);
+	_audioBackends = backends;
+}
+
+/** Applied the next time a track is played with play(). */
+void GaplessPlayer::setBufferDepth(int ms)
+{
+	QMutexLocker locker(&_mutex);
+	_bufferDepth = qMax(100, ms);
+}
+
+/** Applied at the end of the current track. */
+void GaplessPlayer::setCrossfadeDuration(int ms)
+{
+	QMutexLocker locker(&_mutex);
+	_crossfadeDuration = qBound(0, ms, 10000);
+}
+
+void GaplessPlayer::setPaused(bool paused)
+{
+	_isPaused.store(paused);
+	_ringBuffer.wakeConsumer();
+}
+
+/** Plays and skips are sent to this history, which must outlive the player. */
+void GaplessPlayer::setPlayHistory(PlayHistory *history)
+{
+	QMutexLocker locker(&_mutex);
+	_history = history;
+}
+
+void GaplessPlayer::setPreloadSeconds(int seconds)
+{
+	QMutexLocker locker(&_mutex);
+	_preloadSeconds = qMax(1, seconds);
+}
+
+/** Applied to the next track which is opened. Gains are read from table "loudness". */
+void GaplessPlayer::setReplayGainMode(ReplayGainMode mode)
+{
+	QMutexLocker locker(&_mutex);
+	_replayGainMode = mode;
+}
+
+void GaplessPlayer::setVolume(qreal volume)
+{
+	_volume.store(volume);
+}
+
+void GaplessPlayer::stop()
+{
+	QMutexLocker locker(&_mutex);
+	_requestedUri.clear();
+	_requestedPosition = -1;
+	_isStopRequested = true;
+	_condition.wakeAll();
+}
+
+void GaplessPlayer::run()
+{
+	AudioOutput output;
+	SqlDatabase db;
+	_db = &db;
+	forever {
+		QString requestedUri;
+		qint64 requestedPosition = -1;
+		bool isStopRequested = false;
+		qint64 preloadMs = 0;
+		_mutex.lock();
+		while (!_isAborting && _requestedUri.isEmpty() && !_isStopRequested && _current == nullptr) {
+			_condition.wait(&_mutex);
+		}
+		if (_isAborting) {
+			_mutex.unlock();
+			break;
+		}
+		requestedUri = _requestedUri;
+		_requestedUri.clear();
+		requestedPosition = _requestedPosition;
+		_requestedPosition = -1;
+		isStopRequested = _isStopRequested;
+		_isStopRequested = false;
+		preloadMs = _preloadSeconds * 1000;
+		_mutex.unlock();
+
+		if (isStopRequested) {
+			this->finishPlay(true);
+			this->stopSink();
+			this->releaseTracks();
+			output.clear();
+			continue;
+		}
+		if (!requestedUri.isEmpty()) {
+			if (!this->openTrack(&output, requestedUri)) {
+				emit error(requestedUri);
+			}
+			continue;
+		}
+		if (requestedPosition >= 0 && _current) {
+			this->seekTrack(&output, requestedPosition);
+			continue;
+		}
+
+		// Decoders of every track have the same format, and the DSP chain converts their samples to the format of the device
+		const AudioFormat format = _current->outputFormat();
+		QByteArray frame = _current->decode();
+		if (!frame.isEmpty()) {
+			this->processFrame(frame);
+			if (_next == nullptr && _current->duration() > 0 && _current->duration() - _current->position() <= preloadMs) {
+				this->preloadNextTrack(format);
+			}
+			continue;
+		}
+
+		// End of the current track: samples of the next one directly follow the last ones in the buffer
+		const QByteArray tail = this->takeTail();
+		const qreal tailGain = _currentGain;
+		if (this->switchToNextTrack(format)) {
+			// The tail of a track which is shorter than the crossfade is simply played after the previous one
+			if (tail.isEmpty() || _dsp.isCrossfading()) {
+				this->writeFrame(_dsp.process(tail, tailGain));
+				this->writeFrame(_dsp.finishCrossfade());
+			} else {
+				_dsp.beginCrossfade(tail, tailGain);
+			}
+			_markers.append({ _ringBuffer.totalWritten(), _current->uri(), _current->duration(), 0 });
+			for (const QByteArray &preloadedFrame : _preloadedFrames) {
+				if (!this->processFrame(preloadedFrame)) {
+					break;
+				}
+			}
+			_preloadedFrames.clear();
+			continue;
+		}
+		this->writeFrame(_dsp.process(tail, tailGain));
+		this->writeFrame(_dsp.finishCrossfade());
+
+		// Wait for the sink to play everything, unless the user wants something else
+		_ringBuffer.setEndOfStream(true);
+		while (_ringBuffer.bytesAvailable() > 0 && !this->hasPendingRequest()) {
+			this->updatePlayback();
+			QThread::msleep(10);
+		}
+		if (!this->hasPendingRequest()) {
+			this->updatePlayback();
+			this->finishPlay(false);
+			this->stopSink();
+			emit finished();
+		}
+		this->releaseTracks();
+	}
+	this->finishPlay(true);
+	this->stopSink();
+	this->releaseTracks();
+	output.close();
+	_db = nullptr;
+}
+
+/** Starts counting the time which is played for the first track of the buffer. */
+void GaplessPlayer::beginPlay(const TrackMarker &marker)
+{
+	_playedUri = marker.uri;
+	_playedTrackDuration = marker.duration;
+	_playStarted = QDateTime::currentMSecsSinceEpoch();
+	_playedBytes = 0;
+}
+
+/** Sends the track which was heard to the history. A play which is interrupted early is a skip. */
+void GaplessPlayer::finishPlay(bool isInterrupted)
+{
+	if (_playedUri.isEmpty() || _bytesPerSecond <= 0) {
+		return;
+	}
+	PlayHistory::Play play;
+	play.uri = _playedUri;
+	play.timestamp = _playStarted;
+	play.duration = qint64(_playedBytes) * 1000 / _bytesPerSecond;
+	play.isSkipped = isInterrupted && PlayHistory::isSkip(play.duration, _playedTrackDuration);
+	_playedUri.clear();
+
+	_mutex.lock();
+	PlayHistory *history = _history;
+	_mutex.unlock();
+	if (history) {
+		history->record(play);
+	}
+}
+
+/** Returns true if the user has requested another track, or to stop. */
+bool GaplessPlayer::hasPendingRequest() const
+{
+	QMutexLocker locker(&_mutex);
+	return _isAborting || _isStopRequested || !_requestedUri.isEmpty() || _requestedPosition >= 0;
+}
+
+/** Opens a track requested by the user. The device is reopened if the format of this track is different. */
+bool GaplessPlayer::openTrack(AudioOutput *output, const QString &uri)
+{
+	this->finishPlay(true);
+	this->stopSink();
+	this->releaseTracks();
+	output->clear();
+
+	// The first frame gives the format of the track, samples are decoded as floats for the DSP chain
+	TrackDecoder *decoder = new TrackDecoder(uri);
+	decoder->setSampleFormat(AudioFormat::SampleFormat_Float);
+	QByteArray frame;
+	if (decoder->open()) {
+		frame = decoder->decode();
+	}
+	if (frame.isEmpty()) {
+		delete decoder;
+		return false;
+	}
+
+	_mutex.lock();
+	const QStringList backends = _audioBackends;
+	const int bufferDepth = _bufferDepth;
+	_mutex.unlock();
+	if (!backends.isEmpty() && backends != output->backends()) {
+		output->close();
+		output->setBackends(backends);
+	}
+
+	AudioFormat format = decoder->outputFormat();
+	if (!output->isSupported(format)) {
+		format.setSampleFormat(AudioFormat::SampleFormat_Signed16);
+	}
+	if (!output->isOpen() || output->audioFormat() != format) {
+		output->close();
+		output->setAudioFormat(format);
+		if (!output->open()) {
+			qDebug() << Q_FUNC_INFO << "cannot open audio device with format" << format;
+			delete decoder;
+			return false;
+		}
+	}
+
+	_dsp.setFormat(format);
+	_bytesPerSecond = format.bytesPerSecond();
+	_ringBuffer.reset(qint64(format.bytesPerSecond()) * bufferDepth / 1000, format.bytesPerFrame());
+	_current = decoder;
+	_currentGain = this->replayGain(uri);
+	_markers.append({ 0, uri, decoder->duration(), 0 });
+	_lastPosition = -1;
+	_lastRead = 0;
+	this->beginPlay(_markers.first());
+	emit currentTrackChanged(uri);
+
+	_sink = new AudioSink(this, output);
+	_sink->start(QThread::TimeCriticalPriority);
+	this->processFrame(frame);
+	return true;
+}
+
+/** Opens the next track in the queue, and decodes its first frames. */
+void GaplessPlayer::preloadNextTrack(const AudioFormat &format)
+{
+	QString uri;
+	_mutex.lock();
+	if (!_queue.isEmpty()) {
+		uri = _queue.first();
+	}
+	_mutex.unlock();
+	if (uri.isEmpty()) {
+		return;
+	}
+
+	_next = new TrackDecoder(uri, format);
+	if (!_next->open()) {
+		delete _next;
+		_next = nullptr;
+		_mutex.lock();
+		if (!_queue.isEmpty() && _queue.first() == uri) {
+			_queue.removeFirst();
+		}
+		_mutex.unlock();
+		emit error(uri);
+		return;
+	}
+	_nextGain = this->replayGain(uri);
+
+	// Enough samples to feed the sink while the rest of the track is decoded
+	int preloadedBytes = 0;
+	while (preloadedBytes < format.bytesPerSecond() / 2 && !_next->atEnd()) {
+		QByteArray frame = _next->decode();
+		preloadedBytes += frame.size();
+		_preloadedFrames.append(frame);
+	}
+}
+
+/** Applies the DSP chain to samples of the current track, and holds back the last ones while a crossfade is enabled. */
+bool GaplessPlayer::processFrame(const QByteArray &frame)
+{
+	_mutex.lock();
+	const int crossfadeDuration = _crossfadeDuration;
+	_mutex.unlock();
+	if (crossfadeDuration == 0 && _tail.isEmpty()) {
+		return this->writeFrame(_dsp.process(frame, _currentGain));
+	}
+
+	// Frames leave the tail in order, as soon as the rest is still longer than the crossfade
+	const qint64 crossfadeBytes = qint64(_current->outputFormat().bytesPerSecond()) * crossfadeDuration / 1000;
+	_tail.append(frame);
+	_tailBytes += frame.size();
+	while (!_tail.isEmpty() && _tailBytes - _tail.first().size() >= crossfadeBytes) {
+		const QByteArray head = _tail.takeFirst();
+		_tailBytes -= head.size();
+		if (!this->writeFrame(_dsp.process(head, _currentGain))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void GaplessPlayer::releaseTracks()
+{
+	delete _current;
+	_current = nullptr;
+	delete _next;
+	_next = nullptr;
+	_preloadedFrames.clear();
+	_tail.clear();
+	_tailBytes = 0;
+}
+
+/** Moves in the track which is heard. Samples which are in the buffer are discarded, and the next track is preloaded again. */
+void GaplessPlayer::seekTrack(AudioOutput *output, qint64 position)
+{
+	// The decoder can be ahead of the sink: tracks after the one which is heard were already taken from the queue
+	this->updatePlayback();
+	QStringList decodedUris;
+	for (const TrackMarker &marker : _markers) {
+		decodedUris.append(marker.uri);
+	}
+	this->finishPlay(true);
+	this->stopSink();
+	output->clear();
+	delete _next;
+	_next = nullptr;
+	_preloadedFrames.clear();
+	_tail.clear();
+	_tailBytes = 0;
+	_dsp.finishCrossfade();
+
+	if (decodedUris.size() > 1) {
+		TrackDecoder *decoder = new TrackDecoder(decodedUris.first(), _current->outputFormat());
+		if (decoder->open()) {
+			_mutex.lock();
+			for (int i = decodedUris.size() - 1; i > 0; i--) {
+				_queue.prepend(decodedUris.at(i));
+			}
+			_mutex.unlock();
+			delete _current;
+			_current = decoder;
+			_currentGain = this->replayGain(decoder->uri());
+		} else {
+			delete decoder;
+			emit error(decodedUris.first());
+		}
+	}
+
+	// The index is read once for each track, it's null if the scanner hasn't built it
+	if (_current->seekIndex().isNull() && SeekIndex::isIndexable(_current->uri()) && _db) {
+		_current->setSeekIndex(SeekIndex::load(_db, _current->uri()));
+	}
+	if (!_current->seek(position)) {
+		emit error(_current->uri());
+	}
+
+	_mutex.lock();
+	const int bufferDepth = _bufferDepth;
+	_mutex.unlock();
+	const AudioFormat format = output->audioFormat();
+	_ringBuffer.reset(qint64(format.bytesPerSecond()) * bufferDepth / 1000, format.bytesPerFrame());
+	_markers.append({ 0, _current->uri(), _current->duration(), _current->position() });
+	_lastPosition = -1;
+	_lastRead = 0;
+	this->beginPlay(_markers.first());
+
+	_sink = new AudioSink(this, output);
+	_sink->start(QThread::TimeCriticalPriority);
+}
+
+/** Linear gain of a track, lowered if its peak would clip. 1 if the track wasn't analyzed. */
+qreal GaplessPlayer::replayGain(const QString &uri) const
+{
+	_mutex.lock();
+	const ReplayGainMode mode = _replayGainMode;
+	_mutex.unlock();
+	if (mode == NoReplayGain || _db == nullptr) {
+		return 1.0;
+	}
+
+	QSqlQuery selectGain(*_db);
+	selectGain.prepare("SELECT trackGain, trackPeak, albumGain, albumPeak FROM loudness WHERE uri = ?");
+	selectGain.addBindValue(uri);
+	if (!selectGain.exec() || !selectGain.next()) {
+		return 1.0;
+	}
+
+	// Track gain is used when the album hasn't been completely analyzed
+	const int column = (mode == AlbumGain && !selectGain.isNull(2)) ? 2 : 0;
+	if (selectGain.isNull(column)) {
+		return 1.0;
+	}
+	const qreal gain = qPow(10.0, selectGain.value(column).toDouble() / 20.0);
+	const qreal peak = selectGain.value(column + 1).toDouble();
+	return peak > 0.0 ? qMin(gain, 1.0 / peak) : gain;
+}
+
+void GaplessPlayer::stopSink()
+{
+	if (_sink) {
+		_sink->abort();
+		_sink->wait();
+		delete _sink;
+		_sink = nullptr;
+	}
+	_markers.clear();
+}
+
+/** Replaces the current track with the next one, when it's still the first one in the queue. */
+bool GaplessPlayer::switchToNextTrack(const AudioFormat &format)
+{
+	forever {
+		QString uri;
+		_mutex.lock();
+		if (!_queue.isEmpty()) {
+			uri = _queue.takeFirst();
+		}
+		_mutex.unlock();
+		if (uri.isEmpty()) {
+			break;
+		}
+
+		if (_next && _next->uri() == uri) {
+			delete _current;
+			_current = _next;
+			_currentGain = _nextGain;
+			_next = nullptr;
+			return true;
+		}
+
+		// Queue has changed since the next track was preloaded (or the current one has no duration)
+		delete _next;
+		_next = nullptr;
+		_preloadedFrames.clear();
+		TrackDecoder *decoder = new TrackDecoder(uri, format);
+		if (decoder->open()) {
+			delete _current;
+			_current = decoder;
+			_currentGain = this->replayGain(uri);
+			return true;
+		}
+		delete decoder;
+		emit error(uri);
+	}
+	return false;
+}
+
+/** Returns the frames which were held back, and empties the tail. */
+QByteArray GaplessPlayer::takeTail()
+{
+	QByteArray tail;
+	tail.reserve(_tailBytes);
+	for (const QByteArray &frame : _tail) {
+		tail.append(frame);
+	}
+	_tail.clear();
+	_tailBytes = 0;
+	return tail;
+}
+
+/** Reports the track and the position which are played by the sink, behind the decoder. */
+void GaplessPlayer::updatePlayback()
+{
+	if (_markers.isEmpty()) {
+		return;
+	}
+	const quint64 played = _ringBuffer.totalRead();
+	while (_markers.size() > 1 && _markers.at(1).offset <= played) {
+		// Samples before the marker belong to the previous track
+		const quint64 offset = _markers.at(1).offset;
+		_playedBytes += offset - qMin(_lastRead, offset);
+		_lastRead = qMax(_lastRead, offset);
+		this->finishPlay(false);
+		_markers.removeFirst();
+		_lastPosition = -1;
+		this->beginPlay(_markers.first());
+		emit currentTrackChanged(_markers.first().uri);
+	}
+	_playedBytes += played - qMin(_lastRead, played);
+	_lastRead = qMax(_lastRead, played);
+
+	const TrackMarker &marker = _markers.first();
+	if (_bytesPerSecond > 0 && played >= marker.offset) {
+		qint64 position = marker.position + qint64(played - marker.offset) * 1000 / _bytesPerSecond;
+		if (position / 1000 != _lastPosition) {
+			_lastPosition = position / 1000;
+			emit positionChanged(position, marker.duration);
+		}
+	}
+}
+
+/** Copies samples to the ring buffer, and waits while it's full. Returns false if the wait was interrupted by a request. */
+bool GaplessPlayer::writeFrame(const QByteArray &frame)
+{
+	int written = _ringBuffer.write(frame.constData(), frame.size());
+	while (written < frame.size()) {
+		this->updatePlayback();
+		if (this->hasPendingRequest()) {
+			return false;
+		}
+		QThread::msleep(5);
+		written += _ringBuffer.write(frame.constData() + written, frame.size() - written);
+	}
+	this->updatePlayback();
+	return true;
+}
@@ -0,0 +1,260 @@
+#ifndef GAPLESSPLAYER_H
+#define GAPLESSPLAYER_H
+
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+
+#include "audioringbuffer.h"
+#include "dspchain.h"
+#include "miamcore_global.h"
+
+/// Forward declarations
+namespace QtAV {
+class AudioFormat;
+class AudioOutput;
+}
+class AudioSink;
+class PlayHistory;
+class SqlDatabase;
+class TrackDecoder;
+
+/**
+ * \brief		The GaplessPlayer class plays a queue of tracks without silence between them.
+ * \details		Tracks are decoded in a dedicated thread and written to a lock-free ring buffer. Another thread reads this buffer and
+ *				feeds a single AudioOutput which is opened once, so a slow decoder (or a stalled network share) doesn't starve the
+ *				device as long as the buffer isn't empty.
+ *				Before the end of a track, the next one in the queue is opened and its first frames are decoded, so it starts
+ *				immediately. Its samples follow the last samples of the current track in the buffer, without padding.
+ *				Every track is converted to the format of the first one, so the device never has to be reopened while the queue plays.
+ *				Decoded samples go through a DspChain before the buffer: replay gain, equalizer, and crossfades. When a crossfade is
+ *				enabled, the last seconds of each track are held back, and fade out under the first samples of the next track.
+ *				Tracks which were heard are sent to a PlayHistory, with the time which was actually played by the sink. The decoding
+ *				thread only appends them to a buffer, the history saves them in its own thread.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY GaplessPlayer : public QThread
+{
+	Q_OBJECT
+public:
+	enum ReplayGainMode : int
+	{
+		NoReplayGain	= 0,
+		TrackGain		= 1,
+		AlbumGain		= 2
+	};
+
+private:
+	/** Position of the first sample of a track in the ring buffer. */
+	struct TrackMarker
+	{
+		quint64 offset;
+		QString uri;
+		qint64 duration;
+		/** Position in the track of this sample, in ms, which isn't 0 after a seek. */
+		qint64 position;
+	};
+
+	/** Protects every request from other threads. */
+	mutable QMutex _mutex;
+
+	QWaitCondition _condition;
+
+	/** Tracks to play after the current one. */
+	QStringList _queue;
+
+	/** Track to play right now, instead of the current one. */
+	QString _requestedUri;
+
+	/** Position in the current track to move to, in ms, or -1. */
+	qint64 _requestedPosition;
+
+	/** Names of QtAV backends, like "null" for headless tests. Default backends are used if empty. */
+	QStringList _audioBackends;
+
+	int _bufferDepth;
+
+	int _crossfadeDuration;
+
+	ReplayGainMode _replayGainMode;
+
+	bool _isAborting;
+
+	bool _isStopRequested;
+
+	int _preloadSeconds;
+
+	/** Read by the sink without locking. */
+	std::atomic<bool> _isPaused;
+
+	/** Read by the sink without locking. */
+	std::atomic<qreal> _volume;
+
+	AudioRingBuffer _ringBuffer;
+
+	DspChain _dsp;
+
+	/** Connection of the decoding thread, to read replay gains. */
+	SqlDatabase *_db;
+
+	/** Owned by the decoding thread. */
+	TrackDecoder *_current;
+
+	/** Next track, opened before the end of the current one. */
+	TrackDecoder *_next;
+
+	/** First frames of the next track. */
+	QList<QByteArray> _preloadedFrames;
+
+	/** Linear gains of the current and the next track. */
+	qreal _currentGain;
+
+	qreal _nextGain;
+
+	/** Last frames of the current track, held back for a crossfade. */
+	QList<QByteArray> _tail;
+
+	int _tailBytes;
+
+	/** Of the device. */
+	int _bytesPerSecond;
+
+	/** Tracks which are in the ring buffer, the first one is playing. */
+	QList<TrackMarker> _markers;
+
+	qint64 _lastPosition;
+
+	/** Receives plays of tracks, can be null. */
+	PlayHistory *_history;
+
+	/** Track which is heard right now, for the history. */
+	QString _playedUri;
+
+	qint64 _playedTrackDuration;
+
+	qint64 _playStarted;
+
+	quint64 _playedBytes;
+
+	/** Bytes which were read by the sink at the last update. */
+	quint64 _lastRead;
+
+	AudioSink *_sink;
+
+	friend class AudioSink;
+
+public:
+	explicit GaplessPlayer(QObject *parent = nullptr);
+
+	virtual ~GaplessPlayer();
+
+	/** Milliseconds of decoded audio between the decoder and the device. */
+	int bufferDepth() const;
+
+	/** Producer stalls, underruns and filling of the buffer between the decoder and the device. */
+	AudioRingBuffer::Stats bufferStats() const;
+
+	void clearQueue();
+
+	/** Milliseconds of overlap between two tracks in the queue, or 0 for gapless playback. */
+	int crossfadeDuration() const;
+
+	/** Equalizer, preamp and time spent processing samples. Parameters can be changed from any thread. */
+	inline DspChain *dspChain() { return &_dsp; }
+
+	void enqueue(const QString &uri);
+
+	/** Plays a track immediately. Tracks in the queue are played after this one. */
+	void play(const QString &uri);
+
+	/** Seconds before the end of the current track when the next one is opened and decoded. */
+	int preloadSeconds() const;
+
+	QStringList queue() const;
+
+	/** Moves in the current track, in ms. Seek indexes are used when they were built by the scanner. */
+	void seek(qint64 position);
+
+	/** Applied the next time the device is opened. */
+	void setAudioBackends(const QStringList &backends);
+
+	/** Applied the next time a track is played with play(). */
+	void setBufferDepth(int ms);
+
+	/** Applied at the end of the current track. */
+	void setCrossfadeDuration(int ms);
+
+	void setPaused(bool paused);
+
+	/** Plays and skips are sent to this history, which must outlive the player. */
+	void setPlayHistory(PlayHistory *history);
+
+	void setPreloadSeconds(int seconds);
+
+	/** Applied to the next track which is opened. Gains are read from table "loudness". */
+	void setReplayGainMode(ReplayGainMode mode);
+
+	void setVolume(qreal volume);
+
+	void stop();
+
+protected:
+	virtual void run() override;
+
+private:
+	/** Starts counting the time which is played for the first track of the buffer. */
+	void beginPlay(const TrackMarker &marker);
+
+	/** Sends the track which was heard to the history. A play which is interrupted early is a skip. */
+	void finishPlay(bool isInterrupted);
+
+	/** Returns true if the user has requested another track, or to stop. */
+	bool hasPendingRequest() const;
+
+	/** Opens a track requested by the user. The device is reopened if the format of this track is different. */
+	bool openTrack(QtAV::AudioOutput *output, const QString &uri);
+
+	/** Opens the next track in the queue, and decodes its first frames. */
+	void preloadNextTrack(const QtAV::AudioFormat &format);
+
+	/** Applies the DSP chain to samples of the current track, and holds back the last ones while a crossfade is enabled. */
+	bool processFrame(const QByteArray &frame);
+
+	void releaseTracks();
+
+	/** Moves in the track which is heard. Samples which are in the buffer are discarded, and the next track is preloaded again. */
+	void seekTrack(QtAV::AudioOutput *output, qint64 position);
+
+	/** Linear gain of a track, lowered if its peak would clip. 1 if the track wasn't analyzed. */
+	qreal replayGain(const QString &uri) const;
+
+	void stopSink();
+
+	/** Replaces the current track with the next one, when it's still the first one in the queue. */
+	bool switchToNextTrack(const QtAV::AudioFormat &format);
+
+	/** Returns the frames which were held back, and empties the tail. */
+	QByteArray takeTail();
+
+	/** Reports the track and the position which are played by the sink, behind the decoder. */
+	void updatePlayback();
+
+	/** Copies samples to the ring buffer, and waits while it's full. Returns false if the wait was interrupted by a request. */
+	bool writeFrame(const QByteArray &frame);
+
+signals:
+	void currentTrackChanged(const QString &uri);
+
+	void error(const QString &uri);
+
+	/** Last track of the queue was played. */
+	void finished();
+
+	void positionChanged(qint64 position, qint64 duration);
+};
+
+#endif // GAPLESSPLAYER_H
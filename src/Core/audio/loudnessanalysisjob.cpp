@@ -0,0 +1,342 @@
+#include "loudnessanalysisjob.h"
+#include "loudnessmeter.h"
+#include "trackdecoder.h"
+
+#include "filehelper.h"
+#include "model/sqldatabase.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include <QtDebug>
+
+#include <cmath>
+#include <limits>
+
+const double LoudnessAnalysisJob::referenceLoudness = -18.0;
+
+namespace {
+
+QByteArray packHistogram(const QVector<quint32> &histogram)
+{
+	QByteArray bytes;
+	QDataStream stream(&bytes, QIODevice::WriteOnly);
+	stream << histogram;
+	// Most bins are empty
+	return qCompress(bytes);
+}
+
+QVector<quint32> unpackHistogram(const QByteArray &blob)
+{
+	QVector<quint32> histogram;
+	QDataStream stream(qUncompress(blob));
+	stream >> histogram;
+	return histogram;
+}
+
+/** Decodes and measures one track. */
+class LoudnessTask : public QRunnable
+{
+private:
+	LoudnessAnalysisJob *_job;
+	QString _uri;
+	uint _albumId;
+	qint64 _lastAnalyzed;
+
+public:
+	LoudnessTask(LoudnessAnalysisJob *job, const QString &uri, uint albumId, qint64 lastAnalyzed)
+		: QRunnable()
+		, _job(job)
+		, _uri(uri)
+		, _albumId(albumId)
+		, _lastAnalyzed(lastAnalyzed)
+	{}
+
+	virtual void run() override
+	{
+		this->analyze();
+		_job->trackHasBeenAnalyzed();
+		_job->taskHasFinished();
+	}
+
+private:
+	void analyze()
+	{
+		QFileInfo fileInfo(_uri);
+		if (_job->isCanceled()) {
+			return;
+		}
+		LoudnessAnalysisJob::Result result;
+		result.uri = _uri;
+		result.lastModified = fileInfo.exists() ? fileInfo.lastModified().toMSecsSinceEpoch() : 0;
+		result.albumId = _albumId;
+		result.loudness = std::numeric_limits<double>::quiet_NaN();
+		result.truePeak = 0.0;
+		if (result.lastModified == _lastAnalyzed) {
+			return;
+		}
+
+		// A missing file is saved without gain, so its album can be completed with the other tracks
+		if (!fileInfo.exists()) {
+			_job->addResult(result);
+			return;
+		}
+
+		TrackDecoder decoder(_uri);
+		decoder.setSampleFormat(QtAV::AudioFormat::SampleFormat_Float);
+		if (decoder.open()) {
+			LoudnessMeter *meter = nullptr;
+			while (!decoder.atEnd()) {
+				if (_job->isCanceled()) {
+					delete meter;
+					return;
+				}
+				const QByteArray frame = decoder.decode();
+				if (frame.isEmpty()) {
+					continue;
+				}
+				const QtAV::AudioFormat &format = decoder.outputFormat();
+				if (meter == nullptr) {
+					meter = new LoudnessMeter(format.sampleRate(), format.channels());
+				}
+				meter->process(reinterpret_cast<const float*>(frame.constData()), frame.size() / format.bytesPerFrame());
+			}
+			if (meter) {
+				result.loudness = meter->loudness();
+				result.truePeak = meter->truePeak();
+				result.histogram = meter->histogram();
+				delete meter;
+			}
+		}
+		// Tracks which can't be decoded are saved too, they won't be decoded again until they change
+		_job->addResult(result);
+	}
+};
+
+/** Writes ReplayGain tags to one file. */
+class ReplayGainTask : public QRunnable
+{
+private:
+	LoudnessAnalysisJob *_job;
+	QString _uri;
+	double _trackGain;
+	double _trackPeak;
+	double _albumGain;
+	double _albumPeak;
+
+public:
+	ReplayGainTask(LoudnessAnalysisJob *job, const QString &uri, double trackGain, double trackPeak, double albumGain, double albumPeak)
+		: QRunnable()
+		, _job(job)
+		, _uri(uri)
+		, _trackGain(trackGain)
+		, _trackPeak(trackPeak)
+		, _albumGain(albumGain)
+		, _albumPeak(albumPeak)
+	{}
+
+	virtual void run() override
+	{
+		if (!_job->isCanceled()) {
+			FileHelper fh(_uri);
+			if (fh.isValid()) {
+				fh.setReplayGain(_trackGain, _trackPeak, _albumGain, _albumPeak);
+				if (fh.save()) {
+					// Tags have changed the file, but not its loudness
+					_job->addWrittenTags(_uri, QFileInfo(_uri).lastModified().toMSecsSinceEpoch());
+				}
+			}
+		}
+		_job->taskHasFinished();
+	}
+};
+
+}
+
+LoudnessAnalysisJob::LoudnessAnalysisJob(QObject *parent)
+	: BackgroundJob(parent)
+	, _analyzedTracks(0)
+	, _isWritingTags(false)
+{}
+
+LoudnessAnalysisJob::~LoudnessAnalysisJob()
+{
+	this->cancel();
+}
+
+/** Called by tasks, from any thread. */
+void LoudnessAnalysisJob::addResult(const Result &result)
+{
+	QMutexLocker locker(&_mutex);
+	_results.append(result);
+}
+
+/** Called by tasks, from any thread. */
+void LoudnessAnalysisJob::addWrittenTags(const QString &uri, qint64 lastModified)
+{
+	QMutexLocker locker(&_mutex);
+	_writtenTags.append(qMakePair(uri, lastModified));
+}
+
+/** Writes ReplayGain tags when gains of an album are known. */
+void LoudnessAnalysisJob::setWritingTags(bool enabled)
+{
+	_isWritingTags = enabled;
+}
+
+void LoudnessAnalysisJob::start()
+{
+	if (this->isRunning()) {
+		return;
+	}
+	SqlDatabase *db = this->database();
+	_isCanceled = false;
+	_analyzedTracks = 0;
+
+	// Albums which were complete when the job was interrupted
+	QList<uint> albumIds;
+	QSqlQuery selectAlbums(*db);
+	selectAlbums.setForwardOnly(true);
+	if (selectAlbums.exec("SELECT DISTINCT albumId FROM loudness WHERE albumGain IS NULL")) {
+		while (selectAlbums.next()) {
+			albumIds.append(selectAlbums.value(0).toUInt());
+		}
+	}
+
+	// Tracks of the same album are analyzed together, so albums are completed as soon as possible
+	QSqlQuery selectTracks(*db);
+	selectTracks.setForwardOnly(true);
+	selectTracks.exec("SELECT c.uri, c.albumId, l.lastModified FROM cache c LEFT JOIN loudness l ON c.uri = l.uri " \
+					  "WHERE c.host IS NULL OR c.host = '' ORDER BY c.albumId");
+	QList<QRunnable*> tasks;
+	while (selectTracks.next()) {
+		qint64 lastAnalyzed = selectTracks.value(2).isNull() ? -1 : selectTracks.value(2).toLongLong();
+		tasks.append(new LoudnessTask(this, selectTracks.value(0).toString(), selectTracks.value(1).toUInt(), lastAnalyzed));
+	}
+	this->startTasks(tasks);
+	this->updateAlbums(albumIds);
+}
+
+/** Tags which are written don't count. */
+int LoudnessAnalysisJob::finishedTracks() const
+{
+	return _analyzedTracks.load();
+}
+
+/** Saves results of tasks in one transaction, then computes gains of completed albums. */
+void LoudnessAnalysisJob::flushResults()
+{
+	QList<Result> results;
+	QList<QPair<QString, qint64>> writtenTags;
+	_mutex.lock();
+	results.swap(_results);
+	writtenTags.swap(_writtenTags);
+	_mutex.unlock();
+
+	QList<uint> albumIds;
+	SqlDatabase *db = this->database();
+	if (!results.isEmpty() || !writtenTags.isEmpty()) {
+		db->transaction();
+		QSqlQuery insertResult(*db);
+		insertResult.prepare("INSERT OR REPLACE INTO loudness (uri, lastModified, albumId, trackGain, trackPeak, histogram) " \
+							 "VALUES (?, ?, ?, ?, ?, ?)");
+		QSqlQuery resetAlbum(*db);
+		resetAlbum.prepare("UPDATE loudness SET albumGain = NULL, albumPeak = NULL WHERE albumId = ?");
+		for (const Result &result : results) {
+			bool isMeasured = !std::isnan(result.loudness);
+			insertResult.addBindValue(result.uri);
+			insertResult.addBindValue(result.lastModified);
+			insertResult.addBindValue(result.albumId);
+			insertResult.addBindValue(isMeasured ? QVariant(referenceLoudness - result.loudness) : QVariant());
+			insertResult.addBindValue(isMeasured ? QVariant(result.truePeak) : QVariant());
+			insertResult.addBindValue(isMeasured ? packHistogram(result.histogram) : QByteArray());
+			if (!insertResult.exec()) {
+				qDebug() << Q_FUNC_INFO << insertResult.lastError();
+			}
+			if (!albumIds.contains(result.albumId)) {
+				// Gain of the album has to be computed again with this track
+				resetAlbum.addBindValue(result.albumId);
+				resetAlbum.exec();
+				albumIds.append(result.albumId);
+			}
+		}
+
+		QSqlQuery updateLastModified(*db);
+		updateLastModified.prepare("UPDATE loudness SET lastModified = ? WHERE uri = ?");
+		for (const QPair<QString, qint64> &writtenTag : writtenTags) {
+			updateLastModified.addBindValue(writtenTag.second);
+			updateLastModified.addBindValue(writtenTag.first);
+			updateLastModified.exec();
+		}
+		db->commit();
+	}
+
+	if (!_isCanceled) {
+		this->updateAlbums(albumIds);
+	}
+}
+
+bool LoudnessAnalysisJob::hasPendingResults() const
+{
+	QMutexLocker locker(&_mutex);
+	return !_results.isEmpty() || !_writtenTags.isEmpty();
+}
+
+/** Computes the gain of each album if all its tracks were measured. */
+void LoudnessAnalysisJob::updateAlbums(const QList<uint> &albumIds)
+{
+	SqlDatabase *db = this->database();
+	QSqlQuery countMissingTracks(*db);
+	countMissingTracks.prepare("SELECT COUNT(*) FROM cache c LEFT JOIN loudness l ON c.uri = l.uri WHERE c.albumId = ? AND l.uri IS NULL");
+	QSqlQuery selectTracks(*db);
+	selectTracks.setForwardOnly(true);
+	selectTracks.prepare("SELECT uri, trackGain, trackPeak, histogram FROM loudness WHERE albumId = ? AND trackGain IS NOT NULL");
+	QSqlQuery updateAlbum(*db);
+	updateAlbum.prepare("UPDATE loudness SET albumGain = ?, albumPeak = ? WHERE albumId = ?");
+
+	for (uint albumId : albumIds) {
+		countMissingTracks.addBindValue(albumId);
+		if (!countMissingTracks.exec() || !countMissingTracks.next() || countMissingTracks.value(0).toInt() > 0) {
+			continue;
+		}
+		countMissingTracks.finish();
+
+		// Blocks of all tracks are gated together
+		QVector<quint32> histogram(LoudnessMeter::histogramSize, 0);
+		double albumPeak = 0.0;
+		QList<QPair<QString, QPair<double, double>>> tracks;
+		selectTracks.addBindValue(albumId);
+		if (!selectTracks.exec()) {
+			continue;
+		}
+		while (selectTracks.next()) {
+			const QVector<quint32> trackHistogram = unpackHistogram(selectTracks.value(3).toByteArray());
+			for (int bin = 0; bin < trackHistogram.size() && bin < histogram.size(); bin++) {
+				histogram[bin] += trackHistogram.at(bin);
+			}
+			double trackPeak = selectTracks.value(2).toDouble();
+			albumPeak = qMax(albumPeak, trackPeak);
+			tracks.append(qMakePair(selectTracks.value(0).toString(), qMakePair(selectTracks.value(1).toDouble(), trackPeak)));
+		}
+		double albumLoudness = LoudnessMeter::integratedLoudness(histogram);
+		if (std::isnan(albumLoudness)) {
+			continue;
+		}
+		double albumGain = referenceLoudness - albumLoudness;
+		updateAlbum.addBindValue(albumGain);
+		updateAlbum.addBindValue(albumPeak);
+		updateAlbum.addBindValue(albumId);
+		updateAlbum.exec();
+
+		if (_isWritingTags) {
+			for (const auto &track : tracks) {
+				_remainingTasks++;
+				_pool.start(new ReplayGainTask(this, track.first, track.second.first, track.second.second, albumGain, albumPeak));
+			}
+		}
+	}
+}
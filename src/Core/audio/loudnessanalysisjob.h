@@ -0,0 +1,82 @@
+#ifndef LOUDNESSANALYSISJOB_H
+#define LOUDNESSANALYSISJOB_H
+
+#include <QVector>
+
+#include "backgroundjob.h"
+
+/**
+ * \brief		The LoudnessAnalysisJob class measures loudness of the whole library, and computes ReplayGain of tracks and albums.
+ * \details		Each track is decoded and measured by a task of the pool of the job, with one thread per core. Results are saved in
+ *				table "loudness" every second, in a single transaction, so the job can be interrupted at any time: next time, only
+ *				tracks which are new, modified or not analyzed yet are decoded again.
+ *				Tracks are sorted by album, and when all tracks of an album have been measured, histograms of their blocks are added to
+ *				compute the loudness of the album. ReplayGain tags can then be written to files, in the same pool.
+ *				Gains are relative to -18 LUFS, like ReplayGain 2.0.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY LoudnessAnalysisJob : public BackgroundJob
+{
+	Q_OBJECT
+public:
+	/** Measure of one track, sent by tasks to the job. */
+	struct Result
+	{
+		QString uri;
+		qint64 lastModified;
+		uint albumId;
+		/** NaN if the track can't be decoded or is silent. */
+		double loudness;
+		double truePeak;
+		QVector<quint32> histogram;
+	};
+
+	static const double referenceLoudness;
+
+private:
+	QList<Result> _results;
+
+	/** Files which have new tags, with their new modification time. */
+	QList<QPair<QString, qint64>> _writtenTags;
+
+	/** Analysis tasks which have finished, even if the track didn't have to be decoded. */
+	std::atomic<int> _analyzedTracks;
+
+	bool _isWritingTags;
+
+public:
+	explicit LoudnessAnalysisJob(QObject *parent = nullptr);
+
+	virtual ~LoudnessAnalysisJob();
+
+	/** Called by tasks, from any thread. */
+	void addResult(const Result &result);
+
+	/** Called by tasks, from any thread. */
+	void addWrittenTags(const QString &uri, qint64 lastModified);
+
+	/** Writes ReplayGain tags when gains of an album are known. */
+	void setWritingTags(bool enabled);
+
+	/** Called by analysis tasks, from any thread, before taskHasFinished(). */
+	inline void trackHasBeenAnalyzed() { _analyzedTracks++; }
+
+protected:
+	/** Tags which are written don't count. */
+	virtual int finishedTracks() const override;
+
+	/** Saves results of tasks in one transaction, then computes gains of completed albums. */
+	virtual void flushResults() override;
+
+	virtual bool hasPendingResults() const override;
+
+private:
+	/** Computes the gain of each album if all its tracks were measured. */
+	void updateAlbums(const QList<uint> &albumIds);
+
+public slots:
+	void start();
+};
+
+#endif // LOUDNESSANALYSISJOB_H
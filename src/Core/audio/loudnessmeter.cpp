@@ -0,0 +1,269 @@
+#include "loudnessmeter.h"
+
+#include <QtMath>
+
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIAM_LOUDNESS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const int peakTaps = 12;
+
+/** Polyphase filter from ITU-R BS.1770-4 Annex 2, to oversample 4 times. */
+const float peakCoefficients[4][peakTaps] = {
+	{  0.0017089843750f,  0.0109863281250f, -0.0196533203125f,  0.0332031250000f, -0.0594482421875f,  0.1373291015625f,
+	   0.9721679687500f, -0.1022949218750f,  0.0476074218750f, -0.0266113281250f,  0.0148925781250f, -0.0083007812500f },
+	{ -0.0291748046875f,  0.0292968750000f, -0.0517578125000f,  0.0891113281250f, -0.1665039062500f,  0.4650878906250f,
+	   0.7797851562500f, -0.2003173828125f,  0.1015625000000f, -0.0582275390625f,  0.0330810546875f, -0.0189208984375f },
+	{ -0.0189208984375f,  0.0330810546875f, -0.0582275390625f,  0.1015625000000f, -0.2003173828125f,  0.7797851562500f,
+	   0.4650878906250f, -0.1665039062500f,  0.0891113281250f, -0.0517578125000f,  0.0292968750000f, -0.0291748046875f },
+	{ -0.0083007812500f,  0.0148925781250f, -0.0266113281250f,  0.0476074218750f, -0.1022949218750f,  0.9721679687500f,
+	   0.1373291015625f, -0.0594482421875f,  0.0332031250000f, -0.0196533203125f,  0.0109863281250f,  0.0017089843750f }
+};
+
+const double histogramMinimum = -70.0;
+const double histogramStep = 0.05;
+
+/** Mean square of blocks which are in this bin. */
+double binEnergy(int bin)
+{
+	const double loudness = histogramMinimum + (bin + 0.5) * histogramStep;
+	return std::pow(10.0, (loudness + 0.691) / 10.0);
+}
+
+}
+
+LoudnessMeter::LoudnessMeter(int sampleRate, int channels)
+	: _sampleRate(qMax(1, sampleRate))
+	, _channels(qMax(1, channels))
+	, _weights(_channels, 1.0)
+	, _filterStates(4 * _channels, 0.0)
+	, _peakHistory((peakTaps - 1) * _channels, 0.0f)
+	, _isOversampling(_sampleRate < 96000)
+	, _truePeak(0.0f)
+	, _subBlockSize(_sampleRate / 10)
+	, _subBlockPosition(0)
+	, _subBlockEnergy(0.0)
+	, _subBlockCount(0)
+	, _histogram(histogramSize, 0)
+{
+	// Surround channels for 5.0 and 5.1 layouts (LFE is the 4th channel in 5.1)
+	if (_channels == 5) {
+		_weights[3] = _weights[4] = 1.41;
+	} else if (_channels == 6) {
+		_weights[3] = 0.0;
+		_weights[4] = _weights[5] = 1.41;
+	}
+
+	// High shelf, which models the head
+	double f0 = 1681.974450955533;
+	double gain = 3.999843853973347;
+	double q = 0.7071752369554196;
+	double k = std::tan(M_PI * f0 / _sampleRate);
+	double vh = std::pow(10.0, gain / 20.0);
+	double vb = std::pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+	_shelf[0] = (vh + vb * k / q + k * k) / a0;
+	_shelf[1] = 2.0 * (k * k - vh) / a0;
+	_shelf[2] = (vh - vb * k / q + k * k) / a0;
+	_shelf[3] = 2.0 * (k * k - 1.0) / a0;
+	_shelf[4] = (1.0 - k / q + k * k) / a0;
+
+	// High pass
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = std::tan(M_PI * f0 / _sampleRate);
+	a0 = 1.0 + k / q + k * k;
+	_highPass[0] = 1.0;
+	_highPass[1] = -2.0;
+	_highPass[2] = 1.0;
+	_highPass[3] = 2.0 * (k * k - 1.0) / a0;
+	_highPass[4] = (1.0 - k / q + k * k) / a0;
+
+	for (int i = 0; i < 4; i++) {
+		_subBlocks[i] = 0.0;
+	}
+}
+
+/** Integrated loudness in LUFS of a histogram, or NaN if everything is below the absolute gate. */
+double LoudnessMeter::integratedLoudness(const QVector<quint32> &histogram)
+{
+	// Blocks below -70 LUFS are not in the histogram
+	double energy = 0.0;
+	quint64 count = 0;
+	for (int bin = 0; bin < histogram.size(); bin++) {
+		if (histogram.at(bin) > 0) {
+			energy += histogram.at(bin) * binEnergy(bin);
+			count += histogram.at(bin);
+		}
+	}
+	if (count == 0) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+
+	// Relative gate, 10 LU below the loudness of blocks above the absolute gate
+	const double relativeGate = -0.691 + 10.0 * std::log10(energy / count) - 10.0;
+	const int firstBin = qMax(0, static_cast<int>(std::ceil((relativeGate - histogramMinimum) / histogramStep)));
+	energy = 0.0;
+	count = 0;
+	for (int bin = firstBin; bin < histogram.size(); bin++) {
+		energy += histogram.at(bin) * binEnergy(bin);
+		count += histogram.at(bin);
+	}
+	if (count == 0) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+	return -0.691 + 10.0 * std::log10(energy / count);
+}
+
+/** Adds interleaved samples, in floating point. */
+void LoudnessMeter::process(const float *samples, int frames)
+{
+	int offset = 0;
+	while (offset < frames) {
+		// Never cross the end of a block of 100 ms
+		const int count = qMin(frames - offset, _subBlockSize - _subBlockPosition);
+		_channel.resize(peakTaps - 1 + count);
+		for (int c = 0; c < _channels; c++) {
+			float *channel = _channel.data();
+			float *x = channel + peakTaps - 1;
+			const float *history = _peakHistory.constData() + c * (peakTaps - 1);
+			for (int i = 0; i < peakTaps - 1; i++) {
+				channel[i] = history[i];
+			}
+			const float *input = samples + offset * _channels + c;
+			for (int i = 0; i < count; i++) {
+				x[i] = input[i * _channels];
+			}
+			this->measurePeak(channel, count, c);
+		}
+		this->weightChannels(samples + offset * _channels, count);
+		offset += count;
+		_subBlockPosition += count;
+		if (_subBlockPosition == _subBlockSize) {
+			this->addSubBlock();
+		}
+	}
+}
+
+void LoudnessMeter::addSubBlock()
+{
+	_subBlocks[_subBlockCount % 4] = _subBlockEnergy / _subBlockSize;
+	_subBlockCount++;
+	_subBlockEnergy = 0.0;
+	_subBlockPosition = 0;
+	if (_subBlockCount < 4) {
+		return;
+	}
+
+	// Blocks of 400 ms, every 100 ms
+	const double energy = (_subBlocks[0] + _subBlocks[1] + _subBlocks[2] + _subBlocks[3]) / 4.0;
+	if (energy <= 0.0) {
+		return;
+	}
+	const double loudness = -0.691 + 10.0 * std::log10(energy);
+	if (loudness >= histogramMinimum) {
+		int bin = qMin(histogramSize - 1, static_cast<int>((loudness - histogramMinimum) / histogramStep));
+		_histogram[bin]++;
+	}
+}
+
+/** Adds the energy of K-weighted interleaved samples to the current block of 100 ms. */
+void LoudnessMeter::weightChannels(const float *samples, int count)
+{
+	// K-weighting, 2 biquads in transposed direct form II. They are recursive, so they are vectorized across channels
+	const int n = _channels;
+	double *states = _filterStates.data();
+	int c = 0;
+#if defined(MIAM_LOUDNESS_SSE2)
+	const __m128d b0 = _mm_set1_pd(_shelf[0]), b1 = _mm_set1_pd(_shelf[1]), b2 = _mm_set1_pd(_shelf[2]);
+	const __m128d a1 = _mm_set1_pd(_shelf[3]), a2 = _mm_set1_pd(_shelf[4]);
+	const __m128d hb0 = _mm_set1_pd(_highPass[0]), hb1 = _mm_set1_pd(_highPass[1]), hb2 = _mm_set1_pd(_highPass[2]);
+	const __m128d ha1 = _mm_set1_pd(_highPass[3]), ha2 = _mm_set1_pd(_highPass[4]);
+	for (; c + 2 <= n; c += 2) {
+		__m128d s1 = _mm_loadu_pd(states + c);
+		__m128d s2 = _mm_loadu_pd(states + n + c);
+		__m128d s3 = _mm_loadu_pd(states + 2 * n + c);
+		__m128d s4 = _mm_loadu_pd(states + 3 * n + c);
+		__m128d energy = _mm_setzero_pd();
+		const float *input = samples + c;
+		for (int i = 0; i < count; i++) {
+			// Two adjacent samples of a frame
+			const __m128 pair = _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + i * n)));
+			const __m128d in = _mm_cvtps_pd(pair);
+			const __m128d y = _mm_add_pd(_mm_mul_pd(b0, in), s1);
+			s1 = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(b1, in), s2), _mm_mul_pd(a1, y));
+			s2 = _mm_sub_pd(_mm_mul_pd(b2, in), _mm_mul_pd(a2, y));
+			const __m128d z = _mm_add_pd(_mm_mul_pd(hb0, y), s3);
+			s3 = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(hb1, y), s4), _mm_mul_pd(ha1, z));
+			s4 = _mm_sub_pd(_mm_mul_pd(hb2, y), _mm_mul_pd(ha2, z));
+			energy = _mm_add_pd(energy, _mm_mul_pd(z, z));
+		}
+		_mm_storeu_pd(states + c, s1);
+		_mm_storeu_pd(states + n + c, s2);
+		_mm_storeu_pd(states + 2 * n + c, s3);
+		_mm_storeu_pd(states + 3 * n + c, s4);
+		double energies[2];
+		_mm_storeu_pd(energies, energy);
+		_subBlockEnergy += _weights.at(c) * energies[0] + _weights.at(c + 1) * energies[1];
+	}
+#endif
+	for (; c < n; c++) {
+		if (_weights.at(c) == 0.0) {
+			continue;
+		}
+		double s1 = states[c], s2 = states[n + c], s3 = states[2 * n + c], s4 = states[3 * n + c];
+		double energy = 0.0;
+		const float *input = samples + c;
+		for (int i = 0; i < count; i++) {
+			const double in = input[i * n];
+			const double y = _shelf[0] * in + s1;
+			s1 = _shelf[1] * in - _shelf[3] * y + s2;
+			s2 = _shelf[2] * in - _shelf[4] * y;
+			const double z = _highPass[0] * y + s3;
+			s3 = _highPass[1] * y - _highPass[3] * z + s4;
+			s4 = _highPass[2] * y - _highPass[4] * z;
+			energy += z * z;
+		}
+		states[c] = s1;
+		states[n + c] = s2;
+		states[2 * n + c] = s3;
+		states[3 * n + c] = s4;
+		_subBlockEnergy += _weights.at(c) * energy;
+	}
+}
+
+void LoudnessMeter::measurePeak(float *channel, int count, int channelIndex)
+{
+	const float *x = channel + peakTaps - 1;
+	float peak = _truePeak;
+	for (int i = 0; i < count; i++) {
+		peak = qMax(peak, std::fabs(x[i]));
+	}
+
+	// Peaks between samples
+	if (_isOversampling) {
+		for (int i = 0; i < count; i++) {
+			const float *window = channel + i;
+			for (int phase = 0; phase < 4; phase++) {
+				const float *coefficients = peakCoefficients[phase];
+				float y = 0.0f;
+				for (int k = 0; k < peakTaps; k++) {
+					y += coefficients[k] * window[peakTaps - 1 - k];
+				}
+				peak = qMax(peak, std::fabs(y));
+			}
+		}
+	}
+	_truePeak = peak;
+
+	float *history = _peakHistory.data() + channelIndex * (peakTaps - 1);
+	for (int i = 0; i < peakTaps - 1; i++) {
+		history[i] = channel[count + i];
+	}
+}
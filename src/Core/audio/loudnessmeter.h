@@ -0,0 +1,87 @@
+#ifndef LOUDNESSMETER_H
+#define LOUDNESSMETER_H
+
+#include <QVector>
+
+#include "miamcore_global.h"
+
+/**
+ * \brief		The LoudnessMeter class measures integrated loudness and true peak of a track, as defined by EBU R128 (ITU-R BS.1770).
+ * \details		Samples are K-weighted, and the energy of 400 ms blocks (overlapping by 75%) is kept in a histogram instead of a list of
+ *				blocks. Histograms of many tracks can be added to measure an album, and they're small enough to be saved in the database.
+ *				True peak is measured by oversampling 4 times with the polyphase filter from BS.1770, for sample rates below 96 kHz.
+ *				True peak is measured one channel after the other on contiguous arrays. K-weighting biquads are recursive, so they
+ *				are vectorized across channels instead: with SSE2, two channels of a frame go through the filters in one register.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY LoudnessMeter
+{
+public:
+	/** Blocks from -70 to +5 LUFS, by steps of 0.05 LU. */
+	static const int histogramSize = 1500;
+
+private:
+	int _sampleRate;
+
+	int _channels;
+
+	/** Weight of each channel: surround channels are louder, LFE is ignored. */
+	QVector<double> _weights;
+
+	/** Coefficients of the 2 biquads of the K-weighting filter: b0, b1, b2, a1, a2. */
+	double _shelf[5];
+	double _highPass[5];
+
+	/** State of the filters, 4 values for each channel: each value of all channels is contiguous. */
+	QVector<double> _filterStates;
+
+	/** Last samples of each channel, for the oversampling filter. */
+	QVector<float> _peakHistory;
+
+	bool _isOversampling;
+
+	float _truePeak;
+
+	/** Samples of one channel, with history for the oversampling filter in front of them. */
+	QVector<float> _channel;
+
+	int _subBlockSize;
+
+	int _subBlockPosition;
+
+	double _subBlockEnergy;
+
+	/** Mean squares of the last 4 blocks of 100 ms. */
+	double _subBlocks[4];
+
+	int _subBlockCount;
+
+	QVector<quint32> _histogram;
+
+public:
+	LoudnessMeter(int sampleRate, int channels);
+
+	inline const QVector<quint32> &histogram() const { return _histogram; }
+
+	/** Integrated loudness in LUFS of a histogram, or NaN if everything is below the absolute gate. */
+	static double integratedLoudness(const QVector<quint32> &histogram);
+
+	inline double loudness() const { return LoudnessMeter::integratedLoudness(_histogram); }
+
+	/** Adds interleaved samples, in floating point. */
+	void process(const float *samples, int frames);
+
+	/** Linear true peak, 1.0 is full scale. */
+	inline double truePeak() const { return _truePeak; }
+
+private:
+	void addSubBlock();
+
+	void measurePeak(float *channel, int count, int channelIndex);
+
+	/** Adds the energy of K-weighted interleaved samples to the current block of 100 ms. */
+	void weightChannels(const float *samples, int count);
+};
+
+#endif // LOUDNESSMETER_H
@@ -0,0 +1,281 @@
+#include "prefetchcache.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QStorageInfo>
+
+#include <QtDebug>
+
+#include <limits>
+
+namespace {
+
+/** Large sequential requests are much faster than small ones on network shares. */
+const qint64 chunkSize = 1024 * 1024;
+
+}
+
+PrefetchCache::Entry::~Entry()
+{
+	if (!spillPath.isEmpty()) {
+		QFile::remove(spillPath);
+	}
+}
+
+/** Private constructor. */
+PrefetchCache::PrefetchCache()
+	: QThread()
+	, _ramCapacity(128 * 1024 * 1024)
+	, _spillCapacity(Q_INT64_C(1024) * 1024 * 1024)
+	, _ramBytes(0)
+	, _spilledBytes(0)
+	, _isPrefetchingLocalFiles(false)
+	, _spillDir(nullptr)
+	, _clock(0)
+	, _hitBytes(0)
+	, _missBytes(0)
+	, _bytesPrefetched(0)
+{}
+
+PrefetchCache::~PrefetchCache()
+{
+	_mutex.lock();
+	this->requestInterruption();
+	_queue.clear();
+	_condition.wakeAll();
+	_mutex.unlock();
+	this->wait();
+
+	// Spilled files are removed before their directory
+	_entries.clear();
+	delete _spillDir;
+}
+
+/** Removes files which are waiting to be prefetched. Files which are already in the cache are kept. */
+void PrefetchCache::clearQueue()
+{
+	QMutexLocker locker(&_mutex);
+	_queue.clear();
+}
+
+/** Returns the copy of a file, or a null pointer. Can be called from any thread. */
+QSharedPointer<PrefetchCache::Entry> PrefetchCache::entry(const QString &path)
+{
+	QMutexLocker locker(&_mutex);
+	QSharedPointer<Entry> entry = _entries.value(path);
+	if (entry) {
+		entry->lastUsed = ++_clock;
+	}
+	return entry;
+}
+
+/** Decoders can ask for it from any thread. It's destroyed with the application. */
+PrefetchCache* PrefetchCache::instance()
+{
+	static PrefetchCache *cache = [] () {
+		// The thread is stopped and spilled files are removed when the application is destroyed
+		qAddPostRoutine([] () { delete PrefetchCache::instance(); });
+		return new PrefetchCache;
+	}();
+	return cache;
+}
+
+/** Files on NFS, SMB, SSHFS and other network file systems. */
+bool PrefetchCache::isRemote(const QString &path)
+{
+	static const QStringList networkFileSystems = { "nfs", "nfs4", "cifs", "smbfs", "smb2", "smb3", "afpfs", "9p", "sshfs",
+													"fuse.sshfs", "davfs", "fuse.davfs2" };
+	// UNC paths on Windows
+	if (path.startsWith("//") || path.startsWith("\\\\")) {
+		return true;
+	}
+	QStorageInfo storage(QFileInfo(path).absolutePath());
+	return networkFileSystems.contains(QString::fromLatin1(storage.fileSystemType()).toLower());
+}
+
+/** Adds a file at the end of the queue, unless it's already in the cache. Local files are skipped by the prefetching thread. */
+void PrefetchCache::prefetch(const QString &path)
+{
+	QMutexLocker locker(&_mutex);
+	if ((_ramCapacity == 0 && _spillCapacity == 0) || _entries.contains(path) || _queue.contains(path)) {
+		return;
+	}
+	_queue.append(path);
+	_condition.wakeAll();
+	if (!this->isRunning()) {
+		this->start(QThread::LowPriority);
+	}
+}
+
+/** Budgets in bytes, 0 disables a kind of storage. Files which are in the cache are not removed until another one needs space. */
+void PrefetchCache::setCapacity(qint64 ramBytes, qint64 spillBytes)
+{
+	QMutexLocker locker(&_mutex);
+	_ramCapacity = qMax<qint64>(0, ramBytes);
+	_spillCapacity = qMax<qint64>(0, spillBytes);
+}
+
+void PrefetchCache::setPrefetchingLocalFiles(bool enabled)
+{
+	QMutexLocker locker(&_mutex);
+	_isPrefetchingLocalFiles = enabled;
+}
+
+/** Can be called from any thread. */
+PrefetchCache::Stats PrefetchCache::stats() const
+{
+	QMutexLocker locker(&_mutex);
+	return { _hitBytes.load(), _missBytes.load(), _bytesPrefetched.load(), _ramBytes, _spilledBytes };
+}
+
+void PrefetchCache::run()
+{
+	forever {
+		_mutex.lock();
+		while (_queue.isEmpty() && !this->isInterruptionRequested()) {
+			_condition.wait(&_mutex);
+		}
+		if (this->isInterruptionRequested()) {
+			_mutex.unlock();
+			break;
+		}
+		const QString path = _queue.takeFirst();
+		const bool isPrefetchingLocalFiles = _isPrefetchingLocalFiles;
+		_mutex.unlock();
+
+		// Reading metadata on a share can be slow too, so it's not done with the mutex locked, nor in the thread of the caller
+		if (!isPrefetchingLocalFiles && !PrefetchCache::isRemote(path)) {
+			continue;
+		}
+		const QFileInfo fileInfo(path);
+		if (!fileInfo.isFile()) {
+			continue;
+		}
+		_mutex.lock();
+		QSharedPointer<Entry> entry;
+		if (!_entries.contains(path)) {
+			entry = this->createEntry(fileInfo);
+		}
+		_mutex.unlock();
+		if (entry) {
+			this->load(entry);
+		}
+	}
+}
+
+/** Creates an empty entry, after removing least recently used files if needed. Called with the mutex locked. */
+QSharedPointer<PrefetchCache::Entry> PrefetchCache::createEntry(const QFileInfo &fileInfo)
+{
+	const qint64 size = fileInfo.size();
+	if (size <= 0) {
+		return QSharedPointer<Entry>();
+	}
+	QSharedPointer<Entry> entry(new Entry);
+	entry->path = fileInfo.filePath();
+	entry->size = size;
+	entry->lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+	entry->lastUsed = ++_clock;
+
+	// Whole file in RAM if it fits, otherwise in a temporary file
+	if (size <= _ramCapacity && size < std::numeric_limits<int>::max() && this->makeRoom(size, false)) {
+		entry->data.resize(int(size));
+		_ramBytes += size;
+	} else if (size <= _spillCapacity && this->makeRoom(size, true)) {
+		if (_spillDir == nullptr) {
+			_spillDir = new QTemporaryDir;
+		}
+		if (!_spillDir->isValid()) {
+			qDebug() << Q_FUNC_INFO << "cannot create a temporary directory";
+			return QSharedPointer<Entry>();
+		}
+		entry->spillPath = QString("%1/%2.part").arg(_spillDir->path()).arg(entry->lastUsed);
+		_spilledBytes += size;
+	} else {
+		return QSharedPointer<Entry>();
+	}
+	_entries.insert(entry->path, entry);
+	return entry;
+}
+
+/** Copies a file to its entry, chunk after chunk. */
+void PrefetchCache::load(const QSharedPointer<Entry> &entry)
+{
+	QFile source(entry->path);
+	QFile spill(entry->spillPath);
+	bool isSpilled = !entry->spillPath.isEmpty();
+	if (!source.open(QIODevice::ReadOnly) || (isSpilled && !spill.open(QIODevice::WriteOnly))) {
+		QMutexLocker locker(&_mutex);
+		this->removeEntry(entry->path);
+		return;
+	}
+
+	char *buffer = isSpilled ? nullptr : entry->data.data();
+	QByteArray chunk;
+	qint64 loaded = 0;
+	while (loaded < entry->size && !this->isInterruptionRequested()) {
+		// Another file may have needed space meanwhile
+		_mutex.lock();
+		bool isCached = _entries.value(entry->path) == entry;
+		_mutex.unlock();
+		if (!isCached) {
+			break;
+		}
+
+		qint64 bytes;
+		if (isSpilled) {
+			chunk = source.read(qMin(chunkSize, entry->size - loaded));
+			bytes = chunk.size();
+			if (bytes > 0 && (spill.write(chunk) != bytes || !spill.flush())) {
+				break;
+			}
+		} else {
+			bytes = source.read(buffer + loaded, qMin(chunkSize, entry->size - loaded));
+		}
+		if (bytes <= 0) {
+			break;
+		}
+		loaded += bytes;
+		_bytesPrefetched += bytes;
+
+		// Readers can use these bytes now
+		entry->loaded.store(loaded, std::memory_order_release);
+	}
+}
+
+/** Removes least recently used files until there is enough space. Called with the mutex locked. */
+bool PrefetchCache::makeRoom(qint64 bytes, bool isSpilled)
+{
+	const qint64 capacity = isSpilled ? _spillCapacity : _ramCapacity;
+	while ((isSpilled ? _spilledBytes : _ramBytes) + bytes > capacity) {
+		QString oldest;
+		qint64 oldestUse = std::numeric_limits<qint64>::max();
+		for (auto it = _entries.cbegin(); it != _entries.cend(); ++it) {
+			if (it.value()->spillPath.isEmpty() != isSpilled && it.value()->lastUsed < oldestUse) {
+				oldest = it.key();
+				oldestUse = it.value()->lastUsed;
+			}
+		}
+		if (oldest.isEmpty()) {
+			return false;
+		}
+		this->removeEntry(oldest);
+	}
+	return true;
+}
+
+/** Called with the mutex locked. */
+void PrefetchCache::removeEntry(const QString &path)
+{
+	// Readers keep their copy until they're closed
+	QSharedPointer<Entry> entry = _entries.take(path);
+	if (!entry) {
+		return;
+	}
+	if (entry->spillPath.isEmpty()) {
+		_ramBytes -= entry->size;
+	} else {
+		_spilledBytes -= entry->size;
+	}
+}
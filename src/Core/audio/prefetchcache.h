@@ -0,0 +1,146 @@
+#ifndef PREFETCHCACHE_H
+#define PREFETCHCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+
+#include "miamcore_global.h"
+
+/// Forward declaration
+class QFileInfo;
+
+/**
+ * \brief		The PrefetchCache class copies files of the queue to local storage before they're played, for libraries on network shares.
+ * \details		A dedicated thread reads each file from the beginning to the end with large sequential requests, into a buffer which is
+ *				allocated once for the whole file (the RAM budget), or into a temporary file (the spill budget) when RAM is full.
+ *				Decoders read these files with a PrefetchMediaIO: bytes which are already local are served from the cache, the others
+ *				are read from the share, so a decoder never waits for the prefetching thread.
+ *				When a budget is full, least recently used files are removed. Files on local disks are not prefetched by default.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY PrefetchCache : public QThread
+{
+	Q_OBJECT
+public:
+	/** Copy of one file, which can be shared by the cache and readers. */
+	struct Entry
+	{
+		QString path;
+		qint64 size;
+		/** Whole file, allocated before it's read, or empty if it's spilled to disk. */
+		QByteArray data;
+		QString spillPath;
+		/** Of the original file, in ms since epoch. A copy of an older version must not be read. */
+		qint64 lastModified;
+		/** Bytes which can be read, published by the prefetching thread. */
+		std::atomic<qint64> loaded;
+		qint64 lastUsed;
+
+		Entry() : size(0), lastModified(0), loaded(0), lastUsed(0) {}
+
+		~Entry();
+	};
+
+	struct Stats
+	{
+		quint64 hitBytes;
+		quint64 missBytes;
+		quint64 bytesPrefetched;
+		qint64 ramBytes;
+		qint64 spilledBytes;
+
+		/** Ratio of bytes read by decoders which were already local. */
+		inline double hitRate() const { return hitBytes + missBytes == 0 ? 0.0 : double(hitBytes) / (hitBytes + missBytes); }
+	};
+
+private:
+	mutable QMutex _mutex;
+
+	QWaitCondition _condition;
+
+	/** Files to prefetch, in order. */
+	QStringList _queue;
+
+	QHash<QString, QSharedPointer<Entry>> _entries;
+
+	qint64 _ramCapacity;
+
+	qint64 _spillCapacity;
+
+	qint64 _ramBytes;
+
+	qint64 _spilledBytes;
+
+	bool _isPrefetchingLocalFiles;
+
+	QTemporaryDir *_spillDir;
+
+	qint64 _clock;
+
+	std::atomic<quint64> _hitBytes;
+
+	std::atomic<quint64> _missBytes;
+
+	std::atomic<quint64> _bytesPrefetched;
+
+	/** Private constructor. */
+	PrefetchCache();
+
+public:
+	virtual ~PrefetchCache();
+
+	/** Called by readers, from any thread. */
+	inline void addHit(qint64 bytes) { _hitBytes += bytes; }
+
+	/** Called by readers, from any thread. */
+	inline void addMiss(qint64 bytes) { _missBytes += bytes; }
+
+	/** Removes files which are waiting to be prefetched. Files which are already in the cache are kept. */
+	void clearQueue();
+
+	/** Returns the copy of a file, or a null pointer. Can be called from any thread. */
+	QSharedPointer<Entry> entry(const QString &path);
+
+	/** Decoders can ask for it from any thread. It's destroyed with the application. */
+	static PrefetchCache* instance();
+
+	/** Files on NFS, SMB, SSHFS and other network file systems. */
+	static bool isRemote(const QString &path);
+
+	/** Adds a file at the end of the queue, unless it's already in the cache. Local files are skipped by the prefetching thread. */
+	void prefetch(const QString &path);
+
+	/** Budgets in bytes, 0 disables a kind of storage. Files which are in the cache are not removed until another one needs space. */
+	void setCapacity(qint64 ramBytes, qint64 spillBytes);
+
+	void setPrefetchingLocalFiles(bool enabled);
+
+	/** Can be called from any thread. */
+	Stats stats() const;
+
+protected:
+	virtual void run() override;
+
+private:
+	/** Creates an empty entry, after removing least recently used files if needed. Called with the mutex locked. */
+	QSharedPointer<Entry> createEntry(const QFileInfo &fileInfo);
+
+	/** Copies a file to its entry, chunk after chunk. */
+	void load(const QSharedPointer<Entry> &entry);
+
+	/** Removes least recently used files until there is enough space. Called with the mutex locked. */
+	bool makeRoom(qint64 bytes, bool isSpilled);
+
+	/** Called with the mutex locked. */
+	void removeEntry(const QString &path);
+};
+
+#endif // PREFETCHCACHE_H
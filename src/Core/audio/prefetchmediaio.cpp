@@ -0,0 +1,110 @@
+#include "prefetchmediaio.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+
+#include <QtDebug>
+
+#include <cstring>
+
+PrefetchMediaIO::PrefetchMediaIO(const QSharedPointer<PrefetchCache::Entry> &entry, QObject *parent)
+	: QtAV::MediaIO(parent)
+	, _entry(entry)
+	, _position(0)
+	, _size(0)
+{
+	this->setUrl(entry->path);
+}
+
+qint64 PrefetchMediaIO::read(char *data, qint64 maxSize)
+{
+	if (maxSize <= 0 || _position >= _size) {
+		return 0;
+	}
+	maxSize = qMin(maxSize, _size - _position);
+
+	qint64 bytes = -1;
+	const qint64 loaded = _entry ? _entry->loaded.load(std::memory_order_acquire) : 0;
+	if (_position < loaded) {
+		bytes = this->readCopy(data, qMin(maxSize, loaded - _position));
+		if (bytes > 0) {
+			PrefetchCache::instance()->addHit(bytes);
+		}
+	}
+	if (bytes <= 0) {
+		if (_source.pos() != _position && !_source.seek(_position)) {
+			return -1;
+		}
+		bytes = _source.read(data, maxSize);
+		if (bytes > 0) {
+			PrefetchCache::instance()->addMiss(bytes);
+		}
+	}
+	if (bytes > 0) {
+		_position += bytes;
+	}
+	return bytes;
+}
+
+/**
+ * \param from SEEK_SET, SEEK_CUR and SEEK_END from stdio.h
+ */
+bool PrefetchMediaIO::seek(qint64 offset, int from)
+{
+	qint64 position = offset;
+	if (from == SEEK_CUR) {
+		position += _position;
+	} else if (from == SEEK_END) {
+		position += _size;
+	}
+	if (position < 0 || position > _size) {
+		return false;
+	}
+	_position = position;
+	return true;
+}
+
+void PrefetchMediaIO::onUrlChanged()
+{
+	_spill.close();
+	_source.close();
+	_position = 0;
+	_size = 0;
+	if (this->url().isEmpty()) {
+		return;
+	}
+
+	_source.setFileName(this->url());
+	if (!_source.open(QIODevice::ReadOnly)) {
+		qDebug() << Q_FUNC_INFO << "cannot open" << this->url();
+		return;
+	}
+	_size = _source.size();
+
+	QFileInfo fileInfo(_source);
+	if (_entry && (_entry->path != this->url() || _entry->size != _size ||
+				   _entry->lastModified != fileInfo.lastModified().toMSecsSinceEpoch())) {
+		_entry.clear();
+	}
+	if (_entry && !_entry->spillPath.isEmpty()) {
+		_spill.setFileName(_entry->spillPath);
+	}
+}
+
+/** Reads bytes which were copied, or returns -1 if the temporary file can't be read. */
+qint64 PrefetchMediaIO::readCopy(char *data, qint64 maxSize)
+{
+	if (_entry->spillPath.isEmpty()) {
+		std::memcpy(data, _entry->data.constData() + _position, size_t(maxSize));
+		return maxSize;
+	}
+
+	// The temporary file is created by the prefetching thread, when it starts to copy the original file
+	if (!_spill.isOpen() && !_spill.open(QIODevice::ReadOnly)) {
+		return -1;
+	}
+	if (_spill.pos() != _position && !_spill.seek(_position)) {
+		return -1;
+	}
+	return _spill.read(data, maxSize);
+}
@@ -0,0 +1,59 @@
+#ifndef PREFETCHMEDIAIO_H
+#define PREFETCHMEDIAIO_H
+
+#include <QtAV/MediaIO.h>
+
+#include <QFile>
+
+#include "prefetchcache.h"
+
+/**
+ * \brief		The PrefetchMediaIO class lets the demuxer read a file which is being copied by the PrefetchCache.
+ * \details		Bytes which were already copied are read from memory, or from the temporary file. Others are read from the original
+ *				file, so the demuxer never waits for the prefetching thread, even when it seeks beyond what was copied.
+ *				If the original file was modified after it was copied, the copy is ignored.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY PrefetchMediaIO : public QtAV::MediaIO
+{
+	Q_OBJECT
+private:
+	/** Kept until the reader is closed, even if the cache has removed it. */
+	QSharedPointer<PrefetchCache::Entry> _entry;
+
+	/** Must be closed before the entry removes the file. */
+	QFile _spill;
+
+	QFile _source;
+
+	qint64 _position;
+
+	qint64 _size;
+
+public:
+	PrefetchMediaIO(const QSharedPointer<PrefetchCache::Entry> &entry, QObject *parent = nullptr);
+
+	virtual ~PrefetchMediaIO() {}
+
+	virtual bool isSeekable() const override { return true; }
+
+	virtual QString name() const override { return "Prefetch"; }
+
+	virtual qint64 position() const override { return _position; }
+
+	virtual qint64 read(char *data, qint64 maxSize) override;
+
+	virtual bool seek(qint64 offset, int from = SEEK_SET) override;
+
+	virtual qint64 size() const override { return _size; }
+
+protected:
+	virtual void onUrlChanged() override;
+
+private:
+	/** Reads bytes which were copied, or returns -1 if the temporary file can't be read. */
+	qint64 readCopy(char *data, qint64 maxSize);
+};
+
+#endif // PREFETCHMEDIAIO_H
@@ -0,0 +1,188 @@
+#include "seekindex.h"
+#include "seekindexjob.h"
+
+#include "model/sqldatabase.h"
+
+#include <QtAV/AVDemuxer.h>
+#include <QtAV/Packet.h>
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSqlQuery>
+
+#include <QtDebug>
+
+namespace {
+
+/** Unsigned LEB128: 7 bits per byte, the highest bit is set when another byte follows. */
+void appendVarint(QByteArray &data, quint64 value)
+{
+	while (value >= 0x80) {
+		data.append(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	data.append(static_cast<char>(value));
+}
+
+bool readVarint(const QByteArray &data, int *position, quint64 *value)
+{
+	*value = 0;
+	for (int shift = 0; *position < data.size() && shift < 64; shift += 7) {
+		const quint8 byte = static_cast<quint8>(data.at((*position)++));
+		*value |= quint64(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+}
+
+SeekIndex::SeekIndex()
+	: _interval(defaultInterval)
+{}
+
+/** Demuxes a whole file. Returns a null index if the file can't be read, if packets have no position, or if the job is canceled. */
+SeekIndex SeekIndex::build(const QString &uri, int interval, const BackgroundJob *job)
+{
+	SeekIndex index;
+	index._interval = qMax(100, interval);
+
+	QtAV::AVDemuxer demuxer;
+	if (!demuxer.setMedia(uri) || !demuxer.load()) {
+		qDebug() << Q_FUNC_INFO << "cannot load" << uri;
+		return index;
+	}
+	// A point is known when the next packet starts after its multiple of the interval
+	bool isComplete = true;
+	qint64 previousOffset = -1;
+	qint64 previousPosition = 0;
+	while (!demuxer.atEnd()) {
+		if (job && job->isCanceled()) {
+			isComplete = false;
+			break;
+		}
+		if (!demuxer.readFrame() || demuxer.stream() != demuxer.audioStream()) {
+			continue;
+		}
+		const QtAV::Packet packet = demuxer.packet();
+		if (packet.position < 0) {
+			qDebug() << Q_FUNC_INFO << "packets have no position in" << uri;
+			isComplete = false;
+			break;
+		}
+		const qint64 position = qMax<qint64>(0, qRound64(packet.pts * 1000.0));
+		if (previousOffset < 0) {
+			// The first packet is where the header ends, even if it doesn't start at 0
+			previousOffset = packet.position;
+			previousPosition = position;
+		}
+		while (qint64(index._offsets.size()) * index._interval < position) {
+			index._offsets.append(previousOffset);
+			index._positions.append(previousPosition);
+		}
+		previousOffset = packet.position;
+		previousPosition = position;
+	}
+	demuxer.unload();
+
+	if (!isComplete) {
+		index._offsets.clear();
+		index._positions.clear();
+	} else if (previousOffset >= 0) {
+		while (qint64(index._offsets.size()) * index._interval <= previousPosition) {
+			index._offsets.append(previousOffset);
+			index._positions.append(previousPosition);
+		}
+	}
+	return index;
+}
+
+/** Builds missing indexes of the whole library in background, unless they're being built already. */
+void SeekIndex::generateInBackground()
+{
+	QMetaObject::invokeMethod(SeekIndexJob::instance(), "start", Qt::QueuedConnection);
+}
+
+/** Only for files which can be decoded from any frame. */
+bool SeekIndex::isIndexable(const QString &uri)
+{
+	const QString suffix = QFileInfo(uri).suffix().toLower();
+	return suffix == "mp3" || suffix == "flac";
+}
+
+/** Reads the index of a track. Returns a null index if it's missing, or if the track has changed since. */
+SeekIndex SeekIndex::load(SqlDatabase *db, const QString &uri)
+{
+	SeekIndex index;
+	QSqlQuery selectIndex(*db);
+	selectIndex.prepare("SELECT lastModified, interval, offsets FROM seekIndexes WHERE uri = ?");
+	selectIndex.addBindValue(uri);
+	if (!selectIndex.exec() || !selectIndex.next()) {
+		return index;
+	}
+	if (selectIndex.value(0).toLongLong() != QFileInfo(uri).lastModified().toMSecsSinceEpoch()) {
+		return index;
+	}
+
+	index._interval = selectIndex.value(1).toInt();
+	const QByteArray data = selectIndex.value(2).toByteArray();
+	int i = 0;
+	quint64 offsetDelta, positionDelta;
+	qint64 offset = 0;
+	qint64 position = 0;
+	while (i < data.size()) {
+		if (!readVarint(data, &i, &offsetDelta) || !readVarint(data, &i, &positionDelta)) {
+			index._offsets.clear();
+			index._positions.clear();
+			break;
+		}
+		offset += qint64(offsetDelta);
+		position += qint64(positionDelta);
+		index._offsets.append(offset);
+		index._positions.append(position);
+	}
+	if (index._interval <= 0) {
+		index._offsets.clear();
+		index._positions.clear();
+	}
+	return index;
+}
+
+/** Offset of the last point before a position in ms, and the position in ms where its packet starts. */
+qint64 SeekIndex::offset(qint64 position, qint64 *pointPosition) const
+{
+	if (_offsets.isEmpty()) {
+		*pointPosition = 0;
+		return 0;
+	}
+	const int point = int(qBound<qint64>(0, position / _interval, _offsets.size() - 1));
+
+	// Only the first packet can start after its point
+	*pointPosition = qMin(position, _positions.at(point));
+	return _offsets.at(point);
+}
+
+bool SeekIndex::save(SqlDatabase *db, const QString &uri, qint64 lastModified) const
+{
+	// Offsets and timestamps only grow
+	QByteArray data;
+	data.reserve(_offsets.size() * 5);
+	qint64 previousOffset = 0;
+	qint64 previousPosition = 0;
+	for (int i = 0; i < _offsets.size(); i++) {
+		appendVarint(data, quint64(qMax<qint64>(0, _offsets.at(i) - previousOffset)));
+		appendVarint(data, quint64(qMax<qint64>(0, _positions.at(i) - previousPosition)));
+		previousOffset = qMax(previousOffset, _offsets.at(i));
+		previousPosition = qMax(previousPosition, _positions.at(i));
+	}
+
+	QSqlQuery insertIndex(*db);
+	insertIndex.prepare("INSERT OR REPLACE INTO seekIndexes (uri, lastModified, interval, offsets) VALUES (?, ?, ?, ?)");
+	insertIndex.addBindValue(uri);
+	insertIndex.addBindValue(lastModified);
+	insertIndex.addBindValue(_interval);
+	insertIndex.addBindValue(data);
+	return insertIndex.exec();
+}
@@ -0,0 +1,68 @@
+#ifndef SEEKINDEX_H
+#define SEEKINDEX_H
+
+#include <QString>
+#include <QVector>
+
+#include "miamcore_global.h"
+
+/// Forward declarations
+class BackgroundJob;
+class SqlDatabase;
+
+/**
+ * \brief		The SeekIndex class stores where the frames of a track are in its file, at regular intervals.
+ * \details		Without a TOC (VBR MP3 without a Xing header) or a seektable (FLAC), a demuxer has to estimate the position of a
+ *				timestamp from the bitrate, then scan or bisect the file, which is slow and inaccurate in a 3-hour mix.
+ *				The index is built once by demuxing the whole file, without decoding it: it keeps the byte offset and the timestamp of
+ *				the last packet which starts at or before each multiple of the interval. A seek is then a lookup, followed by decoding
+ *				from the timestamp of the packet, less than one interval.
+ *				Offsets and timestamps are stored in table "seekIndexes" as variable-length deltas, about 5 bytes per point.
+ *				Only MP3 and FLAC files are indexed: their frames can be decoded from any frame boundary, after the header of the file.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY SeekIndex
+{
+public:
+	/** Milliseconds between two points. */
+	static const int defaultInterval = 2000;
+
+private:
+	int _interval;
+
+	/** Byte offset of the last packet at or before each multiple of the interval. The first one is the size of the header. */
+	QVector<qint64> _offsets;
+
+	/** Timestamp in ms of the packet of each point. */
+	QVector<qint64> _positions;
+
+public:
+	SeekIndex();
+
+	/** Demuxes a whole file. Returns a null index if the file can't be read, if packets have no position, or if the job is canceled. */
+	static SeekIndex build(const QString &uri, int interval = defaultInterval, const BackgroundJob *job = nullptr);
+
+	/** Builds missing indexes of the whole library in background, unless they're being built already. */
+	static void generateInBackground();
+
+	/** Bytes before the first packet, which must be read before any frame. */
+	inline qint64 headerSize() const { return _offsets.isEmpty() ? 0 : _offsets.first(); }
+
+	inline int interval() const { return _interval; }
+
+	/** Only for files which can be decoded from any frame. */
+	static bool isIndexable(const QString &uri);
+
+	inline bool isNull() const { return _offsets.isEmpty(); }
+
+	/** Reads the index of a track. Returns a null index if it's missing, or if the track has changed since. */
+	static SeekIndex load(SqlDatabase *db, const QString &uri);
+
+	/** Offset of the last point before a position in ms, and the position in ms where its packet starts. */
+	qint64 offset(qint64 position, qint64 *pointPosition) const;
+
+	bool save(SqlDatabase *db, const QString &uri, qint64 lastModified) const;
+};
+
+#endif // SEEKINDEX_H
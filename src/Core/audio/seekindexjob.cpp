@@ -0,0 +1,135 @@
+#include "seekindexjob.h"
+
+#include "model/sqldatabase.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSqlQuery>
+
+namespace {
+
+/** Demuxes one file, if it has changed since it was indexed. */
+class SeekIndexTask : public QRunnable
+{
+private:
+	SeekIndexJob *_job;
+	QString _uri;
+	qint64 _lastIndexed;
+
+public:
+	SeekIndexTask(SeekIndexJob *job, const QString &uri, qint64 lastIndexed)
+		: QRunnable()
+		, _job(job)
+		, _uri(uri)
+		, _lastIndexed(lastIndexed)
+	{}
+
+	virtual void run() override
+	{
+		this->index();
+		_job->taskHasFinished();
+	}
+
+private:
+	void index()
+	{
+		QFileInfo fileInfo(_uri);
+		if (_job->isCanceled() || !fileInfo.exists()) {
+			return;
+		}
+		SeekIndexJob::Result result;
+		result.uri = _uri;
+		result.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+		if (result.lastModified == _lastIndexed) {
+			return;
+		}
+		result.index = SeekIndex::build(_uri, SeekIndex::defaultInterval, _job);
+		if (!result.index.isNull()) {
+			_job->addResult(result);
+		}
+	}
+};
+
+}
+
+SeekIndexJob::SeekIndexJob(QObject *parent)
+	: BackgroundJob(parent)
+{
+	moveToThread(QCoreApplication::instance()->thread());
+
+	// Files are read from start to end, while music is played
+	this->setThreadCount(1);
+}
+
+SeekIndexJob::~SeekIndexJob()
+{
+	this->cancel();
+}
+
+/** Can be called from any thread. It's canceled and destroyed with the application. */
+SeekIndexJob* SeekIndexJob::instance()
+{
+	static SeekIndexJob *job = [] () {
+		qAddPostRoutine([] () { delete SeekIndexJob::instance(); });
+		return new SeekIndexJob;
+	}();
+	return job;
+}
+
+/** Called by tasks, from any thread. */
+void SeekIndexJob::addResult(const Result &result)
+{
+	QMutexLocker locker(&_mutex);
+	_results.append(result);
+}
+
+/** Saves results of tasks in one transaction. */
+void SeekIndexJob::flushResults()
+{
+	QList<Result> results;
+	_mutex.lock();
+	results.swap(_results);
+	_mutex.unlock();
+
+	if (!results.isEmpty()) {
+		SqlDatabase *db = this->database();
+		db->transaction();
+		for (const Result &result : results) {
+			result.index.save(db, result.uri, result.lastModified);
+		}
+		db->commit();
+	}
+}
+
+bool SeekIndexJob::hasPendingResults() const
+{
+	QMutexLocker locker(&_mutex);
+	return !_results.isEmpty();
+}
+
+void SeekIndexJob::start()
+{
+	if (this->isRunning()) {
+		return;
+	}
+	SqlDatabase *db = this->database();
+
+	// Building an index reads the whole file: the query is consumed first, so it doesn't keep a lock on the database
+	QSqlQuery selectTracks(*db);
+	selectTracks.setForwardOnly(true);
+	if (!selectTracks.exec("SELECT c.uri, s.lastModified FROM cache c LEFT JOIN seekIndexes s ON c.uri = s.uri " \
+						   "WHERE c.host IS NULL OR c.host = ''")) {
+		return;
+	}
+	QList<QRunnable*> tasks;
+	while (selectTracks.next()) {
+		const QString uri = selectTracks.value(0).toString();
+		if (SeekIndex::isIndexable(uri)) {
+			tasks.append(new SeekIndexTask(this, uri, selectTracks.isNull(1) ? qint64(-1) : selectTracks.value(1).toLongLong()));
+		}
+	}
+	selectTracks.finish();
+	this->startTasks(tasks);
+}
@@ -0,0 +1,53 @@
+#ifndef SEEKINDEXJOB_H
+#define SEEKINDEXJOB_H
+
+#include "backgroundjob.h"
+#include "seekindex.h"
+
+/**
+ * \brief		The SeekIndexJob class builds missing seek indexes of MP3 and FLAC files of the whole library after each scan.
+ * \details		Each file is demuxed by a task of the pool of the job, one at a time, because it's read from start to end. Indexes
+ *				are saved in table "seekIndexes" every second, in a single transaction. Tracks and their last indexed time are read
+ *				before the first file is demuxed, and the database isn't locked meanwhile.
+ *				There is only one job, which lives in the main thread: a scan which ends while it's running doesn't start another one,
+ *				and it's canceled when the application quits, even in the middle of a file.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY SeekIndexJob : public BackgroundJob
+{
+	Q_OBJECT
+public:
+	/** Index of one file, sent by tasks to the job. */
+	struct Result
+	{
+		QString uri;
+		qint64 lastModified;
+		SeekIndex index;
+	};
+
+private:
+	QList<Result> _results;
+
+	explicit SeekIndexJob(QObject *parent = nullptr);
+
+public:
+	virtual ~SeekIndexJob();
+
+	/** Can be called from any thread. It's canceled and destroyed with the application. */
+	static SeekIndexJob* instance();
+
+	/** Called by tasks, from any thread. */
+	void addResult(const Result &result);
+
+protected:
+	/** Saves results of tasks in one transaction. */
+	virtual void flushResults() override;
+
+	virtual bool hasPendingResults() const override;
+
+public slots:
+	void start();
+};
+
+#endif // SEEKINDEXJOB_H
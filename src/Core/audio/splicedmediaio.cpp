@@ -0,0 +1,53 @@
+#include "splicedmediaio.h"
+
+/** Takes ownership of the source, which must already be opened. */
+SplicedMediaIO::SplicedMediaIO(QtAV::MediaIO *source, qint64 headerSize, qint64 offset, QObject *parent)
+	: QtAV::MediaIO(parent)
+	, _source(source)
+	, _headerSize(headerSize)
+	, _offset(qMax(headerSize, offset))
+	, _position(0)
+{
+	_source->setParent(this);
+}
+
+qint64 SplicedMediaIO::read(char *data, qint64 maxSize)
+{
+	// The header and the frames are read separately, even if both are requested at once
+	qint64 sourcePosition = _position < _headerSize ? _position : _position - _headerSize + _offset;
+	if (_position < _headerSize) {
+		maxSize = qMin(maxSize, _headerSize - _position);
+	}
+	if (_source->position() != sourcePosition && !_source->seek(sourcePosition)) {
+		return -1;
+	}
+	const qint64 bytes = _source->read(data, maxSize);
+	if (bytes > 0) {
+		_position += bytes;
+	}
+	return bytes;
+}
+
+/**
+ * \param from SEEK_SET, SEEK_CUR and SEEK_END from stdio.h
+ */
+bool SplicedMediaIO::seek(qint64 offset, int from)
+{
+	qint64 position = offset;
+	if (from == SEEK_CUR) {
+		position += _position;
+	} else if (from == SEEK_END) {
+		position += this->size();
+	}
+	if (position < 0 || position > this->size()) {
+		return false;
+	}
+	_position = position;
+	return true;
+}
+
+qint64 SplicedMediaIO::size() const
+{
+	const qint64 sourceSize = _source->size();
+	return sourceSize <= 0 ? sourceSize : _headerSize + qMax<qint64>(0, sourceSize - _offset);
+}
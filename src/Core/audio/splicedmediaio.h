@@ -0,0 +1,47 @@
+#ifndef SPLICEDMEDIAIO_H
+#define SPLICEDMEDIAIO_H
+
+#include <QtAV/MediaIO.h>
+
+#include "miamcore_global.h"
+
+/**
+ * \brief		The SplicedMediaIO class shows the demuxer a file which starts at a frame given by a SeekIndex.
+ * \details		The header of the file is followed by its frames from an offset, so the demuxer reads the first frame it's given
+ *				right after it has parsed the header, instead of looking for the frame of a timestamp. Timestamps of packets start
+ *				from 0 again, the position is kept by the TrackDecoder.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY SplicedMediaIO : public QtAV::MediaIO
+{
+	Q_OBJECT
+private:
+	QtAV::MediaIO *_source;
+
+	qint64 _headerSize;
+
+	qint64 _offset;
+
+	qint64 _position;
+
+public:
+	/** Takes ownership of the source, which must already be opened. */
+	SplicedMediaIO(QtAV::MediaIO *source, qint64 headerSize, qint64 offset, QObject *parent = nullptr);
+
+	virtual ~SplicedMediaIO() {}
+
+	virtual bool isSeekable() const override { return _source->isSeekable(); }
+
+	virtual QString name() const override { return "Spliced"; }
+
+	virtual qint64 position() const override { return _position; }
+
+	virtual qint64 read(char *data, qint64 maxSize) override;
+
+	virtual bool seek(qint64 offset, int from = SEEK_SET) override;
+
+	virtual qint64 size() const override;
+};
+
+#endif // SPLICEDMEDIAIO_H
@@ -0,0 +1,189 @@
+#include "trackdecoder.h"
+
+#include <QtAV/AudioDecoder.h>
+#include <QtAV/AudioFrame.h>
+#include <QtAV/AVDemuxer.h>
+#include <QtAV/Packet.h>
+
+#include <QUrl>
+
+#include "prefetchmediaio.h"
+#include "splicedmediaio.h"
+
+#include <QtDebug>
+
+using namespace QtAV;
+
+TrackDecoder::TrackDecoder(const QString &uri, const AudioFormat &outputFormat)
+	: _uri(uri)
+	, _demuxer(new AVDemuxer)
+	, _io(nullptr)
+	, _decoder(AudioDecoder::create())
+	, _outputFormat(outputFormat)
+	, _sampleFormat(AudioFormat::SampleFormat_Unknown)
+	, _duration(0)
+	, _decodedFrames(0)
+	, _skippedFrames(0)
+	, _isDraining(false)
+	, _isEndOfStream(true)
+{}
+
+TrackDecoder::~TrackDecoder()
+{
+	if (_decoder) {
+		_decoder->close();
+		delete _decoder;
+	}
+	_demuxer->unload();
+	delete _demuxer;
+	delete _io;
+}
+
+/** Decodes the next frame, converted to the output format. Returns an empty array at the end of the track. */
+QByteArray TrackDecoder::decode()
+{
+	while (!_isEndOfStream) {
+		Packet packet;
+		if (_isDraining) {
+			// Codecs with a delay still have frames when there are no more packets
+			packet = Packet::createEOF();
+		} else if (_demuxer->atEnd()) {
+			_isDraining = true;
+			continue;
+		} else if (!_demuxer->readFrame() || _demuxer->stream() != _demuxer->audioStream()) {
+			continue;
+		} else {
+			packet = _demuxer->packet();
+		}
+
+		if (!_decoder->decode(packet)) {
+			_isEndOfStream = _isDraining;
+			continue;
+		}
+		AudioFrame frame = _decoder->frame();
+		if (!frame) {
+			_isEndOfStream = _isDraining;
+			continue;
+		}
+		if (!_outputFormat.isValid()) {
+			_outputFormat = frame.format();
+			if (_sampleFormat == AudioFormat::SampleFormat_Unknown) {
+				_outputFormat.setSampleFormat(AudioFormat::packedSampleFormat(_outputFormat.sampleFormat()));
+			} else {
+				_outputFormat.setSampleFormat(_sampleFormat);
+			}
+		}
+		frame.setAudioResampler(_decoder->resampler());
+		QByteArray data = frame.to(_outputFormat).data();
+
+		// After a seek, samples before the requested position are dropped
+		if (_skippedFrames > 0) {
+			const qint64 skippedFrames = qMin<qint64>(_skippedFrames, data.size() / _outputFormat.bytesPerFrame());
+			_skippedFrames -= skippedFrames;
+			data.remove(0, int(skippedFrames) * _outputFormat.bytesPerFrame());
+			if (data.isEmpty()) {
+				continue;
+			}
+		}
+		_decodedFrames += data.size() / _outputFormat.bytesPerFrame();
+		return data;
+	}
+	return QByteArray();
+}
+
+/** Duration of the track in ms, or 0 if it's unknown. */
+qint64 TrackDecoder::duration() const
+{
+	return _duration;
+}
+
+bool TrackDecoder::open()
+{
+	if (!_decoder || !this->load(0)) {
+		return false;
+	}
+	_duration = qMax<qint64>(0, _demuxer->duration());
+	_decodedFrames = 0;
+	_skippedFrames = 0;
+	_isDraining = false;
+	_isEndOfStream = false;
+	return true;
+}
+
+/** Position of the last decoded sample, in ms. */
+qint64 TrackDecoder::position() const
+{
+	if (!_outputFormat.isValid() || _outputFormat.sampleRate() == 0) {
+		return 0;
+	}
+	return _decodedFrames * 1000 / _outputFormat.sampleRate();
+}
+
+/** Moves to a position in ms, with the seek index if there's one. A frame must have been decoded before. */
+bool TrackDecoder::seek(qint64 position)
+{
+	if (!_decoder || !_outputFormat.isValid() || _outputFormat.sampleRate() == 0) {
+		return false;
+	}
+	if (_duration > 0) {
+		position = qBound<qint64>(0, position, _duration);
+	}
+
+	// Without an index, the demuxer finds the position by itself
+	qint64 pointPosition = position;
+	if (_seekIndex.isNull()) {
+		if (!_demuxer->seek(position)) {
+			qDebug() << Q_FUNC_INFO << "cannot seek in" << _uri;
+			return false;
+		}
+		_decoder->flush();
+	} else if (!this->load(_seekIndex.offset(position, &pointPosition))) {
+		_isEndOfStream = true;
+		return false;
+	}
+	_decodedFrames = position * _outputFormat.sampleRate() / 1000;
+	_skippedFrames = (position - pointPosition) * _outputFormat.sampleRate() / 1000;
+	_isDraining = false;
+	_isEndOfStream = false;
+	return true;
+}
+
+/** Loads the file in the demuxer, from the beginning or from an offset of the seek index, and opens the decoder. */
+bool TrackDecoder::load(qint64 offset)
+{
+	_decoder->close();
+	_demuxer->unload();
+	delete _io;
+	_io = nullptr;
+
+	// Tracks on network shares may have a local copy
+	QUrl url(_uri);
+	const QString path = url.isLocalFile() ? url.toLocalFile() : _uri;
+	QSharedPointer<PrefetchCache::Entry> entry = PrefetchCache::instance()->entry(path);
+	if (entry) {
+		_io = new PrefetchMediaIO(entry);
+	}
+	if (offset > _seekIndex.headerSize()) {
+		MediaIO *source = _io;
+		if (source == nullptr) {
+			source = MediaIO::create("QFile");
+			if (source == nullptr) {
+				return false;
+			}
+			source->setUrl(path);
+		}
+		_io = new SplicedMediaIO(source, _seekIndex.headerSize(), offset);
+	}
+
+	const bool isMediaSet = _io ? _demuxer->setMedia(_io) : _demuxer->setMedia(path);
+	if (!isMediaSet || !_demuxer->load()) {
+		qDebug() << Q_FUNC_INFO << "cannot load" << _uri;
+		return false;
+	}
+	_decoder->setCodecContext(_demuxer->audioCodecContext());
+	if (!_decoder->open()) {
+		qDebug() << Q_FUNC_INFO << "cannot open decoder for" << _uri;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,94 @@
+#ifndef TRACKDECODER_H
+#define TRACKDECODER_H
+
+#include <QtAV/AudioFormat.h>
+
+#include "miamcore_global.h"
+#include "seekindex.h"
+
+/// Forward declarations
+namespace QtAV {
+class AudioDecoder;
+class AVDemuxer;
+class MediaIO;
+}
+
+/**
+ * \brief		The TrackDecoder class decodes one track, frame after frame, to a fixed audio format.
+ * \details		Frames of every track are converted to the format of the output, so tracks can be written one after the other in the
+ *				same audio device. If no format is given, the packed format of the first decoded frame is kept.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY TrackDecoder
+{
+private:
+	QString _uri;
+
+	QtAV::AVDemuxer *_demuxer;
+
+	/** Reads the local copy of a track on a network share, if it was prefetched. */
+	QtAV::MediaIO *_io;
+
+	QtAV::AudioDecoder *_decoder;
+
+	QtAV::AudioFormat _outputFormat;
+
+	/** Sample format which is used when the output format is taken from the first frame. */
+	QtAV::AudioFormat::SampleFormat _sampleFormat;
+
+	/** Taken from the whole file, before any seek. */
+	qint64 _duration;
+
+	SeekIndex _seekIndex;
+
+	/** Number of frames (one sample per channel) which were decoded. */
+	qint64 _decodedFrames;
+
+	/** Frames between the point of the seek index and the requested position, which are decoded but not returned. */
+	qint64 _skippedFrames;
+
+	/** Decoder is flushed when the demuxer has no more packets. */
+	bool _isDraining;
+
+	bool _isEndOfStream;
+
+public:
+	TrackDecoder(const QString &uri, const QtAV::AudioFormat &outputFormat = QtAV::AudioFormat());
+
+	virtual ~TrackDecoder();
+
+	inline bool atEnd() const { return _isEndOfStream; }
+
+	/** Decodes the next frame, converted to the output format. Returns an empty array at the end of the track. */
+	QByteArray decode();
+
+	/** Duration of the track in ms, or 0 if it's unknown. */
+	qint64 duration() const;
+
+	bool open();
+
+	inline const QtAV::AudioFormat &outputFormat() const { return _outputFormat; }
+
+	/** Position of the last decoded sample, in ms. */
+	qint64 position() const;
+
+	/** Moves to a position in ms, with the seek index if there's one. A frame must have been decoded before. */
+	bool seek(qint64 position);
+
+	inline const SeekIndex &seekIndex() const { return _seekIndex; }
+
+	/** If no output format was given, frames are converted to this sample format instead of the packed format of the track. */
+	inline void setSampleFormat(QtAV::AudioFormat::SampleFormat sampleFormat) { _sampleFormat = sampleFormat; }
+
+	/** Used by the next seeks, instead of the demuxer. */
+	inline void setSeekIndex(const SeekIndex &seekIndex) { _seekIndex = seekIndex; }
+
+	inline const QString &uri() const { return _uri; }
+
+private:
+	/** Loads the file in the demuxer, from the beginning or from an offset of the seek index, and opens the decoder. */
+	bool load(qint64 offset);
+};
+
+#endif // TRACKDECODER_H
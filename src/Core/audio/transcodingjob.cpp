@@ -0,0 +1,334 @@
+#include "transcodingjob.h"
+#include "trackdecoder.h"
+
+#include "model/sqldatabase.h"
+#include "cover.h"
+#include "filehelper.h"
+#include "settingsprivate.h"
+
+#include <QtAV/AudioEncoder.h>
+#include <QtAV/AudioFrame.h>
+#include <QtAV/AudioResampler.h>
+#include <QtAV/AVMuxer.h>
+#include <QtAV/Packet.h>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSqlQuery>
+#include <QUrl>
+
+#include <QtDebug>
+
+#include <taglib/tfile.h>
+#include <taglib/tpropertymap.h>
+
+using namespace QtAV;
+
+namespace {
+
+/** Converts one track. */
+class TranscodingTask : public QRunnable
+{
+private:
+	TranscodingJob *_job;
+	QString _uri;
+	QString _output;
+	TranscodingJob::Profile _profile;
+	int _bitRate;
+
+public:
+	TranscodingTask(TranscodingJob *job, const QString &uri, const QString &output, const TranscodingJob::Profile &profile, int bitRate)
+		: QRunnable()
+		, _job(job)
+		, _uri(uri)
+		, _output(output)
+		, _profile(profile)
+		, _bitRate(bitRate)
+	{}
+
+	virtual void run() override
+	{
+		this->transcodeIfNeeded();
+		_job->taskHasFinished();
+	}
+
+private:
+	/** Tags and the cover of the track. */
+	void copyTags()
+	{
+		FileHelper source(_uri);
+		FileHelper target(_output);
+		if (!source.isValid() || !target.isValid() || !source.file() || !target.file()) {
+			return;
+		}
+		target.file()->setProperties(source.file()->properties());
+		Cover *cover = source.extractCover();
+		if (cover) {
+			target.setCover(cover);
+			delete cover;
+		}
+		target.save();
+	}
+
+	/** Decodes the track and encodes it to a file. Returns the duration of the track in ms, or -1. */
+	qint64 transcode(const QString &path)
+	{
+		// Rate and channels of the track, from its first frame
+		AudioFormat sourceFormat;
+		{
+			TrackDecoder probe(_uri);
+			if (!probe.open() || probe.decode().isEmpty()) {
+				return -1;
+			}
+			sourceFormat = probe.outputFormat();
+		}
+
+		// Devices get stereo at most, samples are converted to the format of the encoder frame by frame
+		AudioFormat format;
+		format.setChannels(qMin(2, sourceFormat.channels()));
+		format.setSampleRate(_profile.sampleRate > 0 ? _profile.sampleRate : sourceFormat.sampleRate());
+		format.setSampleFormat(AudioFormat::packedSampleFormat(_profile.sampleFormat));
+		AudioFormat encoderFormat(format);
+		encoderFormat.setSampleFormat(_profile.sampleFormat);
+
+		TrackDecoder decoder(_uri, format);
+		QScopedPointer<AudioEncoder> encoder(AudioEncoder::create("FFmpeg"));
+		QScopedPointer<AudioResampler> resampler(AudioResampler::create("FFmpeg"));
+		if (!decoder.open() || !encoder || !resampler) {
+			return -1;
+		}
+		encoder->setCodecName(_profile.codec);
+		encoder->setBitRate(_bitRate > 0 ? _bitRate : _profile.bitRate);
+		encoder->setAudioFormat(encoderFormat);
+		if (!encoder->open()) {
+			qDebug() << Q_FUNC_INFO << "cannot open encoder" << _profile.codec;
+			return -1;
+		}
+		AVMuxer muxer;
+		muxer.setMedia(path);
+		muxer.setFormat(_profile.format);
+		muxer.copyProperties(encoder.data());
+		if (!muxer.open()) {
+			qDebug() << Q_FUNC_INFO << "cannot open" << path;
+			return -1;
+		}
+
+		// Encoders need frames of a fixed size, except the last one: FLAC, Opus and MP3 encoders take a shorter frame at the end,
+		// so the output has no trailing silence
+		const int frameBytes = _profile.frameSize * format.bytesPerFrame();
+		QByteArray pending;
+		qint64 frames = 0;
+		bool isOk = true;
+		while (isOk && (!decoder.atEnd() || !pending.isEmpty())) {
+			if (_job->isCanceled()) {
+				isOk = false;
+				break;
+			}
+			pending.append(decoder.decode());
+			int consumed = 0;
+			while (isOk && (pending.size() - consumed >= frameBytes || (decoder.atEnd() && consumed < pending.size()))) {
+				const QByteArray chunk = pending.mid(consumed, frameBytes);
+				consumed += chunk.size();
+				const int samples = chunk.size() / format.bytesPerFrame();
+				AudioFrame frame(format, chunk);
+				frame.setSamplesPerChannel(samples);
+				frame.setTimestamp(qreal(frames) / format.sampleRate());
+				if (encoderFormat != format) {
+					frame.setAudioResampler(resampler.data());
+					frame = frame.to(encoderFormat);
+				}
+				frames += samples;
+				if (encoder->encode(frame)) {
+					isOk = muxer.writeAudio(encoder->encoded());
+				}
+			}
+			pending.remove(0, consumed);
+		}
+
+		// Delayed packets
+		while (isOk && encoder->encode()) {
+			isOk = muxer.writeAudio(encoder->encoded());
+		}
+		muxer.close();
+		encoder->close();
+		return isOk ? frames * 1000 / format.sampleRate() : -1;
+	}
+
+	void transcodeIfNeeded()
+	{
+		QFileInfo source(_uri);
+		if (_job->isCanceled() || !source.exists()) {
+			_job->addResult(_uri, _output, TranscodingJob::Failed, 0);
+			return;
+		}
+		QFileInfo output(_output);
+		if (output.exists() && output.lastModified() >= source.lastModified()) {
+			_job->addResult(_uri, _output, TranscodingJob::Skipped, 0);
+			return;
+		}
+
+		// Incomplete outputs never replace a previous one
+		QDir().mkpath(output.absolutePath());
+		const QString partPath = _output + ".part";
+		const qint64 duration = this->transcode(partPath);
+		if (duration < 0 || (output.exists() && !QFile::remove(_output)) || !QFile::rename(partPath, _output)) {
+			QFile::remove(partPath);
+			_job->addResult(_uri, _output, TranscodingJob::Failed, 0);
+			return;
+		}
+		this->copyTags();
+		_job->addResult(_uri, _output, TranscodingJob::Transcoded, duration);
+	}
+};
+
+}
+
+TranscodingJob::TranscodingJob(QObject *parent)
+	: BackgroundJob(parent)
+	, _stats({ 0, 0, 0, 0, 0 })
+	, _profile(TranscodingJob::profile("opus"))
+	, _bitRate(0)
+{}
+
+TranscodingJob::~TranscodingJob()
+{
+	this->cancel();
+}
+
+/** Called by tasks, from any thread. */
+void TranscodingJob::addResult(const QString &uri, const QString &output, Outcome outcome, qint64 audioMs)
+{
+	_mutex.lock();
+	switch (outcome) {
+	case Transcoded:
+		_stats.transcodedTracks++;
+		_stats.audioMs += audioMs;
+		break;
+	case Skipped:
+		_stats.skippedTracks++;
+		break;
+	case Failed:
+		_stats.failedTracks++;
+		break;
+	}
+	_mutex.unlock();
+
+	if (outcome == Transcoded) {
+		emit trackTranscoded(uri, output);
+	} else if (outcome == Failed && !this->isCanceled()) {
+		emit error(uri);
+	}
+}
+
+/** Statistics are updated by tasks directly. */
+void TranscodingJob::flushResults()
+{}
+
+/** Converts every track of a playlist. Returns false if the playlist doesn't exist. */
+bool TranscodingJob::addPlaylist(uint playlistId)
+{
+	QSqlQuery selectTracks(*this->database());
+	selectTracks.setForwardOnly(true);
+	selectTracks.prepare("SELECT url FROM playlistTracks WHERE playlistId = ? AND (host IS NULL OR host = '') ORDER BY rowid");
+	selectTracks.addBindValue(playlistId);
+	if (!selectTracks.exec()) {
+		return false;
+	}
+	QStringList uris;
+	while (selectTracks.next()) {
+		QUrl url(selectTracks.value(0).toString());
+		uris.append(url.isLocalFile() ? url.toLocalFile() : selectTracks.value(0).toString());
+	}
+	if (uris.isEmpty()) {
+		return false;
+	}
+	this->addTracks(uris);
+	return true;
+}
+
+/** Converts tracks with the current profile, to the current output directory. */
+void TranscodingJob::addTracks(const QStringList &uris)
+{
+	if (uris.isEmpty() || _profile.isNull() || _outputDirectory.isEmpty()) {
+		return;
+	}
+	if (!this->isRunning()) {
+		_mutex.lock();
+		_stats = { 0, 0, 0, 0, 0 };
+		_mutex.unlock();
+		_elapsedTimer.start();
+	}
+	QList<QRunnable*> tasks;
+	for (const QString &uri : uris) {
+		tasks.append(new TranscodingTask(this, uri, this->outputPath(uri), _profile, _bitRate));
+	}
+	this->startTasks(tasks);
+}
+
+/** Where a track is converted: its path relative to its music location, in the output directory, with a new suffix. */
+QString TranscodingJob::outputPath(const QString &uri) const
+{
+	const QFileInfo fileInfo(uri);
+	QString relativePath = fileInfo.fileName();
+	for (const QString &musicLocation : SettingsPrivate::instance()->musicLocations()) {
+		const QString path = QDir::fromNativeSeparators(musicLocation);
+		if (fileInfo.absoluteFilePath().startsWith(path + "/")) {
+			relativePath = QDir(path).relativeFilePath(fileInfo.absoluteFilePath());
+			break;
+		}
+	}
+	relativePath.chop(fileInfo.suffix().size());
+	return QDir(_outputDirectory).filePath(relativePath + _profile.suffix);
+}
+
+/** Opus, AAC, MP3 and FLAC. */
+QList<TranscodingJob::Profile> TranscodingJob::profiles()
+{
+	// Frame sizes are the ones FFmpeg's encoders expect: 20 ms for Opus at 48 kHz
+	static const QList<Profile> profiles = {
+		{ "opus", "libopus", "opus", "opus", 128000, 48000, 960, AudioFormat::SampleFormat_Float },
+		{ "aac", "aac", "ipod", "m4a", 192000, 0, 1024, AudioFormat::SampleFormat_FloatPlanar },
+		{ "mp3", "libmp3lame", "mp3", "mp3", 192000, 0, 1152, AudioFormat::SampleFormat_FloatPlanar },
+		{ "flac", "flac", "flac", "flac", 0, 0, 4608, AudioFormat::SampleFormat_Signed16 }
+	};
+	return profiles;
+}
+
+/** Returns a null profile if the name is unknown. */
+TranscodingJob::Profile TranscodingJob::profile(const QString &name)
+{
+	for (const Profile &profile : TranscodingJob::profiles()) {
+		if (profile.name == name.toLower()) {
+			return profile;
+		}
+	}
+	return Profile();
+}
+
+/** Bits per second, or 0 for the default of the profile. Applied to tracks which are added next. */
+void TranscodingJob::setBitRate(int bitRate)
+{
+	_bitRate = qMax(0, bitRate);
+}
+
+/** Applied to tracks which are added next. */
+void TranscodingJob::setOutputDirectory(const QString &directory)
+{
+	_outputDirectory = directory;
+}
+
+/** Applied to tracks which are added next. */
+void TranscodingJob::setProfile(const Profile &profile)
+{
+	_profile = profile;
+}
+
+TranscodingJob::Stats TranscodingJob::stats() const
+{
+	QMutexLocker locker(&_mutex);
+	Stats stats = _stats;
+	stats.elapsedMs = _elapsedTimer.isValid() ? _elapsedTimer.elapsed() : 0;
+	return stats;
+}
@@ -0,0 +1,121 @@
+#ifndef TRANSCODINGJOB_H
+#define TRANSCODINGJOB_H
+
+#include <QtAV/AudioFormat.h>
+
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include "backgroundjob.h"
+
+/**
+ * \brief		The TranscodingJob class converts tracks of the library to another codec, to sync them to devices.
+ * \details		Each track is converted by a task of the pool of the job, with one thread per core by default: it's decoded by a
+ *				TrackDecoder, encoded by QtAV's FFmpeg encoder in frames of the size expected by the codec, and written by a muxer
+ *				to a temporary file which replaces the output when it's complete. Tags and covers are copied with FileHelper.
+ *				Outputs which are newer than their track are skipped. Tracks keep their path relative to their music location.
+ *				Tracks and playlists can be added at any time, with the profile and the output directory which are set at that time.
+ *				Throughput is measured as a multiple of realtime: seconds of audio converted per second of wall time.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY TranscodingJob : public BackgroundJob
+{
+	Q_OBJECT
+public:
+	/** Codec, container and default parameters for a kind of device. */
+	struct Profile
+	{
+		QString name;
+		/** Name of the FFmpeg encoder. */
+		QString codec;
+		/** Name of the FFmpeg muxer. */
+		QString format;
+		QString suffix;
+		int bitRate;
+		/** 0 keeps the rate of the track. */
+		int sampleRate;
+		/** Samples per channel in each frame given to the encoder. */
+		int frameSize;
+		QtAV::AudioFormat::SampleFormat sampleFormat;
+
+		inline bool isNull() const { return name.isEmpty(); }
+	};
+
+	enum Outcome : int
+	{
+		Transcoded	= 0,
+		Skipped		= 1,
+		Failed		= 2
+	};
+
+	struct Stats
+	{
+		int transcodedTracks;
+		int skippedTracks;
+		int failedTracks;
+		/** Duration of converted tracks. */
+		qint64 audioMs;
+		/** Wall time since the job has started. */
+		qint64 elapsedMs;
+
+		inline qreal realtimeMultiple() const { return elapsedMs == 0 ? 0.0 : qreal(audioMs) / elapsedMs; }
+	};
+
+private:
+	QElapsedTimer _elapsedTimer;
+
+	/** Protected by the mutex of the job. */
+	Stats _stats;
+
+	Profile _profile;
+
+	int _bitRate;
+
+	QString _outputDirectory;
+
+public:
+	explicit TranscodingJob(QObject *parent = nullptr);
+
+	virtual ~TranscodingJob();
+
+	/** Called by tasks, from any thread. */
+	void addResult(const QString &uri, const QString &output, Outcome outcome, qint64 audioMs);
+
+	/** Converts every track of a playlist. Returns false if the playlist doesn't exist. */
+	bool addPlaylist(uint playlistId);
+
+	/** Converts tracks with the current profile, to the current output directory. */
+	void addTracks(const QStringList &uris);
+
+	/** Where a track is converted: its path relative to its music location, in the output directory, with a new suffix. */
+	QString outputPath(const QString &uri) const;
+
+	/** Opus, AAC, MP3 and FLAC. */
+	static QList<Profile> profiles();
+
+	/** Returns a null profile if the name is unknown. */
+	static Profile profile(const QString &name);
+
+	/** Bits per second, or 0 for the default of the profile. Applied to tracks which are added next. */
+	void setBitRate(int bitRate);
+
+	/** Applied to tracks which are added next. */
+	void setOutputDirectory(const QString &directory);
+
+	/** Applied to tracks which are added next. */
+	void setProfile(const Profile &profile);
+
+	Stats stats() const;
+
+protected:
+	/** Statistics are updated by tasks directly. */
+	virtual void flushResults() override;
+
+signals:
+	void error(const QString &uri);
+
+	void trackTranscoded(const QString &uri, const QString &output);
+};
+
+#endif // TRANSCODINGJOB_H
@@ -0,0 +1,231 @@
+#include "waveformcache.h"
+#include "backgroundjob.h"
+#include "trackdecoder.h"
+#include "waveformjob.h"
+
+#include "model/sqldatabase.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QSqlQuery>
+
+#include <QtDebug>
+
+const int WaveformCache::decimations[] = { 256, 4096 };
+
+namespace {
+
+const quint32 magic = 0x4d574156; // MWAV
+const quint16 version = 2;
+
+inline char quantize(float value)
+{
+	return static_cast<char>(qBound(-127, qRound(value * 127.0f), 127));
+}
+
+}
+
+WaveformCache::WaveformCache(SqlDatabase *db)
+	: _db(db)
+{
+	// Next to the database file
+	_directory = QFileInfo(db->databaseName()).absolutePath() + "/waveforms";
+	QDir().mkpath(_directory);
+}
+
+/** Decodes a track, and reduces it to peaks. Returns a null waveform if the track can't be decoded, or if the job is canceled. */
+WaveformCache::Waveform WaveformCache::compute(const QString &uri, const BackgroundJob *job)
+{
+	Waveform waveform;
+	waveform.sampleRate = 0;
+	waveform.frames = 0;
+
+	TrackDecoder decoder(uri);
+	decoder.setSampleFormat(QtAV::AudioFormat::SampleFormat_Float);
+	if (!decoder.open()) {
+		return waveform;
+	}
+
+	// Finest level, while decoding
+	Level fine;
+	fine.decimation = decimations[0];
+	float minimum = 1.0f;
+	float maximum = -1.0f;
+	int count = 0;
+	while (!decoder.atEnd()) {
+		if (job && job->isCanceled()) {
+			return waveform;
+		}
+		const QByteArray frame = decoder.decode();
+		if (frame.isEmpty()) {
+			continue;
+		}
+		const int channels = decoder.outputFormat().channels();
+		const float *samples = reinterpret_cast<const float*>(frame.constData());
+		const int frames = frame.size() / decoder.outputFormat().bytesPerFrame();
+		for (int i = 0; i < frames; i++) {
+			for (int c = 0; c < channels; c++) {
+				const float sample = samples[i * channels + c];
+				minimum = qMin(minimum, sample);
+				maximum = qMax(maximum, sample);
+			}
+			if (++count == fine.decimation) {
+				fine.peaks.append(quantize(minimum));
+				fine.peaks.append(quantize(maximum));
+				minimum = 1.0f;
+				maximum = -1.0f;
+				count = 0;
+			}
+		}
+		waveform.frames += frames;
+		waveform.sampleRate = decoder.outputFormat().sampleRate();
+	}
+	if (count > 0) {
+		fine.peaks.append(quantize(minimum));
+		fine.peaks.append(quantize(maximum));
+	}
+	if (fine.peaks.isEmpty()) {
+		return waveform;
+	}
+	waveform.levels.append(fine);
+
+	// Coarser levels are reduced from the finest one
+	for (int i = 1; i < int(sizeof(decimations) / sizeof(int)); i++) {
+		Level coarse;
+		coarse.decimation = decimations[i];
+		const int ratio = coarse.decimation / fine.decimation;
+		for (int j = 0; j < fine.count(); j += ratio) {
+			qint8 low = 127;
+			qint8 high = -127;
+			for (int k = j; k < qMin(j + ratio, fine.count()); k++) {
+				low = qMin(low, static_cast<qint8>(fine.peaks.at(2 * k)));
+				high = qMax(high, static_cast<qint8>(fine.peaks.at(2 * k + 1)));
+			}
+			coarse.peaks.append(static_cast<char>(low));
+			coarse.peaks.append(static_cast<char>(high));
+		}
+		waveform.levels.append(coarse);
+	}
+	return waveform;
+}
+
+/** Computes missing waveforms of the whole library in background, unless they're being computed already. */
+void WaveformCache::generateInBackground()
+{
+	QMetaObject::invokeMethod(WaveformJob::instance(), "start", Qt::QueuedConnection);
+}
+
+/** Coarsest level which has at least one pair for each pixel, or the finest one. */
+const WaveformCache::Level *WaveformCache::levelForWidth(const Waveform &waveform, int width)
+{
+	for (int i = waveform.levels.size() - 1; i >= 0; i--) {
+		if (waveform.levels.at(i).count() >= width) {
+			return &waveform.levels.at(i);
+		}
+	}
+	return waveform.levels.isEmpty() ? nullptr : &waveform.levels.first();
+}
+
+/** Reads the waveform of a track from its file, or computes it if the file is missing or outdated. */
+WaveformCache::Waveform WaveformCache::waveform(uint trackId)
+{
+	Waveform waveform;
+	waveform.sampleRate = 0;
+	waveform.frames = 0;
+
+	QSqlQuery selectUri(*_db);
+	selectUri.prepare("SELECT uri FROM cache WHERE rowid = ?");
+	selectUri.addBindValue(trackId);
+	if (!selectUri.exec() || !selectUri.next()) {
+		return waveform;
+	}
+	const QString uri = selectUri.value(0).toString();
+	if (!this->read(uri, &waveform)) {
+		waveform = WaveformCache::compute(uri);
+		if (!waveform.isNull()) {
+			this->write(uri, waveform);
+		}
+	}
+	return waveform;
+}
+
+/** Computes the waveform of a track only if it's missing or outdated. */
+void WaveformCache::generate(const QString &uri, const BackgroundJob *job)
+{
+	Waveform waveform;
+	if (!this->read(uri, &waveform)) {
+		waveform = WaveformCache::compute(uri, job);
+		if (!waveform.isNull()) {
+			this->write(uri, waveform);
+		}
+	}
+}
+
+/** Removes files of tracks which aren't in a list of URIs. */
+void WaveformCache::removeStaleFiles(const QStringList &uris) const
+{
+	QSet<QString> fileNames;
+	for (const QString &uri : uris) {
+		fileNames.insert(WaveformCache::fileName(uri));
+	}
+	QDir directory(_directory);
+	for (const QString &fileName : directory.entryList({ "*.peaks" }, QDir::Files)) {
+		if (!fileNames.contains(fileName)) {
+			directory.remove(fileName);
+		}
+	}
+}
+
+QString WaveformCache::fileName(const QString &uri)
+{
+	return QCryptographicHash::hash(uri.toUtf8(), QCryptographicHash::Md5).toHex() + ".peaks";
+}
+
+bool WaveformCache::read(const QString &uri, Waveform *waveform) const
+{
+	QFile file(_directory + '/' + WaveformCache::fileName(uri));
+	if (!file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	QDataStream stream(&file);
+	quint32 fileMagic, uriHash;
+	quint16 fileVersion, levelCount;
+	qint64 lastModified;
+	stream >> fileMagic >> fileVersion >> uriHash >> lastModified;
+	if (fileMagic != magic || fileVersion != version || uriHash != qHash(uri) ||
+			lastModified != QFileInfo(uri).lastModified().toMSecsSinceEpoch()) {
+		return false;
+	}
+	qint32 sampleRate;
+	stream >> sampleRate >> waveform->frames >> levelCount;
+	waveform->sampleRate = sampleRate;
+	waveform->levels.clear();
+	for (int i = 0; i < levelCount; i++) {
+		qint32 decimation;
+		Level level;
+		stream >> decimation >> level.peaks;
+		level.decimation = decimation;
+		waveform->levels.append(level);
+	}
+	return stream.status() == QDataStream::Ok && !waveform->isNull();
+}
+
+bool WaveformCache::write(const QString &uri, const Waveform &waveform) const
+{
+	QSaveFile file(_directory + '/' + WaveformCache::fileName(uri));
+	if (!file.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	QDataStream stream(&file);
+	stream << magic << version << quint32(qHash(uri)) << QFileInfo(uri).lastModified().toMSecsSinceEpoch();
+	stream << qint32(waveform.sampleRate) << waveform.frames << quint16(waveform.levels.size());
+	for (const Level &level : waveform.levels) {
+		stream << qint32(level.decimation) << level.peaks;
+	}
+	return file.commit();
+}
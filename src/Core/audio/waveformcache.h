@@ -0,0 +1,82 @@
+#ifndef WAVEFORMCACHE_H
+#define WAVEFORMCACHE_H
+
+#include <QList>
+#include <QStringList>
+
+#include "miamcore_global.h"
+
+/// Forward declarations
+class BackgroundJob;
+class SqlDatabase;
+
+/**
+ * \brief		The WaveformCache class stores summaries of tracks, to draw their waveform without decoding them.
+ * \details		A track is decoded once, and reduced to a pyramid of minimum and maximum peaks of all channels, on 8 bits: one pair
+ *				every 256 samples, and one pair every 4096 samples. Summaries are stored next to the database, in one binary file for
+ *				each track named after a hash of its URI, so they survive a rescan of the library which gives new ids to tracks. Files
+ *				also have the modification time of the track, so a summary is computed again when the track has changed.
+ *				Files of tracks which aren't in the library anymore are removed when waveforms of the whole library are generated,
+ *				by WaveformJob.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY WaveformCache
+{
+public:
+	/** Pairs of minimum and maximum, from -127 to 127, for each group of samples. */
+	struct Level
+	{
+		int decimation;
+		QByteArray peaks;
+
+		inline int count() const { return peaks.size() / 2; }
+	};
+
+	struct Waveform
+	{
+		int sampleRate;
+		qint64 frames;
+		/** From the finest to the coarsest. */
+		QList<Level> levels;
+
+		inline bool isNull() const { return levels.isEmpty(); }
+	};
+
+	static const int decimations[];
+
+private:
+	SqlDatabase *_db;
+
+	QString _directory;
+
+public:
+	explicit WaveformCache(SqlDatabase *db);
+
+	/** Decodes a track, and reduces it to peaks. Returns a null waveform if the track can't be decoded, or if the job is canceled. */
+	static Waveform compute(const QString &uri, const BackgroundJob *job = nullptr);
+
+	/** Computes missing waveforms of the whole library in background, unless they're being computed already. */
+	static void generateInBackground();
+
+	/** Coarsest level which has at least one pair for each pixel, or the finest one. */
+	static const Level *levelForWidth(const Waveform &waveform, int width);
+
+	/** Reads the waveform of a track from its file, or computes it if the file is missing or outdated. */
+	Waveform waveform(uint trackId);
+
+	/** Computes the waveform of a track only if it's missing or outdated. */
+	void generate(const QString &uri, const BackgroundJob *job = nullptr);
+
+	/** Removes files of tracks which aren't in a list of URIs. */
+	void removeStaleFiles(const QStringList &uris) const;
+
+private:
+	static QString fileName(const QString &uri);
+
+	bool read(const QString &uri, Waveform *waveform) const;
+
+	bool write(const QString &uri, const Waveform &waveform) const;
+};
+
+#endif // WAVEFORMCACHE_H
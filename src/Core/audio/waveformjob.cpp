@@ -0,0 +1,97 @@
+#include "waveformjob.h"
+#include "waveformcache.h"
+
+#include "model/sqldatabase.h"
+
+#include <QCoreApplication>
+#include <QRunnable>
+#include <QSqlQuery>
+
+namespace {
+
+/** Decodes one track, if its waveform is missing or outdated. */
+class WaveformTask : public QRunnable
+{
+private:
+	WaveformJob *_job;
+	WaveformCache *_waveformCache;
+	QString _uri;
+
+public:
+	WaveformTask(WaveformJob *job, WaveformCache *waveformCache, const QString &uri)
+		: QRunnable()
+		, _job(job)
+		, _waveformCache(waveformCache)
+		, _uri(uri)
+	{}
+
+	virtual void run() override
+	{
+		if (!_job->isCanceled()) {
+			_waveformCache->generate(_uri, _job);
+		}
+		_job->taskHasFinished();
+	}
+};
+
+}
+
+WaveformJob::WaveformJob(QObject *parent)
+	: BackgroundJob(parent)
+	, _waveformCache(nullptr)
+{
+	moveToThread(QCoreApplication::instance()->thread());
+
+	// Music is played meanwhile
+	this->setThreadCount(1);
+}
+
+WaveformJob::~WaveformJob()
+{
+	this->cancel();
+	delete _waveformCache;
+}
+
+/** Can be called from any thread. It's canceled and destroyed with the application. */
+WaveformJob* WaveformJob::instance()
+{
+	static WaveformJob *job = [] () {
+		qAddPostRoutine([] () { delete WaveformJob::instance(); });
+		return new WaveformJob;
+	}();
+	return job;
+}
+
+/** Tasks have written their files already. */
+void WaveformJob::flushResults()
+{}
+
+void WaveformJob::start()
+{
+	if (this->isRunning()) {
+		return;
+	}
+	SqlDatabase *db = this->database();
+	if (_waveformCache == nullptr) {
+		_waveformCache = new WaveformCache(db);
+	}
+
+	// Decoding the library takes hours: the query is consumed first, so it doesn't keep a lock on the database
+	QSqlQuery selectTracks(*db);
+	selectTracks.setForwardOnly(true);
+	if (!selectTracks.exec("SELECT uri FROM cache WHERE host IS NULL OR host = ''")) {
+		return;
+	}
+	QStringList uris;
+	while (selectTracks.next()) {
+		uris.append(selectTracks.value(0).toString());
+	}
+	selectTracks.finish();
+	_waveformCache->removeStaleFiles(uris);
+
+	QList<QRunnable*> tasks;
+	for (const QString &uri : uris) {
+		tasks.append(new WaveformTask(this, _waveformCache, uri));
+	}
+	this->startTasks(tasks);
+}
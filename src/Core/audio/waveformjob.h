@@ -0,0 +1,42 @@
+#ifndef WAVEFORMJOB_H
+#define WAVEFORMJOB_H
+
+#include "backgroundjob.h"
+
+/// Forward declarations
+class WaveformCache;
+
+/**
+ * \brief		The WaveformJob class computes missing waveforms of the whole library after each scan.
+ * \details		Each track is decoded by a task of the pool of the job, one at a time, so the job doesn't slow down playback.
+ *				Tasks write files of the cache themselves, so the job only reports progress. URIs are read before the first
+ *				track is decoded, and the database isn't locked meanwhile.
+ *				There is only one job, which lives in the main thread: a scan which ends while it's running doesn't start another one,
+ *				and it's canceled when the application quits, even in the middle of a track.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY WaveformJob : public BackgroundJob
+{
+	Q_OBJECT
+private:
+	/** Shared by tasks, which only read and write files. */
+	WaveformCache *_waveformCache;
+
+	explicit WaveformJob(QObject *parent = nullptr);
+
+public:
+	virtual ~WaveformJob();
+
+	/** Can be called from any thread. It's canceled and destroyed with the application. */
+	static WaveformJob* instance();
+
+protected:
+	/** Tasks have written their files already. */
+	virtual void flushResults() override;
+
+public slots:
+	void start();
+};
+
+#endif // WAVEFORMJOB_H
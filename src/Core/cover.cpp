@@ -3,20 +3,19 @@
 #include <QtDebug>
 
 #include <QBuffer>
-#include <QImage>
+#include <QFile>
 #include <QImageReader>
-#include <QHash>
 
 Cover::Cover(const QByteArray &byteArray, const QString &mimeType)
-	: _hasChanged(false)
+	: _mimeType(mimeType)
+	, _data(byteArray)
+	, _hasChanged(false)
 {
-	_data = byteArray;
-	_mimeType = mimeType;
 	if (mimeType == "image/jpeg") {
 		_format = "JPG";
 	} else if (mimeType == "image/png") {
 		_format = "PNG";
-	} else {
+	} else if (!this->sniffFormat()) {
 		// default format is assumed to be jpg
 		_format = "JPG";
 	}
@@ -24,26 +23,62 @@ Cover::Cover(const QByteArray &byteArray, const QString &mimeType)
 
 /** Constructor used when loading pictures directly from the filesystem (drag & drop or with the context menu). */
 Cover::Cover(const QString &fileName)
+	: _hasChanged(false)
+{
+	if (fileName.isEmpty()) {
+		return;
+	}
+	// Original bytes are kept as is, instead of decoding the picture then encoding it again
+	QFile file(fileName);
+	if (file.open(QIODevice::ReadOnly)) {
+		_data = file.readAll();
+		file.close();
+	}
+	if (this->sniffFormat()) {
+		_hasChanged = true;
+	} else {
+		_data.clear();
+	}
+}
+
+/** Decodes pixels, and scales the picture while decoding if it's larger than this size. */
+QImage Cover::image(const QSize &size) const
 {
-	if (!fileName.isEmpty()) {
-		// QImage is faster than QPixmap for I/O ops
-		QImage image(fileName);
-		if (!image.isNull()) {
-			QString format = QImageReader::imageFormat(fileName);
-			QBuffer buffer(&_data);
-			if (buffer.open(QIODevice::WriteOnly)) {
-				if (image.save(&buffer, format.toStdString().data())) {
-					if (format == "jpeg") {
-						_format = "JPG";
-						_mimeType = "image/jpeg";
-					} else if (format == "png") {
-						_format = "PNG";
-						_mimeType = "image/png";
-					}
-					_hasChanged = true;
-				}
-				buffer.close();
-			}
-		}
+	QBuffer buffer;
+	buffer.setData(_data);
+	if (!buffer.open(QIODevice::ReadOnly)) {
+		return QImage();
+	}
+	QImageReader reader(&buffer);
+	QSize imageSize = reader.size();
+	if (imageSize.isValid() && size.isValid() && !size.isEmpty() &&
+			(imageSize.width() > size.width() || imageSize.height() > size.height())) {
+		// Decoders like JPEG can scale while decoding, which is much faster than scaling afterwards
+		reader.setScaledSize(imageSize.scaled(size, Qt::KeepAspectRatio));
+	}
+	return reader.read();
+}
+
+/** Detects the format from magic bytes at the beginning of the picture. Returns false if it's not a known format. */
+bool Cover::sniffFormat()
+{
+	if (_data.startsWith("\xFF\xD8\xFF")) {
+		_format = "JPG";
+		_mimeType = "image/jpeg";
+	} else if (_data.startsWith("\x89PNG\r\n\x1A\n")) {
+		_format = "PNG";
+		_mimeType = "image/png";
+	} else if (_data.startsWith("GIF87a") || _data.startsWith("GIF89a")) {
+		_format = "GIF";
+		_mimeType = "image/gif";
+	} else if (_data.startsWith("BM")) {
+		_format = "BMP";
+		_mimeType = "image/bmp";
+	} else if (_data.startsWith("RIFF") && _data.mid(8, 4) == "WEBP") {
+		_format = "WEBP";
+		_mimeType = "image/webp";
+	} else {
+		return false;
 	}
+	return true;
 }
@@ -1,13 +1,17 @@
 #ifndef COVER_H
 #define COVER_H
 
+#include <QByteArray>
+#include <QImage>
 #include <QString>
 #include <QUrl>
 
 #include "miamcore_global.h"
 
 /**
- * \brief		The Cover class
+ * \brief		The Cover class holds the original bytes of a picture, like an embedded cover or a picture next to tracks.
+ * \details		Bytes are never decoded nor encoded again to build a cover: the format is detected from the first bytes of the
+ *				picture, and pixels are decoded only when one asks for an image. Bytes are implicitly shared, so a cover is cheap to copy.
  * \author      Matthieu Bachelier
  * \copyright   GNU General Public License v3
  */
@@ -18,7 +22,7 @@ private:
 	QString _mimeType;
 
 	/** Like "JPG" (for QClasses). */
-	QString _format;
+	QByteArray _format;
 
 	QByteArray _data;
 
@@ -32,13 +36,20 @@ public:
 
 	inline std::string mimeType() const { return _mimeType.toStdString(); }
 
-	inline const QByteArray byteArray() const { return _data; }
+	inline const QByteArray& byteArray() const { return _data; }
 
-	inline const char* format() { return _format.toStdString().data(); }
+	inline const char* format() const { return _format.constData(); }
+
+	/** Decodes pixels, and scales the picture while decoding if it's larger than this size. */
+	QImage image(const QSize &size = QSize()) const;
 
 	inline bool hasChanged() const { return _hasChanged && !_data.isEmpty(); }
 
 	inline void setChanged(bool changed) { this->_hasChanged = changed; }
+
+private:
+	/** Detects the format from magic bytes at the beginning of the picture. Returns false if it's not a known format. */
+	bool sniffFormat();
 };
 
 #endif // COVER_H
@@ -0,0 +1,239 @@
+#include "coverprobe.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+
+namespace {
+
+/** Sizes in ID3v2 headers are stored on 4 bytes of 7 bits. */
+qint64 syncSafe(const QByteArray &b, int i)
+{
+	return (qint64(uchar(b.at(i)) & 0x7f) << 21) | (qint64(uchar(b.at(i + 1)) & 0x7f) << 14) |
+			(qint64(uchar(b.at(i + 2)) & 0x7f) << 7) | qint64(uchar(b.at(i + 3)) & 0x7f);
+}
+
+qint64 bigEndian(const QByteArray &b, int i, int bytes = 4)
+{
+	qint64 value = 0;
+	for (int j = 0; j < bytes; j++) {
+		value = (value << 8) | uchar(b.at(i + j));
+	}
+	return value;
+}
+
+}
+
+CoverProbe::CoverProbe(const QString &filePath)
+	: _filePath(filePath)
+	, _isValid(false)
+	, _offset(-1)
+	, _size(0)
+{
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly)) {
+		return;
+	}
+	const QString suffix = QFileInfo(filePath).suffix().toLower();
+	if (suffix == "mp3") {
+		// A file without ID3v2 tag has no picture
+		_isValid = !file.peek(3).startsWith("ID3") || this->probeID3v2(file);
+	} else if (suffix == "flac") {
+		// An ID3v2 tag can be in front of metadata blocks, but pictures are read from blocks only
+		QByteArray header = file.peek(10);
+		if (header.startsWith("ID3") && header.size() == 10) {
+			qint64 tagSize = 10 + syncSafe(header, 6);
+			if (uchar(header.at(5)) & 0x10) {
+				// Footer
+				tagSize += 10;
+			}
+			file.seek(tagSize);
+		}
+		_isValid = this->probeFlac(file);
+	}
+	if (!_isValid) {
+		_offset = -1;
+		_size = 0;
+		_mimeType.clear();
+	}
+}
+
+/** Hash of the picture, computed by streaming its bytes from the file. Empty if there is no picture. */
+QString CoverProbe::hash() const
+{
+	if (!this->hasCover()) {
+		return QString();
+	}
+	QFile file(_filePath);
+	if (!file.open(QIODevice::ReadOnly) || !file.seek(_offset)) {
+		return QString();
+	}
+	QCryptographicHash hash(QCryptographicHash::Md5);
+	qint64 remaining = _size;
+	while (remaining > 0) {
+		QByteArray chunk = file.read(qMin<qint64>(remaining, 64 * 1024));
+		if (chunk.isEmpty()) {
+			return QString();
+		}
+		hash.addData(chunk);
+		remaining -= chunk.size();
+	}
+	return hash.result().toHex();
+}
+
+/** Reads only the bytes of the picture. */
+QByteArray CoverProbe::readPicture() const
+{
+	QByteArray picture;
+	if (this->hasCover()) {
+		QFile file(_filePath);
+		if (file.open(QIODevice::ReadOnly) && file.seek(_offset)) {
+			picture = file.read(_size);
+		}
+	}
+	return picture;
+}
+
+bool CoverProbe::probeFlac(QFile &file)
+{
+	if (file.read(4) != "fLaC") {
+		return false;
+	}
+	bool isLastBlock = false;
+	while (!isLastBlock) {
+		QByteArray blockHeader = file.read(4);
+		if (blockHeader.size() < 4) {
+			return false;
+		}
+		isLastBlock = uchar(blockHeader.at(0)) & 0x80;
+		int type = uchar(blockHeader.at(0)) & 0x7f;
+		qint64 length = bigEndian(blockHeader, 1, 3);
+		qint64 body = file.pos();
+
+		// Only the first front cover, like FileHelper::extractCover
+		if (type == 6 && _size == 0) {
+			QByteArray fields = file.read(8);
+			if (fields.size() < 8) {
+				return false;
+			}
+			qint64 pictureType = bigEndian(fields, 0);
+			qint64 mimeLength = bigEndian(fields, 4);
+			if (mimeLength > length) {
+				return false;
+			}
+			QByteArray mimeType = file.read(mimeLength);
+			QByteArray descriptionLength = file.read(4);
+			if (descriptionLength.size() < 4) {
+				return false;
+			}
+			// Skip description, width, height, depth and number of colors
+			file.seek(file.pos() + bigEndian(descriptionLength, 0) + 16);
+			QByteArray dataLength = file.read(4);
+			if (dataLength.size() < 4) {
+				return false;
+			}
+			if (pictureType == 3) {
+				_offset = file.pos();
+				_size = bigEndian(dataLength, 0);
+				_mimeType = QString::fromLatin1(mimeType);
+				if (_offset + _size > body + length) {
+					return false;
+				}
+			}
+		}
+		if (!file.seek(body + length)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CoverProbe::probeID3v2(QFile &file)
+{
+	QByteArray header = file.read(10);
+	if (header.size() < 10) {
+		return false;
+	}
+	int majorVersion = uchar(header.at(3));
+	int flags = uchar(header.at(5));
+	// ID3v2.2 has another layout, and unsynchronised tags have bytes inserted in pictures
+	if (majorVersion < 3 || majorVersion > 4 || (flags & 0x80)) {
+		return false;
+	}
+	const qint64 tagEnd = 10 + syncSafe(header, 6);
+	qint64 pos = 10;
+	if (flags & 0x40) {
+		QByteArray extendedHeader = file.read(4);
+		if (extendedHeader.size() < 4) {
+			return false;
+		}
+		// Size of the extended header includes itself in ID3v2.4 only
+		pos += majorVersion == 4 ? syncSafe(extendedHeader, 0) : bigEndian(extendedHeader, 0) + 4;
+	}
+
+	while (pos + 10 <= tagEnd) {
+		if (!file.seek(pos)) {
+			return false;
+		}
+		QByteArray frameHeader = file.read(10);
+		if (frameHeader.size() < 10) {
+			return false;
+		}
+		// Padding
+		if (frameHeader.at(0) == 0) {
+			break;
+		}
+		qint64 frameSize = majorVersion == 4 ? syncSafe(frameHeader, 4) : bigEndian(frameHeader, 4);
+		qint64 body = pos + 10;
+		if (frameSize <= 0 || body + frameSize > tagEnd) {
+			return false;
+		}
+
+		if (frameHeader.startsWith("APIC")) {
+			int formatFlags = uchar(frameHeader.at(9));
+			qint64 dataStart = body;
+			if (majorVersion == 4) {
+				// Compressed, encrypted or unsynchronised
+				if (formatFlags & 0x0e) {
+					return false;
+				}
+				// Group identifier, then data length indicator
+				dataStart += ((formatFlags & 0x40) ? 1 : 0) + ((formatFlags & 0x01) ? 4 : 0);
+			} else {
+				if (formatFlags & 0xc0) {
+					return false;
+				}
+				dataStart += (formatFlags & 0x20) ? 1 : 0;
+			}
+
+			// Text fields are short, the picture itself is not read
+			file.seek(dataStart);
+			QByteArray fields = file.read(qMin<qint64>(body + frameSize - dataStart, 1024));
+			int encoding = fields.isEmpty() ? -1 : uchar(fields.at(0));
+			int mimeEnd = fields.indexOf('\0', 1);
+			if (mimeEnd == -1 || mimeEnd + 2 > fields.size()) {
+				return false;
+			}
+			// After the mime type, a byte for the type of picture, then the description
+			int i = mimeEnd + 2;
+			if (encoding == 1 || encoding == 2) {
+				// UTF-16 descriptions end with 2 null bytes
+				while (i + 1 < fields.size() && (fields.at(i) != 0 || fields.at(i + 1) != 0)) {
+					i += 2;
+				}
+				i += 2;
+			} else {
+				i = fields.indexOf('\0', i) + 1;
+			}
+			if (i <= 0 || i > fields.size()) {
+				return false;
+			}
+			// The last picture, like FileHelper::extractCover
+			_mimeType = QString::fromLatin1(fields.mid(1, mimeEnd - 1));
+			_offset = dataStart + i;
+			_size = body + frameSize - _offset;
+		}
+		pos = body + frameSize;
+	}
+	return true;
+}
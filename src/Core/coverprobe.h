@@ -0,0 +1,59 @@
+#ifndef COVERPROBE_H
+#define COVERPROBE_H
+
+#include <QString>
+
+#include "miamcore_global.h"
+
+/// Forward declaration
+class QFile;
+
+/**
+ * \brief		The CoverProbe class finds where an embedded picture is stored in a file, without reading the picture itself.
+ * \details		Only headers of ID3v2 frames (MP3) and metadata blocks (FLAC) are read, and picture bytes are skipped with a seek.
+ *				The probe records the offset, the size and the mime type of the picture, which can then be hashed or read directly.
+ *				If the layout is not supported (ID3v2.2, unsynchronisation, compressed frames, other formats), the probe is not valid
+ *				and one has to use FileHelper instead.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY CoverProbe
+{
+private:
+	QString _filePath;
+
+	bool _isValid;
+
+	qint64 _offset;
+
+	qint64 _size;
+
+	QString _mimeType;
+
+public:
+	explicit CoverProbe(const QString &filePath);
+
+	inline bool hasCover() const { return _isValid && _size > 0; }
+
+	/** True if the layout of the file is supported, then hasCover() is reliable. */
+	inline bool isValid() const { return _isValid; }
+
+	inline QString mimeType() const { return _mimeType; }
+
+	inline qint64 offset() const { return _offset; }
+
+	inline qint64 size() const { return _size; }
+
+	/** Hash of the picture, computed by streaming its bytes from the file. Empty if there is no picture. */
+	QString hash() const;
+
+	/** Reads only the bytes of the picture. */
+	QByteArray readPicture() const;
+
+private:
+	bool probeFlac(QFile &file);
+
+	bool probeID3v2(QFile &file);
+};
+
+#endif // COVERPROBE_H
@@ -1,9 +1,11 @@
 #include "filehelper.h"
 #include "cover.h"
+#include "coverprobe.h"
 
 #include <algorithm>
 #include <map>
 
+#include <QCryptographicHash>
 #include <QDateTime>
 #include <QDir>
 #include <QFileInfo>
@@ -24,10 +26,12 @@
 
 #include <taglib/id3v2tag.h>
 #include <taglib/id3v2frame.h>
+#include <taglib/id3v2framefactory.h>
 
 #include <taglib/attachedpictureframe.h>
 #include <taglib/popularimeterframe.h>
 #include <taglib/tag.h>
+#include <taglib/tfilestream.h>
 #include <taglib/tlist.h>
 #include <taglib/textidentificationframe.h>
 #include <taglib/tstring.h>
@@ -39,10 +43,55 @@
 
 #include <QtDebug>
 
+namespace {
+
+/** Reads a file for TagLib, except bytes of one picture which are replaced with zeros without being read. */
+class PictureSkippingStream : public TagLib::FileStream
+{
+private:
+	long _pictureStart;
+
+	long _pictureEnd;
+
+public:
+	PictureSkippingStream(TagLib::FileName fileName, qint64 pictureOffset, qint64 pictureSize)
+		: TagLib::FileStream(fileName, true)
+		, _pictureStart(long(pictureOffset))
+		, _pictureEnd(long(pictureOffset + pictureSize))
+	{}
+
+	virtual TagLib::ByteVector readBlock(TagLib::ulong length) override
+	{
+		const long start = this->tell();
+		const long end = start + long(length);
+		if (end <= _pictureStart || start >= _pictureEnd) {
+			return TagLib::FileStream::readBlock(length);
+		}
+
+		// TagLib parses tags with an empty picture, which is never used
+		TagLib::ByteVector block;
+		if (start < _pictureStart) {
+			block.append(TagLib::FileStream::readBlock(_pictureStart - start));
+		}
+		const long skippedEnd = qMin(end, _pictureEnd);
+		block.resize(block.size() + (skippedEnd - qMax(start, _pictureStart)), 0);
+		this->seek(skippedEnd);
+		if (end > skippedEnd) {
+			block.append(TagLib::FileStream::readBlock(end - skippedEnd));
+		}
+		return block;
+	}
+};
+
+}
+
 FileHelper::FileHelper(const QMediaContent &track)
 	: _file(nullptr)
+	, _stream(nullptr)
 	, _fileType(EXT_UNKNOWN)
 	, _isValid(false)
+	, _skippedPictureOffset(-1)
+	, _skippedPictureSize(0)
 {
 	bool b = init(QDir::fromNativeSeparators(track.canonicalUrl().toLocalFile()));
 	if (!b) {
@@ -59,8 +108,11 @@ FileHelper::FileHelper(const QMediaContent &track)
 
 FileHelper::FileHelper(const QString &filePath)
 	: _file(nullptr)
+	, _stream(nullptr)
 	, _fileType(EXT_UNKNOWN)
 	, _isValid(false)
+	, _skippedPictureOffset(-1)
+	, _skippedPictureSize(0)
 {
 	bool b = init(filePath);
 	if (!b) {
@@ -73,6 +125,22 @@ FileHelper::FileHelper(const QString &filePath)
 	}
 }
 
+/** Reads tags for scans: bytes of the picture which was found by the probe are not read, and the file can't be saved. */
+FileHelper::FileHelper(const QString &filePath, const CoverProbe &probe)
+	: _file(nullptr)
+	, _stream(nullptr)
+	, _fileType(EXT_UNKNOWN)
+	, _isValid(false)
+	, _skippedPictureOffset(probe.hasCover() ? probe.offset() : -1)
+	, _skippedPictureSize(probe.hasCover() ? probe.size() : 0)
+{
+	if (!init(filePath)) {
+		delete _file;
+		_file = nullptr;
+		_fileType = EXT_UNKNOWN;
+	}
+}
+
 std::string FileHelper::keyToStdString(Field f)
 {
 	switch (f) {
@@ -115,6 +183,10 @@ bool FileHelper::init(const QString &filePath)
 	TagLib::String s(QDir::toNativeSeparators(fileName).toUtf8().constData(), TagLib::String::UTF8);
 	TagLib::FileName fp(s.toCString(true));
 #endif
+	// Only MP3 and FLAC files are probed
+	if (_skippedPictureSize > 0 && (suffix == "mp3" || suffix == "flac")) {
+		_stream = new PictureSkippingStream(fp, _skippedPictureOffset, _skippedPictureSize);
+	}
 	if (suffix == "ape") {
 		_file = new TagLib::APE::File(fp);
 		_fileType = EXT_APE;
@@ -122,7 +194,7 @@ bool FileHelper::init(const QString &filePath)
 		_file = new TagLib::ASF::File(fp);
 		_fileType = EXT_ASF;
 	} else if (suffix == "flac") {
-		_file = new TagLib::FLAC::File(fp);
+		_file = _stream ? new TagLib::FLAC::File(_stream, TagLib::ID3v2::FrameFactory::instance()) : new TagLib::FLAC::File(fp);
 		_fileType = EXT_FLAC;
 	} else if (suffix == "m4a" || suffix == "mp4") {
 		_file = new TagLib::MP4::File(fp);
@@ -131,7 +203,7 @@ bool FileHelper::init(const QString &filePath)
 		_file = new TagLib::MPC::File(fp);
 		_fileType = EXT_MPC;
 	} else if (suffix == "mp3") {
-		_file = new TagLib::MPEG::File(fp);
+		_file = _stream ? new TagLib::MPEG::File(_stream, TagLib::ID3v2::FrameFactory::instance()) : new TagLib::MPEG::File(fp);
 		_fileType = EXT_MP3;
 	} else if (suffix == "ogg" || suffix == "oga") {
 		_file = new TagLib::Vorbis::File(fp);
@@ -160,6 +232,7 @@ FileHelper::~FileHelper()
 		delete _file;
 		_file = nullptr;
 	}
+	delete _stream;
 }
 
 const QStringList FileHelper::suffixes(ExtensionType et, bool withPrefix)
@@ -315,6 +388,12 @@ int FileHelper::discNumber(bool canBeZero) const
 
 Cover* FileHelper::extractCover()
 {
+	// The picture which was skipped is read from its location
+	if (_skippedPictureSize > 0) {
+		CoverProbe probe(_fileInfo.absoluteFilePath());
+		return probe.hasCover() ? new Cover(probe.readPicture(), probe.mimeType()) : nullptr;
+	}
+
 	Cover *cover = nullptr;
 	switch (_fileType) {
 	case EXT_MP3: {
@@ -403,6 +482,10 @@ bool FileHelper::insert(Field key, const QVariant &value)
 /** Check if file has an inner picture. */
 bool FileHelper::hasCover() const
 {
+	if (_skippedPictureSize > 0) {
+		return true;
+	}
+
 	bool atLeastOnePicture = false;
 	switch (_fileType) {
 	case EXT_MP3: {
@@ -432,6 +515,52 @@ bool FileHelper::hasCover() const
 	return atLeastOnePicture;
 }
 
+/** Hash of the inner picture, computed from bytes already read by TagLib. Empty if there is no picture. */
+QString FileHelper::coverHash() const
+{
+	if (_skippedPictureSize > 0) {
+		return CoverProbe(_fileInfo.absoluteFilePath()).hash();
+	}
+
+	// Byte vectors are shared with the tag, pictures are not copied
+	TagLib::ByteVector picture;
+	switch (_fileType) {
+	case EXT_MP3: {
+		TagLib::MPEG::File *mpegFile = static_cast<TagLib::MPEG::File*>(_file);
+		if (mpegFile && mpegFile->hasID3v2Tag()) {
+			// Same picture as extractCover: the last one
+			TagLib::ID3v2::FrameList listOfMp3Frames = mpegFile->ID3v2Tag()->frameListMap()["APIC"];
+			for (TagLib::ID3v2::FrameList::ConstIterator it = listOfMp3Frames.begin(); it != listOfMp3Frames.end() ; it++) {
+				if (TagLib::ID3v2::AttachedPictureFrame *pictureFrame = static_cast<TagLib::ID3v2::AttachedPictureFrame*>(*it)) {
+					picture = pictureFrame->picture();
+				}
+			}
+		}
+		break;
+	}
+	case EXT_FLAC: {
+		if (TagLib::FLAC::File *flacFile = static_cast<TagLib::FLAC::File*>(_file)) {
+			auto list = flacFile->pictureList();
+			for (auto it = list.begin(); it != list.end() ; it++) {
+				if ((*it)->type() == TagLib::FLAC::Picture::FrontCover) {
+					picture = (*it)->data();
+					break;
+				}
+			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	if (picture.isEmpty()) {
+		return QString();
+	}
+	// Non const data() would detach the vector from the tag
+	const TagLib::ByteVector &bytes = picture;
+	return QCryptographicHash::hash(QByteArray::fromRawData(bytes.data(), bytes.size()), QCryptographicHash::Md5).toHex();
+}
+
 /** Convert the existing rating number into a smaller range from 1 to 5. */
 int FileHelper::rating() const
 {
@@ -591,6 +720,53 @@ void FileHelper::setRating(int rating)
 	this->save();
 }
 
+/** Sets ReplayGain fields: gains in dB and linear peaks. Fields of the album are removed if gains are not a number. */
+void FileHelper::setReplayGain(double trackGain, double trackPeak, double albumGain, double albumPeak)
+{
+	QMap<QString, QString> fields;
+	fields.insert("REPLAYGAIN_TRACK_GAIN", QString::asprintf("%+.2f dB", trackGain));
+	fields.insert("REPLAYGAIN_TRACK_PEAK", QString::asprintf("%.6f", trackPeak));
+	if (qIsNaN(albumGain)) {
+		fields.insert("REPLAYGAIN_ALBUM_GAIN", QString());
+		fields.insert("REPLAYGAIN_ALBUM_PEAK", QString());
+	} else {
+		fields.insert("REPLAYGAIN_ALBUM_GAIN", QString::asprintf("%+.2f dB", albumGain));
+		fields.insert("REPLAYGAIN_ALBUM_PEAK", QString::asprintf("%.6f", albumPeak));
+	}
+
+	switch (_fileType) {
+	case EXT_MP4: {
+		// Freeform atoms, like iTunes and foobar2000
+		for (auto it = fields.cbegin(); it != fields.cend(); ++it) {
+			std::string atom = "----:com.apple.iTunes:" + it.key().toLower().toStdString();
+			if (it.value().isEmpty()) {
+				static_cast<TagLib::MP4::File*>(_file)->tag()->removeItem(atom);
+			} else {
+				this->setMp4Attribute(atom, TagLib::MP4::Item(TagLib::StringList(TagLib::String(it.value().toStdString()))));
+			}
+		}
+		break;
+	}
+	case EXT_UNKNOWN:
+		qDebug() << Q_FUNC_INFO << "Not implemented for this file type";
+		break;
+	default: {
+		// TXXX frames for ID3v2, fields for Xiph comments and items for APE tags
+		TagLib::PropertyMap properties = _file->properties();
+		for (auto it = fields.cbegin(); it != fields.cend(); ++it) {
+			TagLib::String key(it.key().toStdString());
+			if (it.value().isEmpty()) {
+				properties.erase(key);
+			} else {
+				properties.replace(key, TagLib::StringList(TagLib::String(it.value().toStdString())));
+			}
+		}
+		_file->setProperties(properties);
+		break;
+	}
+	}
+}
+
 bool FileHelper::isValid() const
 {
 	/*if (_file) {
@@ -8,12 +8,14 @@
 
 #include <QFileInfo>
 
-/// Forward declaration
+/// Forward declarations
 class Cover;
+class CoverProbe;
 
 /// Forward declaration
 namespace TagLib {
 	class File;
+	class IOStream;
 
 	namespace ID3v2 {
 		class Tag;
@@ -34,9 +36,17 @@ class MIAMCORE_LIBRARY FileHelper
 private:
 	TagLib::File *_file;
 
+	/** Stream of the file when bytes of its picture are skipped, owned by this helper. */
+	TagLib::IOStream *_stream;
+
 	int _fileType;
 	bool _isValid;
 
+	/** Location of the picture which isn't read, or -1. */
+	qint64 _skippedPictureOffset;
+
+	qint64 _skippedPictureSize;
+
 	QFileInfo _fileInfo;
 
 	Q_ENUMS(Extension)
@@ -84,6 +94,9 @@ public:
 
 	explicit FileHelper(const QString &filePath);
 
+	/** Reads tags for scans: bytes of the picture which was found by the probe are not read, and the file can't be saved. */
+	FileHelper(const QString &filePath, const CoverProbe &probe);
+
 	static std::string keyToStdString(Field f);
 
 private:
@@ -109,6 +122,9 @@ public:
 	/** Check if file has an inner picture. */
 	bool hasCover() const;
 
+	/** Hash of the inner picture, computed from bytes already read by TagLib. Empty if there is no picture. */
+	QString coverHash() const;
+
 	/** Convert the existing rating number into a smaller range from 1 to 5. */
 	int rating() const;
 
@@ -121,6 +137,9 @@ public:
 	/** Set or remove any rating. */
 	void setRating(int rating);
 
+	/** Sets ReplayGain fields: gains in dB and linear peaks. Fields of the album are removed if gains are not a number. */
+	void setReplayGain(double trackGain, double trackPeak, double albumGain, double albumPeak);
+
 	/// Facade
 	bool isValid() const;
 	QString title() const;
@@ -2,10 +2,16 @@
 
 #include <settingsprivate.h>
 
+#include <QTimer>
+
 #include <QtDebug>
 
-LibraryFilterProxyModel::LibraryFilterProxyModel(QObject *parent) :
-	MiamSortFilterProxyModel(parent)
+LibraryFilterProxyModel::LibraryFilterProxyModel(QObject *parent)
+	: MiamSortFilterProxyModel(parent)
+	, _matchingRole(Qt::DisplayRole)
+	, _isAcceptingAll(true)
+	, _isAcceptedItemsStale(false)
+	, _isUpdateScheduled(false)
 {}
 
 /** Redefined to override Qt::FontRole. */
@@ -19,43 +25,44 @@ QVariant LibraryFilterProxyModel::data(const QModelIndex &index, int role) const
 	}
 }
 
-bool LibraryFilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
+/** Redefined to invalidate accepted items when rows are inserted or removed. */
+void LibraryFilterProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
 {
-	if (filterAcceptsRowItself(sourceRow, sourceParent)) {
-		return true;
+	MiamSortFilterProxyModel::setSourceModel(sourceModel);
+	if (sourceModel) {
+		auto invalidate = [=]() {
+			_isAcceptedItemsStale = true;
+		};
+		connect(sourceModel, &QAbstractItemModel::rowsAboutToBeInserted, this, invalidate);
+		connect(sourceModel, &QAbstractItemModel::rowsAboutToBeRemoved, this, invalidate);
+		connect(sourceModel, &QAbstractItemModel::modelAboutToBeReset, this, invalidate);
+		connect(sourceModel, &QAbstractItemModel::rowsInserted, this, &LibraryFilterProxyModel::scheduleUpdate);
+		connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, &LibraryFilterProxyModel::scheduleUpdate);
+		connect(sourceModel, &QAbstractItemModel::modelReset, this, &LibraryFilterProxyModel::scheduleUpdate);
 	}
+}
 
-	// Accept if any of the parents is accepted on it's own merits
-	QModelIndex parent = sourceParent;
-	while (parent.isValid()) {
-		if (filterAcceptsRowItself(parent.row(), parent.parent())) {
-			return true;
-		}
-		parent = parent.parent();
+bool LibraryFilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
+{
+	if (SettingsPrivate::instance()->librarySnapshot().librarySearchMode == SettingsPrivate::LSM_HighlightOnly) {
+		return true;
 	}
 
-	// Accept if any of the children is accepted on it's own merits
-	if (hasAcceptedChildren(sourceRow, sourceParent)) {
+	// While rows are added to the tree, new ones are hidden until the whole tree is evaluated again
+	if (_isAcceptingAll) {
 		return true;
 	}
 
-	// Accept separators if any top level items and its children are accepted
-	QStandardItemModel *model = qobject_cast<QStandardItemModel*>(sourceModel());
-	QStandardItem *item = model->itemFromIndex(model->index(sourceRow, 0, sourceParent));
-	if (item && item->type() == Miam::IT_Separator) {
-		for (QModelIndex index : _topLevelItems.values(static_cast<SeparatorItem*>(item))) {
-			if (filterAcceptsRow(index.row(), sourceParent)) {
-				return true;
-			}
-		}
-	}
-	return (SettingsPrivate::instance()->librarySearchMode() == SettingsPrivate::LSM_HighlightOnly);
+	QStandardItemModel *model = static_cast<QStandardItemModel*>(sourceModel());
+	return _acceptedItems.contains(model->itemFromIndex(model->index(sourceRow, 0, sourceParent)));
 }
 
 /** Redefined for custom sorting. */
 bool LibraryFilterProxyModel::lessThan(const QModelIndex &idxLeft, const QModelIndex &idxRight) const
 {
 	bool result = false;
+	// This method is called O(n log n) times: settings must not be read from the file
+	const SettingsPrivate::InsertPolicy insertPolicy = SettingsPrivate::instance()->librarySnapshot().insertPolicy;
 	QStandardItemModel *model = qobject_cast<QStandardItemModel *>(this->sourceModel());
 	QStandardItem *left = model->itemFromIndex(idxLeft);
 	QStandardItem *right = model->itemFromIndex(idxRight);
@@ -71,7 +78,7 @@ bool LibraryFilterProxyModel::lessThan(const QModelIndex &idxLeft, const QModelI
 		if (rType == Miam::IT_Album) {
 			int lYear = left->data(Miam::DF_Year).toInt();
 			int rYear = right->data(Miam::DF_Year).toInt();
-			if (SettingsPrivate::instance()->insertPolicy() == SettingsPrivate::IP_Artists && lYear >= 0 && rYear >= 0) {
+			if (insertPolicy == SettingsPrivate::IP_Artists && lYear >= 0 && rYear >= 0) {
 				if (sortOrder() == Qt::AscendingOrder) {
 					if (lYear == rYear) {
 						result = MiamSortFilterProxyModel::lessThan(idxLeft, idxRight);
@@ -100,7 +107,7 @@ bool LibraryFilterProxyModel::lessThan(const QModelIndex &idxLeft, const QModelI
 
 	case Miam::IT_Separator:
 		// Separators have a different sorting order when Hierarchical Order starts with Years
-		if (SettingsPrivate::instance()->insertPolicy() == SettingsPrivate::IP_Years) {
+		if (insertPolicy == SettingsPrivate::IP_Years) {
 			if (sortOrder() == Qt::AscendingOrder) {
 				result = left->data(Miam::DF_NormalizedString).toInt() <= right->data(Miam::DF_NormalizedString).toInt();
 			} else {
@@ -166,32 +173,134 @@ bool LibraryFilterProxyModel::lessThan(const QModelIndex &idxLeft, const QModelI
 	return result;
 }
 
-bool LibraryFilterProxyModel::filterAcceptsRowItself(int sourceRow, const QModelIndex &sourceParent) const
+/** Redefined to evaluate the whole tree in a single pass. */
+void LibraryFilterProxyModel::updateAcceptedItems(int role, const QRegExp &regExp) const
+{
+	bool narrowing = this->isNarrowing(role, regExp);
+
+	_acceptedItems.clear();
+	_isAcceptedItemsStale = false;
+	_isAcceptingAll = regExp.isEmpty();
+	_matchingRole = role;
+	_matchingRegExp = regExp;
+
+	QStandardItemModel *model = qobject_cast<QStandardItemModel*>(sourceModel());
+	if (_isAcceptingAll || model == nullptr) {
+		_matchingItems.clear();
+		return;
+	}
+
+	if (narrowing) {
+		// Candidates are only items which were matching the previous filter
+		QSet<const QStandardItem*> candidates;
+		candidates.swap(_matchingItems);
+		for (const QStandardItem *item : candidates) {
+			if (item->data(role).toString().contains(regExp)) {
+				_matchingItems.insert(item);
+			}
+		}
+		for (const QStandardItem *item : _matchingItems) {
+			this->acceptMatchingItem(item);
+		}
+	} else {
+		// Separators don't have children: they are accepted on their own merits during the first pass
+		_matchingItems.clear();
+		QStandardItem *root = model->invisibleRootItem();
+		for (int i = 0; i < root->rowCount(); i++) {
+			if (QStandardItem *item = root->child(i, 0)) {
+				this->acceptItems(item, role, regExp, false);
+			}
+		}
+	}
+
+	// Accept separators if any top level items and its children are accepted
+	for (auto it = _topLevelItems.cbegin(); it != _topLevelItems.cend(); ++it) {
+		if (!_acceptedItems.contains(it.key()) && _acceptedItems.contains(model->itemFromIndex(it.value()))) {
+			_acceptedItems.insert(it.key());
+		}
+	}
+}
+
+/** Evaluates a subtree, and returns true if the node itself or one of its children is matching the filter. */
+bool LibraryFilterProxyModel::acceptItems(const QStandardItem *item, int role, const QRegExp &regExp, bool isAncestorAccepted) const
 {
-	return MiamSortFilterProxyModel::filterAcceptsRow(sourceRow, sourceParent);
+	bool isAcceptedItself = item->data(role).toString().contains(regExp);
+	bool hasAcceptedChildren = false;
+	for (int i = 0; i < item->rowCount(); i++) {
+		if (const QStandardItem *child = item->child(i, 0)) {
+			if (this->acceptItems(child, role, regExp, isAncestorAccepted || isAcceptedItself)) {
+				hasAcceptedChildren = true;
+			}
+		}
+	}
+	if (isAcceptedItself) {
+		_matchingItems.insert(item);
+	}
+	if (isAncestorAccepted || isAcceptedItself || hasAcceptedChildren) {
+		_acceptedItems.insert(item);
+	}
+	return isAcceptedItself || hasAcceptedChildren;
 }
 
-bool LibraryFilterProxyModel::hasAcceptedChildren(int sourceRow, const QModelIndex &sourceParent) const
+/** Accepts a matching item, its ancestors and all its children. */
+void LibraryFilterProxyModel::acceptMatchingItem(const QStandardItem *item) const
 {
-	QModelIndex item = sourceModel()->index(sourceRow, 0, sourceParent);
-	if (!item.isValid()) {
-		return false;
+	// If one of the ancestors is matching too, it will accept this subtree
+	for (const QStandardItem *parent = item->parent(); parent != nullptr; parent = parent->parent()) {
+		if (_matchingItems.contains(parent)) {
+			return;
+		}
 	}
 
-	// Check if there are children
-	int childCount = item.model()->rowCount(item);
-	if (childCount == 0) {
+	for (const QStandardItem *parent = item->parent(); parent != nullptr; parent = parent->parent()) {
+		if (_acceptedItems.contains(parent)) {
+			break;
+		}
+		_acceptedItems.insert(parent);
+	}
+
+	QList<const QStandardItem*> subtree;
+	subtree.append(item);
+	while (!subtree.isEmpty()) {
+		const QStandardItem *node = subtree.takeLast();
+		_acceptedItems.insert(node);
+		for (int i = 0; i < node->rowCount(); i++) {
+			if (const QStandardItem *child = node->child(i, 0)) {
+				subtree.append(child);
+			}
+		}
+	}
+}
+
+/** Returns true if items matching the new filter are necessarily a subset of those which are matching the previous one. */
+bool LibraryFilterProxyModel::isNarrowing(int role, const QRegExp &regExp) const
+{
+	if (_isAcceptedItemsStale || _isAcceptingAll || role != _matchingRole) {
 		return false;
 	}
+	// Only plain text can be compared: "beatl" is matching less items than "beat"
+	if (regExp.patternSyntax() != QRegExp::FixedString || _matchingRegExp.patternSyntax() != QRegExp::FixedString ||
+			regExp.caseSensitivity() != _matchingRegExp.caseSensitivity()) {
+		return false;
+	}
+	return regExp.pattern().contains(_matchingRegExp.pattern(), regExp.caseSensitivity());
+}
 
-	for (int i = 0; i < childCount; ++i) {
-		if (filterAcceptsRowItself(i, item)) {
-			return true;
+/** Evaluates the tree once, after all rows of a batch of changes were inserted or removed. */
+void LibraryFilterProxyModel::scheduleUpdate()
+{
+	if (_isUpdateScheduled) {
+		return;
+	}
+	_isUpdateScheduled = true;
+	QTimer::singleShot(0, this, [=]() {
+		_isUpdateScheduled = false;
+		if (!_isAcceptedItemsStale) {
+			return;
 		}
-		// Recursive call
-		if (hasAcceptedChildren(i, item)) {
-			return true;
+		this->updateAcceptedItems(filterRole(), filterRegExp());
+		if (!_isAcceptingAll) {
+			this->invalidateFilter();
 		}
-	}
-	return false;
+	});
 }
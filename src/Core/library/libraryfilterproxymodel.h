@@ -1,6 +1,7 @@
 #ifndef LIBRARYFILTERPROXYMODEL_H
 #define LIBRARYFILTERPROXYMODEL_H
 
+#include <QSet>
 #include <QStandardItem>
 #include "miamsortfilterproxymodel.h"
 
@@ -9,20 +10,47 @@
 
 /**
  * \brief		The LibraryFilterProxyModel class is used to filter Library by looking in all items
- * \details		When filtering, the method filterAcceptsRow will not stop if a search term was not found in a node. The algorithm
- *				will continue recursively until all subnodes and leaves are evaluated.
+ * \details		When filtering, a node is accepted if it matches the search term, if one of its ancestors or one of its children
+ *				does. Instead of evaluating ancestors and children for every row, all nodes are evaluated once per filter change in a
+ *				single pass, then filterAcceptsRow is a simple lookup. Separators are accepted if one of their top level items is.
+ *				When one is extending the previous search term, only items which were matching the previous term are tested again.
+ *				When rows are inserted or removed while a filter is active, the tree is evaluated again once, after the event loop
+ *				is back: a load or a rescan which inserts thousands of rows costs a single pass, not one pass per row.
  * \author      Matthieu Bachelier
  * \copyright   GNU General Public License v3
  */
 class MIAMCORE_LIBRARY LibraryFilterProxyModel : public MiamSortFilterProxyModel
 {
 	Q_OBJECT
+private:
+	/** Items which are accepted by the current filter, computed once per filter change. */
+	mutable QSet<const QStandardItem*> _acceptedItems;
+
+	/** Items which are matching the current filter on their own merits, without their ancestors or children. */
+	mutable QSet<const QStandardItem*> _matchingItems;
+
+	/** Filter used to compute matching items. */
+	mutable int _matchingRole;
+	mutable QRegExp _matchingRegExp;
+
+	/** True when the current filter is empty. */
+	mutable bool _isAcceptingAll;
+
+	/** True when rows were inserted or removed in the source model since the last evaluation. */
+	mutable bool _isAcceptedItemsStale;
+
+	/** True when an evaluation of the whole tree is pending, after rows were inserted or removed. */
+	bool _isUpdateScheduled;
+
 public:
 	explicit LibraryFilterProxyModel(QObject *parent = nullptr);
 
 	/** Redefined to override Qt::FontRole. */
 	virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
 
+	/** Redefined to invalidate accepted items when rows are inserted or removed. */
+	virtual void setSourceModel(QAbstractItemModel *sourceModel) override;
+
 protected:
 	/** Redefined from QSortFilterProxyModel. */
 	virtual bool filterAcceptsRow(int sourceRow, const QModelIndex &parent) const override;
@@ -30,9 +58,21 @@ protected:
 	/** Redefined for custom sorting. */
 	virtual bool lessThan(const QModelIndex &idxLeft, const QModelIndex &idxRight) const override;
 
+	/** Redefined to evaluate the whole tree in a single pass. */
+	virtual void updateAcceptedItems(int role, const QRegExp &regExp) const override;
+
 private:
-	bool filterAcceptsRowItself(int sourceRow, const QModelIndex &sourceParent) const;
-	bool hasAcceptedChildren(int sourceRow, const QModelIndex &sourceParent) const;
+	/** Evaluates a subtree, and returns true if the node itself or one of its children is matching the filter. */
+	bool acceptItems(const QStandardItem *item, int role, const QRegExp &regExp, bool isAncestorAccepted) const;
+
+	/** Accepts a matching item, its ancestors and all its children. */
+	void acceptMatchingItem(const QStandardItem *item) const;
+
+	/** Returns true if items matching the new filter are necessarily a subset of those which are matching the previous one. */
+	bool isNarrowing(int role, const QRegExp &regExp) const;
+
+	/** Evaluates the tree once, after all rows of a batch of changes were inserted or removed. */
+	void scheduleUpdate();
 };
 
 #endif // LIBRARYFILTERPROXYMODEL_H
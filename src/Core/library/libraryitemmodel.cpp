@@ -9,9 +9,7 @@
 
 #include <functional>
 
-#include <QRegularExpression>
 #include <QSqlQuery>
-#include <QSqlRecord>
 
 #include <QtDebug>
 
@@ -22,6 +20,7 @@ LibraryItemModel::LibraryItemModel(QObject *parent)
 	setColumnCount(1);
 	_proxy->setSourceModel(this);
 	_proxy->setTopLevelItems(this->topLevelItems());
+	connect(SettingsPrivate::instance(), &SettingsPrivate::libraryArticlesHaveChanged, this, &LibraryItemModel::rebuildSeparators);
     qDebug() << Q_FUNC_INFO;
 }
 
@@ -62,73 +61,74 @@ void LibraryItemModel::load(const QString &)
 
 	SqlDatabase db;
 
-	QSqlQuery q("SELECT uri, trackNumber, trackTitle, artist, artistNormalized, album, albumNormalized, artistAlbum, " \
-				"albumYear, trackLength, rating, disc, internalCover, cover, host, icon FROM cache ORDER BY uri, internalCover", db);
+	// Passing the statement to the constructor would execute it twice, the second time with forward only mode
+	QSqlQuery q(db);
 	q.setForwardOnly(true);
-	if (!q.exec()) {
+	if (!q.exec("SELECT uri, trackNumber, trackTitle, artist, artistNormalized, album, albumNormalized, artistAlbum, " \
+				"albumYear, trackLength, rating, disc, internalCover, cover, host, icon, artistHasWord, albumHasWord, albumId, rowid " \
+				"FROM cache ORDER BY uri, internalCover")) {
 		return;
 	}
 	const int uri = 0, trackNumber = 1, trackTitle = 2, artist = 3, artistNorm = 4, album = 5, albumNorm = 6, artistAlbum = 7,
-			year = 8, trackLength = 9, rating = 10, disc = 11, internalCover = 12, cover = 13, host = 14, icon = 15;
+			year = 8, trackLength = 9, rating = 10, disc = 11, internalCover = 12, cover = 13, host = 14, icon = 15,
+			artistHasWord = 16, albumHasWord = 17, albumId = 18, trackId = 19;
+
+	// Normalized strings without any letter nor digit are grouped under the same key, which is computed when scanning files
+	const QString various = QStringLiteral("0");
 
 	// Lambda function to reduce duplicate code which is relevant in this method only
-	auto loadTrack = [=] (QSqlRecord& r) -> TrackItem* {
+	// Each column is read directly from the current row, without copying the whole record
+	auto loadTrack = [=] (const QSqlQuery &r, bool isRemote) -> TrackItem* {
 		TrackItem *trackItem = new TrackItem;
 		trackItem->setText(r.value(trackTitle).toString());
 		trackItem->setData(r.value(uri).toString(), Miam::DF_URI);
+		trackItem->setData(r.value(trackId).toUInt(), Miam::DF_ID);
 		trackItem->setData(r.value(trackNumber).toString(), Miam::DF_TrackNumber);
 		trackItem->setData(r.value(disc).toString(), Miam::DF_DiscNumber);
 		trackItem->setData(r.value(trackLength).toUInt(), Miam::DF_TrackLength);
-		if (r.value(rating).toInt() != -1) {
-			trackItem->setData(r.value(rating).toInt(), Miam::DF_Rating);
+		int trackRating = r.value(rating).toInt();
+		if (trackRating != -1) {
+			trackItem->setData(trackRating, Miam::DF_Rating);
 		}
 		trackItem->setData(r.value(artist).toString(), Miam::DF_Artist);
 		trackItem->setData(r.value(album).toString(), Miam::DF_Album);
-		trackItem->setData(!r.value(host).toString().isEmpty(), Miam::DF_IsRemote);
+		trackItem->setData(isRemote, Miam::DF_IsRemote);
 		return trackItem;
 	};
 
-	auto s = SettingsPrivate::instance();
-	switch (s->insertPolicy()) {
+	const SettingsPrivate::LibrarySnapshot &settings = SettingsPrivate::instance()->librarySnapshot();
+	switch (settings.insertPolicy) {
 	case SettingsPrivate::IP_Artists: {
-		QStringList filters;
-		if (s->isLibraryFilteredByArticles() && !s->libraryFilteredByArticles().isEmpty()) {
-			filters = s->libraryFilteredByArticles();
-		}
+		const QStringList filters = settings.articles;
 
 		QHash<uint, ArtistItem*> _artists;
 		QHash<uint, AlbumItem*> _albums;
 
 		while (q.next()) {
-			QSqlRecord r = q.record();
+			const QString artistNormalized = q.value(artistNorm).toString();
+			const QString albumNormalized = q.value(albumNorm).toString();
+			const bool isRemote = !q.value(host).toString().isEmpty();
 
 			ArtistItem *artistItem = new ArtistItem;
-			QString artistNormalized = r.value(artistNorm).toString();
-			QString artist = r.value(3).toString();
-			QString aa = r.value(artistAlbum).toString();
-			artistItem->setText(aa);
-			for (QString filter : filters) {
-				if (artist.startsWith(filter + " ", Qt::CaseInsensitive)) {
-					artist = artist.mid(filter.length() + 1);
-					artistItem->setData(artist + ", " + filter, Miam::DF_CustomDisplayText);
+			QString artistName = q.value(artist).toString();
+			artistItem->setText(q.value(artistAlbum).toString());
+			for (const QString &filter : filters) {
+				if (artistName.startsWith(filter + " ", Qt::CaseInsensitive)) {
+					artistName = artistName.mid(filter.length() + 1);
+					artistItem->setData(artistName + ", " + filter, Miam::DF_CustomDisplayText);
 					break;
 				}
 			}
-
-			if (artistNormalized.isEmpty() || !artistNormalized.contains(QRegularExpression("[\\w]"))) {
-				artistItem->setData("0", Miam::DF_NormalizedString);
-			} else {
-				artistItem->setData(artistNormalized, Miam::DF_NormalizedString);
-			}
+			artistItem->setData(q.value(artistHasWord).toBool() ? artistNormalized : various, Miam::DF_NormalizedString);
 
 			// Add artist
-			if (_artists.contains(artistItem->hash())) {
-				//qDebug() << "hash found:" << artistItem->hash() << "for" << artistItem->text() ;
-				auto it = _artists.find(artistItem->hash());
+			uint artistHash = artistItem->hash();
+			auto itArtist = _artists.constFind(artistHash);
+			if (itArtist != _artists.constEnd()) {
 				delete artistItem;
-				artistItem = (*it);
+				artistItem = itArtist.value();
 			} else {
-				_artists.insert(artistItem->hash(), artistItem);
+				_artists.insert(artistHash, artistItem);
 				invisibleRootItem()->appendRow(artistItem);
 
 				// Also check if newly inserted artist needs to insert a separator
@@ -138,42 +138,39 @@ void LibraryItemModel::load(const QString &)
 			}
 
 			AlbumItem *albumItem = new AlbumItem;
-			if (r.value(albumNorm).toString().isEmpty() || !r.value(albumNorm).toString().contains(QRegularExpression("[\\w]"))) {
-				albumItem->setData("0", Miam::DF_NormalizedString);
-			} else {
-				albumItem->setData(r.value(albumNorm).toString(), Miam::DF_NormalizedString);
-			}
+			albumItem->setData(q.value(albumHasWord).toBool() ? albumNormalized : various, Miam::DF_NormalizedString);
 			albumItem->setData(artistNormalized, Miam::DF_NormArtist);
-			albumItem->setData(r.value(year).toString(), Miam::DF_Year);
+			albumItem->setData(q.value(year).toString(), Miam::DF_Year);
+			albumItem->setData(q.value(albumId).toUInt(), Miam::DF_ID);
 
-			QString internalCoverPath = r.value(internalCover).toString();
-			QString coverPath = r.value(cover).toString();
+			const QString internalCoverPath = q.value(internalCover).toString();
+			const QString coverPath = q.value(cover).toString();
 
 			// Add album
-			if (_albums.contains(albumItem->hash())) {
-				auto it = _albums.find(albumItem->hash());
+			uint albumHash = albumItem->hash();
+			auto itAlbum = _albums.constFind(albumHash);
+			if (itAlbum != _albums.constEnd()) {
 				delete albumItem;
-				albumItem = *it;
-				if (albumItem->data(Miam::DF_InternalCover).toString().isEmpty() && !internalCoverPath.isEmpty()) {
+				albumItem = itAlbum.value();
+				if (!internalCoverPath.isEmpty() && albumItem->data(Miam::DF_InternalCover).toString().isEmpty()) {
 					albumItem->setData(internalCoverPath, Miam::DF_InternalCover);
 				}
-				if (albumItem->data(Miam::DF_CoverPath).toString().isEmpty() && !coverPath.isEmpty()) {
+				if (!coverPath.isEmpty() && albumItem->data(Miam::DF_CoverPath).toString().isEmpty()) {
 					albumItem->setData(coverPath, Miam::DF_CoverPath);
 				}
 			} else {
-
-				albumItem->setText(r.value(album).toString());
+				albumItem->setText(q.value(album).toString());
 				albumItem->setData(internalCoverPath, Miam::DF_InternalCover);
 				albumItem->setData(coverPath, Miam::DF_CoverPath);
-				albumItem->setData(r.value(icon).toString(), Miam::DF_IconPath);
-				albumItem->setData(!r.value(host).toString().isEmpty(), Miam::DF_IsRemote);
+				albumItem->setData(q.value(icon).toString(), Miam::DF_IconPath);
+				albumItem->setData(isRemote, Miam::DF_IsRemote);
 
-				_albums.insert(albumItem->hash(), albumItem);
+				_albums.insert(albumHash, albumItem);
 				artistItem->appendRow(albumItem);
 			}
 
 			// Add tracks
-			albumItem->appendRow(loadTrack(r));
+			albumItem->appendRow(loadTrack(q, isRemote));
 		}
 		break;
 	}
@@ -181,32 +178,30 @@ void LibraryItemModel::load(const QString &)
 
 		QHash<uint, AlbumItem*> _albums;
 		while (q.next()) {
-			QSqlRecord r = q.record();
-			QString artistNormalized = r.value(artistNorm).toString();
+			const QString internalCoverPath = q.value(internalCover).toString();
+			const bool isRemote = !q.value(host).toString().isEmpty();
 
 			AlbumItem *albumItem = new AlbumItem;
-			albumItem->setText(r.value(album).toString());
-			if (r.value(albumNorm).toString().isEmpty() || !r.value(albumNorm).toString().contains(QRegularExpression("[\\w]"))) {
-				albumItem->setData("0", Miam::DF_NormalizedString);
-			} else {
-				albumItem->setData(r.value(albumNorm).toString(), Miam::DF_NormalizedString);
-			}
-			albumItem->setData(artistNormalized, Miam::DF_NormArtist);
-			albumItem->setData(r.value(year).toString(), Miam::DF_Year);
-			if (!r.value(internalCover).toString().isEmpty()) {
-				albumItem->setData(r.value(internalCover).toString(), Miam::DF_InternalCover);
+			albumItem->setText(q.value(album).toString());
+			albumItem->setData(q.value(albumHasWord).toBool() ? q.value(albumNorm).toString() : various, Miam::DF_NormalizedString);
+			albumItem->setData(q.value(artistNorm).toString(), Miam::DF_NormArtist);
+			albumItem->setData(q.value(year).toString(), Miam::DF_Year);
+			albumItem->setData(q.value(albumId).toUInt(), Miam::DF_ID);
+			if (!internalCoverPath.isEmpty()) {
+				albumItem->setData(internalCoverPath, Miam::DF_InternalCover);
 			}
-			albumItem->setData(r.value(cover).toString(), Miam::DF_CoverPath);
-			albumItem->setData(r.value(icon).toString(), Miam::DF_IconPath);
-			albumItem->setData(!r.value(host).toString().isEmpty(), Miam::DF_IsRemote);
+			albumItem->setData(q.value(cover).toString(), Miam::DF_CoverPath);
+			albumItem->setData(q.value(icon).toString(), Miam::DF_IconPath);
+			albumItem->setData(isRemote, Miam::DF_IsRemote);
 
 			// Add album
-			if (_albums.contains(albumItem->hash())) {
-				auto it = _albums.find(albumItem->hash());
+			uint albumHash = albumItem->hash();
+			auto it = _albums.constFind(albumHash);
+			if (it != _albums.constEnd()) {
 				delete albumItem;
-				albumItem = (*it);
+				albumItem = it.value();
 			} else {
-				_albums.insert(albumItem->hash(), albumItem);
+				_albums.insert(albumHash, albumItem);
 				invisibleRootItem()->appendRow(albumItem);
 				// Also check if newly inserted artist needs to insert a separator
 				if (SeparatorItem *separator = this->insertSeparator(albumItem)) {
@@ -215,33 +210,34 @@ void LibraryItemModel::load(const QString &)
 			}
 
 			// Add tracks
-			albumItem->appendRow(loadTrack(r));
+			albumItem->appendRow(loadTrack(q, isRemote));
 		}
 		break;
 	}
 	case SettingsPrivate::IP_ArtistsAlbums: {
 		QHash<uint, AlbumItem*> _albums;
 		while (q.next()) {
-			QSqlRecord r = q.record();
-			QString artistNormalized = r.value(artistNorm).toString();
-			QString albumNormalized = r.value(albumNorm).toString();
+			const QString artistNormalized = q.value(artistNorm).toString();
+			const bool isRemote = !q.value(host).toString().isEmpty();
 
 			AlbumItem *albumItem = new AlbumItem;
-			albumItem->setText(r.value(artist).toString() + " – " + r.value(album).toString());
-			albumItem->setData(artistNormalized + "|" + albumNormalized, Miam::DF_NormalizedString);
+			albumItem->setText(q.value(artist).toString() + " – " + q.value(album).toString());
+			albumItem->setData(artistNormalized + "|" + q.value(albumNorm).toString(), Miam::DF_NormalizedString);
 			albumItem->setData(artistNormalized, Miam::DF_NormArtist);
-			albumItem->setData(r.value(year).toString(), Miam::DF_Year);
-			albumItem->setData(r.value(cover).toString(), Miam::DF_CoverPath);
-			albumItem->setData(r.value(icon).toString(), Miam::DF_IconPath);
-			albumItem->setData(!r.value(host).toString().isEmpty(), Miam::DF_IsRemote);
+			albumItem->setData(q.value(year).toString(), Miam::DF_Year);
+			albumItem->setData(q.value(albumId).toUInt(), Miam::DF_ID);
+			albumItem->setData(q.value(cover).toString(), Miam::DF_CoverPath);
+			albumItem->setData(q.value(icon).toString(), Miam::DF_IconPath);
+			albumItem->setData(isRemote, Miam::DF_IsRemote);
 
 			// Add album
-			if (_albums.contains(albumItem->hash())) {
-				auto it = _albums.find(albumItem->hash());
+			uint albumHash = albumItem->hash();
+			auto it = _albums.constFind(albumHash);
+			if (it != _albums.constEnd()) {
 				delete albumItem;
-				albumItem = *it;
+				albumItem = it.value();
 			} else {
-				_albums.insert(albumItem->hash(), albumItem);
+				_albums.insert(albumHash, albumItem);
 				invisibleRootItem()->appendRow(albumItem);
 				// Also check if newly inserted artist needs to insert a separator
 				if (SeparatorItem *separator = this->insertSeparator(albumItem)) {
@@ -250,7 +246,7 @@ void LibraryItemModel::load(const QString &)
 			}
 
 			// Add tracks
-			albumItem->appendRow(loadTrack(r));
+			albumItem->appendRow(loadTrack(q, isRemote));
 		}
 		break;
 	}
@@ -260,16 +256,20 @@ void LibraryItemModel::load(const QString &)
 		QHash<uint, AlbumItem*> _artistAlbums;
 
 		while (q.next()) {
-			QSqlRecord r = q.record();
-			YearItem *yearItem = new YearItem(r.value(year).toString());
+			const QString artistNormalized = q.value(artistNorm).toString();
+			const QString albumYear = q.value(year).toString();
+			const bool isRemote = !q.value(host).toString().isEmpty();
+
+			YearItem *yearItem = new YearItem(albumYear);
 
 			// Add year
-			if (_years.contains(yearItem->hash())) {
-				auto it = _years.find(yearItem->hash());
+			uint yearHash = yearItem->hash();
+			auto itYear = _years.constFind(yearHash);
+			if (itYear != _years.constEnd()) {
 				delete yearItem;
-				yearItem = (*it);
+				yearItem = itYear.value();
 			} else {
-				_years.insert(yearItem->hash(), yearItem);
+				_years.insert(yearHash, yearItem);
 				invisibleRootItem()->appendRow(yearItem);
 
 				// Also check if newly inserted artist needs to insert a separator
@@ -280,30 +280,34 @@ void LibraryItemModel::load(const QString &)
 
 			// Add Artist - Album
 			AlbumItem *artistAlbumItem = new AlbumItem;
-			artistAlbumItem->setText(r.value(3).toString() + " – " + r.value(album).toString());
-			artistAlbumItem->setData(r.value(artistNorm).toString() + "|" + r.value(albumNorm).toString(), Miam::DF_NormalizedString);
-			artistAlbumItem->setData(r.value(artistNorm).toString(), Miam::DF_NormArtist);
-			artistAlbumItem->setData(r.value(year).toString(), Miam::DF_Year);
-			artistAlbumItem->setData(r.value(cover).toString(), Miam::DF_CoverPath);
-			artistAlbumItem->setData(r.value(icon).toString(), Miam::DF_IconPath);
-			artistAlbumItem->setData(!r.value(14).toString().isEmpty(), Miam::DF_IsRemote);
-
-			if (_artistAlbums.contains(artistAlbumItem->hash())) {
-				auto it = _artistAlbums.find(artistAlbumItem->hash());
+			artistAlbumItem->setText(q.value(artist).toString() + " – " + q.value(album).toString());
+			artistAlbumItem->setData(artistNormalized + "|" + q.value(albumNorm).toString(), Miam::DF_NormalizedString);
+			artistAlbumItem->setData(artistNormalized, Miam::DF_NormArtist);
+			artistAlbumItem->setData(albumYear, Miam::DF_Year);
+			artistAlbumItem->setData(q.value(albumId).toUInt(), Miam::DF_ID);
+			artistAlbumItem->setData(q.value(cover).toString(), Miam::DF_CoverPath);
+			artistAlbumItem->setData(q.value(icon).toString(), Miam::DF_IconPath);
+			artistAlbumItem->setData(isRemote, Miam::DF_IsRemote);
+
+			uint artistAlbumHash = artistAlbumItem->hash();
+			auto itArtistAlbum = _artistAlbums.constFind(artistAlbumHash);
+			if (itArtistAlbum != _artistAlbums.constEnd()) {
 				delete artistAlbumItem;
-				artistAlbumItem = *it;
+				artistAlbumItem = itArtistAlbum.value();
 			} else {
-				_artistAlbums.insert(artistAlbumItem->hash(), artistAlbumItem);
+				_artistAlbums.insert(artistAlbumHash, artistAlbumItem);
 				yearItem->appendRow(artistAlbumItem);
 			}
 
 			// Add tracks
-			artistAlbumItem->appendRow(loadTrack(r));
+			artistAlbumItem->appendRow(loadTrack(q, isRemote));
 		}
 		break;
 	}
 	}
 
+	// Separators and their top level items are needed by the proxy to filter the tree
+	_proxy->setTopLevelItems(_topLevelItems);
 	this->sort(0);
 }
 
@@ -339,64 +343,82 @@ LibraryFilterProxyModel* LibraryItemModel::proxy() const
 /** Rebuild the list of separators when one has changed grammatical articles in options. */
 void LibraryItemModel::rebuildSeparators()
 {
-	SqlDatabase db;
-	auto s = SettingsPrivate::instance();
-	QStringList filters;
-	if (s->isLibraryFilteredByArticles() && !s->libraryFilteredByArticles().isEmpty()) {
-		filters = s->libraryFilteredByArticles();
-	}
-
-	// Reset custom displayed text, like "Artist, the"
-	QHashIterator<SeparatorItem*, QModelIndex> i(_topLevelItems);
-	while (i.hasNext()) {
-		i.next();
-		if (auto item = itemFromIndex(i.value())) {
-			if (!i.value().data(Miam::DF_CustomDisplayText).toString().isEmpty()) {
-				item->setData(QString(), Miam::DF_CustomDisplayText);
-				// Recompute standard normalized name: "The Artist" -> "theartist"
-				item->setData(db.normalizeField(item->text()), Miam::DF_NormalizedString);
-			} else if (!filters.isEmpty()) {
-				for (QString filter : filters) {
-					QString text = item->text();
-					if (text.startsWith(filter + " ", Qt::CaseInsensitive)) {
-						text = text.mid(filter.length() + 1);
-						item->setData(text + ", " + filter, Miam::DF_CustomDisplayText);
-						item->setData(db.normalizeField(text), Miam::DF_NormalizedString);
-						break;
-					}
+	const QStringList filters = SettingsPrivate::instance()->librarySnapshot().articles;
+
+	// Only items which have gained or lost an article are re-keyed, and can move to another separator
+	QMultiHash<SeparatorItem*, QPersistentModelIndex> topLevelItems;
+	QHash<QString, SeparatorItem*> letters;
+	QList<QStandardItem*> newSeparators;
+	bool hasChanged = false;
+	for (auto it = _topLevelItems.cbegin(); it != _topLevelItems.cend(); ++it) {
+		QStandardItem *item = itemFromIndex(it.value());
+		if (item == nullptr) {
+			continue;
+		}
+		SeparatorItem *separator = it.key();
+		QString text = item->text();
+		QString customText;
+		for (const QString &filter : filters) {
+			if (text.startsWith(filter + " ", Qt::CaseInsensitive)) {
+				text = text.mid(filter.length() + 1);
+				customText = text + ", " + filter;
+				break;
+			}
+		}
+		if (customText != item->data(Miam::DF_CustomDisplayText).toString()) {
+			hasChanged = true;
+			// Custom displayed text, like "Artist, the", and normalized name: "The Artist" -> "theartist", or "artist"
+			item->setData(customText, Miam::DF_CustomDisplayText);
+			item->setData(SqlDatabase::normalizeField(text), Miam::DF_NormalizedString);
+
+			const QString key = this->separatorKey(item);
+			if (key != separator->text()) {
+				if (letters.contains(key)) {
+					separator = letters.value(key);
+				} else if (_letters.contains(key)) {
+					separator = _letters.value(key);
+				} else {
+					separator = this->createSeparator(key);
+					newSeparators.append(separator);
 				}
 			}
 		}
+		letters.insert(separator->text(), separator);
+		topLevelItems.insert(separator, it.value());
 	}
-
-	// Delete separators first
-	QSet<int> setRows;
-	QHashIterator<QString, SeparatorItem*> it(_letters);
-	while (it.hasNext()) {
-		it.next();
-		setRows << it.value()->index().row();
+	if (!hasChanged) {
+		return;
 	}
 
-	// Always remove items (rows) in reverse order
-	QList<int> rows = setRows.toList();
-	std::sort(rows.begin(), rows.end(), std::greater<int>());
-	for (int row : rows) {
-		auto item = takeItem(row);
-		removeRow(row);
-		delete item;
+	// Remove separators which have no more items, contiguous rows at once and from the end, to avoid shifting remaining rows
+	QList<int> rows;
+	for (auto it = _letters.cbegin(); it != _letters.cend(); ++it) {
+		if (!letters.contains(it.key())) {
+			rows.append(it.value()->row());
+		}
 	}
-	_letters.clear();
-	_topLevelItems.clear();
-
-	// Insert once again new separators
-	for (int row = 0; row < rowCount(); row++) {
-		auto item = this->item(row);
-		if (item->type() != Miam::IT_Separator) {
-			if (auto separator = this->insertSeparator(item)) {
-				_topLevelItems.insert(separator, item->index());
-			}
+	std::sort(rows.begin(), rows.end());
+	int i = rows.size() - 1;
+	while (i >= 0) {
+		int first = rows.at(i);
+		int count = 1;
+		while (i - count >= 0 && rows.at(i - count) == first - 1) {
+			first--;
+			count++;
 		}
+		this->removeRows(first, count);
+		i -= count;
 	}
+	if (!newSeparators.isEmpty()) {
+		invisibleRootItem()->appendRows(newSeparators);
+	}
+
+	_letters = letters;
+	_topLevelItems = topLevelItems;
+	_proxy->setTopLevelItems(_topLevelItems);
+
+	// Items were renamed: sort again instead of resetting the view
+	_proxy->sort(_proxy->defaultSortColumn(), _proxy->sortOrder());
 }
 
 void LibraryItemModel::reset()
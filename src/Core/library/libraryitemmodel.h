@@ -18,6 +18,7 @@
 class MIAMCORE_LIBRARY LibraryItemModel : public MiamItemModel
 {
 	Q_OBJECT
+	Q_PROPERTY(LibraryFilterProxyModel* proxy READ proxy CONSTANT)
 private:
 	LibraryFilterProxyModel *_proxy;
 
@@ -37,7 +38,16 @@ public:
 
 	void reset();
 
-	inline QMultiHash<SeparatorItem*, QModelIndex> topLevelItems() const { return _topLevelItems; }
+	/** Returns the row of the separator for this letter in the proxy, or -1 if it's not displayed. Used by the jump bar. */
+	Q_INVOKABLE inline int rowForLetter(const QString &letter) const { return _proxy->rowForLetter(letter); }
+
+	/** Returns the row of the separator for this letter in the tree view, below children of expanded items, or -1. */
+	Q_INVOKABLE inline int flatRowForLetter(const QString &letter) const { return _proxy->flatRowForLetter(letter); }
+
+	/** Called by the tree view when an item of the proxy is expanded or collapsed. */
+	Q_INVOKABLE inline void setExpanded(const QModelIndex &index, bool expanded) { _proxy->setExpanded(index, expanded); }
+
+	inline QMultiHash<SeparatorItem*, QPersistentModelIndex> topLevelItems() const { return _topLevelItems; }
 
 public slots:
 	virtual void load(const QString & = QString::null) override;
@@ -15,8 +15,8 @@ MiamItemModel::~MiamItemModel()
 
 void MiamItemModel::deleteCache()
 {
+	// Separators are owned by the model, they are deleted with their rows
 	qDeleteAll(_hash);
-	qDeleteAll(_letters);
 	qDeleteAll(_tracks);
 
 	_hash.clear();
@@ -28,56 +28,55 @@ void MiamItemModel::deleteCache()
 }
 
 SeparatorItem *MiamItemModel::insertSeparator(const QStandardItem *node)
+{
+	const QString key = this->separatorKey(node);
+	if (key.isEmpty()) {
+		return nullptr;
+	}
+	auto it = _letters.constFind(key);
+	if (it != _letters.constEnd()) {
+		return it.value();
+	}
+	SeparatorItem *separator = this->createSeparator(key);
+	invisibleRootItem()->appendRow(separator);
+	_letters.insert(key, separator);
+	return separator;
+}
+
+/** Returns the text of the separator under which a top level item is grouped, or an empty string if there is none. */
+QString MiamItemModel::separatorKey(const QStandardItem *node) const
 {
 	// Items are grouped every ten years in this particular case
-	switch (SettingsPrivate::instance()->insertPolicy()) {
-	case SettingsPrivate::IP_Years: {
+	if (SettingsPrivate::instance()->librarySnapshot().insertPolicy == SettingsPrivate::IP_Years) {
 		int year = node->text().toInt();
 		if (year == 0) {
-			return nullptr;
-		}
-		QString yearStr = QString::number(year - year % 10);
-		if (_letters.contains(yearStr)) {
-			return _letters.value(yearStr);
-		} else {
-			SeparatorItem *separator = new SeparatorItem(yearStr);
-			separator->setData(yearStr, Miam::DF_NormalizedString);
-			invisibleRootItem()->appendRow(separator);
-			_letters.insert(yearStr, separator);
-			return separator;
+			return QString();
 		}
-		break;
+		return QString::number(year - year % 10);
 	}
+
 	// Other types of hierarchy, separators are built from letters
-	default:
-		QString c;
-		if (node->data(Miam::DF_CustomDisplayText).toString().isEmpty()) {
-			c = node->text().left(1).normalized(QString::NormalizationForm_KD).toUpper().remove(QRegExp("[^A-Z\\s]"));
-		} else {
-			QString reorderedText = node->data(Miam::DF_CustomDisplayText).toString();
-			c = reorderedText.left(1).normalized(QString::NormalizationForm_KD).toUpper().remove(QRegExp("[^A-Z\\s]"));
-		}
-		QString letter;
-		bool topLevelLetter = false;
-		if (c.contains(QRegExp("\\w"))) {
-			letter = c;
-		} else {
-			letter = tr("Various");
-			topLevelLetter = true;
-		}
-		if (_letters.contains(letter)) {
-			return _letters.value(letter);
-		} else {
-			SeparatorItem *separator = new SeparatorItem(letter);
-			if (topLevelLetter) {
-				separator->setData("0", Miam::DF_NormalizedString);
-			} else {
-				separator->setData(letter.toLower(), Miam::DF_NormalizedString);
-			}
-			invisibleRootItem()->appendRow(separator);
-			_letters.insert(letter, separator);
-			return separator;
-		}
+	QString text = node->data(Miam::DF_CustomDisplayText).toString();
+	if (text.isEmpty()) {
+		text = node->text();
+	}
+	QString c = text.left(1).normalized(QString::NormalizationForm_KD).toUpper().remove(QRegExp("[^A-Z\\s]"));
+	if (c.contains(QRegExp("\\w"))) {
+		return c;
+	} else {
+		return tr("Various");
+	}
+}
+
+/** Creates a separator, without inserting it in the model. */
+SeparatorItem *MiamItemModel::createSeparator(const QString &key) const
+{
+	SeparatorItem *separator = new SeparatorItem(key);
+	if (key == tr("Various")) {
+		// Keep "Various" on top of other separators
+		separator->setData("0", Miam::DF_NormalizedString);
+	} else {
+		separator->setData(key.toLower(), Miam::DF_NormalizedString);
 	}
-	return nullptr;
+	return separator;
 }
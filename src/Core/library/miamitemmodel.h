@@ -25,7 +25,7 @@ protected:
 	QHash<QString, SeparatorItem*> _letters;
 
 	/** Letter L returns all Artists (e.g.) starting with L. */
-	QMultiHash<SeparatorItem*, QModelIndex> _topLevelItems;
+	QMultiHash<SeparatorItem*, QPersistentModelIndex> _topLevelItems;
 
 	QHash<QString, TrackItem*> _tracks;
 
@@ -46,6 +46,12 @@ protected:
 	void deleteCache();
 
 	SeparatorItem *insertSeparator(const QStandardItem *node);
+
+	/** Returns the text of the separator under which a top level item is grouped, or an empty string if there is none. */
+	QString separatorKey(const QStandardItem *node) const;
+
+	/** Creates a separator, without inserting it in the model. */
+	SeparatorItem *createSeparator(const QString &key) const;
 };
 
 #endif // MIAMITEMMODEL_H
@@ -1,15 +1,38 @@
 #include "miamsortfilterproxymodel.h"
+#include "searchindex.h"
 #include "settingsprivate.h"
 
-#include <functional>
-#include <QSet>
-#include <QStandardItem>
+#include <QStandardItemModel>
+#include <QTimer>
 
 #include <QtDebug>
 
 MiamSortFilterProxyModel::MiamSortFilterProxyModel(QObject *parent)
 	: QSortFilterProxyModel(parent)
+	, _findMusicTimer(new QTimer(this))
+	, _searchIndex(new SearchIndex(this))
+	, _sourceItemModel(nullptr)
+	, _isLetterRowsStale(true)
 {
+	_findMusicTimer->setSingleShot(true);
+	_findMusicTimer->setInterval(120);
+	connect(_findMusicTimer, &QTimer::timeout, this, &MiamSortFilterProxyModel::dispatchFindMusic);
+
+	// Rows of separators are moving when sorting or filtering
+	auto invalidateLetterRows = [=]() {
+		_isLetterRowsStale = true;
+	};
+	connect(this, &QAbstractItemModel::layoutChanged, this, invalidateLetterRows);
+	connect(this, &QAbstractItemModel::rowsInserted, this, invalidateLetterRows);
+	connect(this, &QAbstractItemModel::rowsRemoved, this, invalidateLetterRows);
+	connect(this, &QAbstractItemModel::modelReset, this, invalidateLetterRows);
+
+	// Views collapse everything when the model is reset
+	connect(this, &QAbstractItemModel::modelReset, this, [=]() {
+		_expandedIndexes.clear();
+	});
+
+	_collator.setCaseSensitivity(Qt::CaseInsensitive);
 	this->setSortCaseSensitivity(Qt::CaseInsensitive);
 	this->setSortRole(Miam::DF_NormalizedString);
 	this->setDynamicSortFilter(false);
@@ -20,91 +43,223 @@ MiamSortFilterProxyModel::MiamSortFilterProxyModel(QObject *parent)
 /** Single entry point for filtering library, and dispatch to the chosen operation defined in settings. */
 void MiamSortFilterProxyModel::findMusic(const QString &text)
 {
-	if (SettingsPrivate::instance()->librarySearchMode() == SettingsPrivate::LSM_Filter) {
-		this->filterLibrary(text);
+	_pendingText = text;
+	if (_findMusicTimer->interval() == 0) {
+		this->dispatchFindMusic();
 	} else {
-		this->highlightMatchingText(text);
+		// Restart the timer on each keystroke
+		_findMusicTimer->start();
 	}
 }
 
-/** Highlight items in the Tree when one has activated this option in settings. */
-void MiamSortFilterProxyModel::highlightMatchingText(const QString &text)
+/** Sets the delay after the last keystroke before the library is filtered. 0 means no delay. */
+void MiamSortFilterProxyModel::setFindMusicDelay(int msec)
 {
-	// Clear highlight on every call
-	std::function<void(QStandardItem *item)> recursiveClearHighlight;
-	recursiveClearHighlight = [&recursiveClearHighlight] (QStandardItem *item) -> void {
-		if (item->hasChildren()) {
-			item->setData(false, Miam::DF_Highlighted);
-			for (int i = 0; i < item->rowCount(); i++) {
-				recursiveClearHighlight(item->child(i, 0));
+	_findMusicTimer->setInterval(msec);
+}
+
+void MiamSortFilterProxyModel::dispatchFindMusic()
+{
+	_findMusicTimer->stop();
+	if (SettingsPrivate::instance()->librarySnapshot().librarySearchMode == SettingsPrivate::LSM_Filter) {
+		this->filterLibrary(_pendingText);
+	} else {
+		this->highlightMatchingText(_pendingText);
+	}
+}
+
+/** Returns the row of the separator for this letter, or -1 if it's not displayed. */
+int MiamSortFilterProxyModel::rowForLetter(const QString &letter) const
+{
+	if (_isLetterRowsStale) {
+		_letterRows.clear();
+		_isLetterRowsStale = false;
+		if (_sourceItemModel) {
+			for (int row = 0; row < this->rowCount(); row++) {
+				const QStandardItem *item = _sourceItemModel->itemFromIndex(this->mapToSource(this->index(row, 0)));
+				if (item && item->type() == Miam::IT_Separator) {
+					_letterRows.insert(item->text().toUpper(), row);
+				}
 			}
-		} else {
-			item->setData(false, Miam::DF_Highlighted);
 		}
-	};
+	}
+	return _letterRows.value(letter.toUpper(), -1);
+}
 
-	QStandardItemModel *_libraryModel = qobject_cast<QStandardItemModel*>(this->sourceModel());
-	for (int i = 0; i < _libraryModel->rowCount(); i++) {
-		recursiveClearHighlight(_libraryModel->item(i, 0));
+/** Returns the row of the separator for this letter in a tree view, below children of expanded items, or -1. */
+int MiamSortFilterProxyModel::flatRowForLetter(const QString &letter) const
+{
+	const int row = this->rowForLetter(letter);
+	if (row < 0) {
+		return -1;
 	}
 
+	// Only expanded items are visited, not every row above the separator
+	int flatRow = row;
+	for (const QPersistentModelIndex &index : _expandedIndexes) {
+		if (!index.isValid()) {
+			continue;
+		}
+		// Children are displayed only if every parent is expanded too
+		QModelIndex topLevel = index;
+		bool isDisplayed = true;
+		while (isDisplayed && topLevel.parent().isValid()) {
+			topLevel = topLevel.parent();
+			isDisplayed = _expandedIndexes.contains(topLevel);
+		}
+		if (isDisplayed && topLevel.row() < row) {
+			flatRow += this->rowCount(index);
+		}
+	}
+	return flatRow;
+}
+
+/** Called by the view when an item is expanded or collapsed. */
+void MiamSortFilterProxyModel::setExpanded(const QModelIndex &index, bool expanded)
+{
+	if (expanded) {
+		_expandedIndexes.insert(index.sibling(index.row(), 0));
+	} else {
+		_expandedIndexes.remove(index.sibling(index.row(), 0));
+	}
+}
+
+/** Highlight items in the Tree when one has activated this option in settings. */
+void MiamSortFilterProxyModel::highlightMatchingText(const QString &text)
+{
 	// Adapt filter if one is typing '*'
-	QString filter;
-	Qt::MatchFlags flags;
+	QList<QStandardItem*> items;
 	if (text.contains(QRegExp("^(\\*){1,5}$"))) {
 		this->setFilterRole(Miam::DF_Rating);
-		filter = "[" + QString::number(text.size()) + "-5]";
-		flags = Qt::MatchRecursive | Qt::MatchRegExp;
+		items = _searchIndex->matchRating(text.size());
 	} else {
 		this->setFilterRole(Qt::DisplayRole);
-		filter = text;
-		flags = Qt::MatchRecursive | Qt::MatchContains;
+		items = _searchIndex->match(text);
 	}
 
-	// Mark items with a bold font
+	// Matching items and their parents are marked with a bold font
+	QSet<QStandardItem*> highlightedItems;
 	QSet<QChar> lettersToHighlight;
-	if (!text.isEmpty()) {
-		QModelIndexList indexes = _libraryModel->match(_libraryModel->index(0, 0, QModelIndex()), this->filterRole(), filter, -1, flags);
-		QList<QStandardItem*> items;
-		for (int i = 0; i < indexes.size(); ++i) {
-			items.append(_libraryModel->itemFromIndex(indexes.at(i)));
+	for (QStandardItem *item : items) {
+		highlightedItems.insert(item);
+		QStandardItem *parent = item->parent();
+		// For every item marked, mark also the top level item
+		while (parent != nullptr) {
+			if (parent->parent() == nullptr) {
+				lettersToHighlight << parent->data(Miam::DF_NormalizedString).toString().toUpper().at(0);
+			}
+			highlightedItems.insert(parent);
+			parent = parent->parent();
 		}
-		for (QStandardItem *item : items) {
+	}
+
+	// Only items which have changed are updated, instead of clearing the whole tree on each call
+	for (QStandardItem *item : _highlightedItems) {
+		if (!highlightedItems.contains(item) && _searchIndex->contains(item)) {
+			item->setData(false, Miam::DF_Highlighted);
+		}
+	}
+	for (QStandardItem *item : highlightedItems) {
+		if (!item->data(Miam::DF_Highlighted).toBool()) {
 			item->setData(true, Miam::DF_Highlighted);
-			QStandardItem *parent = item->parent();
-			// For every item marked, mark also the top level item
-			while (parent != nullptr) {
-				parent->setData(true, Miam::DF_Highlighted);
-				if (parent->parent() == nullptr) {
-					lettersToHighlight << parent->data(Miam::DF_NormalizedString).toString().toUpper().at(0);
-				}
-				parent = parent->parent();
-			}
 		}
 	}
+	_highlightedItems = highlightedItems;
 	emit aboutToHighlightLetters(lettersToHighlight);
 }
 
+void MiamSortFilterProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
+{
+	QSortFilterProxyModel::setSourceModel(sourceModel);
+	_highlightedItems.clear();
+	_sortKeys.clear();
+	_sourceItemModel = qobject_cast<QStandardItemModel*>(sourceModel);
+	_searchIndex->setModel(_sourceItemModel);
+	if (_sourceItemModel == nullptr) {
+		return;
+	}
+
+	// Collation keys are following items which are removed or renamed
+	connect(_sourceItemModel, &QAbstractItemModel::rowsAboutToBeRemoved, this, [=](const QModelIndex &parent, int first, int last) {
+		QStandardItem *parentItem = parent.isValid() ? _sourceItemModel->itemFromIndex(parent) : _sourceItemModel->invisibleRootItem();
+		for (int row = first; parentItem && row <= last; row++) {
+			this->removeSortKeys(parentItem->child(row, 0));
+		}
+	});
+	connect(_sourceItemModel, &QAbstractItemModel::dataChanged, this, [=](const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles) {
+		if (roles.isEmpty() || roles.contains(Miam::DF_NormalizedString)) {
+			for (int row = topLeft.row(); row <= bottomRight.row(); row++) {
+				_sortKeys.remove(_sourceItemModel->itemFromIndex(topLeft.sibling(row, 0)));
+			}
+		}
+	});
+	connect(_sourceItemModel, &QAbstractItemModel::modelAboutToBeReset, this, [=]() {
+		_sortKeys.clear();
+	});
+}
+
+/** Redefined to compare precomputed collation keys instead of strings. */
+bool MiamSortFilterProxyModel::lessThan(const QModelIndex &idxLeft, const QModelIndex &idxRight) const
+{
+	if (_sourceItemModel && this->sortRole() == Miam::DF_NormalizedString && this->isSortLocaleAware()) {
+		const QStandardItem *left = _sourceItemModel->itemFromIndex(idxLeft);
+		const QStandardItem *right = _sourceItemModel->itemFromIndex(idxRight);
+		if (left && right) {
+			return this->sortKey(left).compare(this->sortKey(right)) < 0;
+		}
+	}
+	return QSortFilterProxyModel::lessThan(idxLeft, idxRight);
+}
+
+/** Returns the collation key of an item, and computes it the first time. */
+QCollatorSortKey MiamSortFilterProxyModel::sortKey(const QStandardItem *item) const
+{
+	auto it = _sortKeys.constFind(item);
+	if (it != _sortKeys.constEnd()) {
+		return it.value();
+	}
+	QCollatorSortKey key = _collator.sortKey(item->data(Miam::DF_NormalizedString).toString());
+	_sortKeys.insert(item, key);
+	return key;
+}
+
+void MiamSortFilterProxyModel::removeSortKeys(const QStandardItem *item)
+{
+	if (item == nullptr) {
+		return;
+	}
+	_sortKeys.remove(item);
+	for (int row = 0; row < item->rowCount(); row++) {
+		this->removeSortKeys(item->child(row, 0));
+	}
+}
+
 /** Reduce the size of the library when the user is typing text. */
 void MiamSortFilterProxyModel::filterLibrary(const QString &filter)
 {
 	if (filter.isEmpty()) {
+		this->updateAcceptedItems(Qt::DisplayRole, QRegExp());
 		this->setFilterRole(Qt::DisplayRole);
 		this->setFilterRegExp(QRegExp());
 		this->sort(this->defaultSortColumn(), this->sortOrder());
 	} else {
-		bool needToSortAgain = false;
-		if (this->filterRegExp().pattern().size() < filter.size() && filter.size() > 1) {
-			needToSortAgain = true;
-		}
+		// When one is extending the previous text, rows can only be removed and the current order is kept.
+		// Otherwise, rows which were filtered out are inserted back
+		bool needToSortAgain = !filter.contains(this->filterRegExp().pattern(), Qt::CaseInsensitive);
+		int role;
+		QRegExp regExp;
 		if (filter.contains(QRegExp("^(\\*){1,5}$"))) {
 			// Convert stars into [1-5], ..., [5-5] regular expression
-			this->setFilterRole(Miam::DF_Rating);
-			this->setFilterRegExp(QRegExp("[" + QString::number(filter.size()) + "-5]", Qt::CaseInsensitive, QRegExp::RegExp));
+			role = Miam::DF_Rating;
+			regExp = QRegExp("[" + QString::number(filter.size()) + "-5]", Qt::CaseInsensitive, QRegExp::RegExp);
 		} else {
-			this->setFilterRole(Qt::DisplayRole);
-			this->setFilterRegExp(QRegExp(filter, Qt::CaseInsensitive, QRegExp::FixedString));
+			role = Qt::DisplayRole;
+			regExp = QRegExp(filter, Qt::CaseInsensitive, QRegExp::FixedString);
 		}
+		// Evaluate the whole tree first, then each call to filterAcceptsRow is cheap
+		this->updateAcceptedItems(role, regExp);
+		this->setFilterRole(role);
+		this->setFilterRegExp(regExp);
 		if (needToSortAgain) {
 			this->sort(this->defaultSortColumn(), this->sortOrder());
 		}
@@ -1,10 +1,16 @@
 #ifndef MIAMSORTFILTERPROXYMODEL_H
 #define MIAMSORTFILTERPROXYMODEL_H
 
+#include <QCollator>
+#include <QSet>
 #include <QSortFilterProxyModel>
 #include "miamcore_global.h"
 
-/// Forward declaration
+/// Forward declarations
+class QStandardItem;
+class QStandardItemModel;
+class QTimer;
+class SearchIndex;
 class SeparatorItem;
 
 /**
@@ -20,28 +26,84 @@ class MIAMCORE_LIBRARY MiamSortFilterProxyModel : public QSortFilterProxyModel
 	Q_OBJECT
 protected:
 	/** Top levels items are specific items, like letters 'A', 'B', ... in the library. Each letter has a reference to all items beginning with this letter. */
-	QMultiHash<SeparatorItem*, QModelIndex> _topLevelItems;
+	QMultiHash<SeparatorItem*, QPersistentModelIndex> _topLevelItems;
+
+private:
+	/** Input is debounced: the library is filtered when one has stopped typing for a short time. */
+	QTimer *_findMusicTimer;
+
+	QString _pendingText;
+
+	/** Texts in the source model, to find items to highlight without walking the whole tree. */
+	SearchIndex *_searchIndex;
+
+	/** Items which are currently displayed in bold, so only differences are updated while typing. */
+	QSet<QStandardItem*> _highlightedItems;
+
+	QStandardItemModel *_sourceItemModel;
+
+	QCollator _collator;
+
+	/** Collation keys are computed once per item, then sorting is only comparing bytes. */
+	mutable QHash<const QStandardItem*, QCollatorSortKey> _sortKeys;
+
+	/** Row of each separator in this proxy, rebuilt once after each sort or filter change. */
+	mutable QHash<QString, int> _letterRows;
+
+	mutable bool _isLetterRowsStale;
+
+	/** Items which are expanded in the view, to find where a separator is in its flat list of rows. */
+	QSet<QPersistentModelIndex> _expandedIndexes;
 
 public:
 	explicit MiamSortFilterProxyModel(QObject *parent = nullptr);
 
 	virtual ~MiamSortFilterProxyModel() {}
 
-	inline void setTopLevelItems(const QMultiHash<SeparatorItem*, QModelIndex> &topLevelItems) { _topLevelItems = topLevelItems; }
+	inline void setTopLevelItems(const QMultiHash<SeparatorItem*, QPersistentModelIndex> &topLevelItems) { _topLevelItems = topLevelItems; }
+
+	/** Returns the row of the separator for this letter, or -1 if it's not displayed. */
+	int rowForLetter(const QString &letter) const;
+
+	/** Returns the row of the separator for this letter in a tree view, below children of expanded items, or -1. */
+	int flatRowForLetter(const QString &letter) const;
+
+	/** Called by the view when an item is expanded or collapsed. */
+	void setExpanded(const QModelIndex &index, bool expanded);
 
 	/** Single entry point for filtering library, and dispatch to the chosen operation defined in settings. */
 	void findMusic(const QString &text);
 
+	/** Sets the delay after the last keystroke before the library is filtered. 0 means no delay. */
+	void setFindMusicDelay(int msec);
+
 	/** Highlight items in the Tree when one has activated this option in settings. */
 	void highlightMatchingText(const QString &text);
 
 	/** For classes that are subclassing this filter, allow to change sort column (for models based on a Table for example). */
 	virtual int defaultSortColumn() const { return 0; }
 
+	virtual void setSourceModel(QAbstractItemModel *sourceModel) override;
+
+protected:
+	/** Redefined to compare precomputed collation keys instead of strings. */
+	virtual bool lessThan(const QModelIndex &idxLeft, const QModelIndex &idxRight) const override;
+
+	/** Called before a new filter is applied, for classes which need to evaluate all items at once. */
+	virtual void updateAcceptedItems(int, const QRegExp &) const {}
+
 private:
+	/** Returns the collation key of an item, and computes it the first time. */
+	QCollatorSortKey sortKey(const QStandardItem *item) const;
+
+	void removeSortKeys(const QStandardItem *item);
+
 	/** Reduce the size of the library when the user is typing text. */
 	void filterLibrary(const QString &filter);
 
+private slots:
+	void dispatchFindMusic();
+
 signals:
 	void aboutToHighlightLetters(const QSet<QChar> &letters);
 };
@@ -0,0 +1,186 @@
+#include "searchindex.h"
+
+#include <QStandardItemModel>
+
+SearchIndex::SearchIndex(QObject *parent)
+	: QObject(parent)
+	, _model(nullptr)
+{}
+
+/** Returns all items displaying a text which contains this one (case insensitive). */
+QList<QStandardItem*> SearchIndex::match(const QString &text) const
+{
+	QList<QStandardItem*> items;
+	const QString query = text.toCaseFolded();
+	if (query.isEmpty()) {
+		return items;
+	}
+
+	// Too short to have a trigram: compare distinct texts only
+	if (query.size() < 3) {
+		for (int id = 0; id < _texts.size(); id++) {
+			if (_texts.at(id).contains(query)) {
+				items.append(_itemsByText.at(id));
+			}
+		}
+		return items;
+	}
+
+	// Candidates are texts which contain the rarest trigram of the query
+	const QVector<int> *candidates = nullptr;
+	for (int i = 0; i + 2 < query.size(); i++) {
+		auto it = _trigrams.constFind(SearchIndex::trigram(query.constData() + i));
+		if (it == _trigrams.constEnd()) {
+			return items;
+		}
+		if (candidates == nullptr || it.value().size() < candidates->size()) {
+			candidates = &it.value();
+		}
+	}
+	for (int id : *candidates) {
+		if (_texts.at(id).contains(query)) {
+			items.append(_itemsByText.at(id));
+		}
+	}
+	return items;
+}
+
+/** Returns all items which have at least this rating. */
+QList<QStandardItem*> SearchIndex::matchRating(int minimumRating) const
+{
+	QList<QStandardItem*> items;
+	for (auto it = _ratings.cbegin(); it != _ratings.cend(); ++it) {
+		if (it.value() >= minimumRating && it.value() <= 5) {
+			items.append(it.key());
+		}
+	}
+	return items;
+}
+
+/** Indexes the whole model, and follows its changes. */
+void SearchIndex::setModel(QStandardItemModel *model)
+{
+	if (_model) {
+		_model->disconnect(this);
+	}
+	this->clear();
+	_model = model;
+	if (_model == nullptr) {
+		return;
+	}
+
+	auto itemFromIndex = [=](const QModelIndex &index) -> QStandardItem* {
+		return index.isValid() ? _model->itemFromIndex(index) : _model->invisibleRootItem();
+	};
+
+	connect(_model, &QAbstractItemModel::rowsInserted, this, [=](const QModelIndex &parent, int first, int last) {
+		if (QStandardItem *parentItem = itemFromIndex(parent)) {
+			for (int row = first; row <= last; row++) {
+				this->insertSubtree(parentItem->child(row, 0));
+			}
+		}
+	});
+	connect(_model, &QAbstractItemModel::rowsAboutToBeRemoved, this, [=](const QModelIndex &parent, int first, int last) {
+		if (QStandardItem *parentItem = itemFromIndex(parent)) {
+			for (int row = first; row <= last; row++) {
+				this->removeSubtree(parentItem->child(row, 0));
+			}
+		}
+	});
+	connect(_model, &QAbstractItemModel::dataChanged, this, [=](const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles) {
+		if (!roles.isEmpty() && !roles.contains(Qt::DisplayRole) && !roles.contains(Miam::DF_Rating)) {
+			return;
+		}
+		for (int row = topLeft.row(); row <= bottomRight.row(); row++) {
+			QStandardItem *item = _model->itemFromIndex(topLeft.sibling(row, 0));
+			if (item && _textByItem.contains(item)) {
+				this->removeItem(item);
+				this->insertItem(item);
+			}
+		}
+	});
+	connect(_model, &QAbstractItemModel::modelAboutToBeReset, this, &SearchIndex::clear);
+	connect(_model, &QAbstractItemModel::modelReset, this, [=]() {
+		this->insertSubtree(_model->invisibleRootItem());
+	});
+
+	this->insertSubtree(_model->invisibleRootItem());
+}
+
+void SearchIndex::clear()
+{
+	_texts.clear();
+	_textIds.clear();
+	_itemsByText.clear();
+	_textByItem.clear();
+	_trigrams.clear();
+	_ratings.clear();
+}
+
+void SearchIndex::insertItem(QStandardItem *item)
+{
+	const QString text = item->text().toCaseFolded();
+	int id = _textIds.value(text, -1);
+	if (id == -1) {
+		id = _texts.size();
+		_texts.append(text);
+		_textIds.insert(text, id);
+		_itemsByText.append(QList<QStandardItem*>());
+		for (int i = 0; i + 2 < text.size(); i++) {
+			// Identifiers are increasing, so a trigram repeated in the same text is referenced once
+			QVector<int> &ids = _trigrams[SearchIndex::trigram(text.constData() + i)];
+			if (ids.isEmpty() || ids.last() != id) {
+				ids.append(id);
+			}
+		}
+	}
+	_itemsByText[id].append(item);
+	_textByItem.insert(item, id);
+
+	QVariant rating = item->data(Miam::DF_Rating);
+	if (rating.isValid()) {
+		_ratings.insert(item, rating.toInt());
+	}
+}
+
+void SearchIndex::insertSubtree(QStandardItem *item)
+{
+	if (item == nullptr) {
+		return;
+	}
+	// The invisible root item is not displayed
+	if (item != _model->invisibleRootItem() && !_textByItem.contains(item)) {
+		this->insertItem(item);
+	}
+	for (int row = 0; row < item->rowCount(); row++) {
+		this->insertSubtree(item->child(row, 0));
+	}
+}
+
+void SearchIndex::removeItem(QStandardItem *item)
+{
+	auto it = _textByItem.find(item);
+	if (it == _textByItem.end()) {
+		return;
+	}
+	// Texts which are no longer displayed are kept, because trigrams are referencing them
+	_itemsByText[it.value()].removeOne(item);
+	_textByItem.erase(it);
+	_ratings.remove(item);
+}
+
+void SearchIndex::removeSubtree(QStandardItem *item)
+{
+	if (item == nullptr) {
+		return;
+	}
+	for (int row = 0; row < item->rowCount(); row++) {
+		this->removeSubtree(item->child(row, 0));
+	}
+	this->removeItem(item);
+}
+
+quint64 SearchIndex::trigram(const QChar *c)
+{
+	return (quint64(c[0].unicode()) << 32) | (quint64(c[1].unicode()) << 16) | quint64(c[2].unicode());
+}
@@ -0,0 +1,75 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QHash>
+#include <QObject>
+#include <QVector>
+
+#include "miamcore_global.h"
+
+/// Forward declarations
+class QStandardItem;
+class QStandardItemModel;
+
+/**
+ * \brief		The SearchIndex class is an index of texts displayed in a QStandardItemModel, used to find items while typing.
+ * \details		Distinct texts are case folded and split into trigrams. Each trigram references the texts which contain it, so looking
+ *				for "beatl" only compares texts which contain "bea", "eat" and "atl", instead of every item in the tree. Ratings are
+ *				indexed separately for queries like "***". The index follows insertions, removals and changes in the model.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY SearchIndex : public QObject
+{
+	Q_OBJECT
+private:
+	QStandardItemModel *_model;
+
+	/** Distinct case folded texts. The position of a text is its identifier, identifiers are never reused. */
+	QVector<QString> _texts;
+
+	QHash<QString, int> _textIds;
+
+	/** Items which are displaying each text, by text identifier. */
+	QVector<QList<QStandardItem*>> _itemsByText;
+
+	/** Reverse lookup, used when an item is removed or has changed. */
+	QHash<QStandardItem*, int> _textByItem;
+
+	/** Each trigram references texts in ascending order of their identifiers. */
+	QHash<quint64, QVector<int>> _trigrams;
+
+	QHash<QStandardItem*, int> _ratings;
+
+public:
+	explicit SearchIndex(QObject *parent = nullptr);
+
+	virtual ~SearchIndex() {}
+
+	/** Returns true if this item is still in the model. */
+	inline bool contains(QStandardItem *item) const { return _textByItem.contains(item); }
+
+	/** Returns all items displaying a text which contains this one (case insensitive). */
+	QList<QStandardItem*> match(const QString &text) const;
+
+	/** Returns all items which have at least this rating. */
+	QList<QStandardItem*> matchRating(int minimumRating) const;
+
+	/** Indexes the whole model, and follows its changes. */
+	void setModel(QStandardItemModel *model);
+
+private:
+	void clear();
+
+	void insertItem(QStandardItem *item);
+
+	void insertSubtree(QStandardItem *item);
+
+	void removeItem(QStandardItem *item);
+
+	void removeSubtree(QStandardItem *item);
+
+	static quint64 trigram(const QChar *c);
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,19 @@
+#include "librarynotifier.h"
+
+#include <QCoreApplication>
+
+LibraryNotifier::LibraryNotifier(QObject *parent)
+	: QObject(parent)
+{
+	moveToThread(QCoreApplication::instance()->thread());
+}
+
+/** Can be called from any thread. It's destroyed with the application. */
+LibraryNotifier* LibraryNotifier::instance()
+{
+	static LibraryNotifier *notifier = [] () {
+		qAddPostRoutine([] () { delete LibraryNotifier::instance(); });
+		return new LibraryNotifier;
+	}();
+	return notifier;
+}
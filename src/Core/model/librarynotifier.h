@@ -0,0 +1,32 @@
+#ifndef LIBRARYNOTIFIER_H
+#define LIBRARYNOTIFIER_H
+
+#include <QObject>
+#include <QStringList>
+
+#include "../miamcore_global.h"
+
+/**
+ * \brief		The LibraryNotifier class tells views which follow the library which tracks have changed.
+ * \details		The scanner, the history of plays and views like smart playlists don't know each other, and are created and destroyed
+ *				at different times: the scanner and the history forward their signals to the notifier, and views connect to it.
+ *				The notifier lives in the main thread, so views receive uris in their thread, whatever the thread which sent them.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY LibraryNotifier : public QObject
+{
+	Q_OBJECT
+private:
+	explicit LibraryNotifier(QObject *parent = nullptr);
+
+public:
+	/** Can be called from any thread. It's destroyed with the application. */
+	static LibraryNotifier* instance();
+
+signals:
+	/** Files which were added, changed or removed by the scanner, or which were played. */
+	void tracksHaveChanged(const QStringList &uris);
+};
+
+#endif // LIBRARYNOTIFIER_H
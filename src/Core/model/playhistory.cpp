@@ -0,0 +1,162 @@
+#include "playhistory.h"
+#include "librarynotifier.h"
+#include "sqldatabase.h"
+
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTimer>
+
+#include <QtDebug>
+
+PlayHistory::PlayHistory(QObject *parent)
+	: QObject(parent)
+	, _db(nullptr)
+	, _timer(new QTimer(this))
+{
+	_timer->setSingleShot(true);
+	_timer->setInterval(flushDelay);
+	connect(_timer, &QTimer::timeout, this, &PlayHistory::flush);
+
+	// Rules of smart playlists can use play counters
+	connect(this, &PlayHistory::playsSaved, LibraryNotifier::instance(), &LibraryNotifier::tracksHaveChanged);
+}
+
+/** Pending plays are saved. */
+PlayHistory::~PlayHistory()
+{
+	this->flush();
+	delete _db;
+}
+
+/** Tells if an interrupted play is a skip, from the time which was played and the duration of the track, in ms. */
+bool PlayHistory::isSkip(qint64 playedTime, qint64 trackDuration)
+{
+	// Like scrobblers, a track counts as played after half of it, or after 4 minutes
+	return playedTime < qMin<qint64>(trackDuration / 2, 240000);
+}
+
+/** Tracks with the most plays, the most played first. */
+QStringList PlayHistory::mostPlayed(int limit)
+{
+	return this->selectTracks("SELECT s.uri FROM playStats s WHERE s.playCount > 0 ORDER BY s.playCount DESC LIMIT ?", limit);
+}
+
+/** Tracks which were never played to the end, the last ones which were added to the library first. */
+QStringList PlayHistory::neverPlayed(int limit)
+{
+	return this->selectTracks("SELECT c.uri FROM cache c WHERE NOT EXISTS " \
+							  "(SELECT 1 FROM playStats s WHERE s.uri = c.uri AND s.playCount > 0) " \
+							  "ORDER BY c.added DESC LIMIT ?", limit);
+}
+
+/** Tracks which were added to the library last, the newest first. */
+QStringList PlayHistory::recentlyAdded(int limit)
+{
+	// Ids change when the library is scanned again, the date is kept when a file is updated or moved
+	return this->selectTracks("SELECT uri FROM cache ORDER BY added DESC LIMIT ?", limit);
+}
+
+/** Tracks which were played last, the latest first. Skips are ignored. */
+QStringList PlayHistory::recentlyPlayed(int limit)
+{
+	return this->selectTracks("SELECT s.uri FROM playStats s WHERE s.lastPlayed IS NOT NULL ORDER BY s.lastPlayed DESC LIMIT ?", limit);
+}
+
+/** Called by the player, from any thread. Plays are saved later. */
+void PlayHistory::record(const Play &play)
+{
+	QMutexLocker locker(&_mutex);
+	_plays.append(play);
+
+	// Timer and database belong to the thread of this object
+	if (_plays.size() == 1) {
+		QMetaObject::invokeMethod(_timer, "start", Qt::QueuedConnection);
+	} else if (_plays.size() == maxPendingPlays) {
+		QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+	}
+}
+
+SqlDatabase* PlayHistory::database()
+{
+	if (_db == nullptr) {
+		_db = new SqlDatabase;
+	}
+	return _db;
+}
+
+QStringList PlayHistory::selectTracks(const QString &query, int limit)
+{
+	QStringList uris;
+	QSqlQuery selectTracks(*this->database());
+	selectTracks.setForwardOnly(true);
+	selectTracks.prepare(query);
+	selectTracks.addBindValue(limit);
+	if (!selectTracks.exec()) {
+		qDebug() << Q_FUNC_INFO << selectTracks.lastError();
+		return uris;
+	}
+	while (selectTracks.next()) {
+		uris.append(selectTracks.value(0).toString());
+	}
+	return uris;
+}
+
+/** Saves pending plays in one transaction, and updates counters of their tracks. */
+void PlayHistory::flush()
+{
+	QList<Play> plays;
+	_mutex.lock();
+	plays.swap(_plays);
+	_mutex.unlock();
+	_timer->stop();
+	if (plays.isEmpty()) {
+		return;
+	}
+
+	SqlDatabase *db = this->database();
+	db->transaction();
+	QSqlQuery selectTrack(*db);
+	selectTrack.prepare("SELECT 1 FROM cache WHERE uri = ?");
+	QSqlQuery insertPlay(*db);
+	insertPlay.prepare("INSERT INTO plays (uri, timestamp, duration, skipped) VALUES (?, ?, ?, ?)");
+	QSqlQuery insertStats(*db);
+	insertStats.prepare("INSERT OR IGNORE INTO playStats (uri, playCount, skipCount, playedTime) VALUES (?, 0, 0, 0)");
+	QSqlQuery updateStats(*db);
+	updateStats.prepare("UPDATE playStats SET playCount = playCount + ?, skipCount = skipCount + ?, playedTime = playedTime + ?, " \
+						"lastPlayed = NULLIF(MAX(IFNULL(lastPlayed, 0), ?), 0) WHERE uri = ?");
+	QStringList uris;
+	for (const Play &play : plays) {
+		// Files which aren't in the library would leave rows which are never deleted
+		selectTrack.addBindValue(play.uri);
+		if (!selectTrack.exec() || !selectTrack.next()) {
+			selectTrack.finish();
+			continue;
+		}
+		selectTrack.finish();
+
+		insertPlay.addBindValue(play.uri);
+		insertPlay.addBindValue(play.timestamp);
+		insertPlay.addBindValue(play.duration);
+		insertPlay.addBindValue(play.isSkipped);
+		if (!insertPlay.exec()) {
+			qDebug() << Q_FUNC_INFO << insertPlay.lastError();
+			continue;
+		}
+		insertStats.addBindValue(play.uri);
+		insertStats.exec();
+		updateStats.addBindValue(play.isSkipped ? 0 : 1);
+		updateStats.addBindValue(play.isSkipped ? 1 : 0);
+		updateStats.addBindValue(play.duration);
+		updateStats.addBindValue(play.isSkipped ? 0 : play.timestamp);
+		updateStats.addBindValue(play.uri);
+		updateStats.exec();
+		if (!uris.contains(play.uri)) {
+			uris.append(play.uri);
+		}
+	}
+	db->commit();
+
+	if (!uris.isEmpty()) {
+		emit playsSaved(uris);
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef PLAYHISTORY_H
+#define PLAYHISTORY_H
+
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+
+#include "../miamcore_global.h"
+
+/// Forward declarations
+class QTimer;
+class SqlDatabase;
+
+/**
+ * \brief		The PlayHistory class records plays and skips of tracks, and keeps counters for each track.
+ * \details		The player only appends plays to a buffer in memory, which takes a short lock and never touches the database. The
+ *				buffer is saved in the thread of this object, a few seconds after the first pending play or as soon as it's full,
+ *				in a single transaction: one row per play in table "plays", and counters of each track in table "playStats".
+ *				Counters are updated with each batch, so lists like "most played" and conditions of smart playlists read one row
+ *				per track instead of the whole history.
+ *				A play is a skip when it's interrupted before half of the track, or before 4 minutes for long tracks.
+ *				Tracks are referenced by their uri, like in tables "loudness" and "fingerprints", because ids in table "cache" change
+ *				when the library is scanned again. Files which aren't in the library are not recorded, and plays of a file are deleted
+ *				when it's removed from the library.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY PlayHistory : public QObject
+{
+	Q_OBJECT
+public:
+	struct Play
+	{
+		QString uri;
+		/** Beginning of the play, in ms since epoch. */
+		qint64 timestamp;
+		/** Time which was actually played, in ms. */
+		qint64 duration;
+		bool isSkipped;
+	};
+
+	/** Milliseconds between the first pending play and the flush. */
+	static const int flushDelay = 5000;
+
+	/** Plays which are saved immediately. */
+	static const int maxPendingPlays = 64;
+
+private:
+	SqlDatabase *_db;
+
+	QTimer *_timer;
+
+	/** Protects plays which are sent by the player. */
+	QMutex _mutex;
+
+	QList<Play> _plays;
+
+public:
+	explicit PlayHistory(QObject *parent = nullptr);
+
+	/** Pending plays are saved. */
+	virtual ~PlayHistory();
+
+	/** Tells if an interrupted play is a skip, from the time which was played and the duration of the track, in ms. */
+	static bool isSkip(qint64 playedTime, qint64 trackDuration);
+
+	/** Tracks with the most plays, the most played first. */
+	QStringList mostPlayed(int limit);
+
+	/** Tracks which were never played to the end, the last ones which were added to the library first. */
+	QStringList neverPlayed(int limit);
+
+	/** Tracks which were added to the library last, the newest first. */
+	QStringList recentlyAdded(int limit);
+
+	/** Tracks which were played last, the latest first. Skips are ignored. */
+	QStringList recentlyPlayed(int limit);
+
+	/** Called by the player, from any thread. Plays are saved later. */
+	void record(const Play &play);
+
+private:
+	SqlDatabase* database();
+
+	QStringList selectTracks(const QString &query, int limit);
+
+public slots:
+	/** Saves pending plays in one transaction, and updates counters of their tracks. */
+	void flush();
+
+signals:
+	/** Tracks whose counters have changed, for smart playlists. */
+	void playsSaved(const QStringList &uris);
+};
+
+#endif // PLAYHISTORY_H
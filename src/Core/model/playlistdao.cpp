@@ -7,7 +7,8 @@ PlaylistDAO::PlaylistDAO(QObject *parent)
 PlaylistDAO::PlaylistDAO(const PlaylistDAO &other)
 	: GenericDAO(other),
 	  _background(other.background()),
-	  _length(other.length())
+	  _length(other.length()),
+	  _rules(other.rules())
 {}
 
 PlaylistDAO& PlaylistDAO::operator=(const PlaylistDAO& other)
@@ -15,6 +16,7 @@ PlaylistDAO& PlaylistDAO::operator=(const PlaylistDAO& other)
 	GenericDAO::operator=(other);
 	_background = other.background();
 	_length = other.length();
+	_rules = other.rules();
 	return *this;
 }
 
@@ -26,3 +28,7 @@ void PlaylistDAO::setBackground(const QString &background) { _background = backg
 
 QString PlaylistDAO::length() const { return _length; }
 void PlaylistDAO::setLength(const QString &length) { _length = length; }
+
+/** Rules of a smart playlist, as JSON. Empty for a playlist of chosen tracks. */
+QString PlaylistDAO::rules() const { return _rules; }
+void PlaylistDAO::setRules(const QString &rules) { _rules = rules; }
@@ -15,6 +15,9 @@ class MIAMCORE_LIBRARY PlaylistDAO : public GenericDAO
 private:
 	QString _background, _length;
 
+	/** Rules of a smart playlist, as JSON. Empty for a playlist of chosen tracks. */
+	QString _rules;
+
 public:
 	explicit PlaylistDAO(QObject *parent = nullptr);
 
@@ -29,6 +32,12 @@ public:
 
 	QString length() const;
 	void setLength(const QString &length);
+
+	/** Rules of a smart playlist, as JSON. Empty for a playlist of chosen tracks. */
+	QString rules() const;
+	void setRules(const QString &rules);
+
+	inline bool isSmart() const { return !_rules.isEmpty(); }
 };
 
 /** Register this class to convert in QVariant. */
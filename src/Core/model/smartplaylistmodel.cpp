@@ -0,0 +1,271 @@
+#include "smartplaylistmodel.h"
+#include "librarynotifier.h"
+#include "sqldatabase.h"
+
+#include <QSet>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include <QtDebug>
+
+#include <algorithm>
+
+namespace {
+
+const char *trackColumns = "c.rowid, c.uri, c.trackTitle, c.artist, c.album, c.trackNumber, c.trackLength, c.rating, c.albumYear";
+
+/** Files which are checked with one query. */
+const int chunkSize = 500;
+
+}
+
+SmartPlaylistModel::SmartPlaylistModel(QObject *parent)
+	: QAbstractListModel(parent)
+	, _db(nullptr)
+	, _rule(SmartPlaylistRule::fromJson(QByteArray()))
+	, _lastId(0)
+	, _isComplete(true)
+{
+	connect(LibraryNotifier::instance(), &LibraryNotifier::tracksHaveChanged, this, &SmartPlaylistModel::updateTracks);
+}
+
+SmartPlaylistModel::~SmartPlaylistModel()
+{
+	delete _db;
+}
+
+bool SmartPlaylistModel::canFetchMore(const QModelIndex &parent) const
+{
+	return !parent.isValid() && !_isComplete;
+}
+
+QVariant SmartPlaylistModel::data(const QModelIndex &index, int role) const
+{
+	if (!index.isValid() || index.row() >= _tracks.size()) {
+		return QVariant();
+	}
+	const Track &track = _tracks.at(index.row());
+	switch (role) {
+	case Qt::DisplayRole:
+	case TitleRole:
+		return track.title;
+	case UriRole:
+		return track.uri;
+	case ArtistRole:
+		return track.artist;
+	case AlbumRole:
+		return track.album;
+	case TrackNumberRole:
+		return track.trackNumber;
+	case LengthRole:
+		return track.length;
+	case RatingRole:
+		return track.rating;
+	case YearRole:
+		return track.year;
+	default:
+		return QVariant();
+	}
+}
+
+void SmartPlaylistModel::fetchMore(const QModelIndex &parent)
+{
+	if (!this->canFetchMore(parent)) {
+		return;
+	}
+
+	QSqlQuery selectTracks(*this->database());
+	selectTracks.setForwardOnly(true);
+	selectTracks.prepare(QString("SELECT %1 FROM cache c WHERE (%2) AND c.rowid > ? ORDER BY c.rowid LIMIT ?").arg(trackColumns, _condition));
+	for (const QVariant &value : _values) {
+		selectTracks.addBindValue(value);
+	}
+	selectTracks.addBindValue(_lastId);
+	selectTracks.addBindValue(pageSize);
+	if (!selectTracks.exec()) {
+		qDebug() << Q_FUNC_INFO << selectTracks.lastError();
+		_isComplete = true;
+		return;
+	}
+	QVector<Track> page;
+	page.reserve(pageSize);
+	while (selectTracks.next()) {
+		page.append(SmartPlaylistModel::readTrack(selectTracks));
+	}
+	_isComplete = page.size() < pageSize;
+	if (page.isEmpty()) {
+		return;
+	}
+
+	// Tracks of the previous pages have smaller ids, even those which were inserted by the scanner
+	beginInsertRows(QModelIndex(), _tracks.size(), _tracks.size() + page.size() - 1);
+	for (const Track &track : page) {
+		_ids.insert(track.uri, track.id);
+	}
+	_tracks += page;
+	_lastId = page.last().id;
+	endInsertRows();
+}
+
+/** Reads rules of a playlist of the database. Returns false if it's not a smart playlist. */
+bool SmartPlaylistModel::loadPlaylist(uint playlistId)
+{
+	const PlaylistDAO playlist = this->database()->selectPlaylist(playlistId);
+	if (!playlist.isSmart()) {
+		return false;
+	}
+	this->setRules(playlist.rules());
+	return true;
+}
+
+QHash<int, QByteArray> SmartPlaylistModel::roleNames() const
+{
+	QHash<int, QByteArray> roles;
+	roles[UriRole] = "uri";
+	roles[TitleRole] = "title";
+	roles[ArtistRole] = "artist";
+	roles[AlbumRole] = "album";
+	roles[TrackNumberRole] = "trackNumber";
+	roles[LengthRole] = "length";
+	roles[RatingRole] = "rating";
+	roles[YearRole] = "year";
+	return roles;
+}
+
+int SmartPlaylistModel::rowCount(const QModelIndex &parent) const
+{
+	return parent.isValid() ? 0 : _tracks.size();
+}
+
+/** Rules as JSON, like in table "playlists". */
+QString SmartPlaylistModel::rules() const
+{
+	return _rule.isValid() ? QString::fromUtf8(_rule.toJson()) : QString();
+}
+
+/** Evaluates the playlist again from the first page. An invalid rule gives an empty playlist. */
+void SmartPlaylistModel::setRule(const SmartPlaylistRule &rule)
+{
+	beginResetModel();
+	_rule = rule;
+	_condition.clear();
+	_values.clear();
+	_tracks.clear();
+	_ids.clear();
+	_lastId = 0;
+	_isComplete = !_rule.compile(&_condition, &_values);
+	endResetModel();
+	emit rulesChanged();
+}
+
+void SmartPlaylistModel::setRules(const QString &rules)
+{
+	this->setRule(SmartPlaylistRule::fromJson(rules.toUtf8()));
+}
+
+SqlDatabase* SmartPlaylistModel::database()
+{
+	if (_db == nullptr) {
+		_db = new SqlDatabase;
+	}
+	return _db;
+}
+
+/** Row of a track, or the row where it would be inserted. */
+int SmartPlaylistModel::rowOf(qint64 id) const
+{
+	auto it = std::lower_bound(_tracks.cbegin(), _tracks.cend(), id, [] (const Track &track, qint64 id) {
+		return track.id < id;
+	});
+	return int(it - _tracks.cbegin());
+}
+
+SmartPlaylistModel::Track SmartPlaylistModel::readTrack(const QSqlQuery &query)
+{
+	Track track;
+	int i = -1;
+	track.id = query.value(++i).toLongLong();
+	track.uri = query.value(++i).toString();
+	track.title = query.value(++i).toString();
+	track.artist = query.value(++i).toString();
+	track.album = query.value(++i).toString();
+	track.trackNumber = query.value(++i).toInt();
+	track.length = query.value(++i).toInt();
+	track.rating = query.value(++i).toInt();
+	track.year = query.value(++i).toInt();
+	return track;
+}
+
+void SmartPlaylistModel::removeTrack(const QString &uri)
+{
+	if (!_ids.contains(uri)) {
+		return;
+	}
+	const int row = this->rowOf(_ids.take(uri));
+	beginRemoveRows(QModelIndex(), row, row);
+	_tracks.remove(row);
+	endRemoveRows();
+}
+
+/** Applies changes of the scanner and plays to tracks which were read, by batches. Files which aren't in the library anymore are removed. */
+void SmartPlaylistModel::updateTracks(const QStringList &uris)
+{
+	if (_condition.isEmpty()) {
+		return;
+	}
+
+	for (int first = 0; first < uris.size(); first += chunkSize) {
+		const QStringList chunk = uris.mid(first, chunkSize);
+		QStringList placeholders;
+		for (int i = 0; i < chunk.size(); i++) {
+			placeholders.append("?");
+		}
+
+		// The rule is evaluated by SQLite, for files of the batch only
+		QSqlQuery selectTracks(*this->database());
+		selectTracks.setForwardOnly(true);
+		selectTracks.prepare(QString("SELECT %1, COALESCE(%2, 0) FROM cache c WHERE c.uri IN (%3)")
+							 .arg(trackColumns, _condition, placeholders.join(",")));
+		for (const QVariant &value : _values) {
+			selectTracks.addBindValue(value);
+		}
+		for (const QString &uri : chunk) {
+			selectTracks.addBindValue(uri);
+		}
+		if (!selectTracks.exec()) {
+			qDebug() << Q_FUNC_INFO << selectTracks.lastError();
+			return;
+		}
+
+		QSet<QString> existingTracks;
+		while (selectTracks.next()) {
+			const Track track = SmartPlaylistModel::readTrack(selectTracks);
+			const bool isMatching = selectTracks.value(9).toBool();
+			existingTracks.insert(track.uri);
+
+			// A file which was removed and added again has a new id, and maybe another row
+			if (_ids.contains(track.uri) && (!isMatching || _ids.value(track.uri) != track.id)) {
+				this->removeTrack(track.uri);
+			}
+			if (!isMatching) {
+				continue;
+			}
+			const int row = this->rowOf(track.id);
+			if (_ids.contains(track.uri)) {
+				_tracks[row] = track;
+				emit dataChanged(index(row), index(row));
+			} else if (_isComplete || track.id <= _lastId) {
+				beginInsertRows(QModelIndex(), row, row);
+				_tracks.insert(row, track);
+				_ids.insert(track.uri, track.id);
+				_lastId = qMax(_lastId, track.id);
+				endInsertRows();
+			}
+		}
+		for (const QString &uri : chunk) {
+			if (!existingTracks.contains(uri)) {
+				this->removeTrack(uri);
+			}
+		}
+	}
+}
@@ -0,0 +1,126 @@
+#ifndef SMARTPLAYLISTMODEL_H
+#define SMARTPLAYLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+#include "smartplaylistrule.h"
+#include "../miamcore_global.h"
+
+/// Forward declarations
+class QSqlQuery;
+class SqlDatabase;
+
+/**
+ * \brief		The SmartPlaylistModel class lists tracks of the library which match the rules of a smart playlist.
+ * \details		Rules are compiled once to a parameterized query, and tracks are read by pages when views need them, in the order of
+ *				the library (rowid). A page starts after the last track which was read, not at an offset, so each page is a range on
+ *				the primary key and only tracks which are displayed are in memory.
+ *				Changes of the scanner and new plays are received from the LibraryNotifier, and applied incrementally: for a batch of
+ *				files, a single query tells which ones match now.
+ *				Tracks are inserted, updated or removed, except tracks after the last page, which will be read with their page.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY SmartPlaylistModel : public QAbstractListModel
+{
+	Q_OBJECT
+	Q_PROPERTY(QString rules READ rules WRITE setRules NOTIFY rulesChanged)
+public:
+	enum CustomRoles {
+		UriRole			= Qt::UserRole + 1,
+		TitleRole		= Qt::UserRole + 2,
+		ArtistRole		= Qt::UserRole + 3,
+		AlbumRole		= Qt::UserRole + 4,
+		TrackNumberRole	= Qt::UserRole + 5,
+		LengthRole		= Qt::UserRole + 6,
+		RatingRole		= Qt::UserRole + 7,
+		YearRole		= Qt::UserRole + 8
+	};
+
+	/** Tracks which are read with one query. */
+	static const int pageSize = 200;
+
+private:
+	struct Track
+	{
+		qint64 id;
+		QString uri;
+		QString title;
+		QString artist;
+		QString album;
+		int trackNumber;
+		int length;
+		int rating;
+		int year;
+	};
+
+	SqlDatabase *_db;
+
+	SmartPlaylistRule _rule;
+
+	/** Compiled rule, and its parameters. */
+	QString _condition;
+
+	QVariantList _values;
+
+	/** Tracks which were read, ordered by id. */
+	QVector<Track> _tracks;
+
+	/** Id of tracks which were read. */
+	QHash<QString, qint64> _ids;
+
+	/** Id of the last track which was read, where the next page starts. */
+	qint64 _lastId;
+
+	bool _isComplete;
+
+public:
+	explicit SmartPlaylistModel(QObject *parent = nullptr);
+
+	virtual ~SmartPlaylistModel();
+
+	virtual bool canFetchMore(const QModelIndex &parent) const override;
+
+	virtual QVariant data(const QModelIndex &index, int role) const override;
+
+	virtual void fetchMore(const QModelIndex &parent) override;
+
+	/** Reads rules of a playlist of the database. Returns false if it's not a smart playlist. */
+	Q_INVOKABLE bool loadPlaylist(uint playlistId);
+
+	virtual QHash<int, QByteArray> roleNames() const override;
+
+	virtual int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+
+	inline SmartPlaylistRule rule() const { return _rule; }
+
+	/** Rules as JSON, like in table "playlists". */
+	QString rules() const;
+
+	/** Evaluates the playlist again from the first page. An invalid rule gives an empty playlist. */
+	void setRule(const SmartPlaylistRule &rule);
+
+	void setRules(const QString &rules);
+
+private:
+	SqlDatabase* database();
+
+	/** Row of a track, or the row where it would be inserted. */
+	int rowOf(qint64 id) const;
+
+	static Track readTrack(const QSqlQuery &query);
+
+	void removeTrack(const QString &uri);
+
+public slots:
+	/** Applies changes of the scanner and plays to tracks which were read, by batches. Files which aren't in the library anymore are removed. */
+	void updateTracks(const QStringList &uris);
+
+signals:
+	void rulesChanged();
+};
+
+#endif // SMARTPLAYLISTMODEL_H
@@ -0,0 +1,237 @@
+#include "smartplaylistrule.h"
+#include "sqldatabase.h"
+
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QStringList>
+
+namespace {
+
+/** Names in JSON documents, in the order of enums. */
+const char *fieldNames[] = { "", "title", "artist", "album", "year", "rating", "length", "trackNumber", "disc", "uri",
+							 "playCount", "skipCount", "lastPlayed" };
+const char *operatorNames[] = { "all", "any", "not", "=", "!=", "<", "<=", ">", ">=", "between", "contains", "startsWith", "inLast" };
+
+/** Counters of tracks which were never played are 0, the date of their last play is NULL. */
+const char *columns[] = { "", "c.trackTitle", "c.artist", "c.album", "c.albumYear", "c.rating", "c.trackLength", "c.trackNumber",
+						  "c.disc", "c.uri",
+						  "IFNULL((SELECT s.playCount FROM playStats s WHERE s.uri = c.uri), 0)",
+						  "IFNULL((SELECT s.skipCount FROM playStats s WHERE s.uri = c.uri), 0)",
+						  "(SELECT s.lastPlayed FROM playStats s WHERE s.uri = c.uri)" };
+const char *comparisons[] = { "", "", "", " = ?", " <> ?", " < ?", " <= ?", " > ?", " >= ?", " BETWEEN ? AND ?" };
+
+template<size_t N>
+int indexOf(const char *(&names)[N], const QString &name)
+{
+	for (size_t i = 0; i < N; i++) {
+		if (name == QLatin1String(names[i])) {
+			return int(i);
+		}
+	}
+	return -1;
+}
+
+/** Wildcards of LIKE which are part of the value. */
+QString escapeLike(QString value)
+{
+	value.replace('\\', "\\\\");
+	value.replace('%', "\\%");
+	value.replace('_', "\\_");
+	return value;
+}
+
+}
+
+/** An empty group, which matches every track. */
+SmartPlaylistRule::SmartPlaylistRule()
+	: _operator(All)
+	, _field(NoField)
+{}
+
+/** Every rule must match. */
+SmartPlaylistRule SmartPlaylistRule::all(const QList<SmartPlaylistRule> &rules)
+{
+	SmartPlaylistRule rule;
+	rule._rules = rules;
+	return rule;
+}
+
+/** At least one rule must match. */
+SmartPlaylistRule SmartPlaylistRule::any(const QList<SmartPlaylistRule> &rules)
+{
+	SmartPlaylistRule rule;
+	rule._operator = Any;
+	rule._rules = rules;
+	return rule;
+}
+
+/** Builds a condition. Between needs the lower and the upper bound, both included. */
+SmartPlaylistRule SmartPlaylistRule::condition(Field field, Operator op, const QVariant &value, const QVariant &upperValue)
+{
+	SmartPlaylistRule rule;
+	rule._operator = op;
+	rule._field = field;
+	rule._values.append(value);
+	if (upperValue.isValid()) {
+		rule._values.append(upperValue);
+	}
+	return rule;
+}
+
+/** Appends an SQL expression over "cache c" to a string, and its parameters to a list. Returns false if the rule isn't valid. */
+bool SmartPlaylistRule::compile(QString *sql, QVariantList *values) const
+{
+	if (!this->isValid()) {
+		return false;
+	}
+
+	if (_operator == Not) {
+		// A condition on NULL is NULL, which must become false before it's negated
+		sql->append("NOT COALESCE(");
+		_rules.first().compile(sql, values);
+		sql->append(", 0)");
+		return true;
+	} else if (this->isGroup()) {
+		if (_rules.isEmpty()) {
+			sql->append(_operator == All ? "1" : "0");
+			return true;
+		}
+		sql->append('(');
+		for (int i = 0; i < _rules.size(); i++) {
+			if (i > 0) {
+				sql->append(_operator == All ? " AND " : " OR ");
+			}
+			_rules.at(i).compile(sql, values);
+		}
+		sql->append(')');
+		return true;
+	}
+
+	const QVariant value = _values.first();
+	if ((_operator == Equals || _operator == NotEquals) && (_field == Artist || _field == Album)) {
+		// Same normalization as the scanner, on indexed columns
+		sql->append(_field == Artist ? "c.artistNormalized" : "c.albumNormalized");
+		sql->append(comparisons[_operator]);
+		values->append(SqlDatabase::normalizeField(value.toString()));
+	} else if (_operator == StartsWith && _field == Uri) {
+		// A range instead of LIKE, which can't use the primary key
+		sql->append("(c.uri >= ? AND c.uri < ?)");
+		const uint last = 0x10FFFF;
+		values->append(value.toString());
+		values->append(value.toString() + QString::fromUcs4(&last, 1));
+	} else if (_operator == InLast) {
+		sql->append(columns[_field]);
+		sql->append(" >= ?");
+		values->append(QDateTime::currentMSecsSinceEpoch() - value.toLongLong() * 86400000);
+	} else if (_operator == Contains || _operator == StartsWith) {
+		sql->append(columns[_field]);
+		sql->append(" LIKE ? ESCAPE '\\'");
+		const QString pattern = escapeLike(value.toString()) + '%';
+		values->append(_operator == Contains ? QString('%') + pattern : pattern);
+	} else {
+		sql->append(columns[_field]);
+		sql->append(comparisons[_operator]);
+		values->append(_values);
+	}
+	return true;
+}
+
+/** Reads rules saved by toJson(). Returns an invalid rule if the document can't be read. */
+SmartPlaylistRule SmartPlaylistRule::fromJson(const QByteArray &json)
+{
+	QJsonParseError error;
+	const QJsonDocument document = QJsonDocument::fromJson(json, &error);
+	if (error.error != QJsonParseError::NoError || !document.isObject()) {
+		return SmartPlaylistRule::condition(NoField, Equals, QVariant());
+	}
+	return SmartPlaylistRule::fromVariant(document.toVariant().toMap());
+}
+
+/** Groups are valid if their rules are. Conditions need a field, text operators need a text field, and InLast needs a date. */
+bool SmartPlaylistRule::isValid() const
+{
+	if (this->isGroup()) {
+		if (_operator == Not && _rules.size() != 1) {
+			return false;
+		}
+		for (const SmartPlaylistRule &rule : _rules) {
+			if (!rule.isValid()) {
+				return false;
+			}
+		}
+		return true;
+	}
+	if (_field <= NoField || _field > LastPlayed || _operator > InLast) {
+		return false;
+	} else if (_operator == InLast) {
+		return _values.size() == 1 && _field == LastPlayed;
+	} else if (_operator == Between) {
+		return _values.size() == 2;
+	} else if (_operator == Contains || _operator == StartsWith) {
+		return _values.size() == 1 && SmartPlaylistRule::isTextField(_field);
+	}
+	return _values.size() == 1;
+}
+
+/** The rule must not match. */
+SmartPlaylistRule SmartPlaylistRule::negation(const SmartPlaylistRule &rule)
+{
+	SmartPlaylistRule negation;
+	negation._operator = Not;
+	negation._rules.append(rule);
+	return negation;
+}
+
+QByteArray SmartPlaylistRule::toJson() const
+{
+	return QJsonDocument::fromVariant(this->toVariant()).toJson(QJsonDocument::Compact);
+}
+
+bool SmartPlaylistRule::isGroup() const
+{
+	return _operator == All || _operator == Any || _operator == Not;
+}
+
+bool SmartPlaylistRule::isTextField(Field field)
+{
+	return field == Title || field == Artist || field == Album || field == Uri;
+}
+
+SmartPlaylistRule SmartPlaylistRule::fromVariant(const QVariantMap &map)
+{
+	SmartPlaylistRule rule;
+	const int op = indexOf(operatorNames, map.value("op").toString());
+	const int field = indexOf(fieldNames, map.value("field").toString());
+	if (op < 0 || field < 0) {
+		// Written by a newer version, or by hand
+		return SmartPlaylistRule::condition(NoField, Equals, QVariant());
+	}
+	rule._operator = Operator(op);
+	rule._field = Field(field);
+	if (rule.isGroup()) {
+		for (const QVariant &child : map.value("rules").toList()) {
+			rule._rules.append(SmartPlaylistRule::fromVariant(child.toMap()));
+		}
+	} else {
+		const QVariant value = map.value("value");
+		rule._values = value.type() == QVariant::List ? value.toList() : QVariantList({ value });
+	}
+	return rule;
+}
+
+QVariantMap SmartPlaylistRule::toVariant() const
+{
+	QVariantMap map;
+	map.insert("op", operatorNames[_operator]);
+	if (this->isGroup()) {
+		QVariantList rules;
+		for (const SmartPlaylistRule &rule : _rules) {
+			rules.append(rule.toVariant());
+		}
+		map.insert("rules", rules);
+	} else {
+		map.insert("field", fieldNames[_field]);
+		map.insert("value", _values.size() == 1 ? _values.first() : QVariant(_values));
+	}
+	return map;
+}
@@ -0,0 +1,115 @@
+#ifndef SMARTPLAYLISTRULE_H
+#define SMARTPLAYLISTRULE_H
+
+#include <QList>
+#include <QVariant>
+
+#include "../miamcore_global.h"
+
+/**
+ * \brief		The SmartPlaylistRule class is a node of the rules of a smart playlist, like "rating >= 4 AND year BETWEEN 1990 AND 1999".
+ * \details		A node is either a condition on one column of table "cache", or a group of rules: all of them must match, any of
+ *				them can match, or the only one must not match. Rules are stored with their playlist as JSON.
+ *				Rules are compiled to a parameterized SQL expression over "cache c": values are never part of the SQL string, and
+ *				columns come from a fixed list. Conditions are written so SQLite can use the indexes of the table: equality on an
+ *				artist or an album uses normalized names, and "starts with" on a path is a range on the primary key.
+ *				Play counters are read from table "playStats" with a lookup on its primary key. "NOT played in 30 days" is the
+ *				negation of "LastPlayed InLast 30": dates are computed when the rule is compiled.
+ *				A condition on a column which is NULL doesn't match, so its negation does: "NOT rating >= 4" includes unrated tracks.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY SmartPlaylistRule
+{
+public:
+	enum Field : int
+	{
+		NoField			= 0,
+		Title			= 1,
+		Artist			= 2,
+		Album			= 3,
+		Year			= 4,
+		Rating			= 5,
+		Length			= 6,
+		TrackNumber		= 7,
+		Disc			= 8,
+		Uri				= 9,
+		PlayCount		= 10,
+		SkipCount		= 11,
+		LastPlayed		= 12
+	};
+
+	enum Operator : int
+	{
+		All				= 0,
+		Any				= 1,
+		Not				= 2,
+		Equals			= 3,
+		NotEquals		= 4,
+		LessThan		= 5,
+		LessOrEqual		= 6,
+		GreaterThan		= 7,
+		GreaterOrEqual	= 8,
+		Between			= 9,
+		Contains		= 10,
+		StartsWith		= 11,
+		/** Number of days before now, for LastPlayed. */
+		InLast			= 12
+	};
+
+private:
+	Operator _operator;
+
+	Field _field;
+
+	/** One value, or two for Between. */
+	QVariantList _values;
+
+	QList<SmartPlaylistRule> _rules;
+
+public:
+	/** An empty group, which matches every track. */
+	SmartPlaylistRule();
+
+	/** Every rule must match. */
+	static SmartPlaylistRule all(const QList<SmartPlaylistRule> &rules);
+
+	/** At least one rule must match. */
+	static SmartPlaylistRule any(const QList<SmartPlaylistRule> &rules);
+
+	/** Builds a condition. Between needs the lower and the upper bound, both included. */
+	static SmartPlaylistRule condition(Field field, Operator op, const QVariant &value, const QVariant &upperValue = QVariant());
+
+	/** Appends an SQL expression over "cache c" to a string, and its parameters to a list. Returns false if the rule isn't valid. */
+	bool compile(QString *sql, QVariantList *values) const;
+
+	/** Reads rules saved by toJson(). Returns an invalid rule if the document can't be read. */
+	static SmartPlaylistRule fromJson(const QByteArray &json);
+
+	/** Groups are valid if their rules are. Conditions need a field, text operators need a text field, and InLast needs a date. */
+	bool isValid() const;
+
+	/** The rule must not match. */
+	static SmartPlaylistRule negation(const SmartPlaylistRule &rule);
+
+	inline Field field() const { return _field; }
+
+	inline Operator op() const { return _operator; }
+
+	inline QList<SmartPlaylistRule> rules() const { return _rules; }
+
+	QByteArray toJson() const;
+
+	inline QVariantList values() const { return _values; }
+
+private:
+	bool isGroup() const;
+
+	static bool isTextField(Field field);
+
+	static SmartPlaylistRule fromVariant(const QVariantMap &map);
+
+	QVariantMap toVariant() const;
+};
+
+#endif // SMARTPLAYLISTRULE_H
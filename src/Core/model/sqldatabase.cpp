@@ -1,6 +1,9 @@
 #include "sqldatabase.h"
 
+#include <QCryptographicHash>
+#include <QDateTime>
 #include <QDir>
+#include <QFileInfo>
 #include <QRegularExpression>
 #include <QSqlError>
 #include <QSqlRecord>
@@ -11,9 +14,11 @@
 #include <QtDebug>
 
 #include "cover.h"
+#include "coverprobe.h"
 #include "settingsprivate.h"
 #include "musicsearchengine.h"
 #include "filehelper.h"
+#include "librarynotifier.h"
 
 #include <chrono>
 #include <random>
@@ -54,10 +59,11 @@ SqlDatabase::SqlDatabase(QObject *parent)
 		createDb.exec("CREATE TABLE IF NOT EXISTS cache (uri varchar(255) PRIMARY KEY ASC, trackNumber INTEGER, trackTitle varchar(255), trackLength INTEGER, " \
 					  "artist varchar(255), artistNormalized varchar(255), " \
 					  "album varchar(255), albumNormalized varchar(255), artistAlbum varchar(255), albumYear INTEGER,  " \
-					  "rating INTEGER, disc INTEGER, cover varchar(255), internalCover varchar(255), host varchar(255), icon varchar(255))");
+					  "rating INTEGER, disc INTEGER, cover varchar(255), internalCover varchar(255), host varchar(255), icon varchar(255), " \
+					  "artistHasWord INTEGER, albumHasWord INTEGER, albumId INTEGER, coverHash varchar(32), lastModified INTEGER, added INTEGER)");
 
 		createDb.exec("CREATE TABLE IF NOT EXISTS playlists (id INTEGER PRIMARY KEY, title varchar(255), duration INTEGER, icon varchar(255), " \
-					  "host varchar(255), background varchar(255), checksum varchar(255))");
+					  "host varchar(255), background varchar(255), checksum varchar(255), rules TEXT)");
 		createDb.exec("CREATE TABLE IF NOT EXISTS playlistTracks (trackNumber INTEGER, title varchar(255), album varchar(255), length INTEGER, " \
 					  "artist varchar(255), rating INTEGER, year INTEGER, icon varchar(255), host varchar(255), id INTEGER, " \
 					  "url varchar(255), playlistId INTEGER, FOREIGN KEY(playlistId) REFERENCES playlists(id) ON DELETE CASCADE)");
@@ -86,15 +92,20 @@ SqlDatabase::~SqlDatabase()
 void SqlDatabase::reset()
 {
 	exec("DELETE FROM cache");
+	exec("DELETE FROM covers");
 	exec("DROP INDEX indexArtist");
 	exec("DROP INDEX indexAlbum");
 	exec("DROP INDEX indexPath");
+	exec("DROP INDEX indexRating");
+	exec("DROP INDEX indexYear");
+	exec("DROP INDEX indexAdded");
 }
 
 void SqlDatabase::init()
 {
 	open();
 	this->setPragmas();
+	this->upgradeSchema();
 }
 
 uint SqlDatabase::insertIntoTablePlaylists(const PlaylistDAO &playlist, const std::list<TrackDAO> &tracks, bool isOverwriting)
@@ -122,13 +133,14 @@ uint SqlDatabase::insertIntoTablePlaylists(const PlaylistDAO &playlist, const st
 		}
 
 		QSqlQuery insert(*this);
-		insert.prepare("INSERT INTO playlists(id, title, duration, icon, host, checksum) VALUES (?, ?, ?, ?, ?, ?)");
+		insert.prepare("INSERT INTO playlists(id, title, duration, icon, host, checksum, rules) VALUES (?, ?, ?, ?, ?, ?, ?)");
 		insert.addBindValue(id);
 		insert.addBindValue(playlist.title());
 		insert.addBindValue(playlist.length());
 		insert.addBindValue(playlist.icon());
 		insert.addBindValue(playlist.host());
 		insert.addBindValue(playlist.checksum());
+		insert.addBindValue(playlist.isSmart() ? QVariant(playlist.rules()) : QVariant());
 		if (insert.exec()) {
 			this->insertIntoTablePlaylistTracks(id, tracks);
 		}
@@ -189,7 +201,7 @@ bool SqlDatabase::insertIntoTableTracks(const TrackDAO &track)
 	QString artistNorm = this->normalizeField(artistAlbum);
 	QString albumNorm = this->normalizeField(track.album());
 	uint artistId = qHash(artistNorm);
-	uint albumId = artistId + qHash(albumNorm, 1);
+	uint albumId = SqlDatabase::albumId(artistNorm, albumNorm);
 
 	insertTrack.addBindValue(track.uri());
 	insertTrack.addBindValue(track.trackNumber());
@@ -318,6 +330,75 @@ Cover* SqlDatabase::selectCoverFromURI(const QString &uri)
 	return c;
 }
 
+/** Returns the file which holds the cover of an album: a track with an embedded picture, or a picture next to tracks. */
+QString SqlDatabase::selectCoverSourceFromAlbumId(uint albumId)
+{
+	if (!isOpen()) {
+		open();
+		this->setPragmas();
+	}
+
+	// Albums which are sharing the same picture are also sharing the same source
+	QSqlQuery selectSource(*this);
+	selectSource.setForwardOnly(true);
+	selectSource.prepare("SELECT covers.uri, covers.hash FROM cache INNER JOIN covers ON cache.coverHash = covers.hash " \
+						 "WHERE cache.albumId = ? LIMIT 1");
+	selectSource.addBindValue(albumId);
+	if (selectSource.exec() && selectSource.next()) {
+		const QString source = selectSource.value(0).toString();
+		const QString coverHash = selectSource.value(1).toString();
+		selectSource.finish();
+
+		// The file which was holding the picture may be unreachable right now. Sources are only repaired when files are removed
+		if (QFileInfo::exists(source)) {
+			return source;
+		}
+		const QString otherSource = this->selectCoverSource(coverHash);
+		if (!otherSource.isEmpty()) {
+			return otherSource;
+		}
+	}
+
+	// Tracks which were scanned before covers were hashed
+	QSqlQuery selectCover(*this);
+	selectCover.setForwardOnly(true);
+	selectCover.prepare("SELECT internalCover, cover FROM cache WHERE albumId = ? AND (internalCover <> '' OR cover <> '') LIMIT 1");
+	selectCover.addBindValue(albumId);
+	if (selectCover.exec() && selectCover.next()) {
+		QString internalCover = selectCover.value(0).toString();
+		return internalCover.isEmpty() ? selectCover.value(1).toString() : internalCover;
+	}
+	return QString();
+}
+
+/** Returns one file for each unique cover. */
+QStringList SqlDatabase::selectCoverSources()
+{
+	if (!isOpen()) {
+		open();
+		this->setPragmas();
+	}
+
+	QStringList sources;
+	QSqlQuery selectCovers(*this);
+	selectCovers.setForwardOnly(true);
+	if (selectCovers.exec("SELECT uri FROM covers")) {
+		while (selectCovers.next()) {
+			sources.append(selectCovers.value(0).toString());
+		}
+	}
+
+	// Tracks which were scanned before covers were hashed
+	if (selectCovers.exec("SELECT MAX(internalCover), MAX(cover) FROM cache WHERE coverHash IS NULL AND (internalCover <> '' OR cover <> '') " \
+						  "GROUP BY albumId")) {
+		while (selectCovers.next()) {
+			QString internalCover = selectCovers.value(0).toString();
+			sources.append(internalCover.isEmpty() ? selectCovers.value(1).toString() : internalCover);
+		}
+	}
+	return sources;
+}
+
 QList<TrackDAO> SqlDatabase::selectPlaylistTracks(uint playlistID)
 {
 	if (!isOpen()) {
@@ -358,7 +439,7 @@ PlaylistDAO SqlDatabase::selectPlaylist(uint playlistId)
 	}
 
 	PlaylistDAO playlist;
-	QSqlQuery results = exec("SELECT id, title, checksum, icon, background FROM playlists WHERE id = " + QString::number(playlistId));
+	QSqlQuery results = exec("SELECT id, title, checksum, icon, background, rules FROM playlists WHERE id = " + QString::number(playlistId));
 	if (results.next()) {
 		int i = -1;
 		playlist.setId(results.record().value(++i).toString());
@@ -366,6 +447,7 @@ PlaylistDAO SqlDatabase::selectPlaylist(uint playlistId)
 		playlist.setChecksum(results.record().value(++i).toString());
 		playlist.setIcon(results.record().value(++i).toString());
 		playlist.setBackground(results.record().value(++i).toString());
+		playlist.setRules(results.record().value(++i).toString());
 	}
 	return playlist;
 }
@@ -378,7 +460,7 @@ QList<PlaylistDAO> SqlDatabase::selectPlaylists()
 	}
 
 	QList<PlaylistDAO> playlists;
-	QSqlQuery results = exec("SELECT title, id, icon, background, checksum FROM playlists");
+	QSqlQuery results = exec("SELECT title, id, icon, background, checksum, rules FROM playlists");
 	while (results.next()) {
 		PlaylistDAO playlist;
 		int i = -1;
@@ -387,6 +469,7 @@ QList<PlaylistDAO> SqlDatabase::selectPlaylists()
 		playlist.setIcon(results.record().value(++i).toString());
 		playlist.setBackground(results.record().value(++i).toString());
 		playlist.setChecksum(results.record().value(++i).toString());
+		playlist.setRules(results.record().value(++i).toString());
 		playlists.append(std::move(playlist));
 	}
 
@@ -471,9 +554,10 @@ bool SqlDatabase::updateTablePlaylist(const PlaylistDAO &playlist)
 	}
 
 	QSqlQuery update(*this);
-	update.prepare("UPDATE playlists SET title = ?, checksum = ? WHERE id = ?");
+	update.prepare("UPDATE playlists SET title = ?, checksum = ?, rules = ? WHERE id = ?");
 	update.addBindValue(playlist.title());
 	update.addBindValue(playlist.checksum());
+	update.addBindValue(playlist.isSmart() ? QVariant(playlist.rules()) : QVariant());
 	update.addBindValue(playlist.id());
 	return update.exec();
 }
@@ -507,10 +591,12 @@ void SqlDatabase::updateTableAlbumWithCoverImage(const QString &coverPath, const
 	update.exec();
 }
 
-
+/** Reads a file of the library again, after it has changed. */
 void SqlDatabase::updateTrack(const QString &absFilePath)
 {
-	FileHelper fh(absFilePath);
+	// Tags are read without the picture, which is located by the probe
+	CoverProbe probe(absFilePath);
+	FileHelper fh(absFilePath, probe);
 	if (!fh.isValid()) {
 		qDebug() << Q_FUNC_INFO << "file is not valid, won't be updated";
 		return;
@@ -519,7 +605,8 @@ void SqlDatabase::updateTrack(const QString &absFilePath)
 	QSqlQuery updateTrack(*this);
 	updateTrack.setForwardOnly(true);
 	updateTrack.prepare("UPDATE cache SET trackNumber = ?, trackTitle = ?, artist = ?, artistNormalized = ?, album = ?, albumNormalized = ?, " \
-						"albumYear = ?, artistAlbum = ?, trackLength = ?, disc = ?, internalCover = ?, rating = ? WHERE uri = ?");
+						"albumYear = ?, artistAlbum = ?, trackLength = ?, disc = ?, internalCover = ?, rating = ?, artistHasWord = ?, albumHasWord = ?, " \
+						"albumId = ?, coverHash = ?, lastModified = ? WHERE uri = ?");
 
 	QString tn = fh.trackNumber();
 	QString title = fh.title();
@@ -546,12 +633,19 @@ void SqlDatabase::updateTrack(const QString &absFilePath)
 	updateTrack.addBindValue(artistAlbum);
 	updateTrack.addBindValue(length);
 	updateTrack.addBindValue(dn);
-	if (fh.hasCover()) {
-		updateTrack.addBindValue(absFilePath);
-	} else {
+	// Each unique picture is saved once, even if every track of an album has the same one
+	QString coverHash = this->saveEmbeddedCover(fh, probe);
+	if (coverHash.isEmpty()) {
 		updateTrack.addBindValue(QVariant());
+	} else {
+		updateTrack.addBindValue(absFilePath);
 	}
 	updateTrack.addBindValue(fh.rating());
+	updateTrack.addBindValue(SqlDatabase::hasWordCharacter(artistNorm));
+	updateTrack.addBindValue(SqlDatabase::hasWordCharacter(albumNorm));
+	updateTrack.addBindValue(SqlDatabase::albumId(artistNorm, albumNorm));
+	updateTrack.addBindValue(coverHash.isEmpty() ? QVariant() : coverHash);
+	updateTrack.addBindValue(fh.fileInfo().lastModified().toMSecsSinceEpoch());
 	updateTrack.addBindValue(absFilePath);
 
 	if (!updateTrack.exec()) {
@@ -573,21 +667,44 @@ void SqlDatabase::updateTracks(const QStringList &oldPaths, const QStringList &n
 	for (int i = 0; i < newPaths.size(); i++) {
 		QString newPath = newPaths.at(i);
 		QString oldPath = oldPaths.at(i);
-		if (newPath.isEmpty()) {
+		if (newPath.isEmpty() || newPath == oldPath) {
 			this->updateTrack(oldPath);
 		} else {
-
-			QSqlQuery removeTrack(*this);
-			removeTrack.prepare("DELETE FROM cache WHERE uri = :h");
-			removeTrack.bindValue(":h", oldPath);
-			removeTrack.exec();
-
 			this->saveFileRef(newPath);
+			this->moveFileHistory(oldPath, newPath);
+			this->removeFileRef(oldPath);
 		}
 	}
 
 	commit();
 	emit aboutToUpdateView();
+
+	// Smart playlists are updated for old and new paths only
+	QStringList uris = oldPaths;
+	for (const QString &newPath : newPaths) {
+		if (!newPath.isEmpty()) {
+			uris.append(newPath);
+		}
+	}
+	emit LibraryNotifier::instance()->tracksHaveChanged(uris);
+}
+
+/** Plays and the date when a file was added are kept when it's moved or renamed. */
+void SqlDatabase::moveFileHistory(const QString &oldPath, const QString &newPath)
+{
+	QSqlQuery updateAdded(*this);
+	updateAdded.prepare("UPDATE cache SET added = (SELECT added FROM cache WHERE uri = ?) WHERE uri = ?");
+	updateAdded.addBindValue(oldPath);
+	updateAdded.addBindValue(newPath);
+	updateAdded.exec();
+
+	for (const char *table : { "plays", "playStats" }) {
+		QSqlQuery updatePlays(*this);
+		updatePlays.prepare(QString("UPDATE OR REPLACE %1 SET uri = ? WHERE uri = ?").arg(table));
+		updatePlays.addBindValue(newPath);
+		updatePlays.addBindValue(oldPath);
+		updatePlays.exec();
+	}
 }
 
 /** Reads an external picture which is close to multimedia files (same folder). */
@@ -598,15 +715,161 @@ void SqlDatabase::saveCoverRef(const QString &coverPath, const QString &track)
 	QString artistNorm = this->normalizeField(artistAlbum);
 	QString albumNorm = this->normalizeField(fh.album());
 
-	QSqlQuery updateCoverPath("UPDATE cache SET cover = ? WHERE artistNormalized = ? AND albumNormalized = ?", *this);
+	// The picture is streamed to compute its hash, it's not kept in memory
+	QString coverHash;
+	QFile file(coverPath);
+	QCryptographicHash hash(QCryptographicHash::Md5);
+	if (file.open(QIODevice::ReadOnly) && hash.addData(&file)) {
+		coverHash = hash.result().toHex();
+		this->saveCover(coverHash, coverPath);
+	}
+
+	// Tracks with an inner picture are keeping their own cover
+	QSqlQuery updateCoverPath(*this);
 	updateCoverPath.setForwardOnly(true);
+	updateCoverPath.prepare("UPDATE cache SET cover = ?, coverHash = COALESCE(coverHash, ?) WHERE artistNormalized = ? AND albumNormalized = ?");
 	updateCoverPath.addBindValue(coverPath);
+	updateCoverPath.addBindValue(coverHash.isEmpty() ? QVariant() : coverHash);
 	updateCoverPath.addBindValue(artistNorm);
 	updateCoverPath.addBindValue(albumNorm);
 	updateCoverPath.exec();
 }
 
-QString SqlDatabase::normalizeField(const QString &s) const
+/** Returns the hash of a picture saved for an unchanged file, or an empty string. */
+QString SqlDatabase::cachedCoverHash(const QString &uri)
+{
+	QSqlQuery selectHash(*this);
+	selectHash.prepare("SELECT hash, lastModified FROM thumbnails WHERE uri = ?");
+	selectHash.addBindValue(uri);
+	if (selectHash.exec() && selectHash.next() &&
+			selectHash.value(1).toLongLong() == QFileInfo(uri).lastModified().toMSecsSinceEpoch()) {
+		return selectHash.value(0).toString();
+	}
+	return QString();
+}
+
+/** Covers which were held by a file which was removed from the library are given another source, or deleted. */
+void SqlDatabase::removeCoverSource(const QString &uri)
+{
+	QStringList coverHashes;
+	QSqlQuery selectCovers(*this);
+	selectCovers.setForwardOnly(true);
+	selectCovers.prepare("SELECT hash FROM covers WHERE uri = ?");
+	selectCovers.addBindValue(uri);
+	if (selectCovers.exec()) {
+		while (selectCovers.next()) {
+			coverHashes.append(selectCovers.value(0).toString());
+		}
+	}
+	for (const QString &coverHash : coverHashes) {
+		this->replaceCoverSource(coverHash);
+	}
+}
+
+/** Finds a file of the library which holds a picture, one which can be read right now if possible. Empty if there is none. */
+QString SqlDatabase::selectCoverSource(const QString &coverHash)
+{
+	QString source;
+	QSqlQuery selectSources(*this);
+	selectSources.setForwardOnly(true);
+	selectSources.prepare("SELECT internalCover, cover FROM cache WHERE coverHash = ? AND (internalCover <> '' OR cover <> '')");
+	selectSources.addBindValue(coverHash);
+	if (selectSources.exec()) {
+		while (selectSources.next()) {
+			const QString internalCover = selectSources.value(0).toString();
+			const QString candidate = internalCover.isEmpty() ? selectSources.value(1).toString() : internalCover;
+			if (source.isEmpty()) {
+				source = candidate;
+			}
+			if (QFileInfo::exists(candidate)) {
+				source = candidate;
+				break;
+			}
+		}
+	}
+	return source;
+}
+
+/** Gives a picture another source, and returns it. The picture is deleted if no track of the library holds it anymore. */
+QString SqlDatabase::replaceCoverSource(const QString &coverHash)
+{
+	const QString source = this->selectCoverSource(coverHash);
+
+	// The location of an embedded picture belongs to the previous file, it's probed again when it's read
+	QSqlQuery updateCover(*this);
+	if (source.isEmpty()) {
+		updateCover.prepare("DELETE FROM covers WHERE hash = ?");
+	} else {
+		updateCover.prepare("UPDATE covers SET uri = ?, offset = NULL, size = NULL, mimeType = NULL WHERE hash = ?");
+		updateCover.addBindValue(source);
+	}
+	updateCover.addBindValue(coverHash);
+	updateCover.exec();
+	return source;
+}
+
+/** Saves a reference to a unique picture, and its hash for the thumbnail cache. */
+void SqlDatabase::saveCover(const QString &coverHash, const QString &uri, const CoverProbe *probe)
+{
+	QSqlQuery insertCover(*this);
+	insertCover.prepare("INSERT OR IGNORE INTO covers (hash, uri, offset, size, mimeType) VALUES (?, ?, ?, ?, ?)");
+	insertCover.addBindValue(coverHash);
+	insertCover.addBindValue(uri);
+	if (probe && probe->hasCover()) {
+		insertCover.addBindValue(probe->offset());
+		insertCover.addBindValue(probe->size());
+		insertCover.addBindValue(probe->mimeType());
+	} else {
+		insertCover.addBindValue(QVariant());
+		insertCover.addBindValue(QVariant());
+		insertCover.addBindValue(QVariant());
+	}
+	insertCover.exec();
+
+	// Thumbnails won't have to read the picture again to find its hash
+	QSqlQuery insertThumbnail(*this);
+	insertThumbnail.prepare("INSERT OR REPLACE INTO thumbnails (uri, lastModified, hash) VALUES (?, ?, ?)");
+	insertThumbnail.addBindValue(uri);
+	insertThumbnail.addBindValue(QFileInfo(uri).lastModified().toMSecsSinceEpoch());
+	insertThumbnail.addBindValue(coverHash);
+	insertThumbnail.exec();
+}
+
+/**
+ * Saves the picture embedded in a track and returns its hash, or an empty string if there is no picture.
+ * Bytes of the picture are streamed from the location found by the probe, only if the file has changed. Pictures of files
+ * which the probe can't read were read by TagLib with other tags.
+ */
+QString SqlDatabase::saveEmbeddedCover(const FileHelper &fh, const CoverProbe &probe)
+{
+	const QString absFilePath = fh.fileInfo().absoluteFilePath();
+	if (probe.isValid() && !probe.hasCover()) {
+		return QString();
+	}
+	QString coverHash = this->cachedCoverHash(absFilePath);
+	if (coverHash.isEmpty()) {
+		coverHash = probe.isValid() ? probe.hash() : fh.coverHash();
+	}
+	if (!coverHash.isEmpty()) {
+		this->saveCover(coverHash, absFilePath, probe.isValid() ? &probe : nullptr);
+	}
+	return coverHash;
+}
+
+/** Identifier of an album, computed from normalized artist and album names, like in table "tracks". */
+uint SqlDatabase::albumId(const QString &artistNorm, const QString &albumNorm)
+{
+	return qHash(artistNorm) + qHash(albumNorm, 1);
+}
+
+/** Returns true if a normalized field has at least one letter or digit. Fields without any are grouped under "Various". */
+bool SqlDatabase::hasWordCharacter(const QString &s)
+{
+	static QRegularExpression regExp("[\\w]");
+	return !s.isEmpty() && s.contains(regExp);
+}
+
+QString SqlDatabase::normalizeField(const QString &s)
 {
 	static QRegularExpression regExp("[^\\w]");
 	QString sNormed = s.toLower().normalized(QString::NormalizationForm_KD).remove(regExp).trimmed();
@@ -617,6 +880,119 @@ QString SqlDatabase::normalizeField(const QString &s) const
 	}
 }
 
+/** Add tables and columns which were introduced after the first release to an existing database. */
+void SqlDatabase::upgradeSchema()
+{
+	// Content hash of covers, to find their thumbnails. Hashes are computed again when files have changed
+	exec("CREATE TABLE IF NOT EXISTS thumbnails (uri varchar(255) PRIMARY KEY ASC, lastModified INTEGER, hash varchar(32))");
+
+	// Unique covers, with one file which holds each of them. Tracks are referencing covers with their hash.
+	// Embedded pictures also have their location in the file, to be read without parsing tags
+	exec("CREATE TABLE IF NOT EXISTS covers (hash varchar(32) PRIMARY KEY ASC, uri varchar(255), " \
+		 "offset INTEGER, size INTEGER, mimeType varchar(32))");
+
+	// Loudness of tracks and albums, and histograms of blocks which are needed to measure an album
+	exec("CREATE TABLE IF NOT EXISTS loudness (uri varchar(255) PRIMARY KEY ASC, lastModified INTEGER, albumId INTEGER, " \
+		 "trackGain REAL, trackPeak REAL, albumGain REAL, albumPeak REAL, histogram BLOB)");
+	exec("CREATE INDEX IF NOT EXISTS indexLoudnessAlbumId ON loudness (albumId)");
+
+	// Acoustic fingerprints of tracks, and their buckets to find the same recording in different files
+	exec("CREATE TABLE IF NOT EXISTS fingerprints (uri varchar(255) PRIMARY KEY ASC, lastModified INTEGER, fingerprint BLOB, " \
+		 "bucketsVersion INTEGER)");
+	exec("CREATE TABLE IF NOT EXISTS fingerprintBuckets (bucket INTEGER, fingerprintId INTEGER)");
+	exec("CREATE INDEX IF NOT EXISTS indexFingerprintBuckets ON fingerprintBuckets (bucket)");
+	exec("CREATE INDEX IF NOT EXISTS indexFingerprintBucketsId ON fingerprintBuckets (fingerprintId)");
+
+	// Byte offsets of frames at regular intervals, for seeks in long tracks
+	exec("CREATE TABLE IF NOT EXISTS seekIndexes (uri varchar(255) PRIMARY KEY ASC, lastModified INTEGER, interval INTEGER, offsets BLOB)");
+
+	// Every play and skip, and counters of each track which are updated with each batch of plays
+	exec("CREATE TABLE IF NOT EXISTS plays (uri varchar(255), timestamp INTEGER, duration INTEGER, skipped INTEGER)");
+	exec("CREATE INDEX IF NOT EXISTS indexPlaysUri ON plays (uri)");
+	exec("CREATE TABLE IF NOT EXISTS playStats (uri varchar(255) PRIMARY KEY ASC, playCount INTEGER, skipCount INTEGER, " \
+		 "playedTime INTEGER, lastPlayed INTEGER)");
+	exec("CREATE INDEX IF NOT EXISTS indexPlayStatsCount ON playStats (playCount)");
+	exec("CREATE INDEX IF NOT EXISTS indexPlayStatsLastPlayed ON playStats (lastPlayed)");
+
+	// Rules of smart playlists, which have no tracks in table "playlistTracks"
+	QSqlRecord playlists = record("playlists");
+	if (!playlists.isEmpty() && !playlists.contains("rules")) {
+		exec("ALTER TABLE playlists ADD COLUMN rules TEXT");
+	}
+
+	QSqlRecord cache = record("cache");
+	if (cache.isEmpty()) {
+		return;
+	}
+	if (!cache.contains("artistHasWord")) {
+		this->upgradeHasWordColumns();
+	}
+	if (!cache.contains("albumId")) {
+		this->upgradeAlbumIdColumn();
+	}
+	if (!cache.contains("lastModified")) {
+		// Tracks are read again by the next scan
+		exec("ALTER TABLE cache ADD COLUMN lastModified INTEGER");
+	}
+	if (!cache.contains("added")) {
+		// Tracks which were already in the library have no date, they're the oldest ones
+		exec("ALTER TABLE cache ADD COLUMN added INTEGER");
+	}
+	if (!cache.contains("coverHash")) {
+		// Pictures can't be hashed without reading every file: hashes are filled by the next scan
+		exec("ALTER TABLE cache ADD COLUMN coverHash varchar(32)");
+	}
+}
+
+void SqlDatabase::upgradeHasWordColumns()
+{
+	exec("ALTER TABLE cache ADD COLUMN artistHasWord INTEGER");
+	exec("ALTER TABLE cache ADD COLUMN albumHasWord INTEGER");
+
+	// Flags are computed once per distinct value, not once per track
+	transaction();
+	const QStringList columns = { "artistNormalized", "albumNormalized" };
+	const QStringList flags = { "artistHasWord", "albumHasWord" };
+	for (int i = 0; i < columns.size(); i++) {
+		QSqlQuery distinct(*this);
+		distinct.setForwardOnly(true);
+		if (!distinct.exec("SELECT DISTINCT " + columns.at(i) + " FROM cache")) {
+			continue;
+		}
+		QSqlQuery update(*this);
+		update.prepare("UPDATE cache SET " + flags.at(i) + " = ? WHERE " + columns.at(i) + " = ?");
+		while (distinct.next()) {
+			QString normalized = distinct.value(0).toString();
+			update.addBindValue(SqlDatabase::hasWordCharacter(normalized));
+			update.addBindValue(normalized);
+			update.exec();
+		}
+	}
+	commit();
+}
+
+void SqlDatabase::upgradeAlbumIdColumn()
+{
+	exec("ALTER TABLE cache ADD COLUMN albumId INTEGER");
+
+	transaction();
+	QSqlQuery distinct(*this);
+	distinct.setForwardOnly(true);
+	if (distinct.exec("SELECT DISTINCT artistNormalized, albumNormalized FROM cache")) {
+		QSqlQuery update(*this);
+		update.prepare("UPDATE cache SET albumId = ? WHERE artistNormalized = ? AND albumNormalized = ?");
+		while (distinct.next()) {
+			QString artistNorm = distinct.value(0).toString();
+			QString albumNorm = distinct.value(1).toString();
+			update.addBindValue(SqlDatabase::albumId(artistNorm, albumNorm));
+			update.addBindValue(artistNorm);
+			update.addBindValue(albumNorm);
+			update.exec();
+		}
+	}
+	commit();
+}
+
 void SqlDatabase::setPragmas()
 {
 	this->exec("PRAGMA journal_mode = OFF");
@@ -626,10 +1002,30 @@ void SqlDatabase::setPragmas()
 	this->exec("PRAGMA count_changes = OFF");
 }
 
+/** Removes a file from the library with its plays, loudness and seek index, and gives its covers another source. */
+void SqlDatabase::removeFileRef(const QString &absFilePath)
+{
+	// Gain of its album is computed again without this track by the next analysis
+	QSqlQuery resetAlbum(*this);
+	resetAlbum.prepare("UPDATE loudness SET albumGain = NULL, albumPeak = NULL WHERE albumId = (SELECT albumId FROM loudness WHERE uri = ?)");
+	resetAlbum.addBindValue(absFilePath);
+	resetAlbum.exec();
+
+	for (const char *table : { "cache", "plays", "playStats", "loudness", "seekIndexes" }) {
+		QSqlQuery removeTrack(*this);
+		removeTrack.prepare(QString("DELETE FROM %1 WHERE uri = ?").arg(table));
+		removeTrack.addBindValue(absFilePath);
+		removeTrack.exec();
+	}
+	this->removeCoverSource(absFilePath);
+}
+
 /** Reads a file from the filesystem and adds it into the library. */
 void SqlDatabase::saveFileRef(const QString &absFilePath)
 {
-	FileHelper fh(absFilePath);
+	// Tags are read without the picture, which is located by the probe
+	CoverProbe probe(absFilePath);
+	FileHelper fh(absFilePath, probe);
 	if (!fh.isValid()) {
 		qDebug() << Q_FUNC_INFO << "file is not valid, won't be saved";
 		return;
@@ -638,7 +1034,8 @@ void SqlDatabase::saveFileRef(const QString &absFilePath)
 	QSqlQuery insertTrack(*this);
 	insertTrack.setForwardOnly(true);
 	insertTrack.prepare("INSERT INTO cache (uri, trackNumber, trackTitle, artist, artistNormalized, album, albumNormalized, " \
-						"albumYear, artistAlbum, trackLength, disc, internalCover, rating) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+						"albumYear, artistAlbum, trackLength, disc, internalCover, rating, artistHasWord, albumHasWord, albumId, coverHash, " \
+						"lastModified, added) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
 
 	QString tn = fh.trackNumber();
 	QString title = fh.title();
@@ -666,12 +1063,20 @@ void SqlDatabase::saveFileRef(const QString &absFilePath)
 	insertTrack.addBindValue(artistAlbum);
 	insertTrack.addBindValue(length);
 	insertTrack.addBindValue(dn);
-	if (fh.hasCover()) {
-		insertTrack.addBindValue(absFilePath);
-	} else {
+	// Each unique picture is saved once, even if every track of an album has the same one
+	QString coverHash = this->saveEmbeddedCover(fh, probe);
+	if (coverHash.isEmpty()) {
 		insertTrack.addBindValue(QVariant());
+	} else {
+		insertTrack.addBindValue(absFilePath);
 	}
 	insertTrack.addBindValue(fh.rating());
+	insertTrack.addBindValue(SqlDatabase::hasWordCharacter(artistNorm));
+	insertTrack.addBindValue(SqlDatabase::hasWordCharacter(albumNorm));
+	insertTrack.addBindValue(SqlDatabase::albumId(artistNorm, albumNorm));
+	insertTrack.addBindValue(coverHash.isEmpty() ? QVariant() : coverHash);
+	insertTrack.addBindValue(fh.fileInfo().lastModified().toMSecsSinceEpoch());
+	insertTrack.addBindValue(QDateTime::currentMSecsSinceEpoch());
 
 	if (!insertTrack.exec()) {
 		qDebug() << Q_FUNC_INFO << insertTrack.lastError();
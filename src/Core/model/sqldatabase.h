@@ -14,6 +14,7 @@
 
 /// Forward declarations
 class Cover;
+class CoverProbe;
 class FileHelper;
 
 /**
@@ -44,6 +45,12 @@ public:
 	void removeRecordsFromHost(const QString &host);
 
 	Cover *selectCoverFromURI(const QString &uri);
+
+	/** Returns the file which holds the cover of an album: a track with an embedded picture, or a picture next to tracks. */
+	QString selectCoverSourceFromAlbumId(uint albumId);
+
+	/** Returns one file for each unique cover. */
+	QStringList selectCoverSources();
 	QList<TrackDAO> selectPlaylistTracks(uint playlistID);
 	PlaylistDAO selectPlaylist(uint playlistId);
 	QList<PlaylistDAO> selectPlaylists();
@@ -55,19 +62,57 @@ public:
 	void updateTablePlaylistWithBackgroundImage(uint playlistID, const QString &backgroundImagePath);
 	void updateTableAlbumWithCoverImage(const QString &coverPath, const QString &album, const QString &artist);
 
+	/** Reads a file of the library again, after it has changed. */
+	void updateTrack(const QString &absFilePath);
+
 	/** Update a list of tracks. If track name has changed, it will be removed from Library then added right after. */
 	void updateTracks(const QStringList &oldPaths, const QStringList &newPaths);
 
-	QString normalizeField(const QString &s) const;
+	static QString normalizeField(const QString &s);
+
+	/** Returns true if a normalized field has at least one letter or digit. Fields without any are grouped under "Various". */
+	static bool hasWordCharacter(const QString &s);
+
+	/** Identifier of an album, computed from normalized artist and album names, like in table "tracks". */
+	static uint albumId(const QString &artistNorm, const QString &albumNorm);
 
 private:
 	void init();
 
 	void setPragmas();
 
-	void updateTrack(const QString &absFilePath);
+	/** Add tables and columns which were introduced after the first release to an existing database. */
+	void upgradeSchema();
+
+	void upgradeHasWordColumns();
+
+	void upgradeAlbumIdColumn();
+
+	/** Returns the hash of a picture saved for an unchanged file, or an empty string. */
+	QString cachedCoverHash(const QString &uri);
+
+	/** Covers which were held by a file which was removed from the library are given another source, or deleted. */
+	void removeCoverSource(const QString &uri);
+
+	/** Gives a picture another source, and returns it. The picture is deleted if no track of the library holds it anymore. */
+	QString replaceCoverSource(const QString &coverHash);
+
+	/** Finds a file of the library which holds a picture, one which can be read right now if possible. Empty if there is none. */
+	QString selectCoverSource(const QString &coverHash);
+
+	/** Plays and the date when a file was added are kept when it's moved or renamed. */
+	void moveFileHistory(const QString &oldPath, const QString &newPath);
+
+	/** Saves a reference to a unique picture, and its hash for the thumbnail cache. */
+	void saveCover(const QString &coverHash, const QString &uri, const CoverProbe *probe = nullptr);
+
+	/** Saves the picture embedded in a track and returns its hash, or an empty string if there is no picture. */
+	QString saveEmbeddedCover(const FileHelper &fh, const CoverProbe &probe);
 
 public slots:
+	/** Removes a file from the library with its plays, loudness and seek index, and gives its covers another source. */
+	void removeFileRef(const QString &absFilePath);
+
 	/** Reads an external picture which is close to multimedia files (same folder). */
 	void saveCoverRef(const QString &coverPath, const QString &track);
 
@@ -1,7 +1,11 @@
 #include "musicsearchengine.h"
 #include "filehelper.h"
 #include "settingsprivate.h"
+#include "model/librarynotifier.h"
 #include "model/sqldatabase.h"
+#include "thumbnailcache.h"
+#include "audio/seekindex.h"
+#include "audio/waveformcache.h"
 
 #include <QCoreApplication>
 #include <QDateTime>
@@ -21,6 +25,8 @@ MusicSearchEngine::MusicSearchEngine(QObject *parent)
 	: QObject(parent)
 	, _timer(new QTimer(this))
 {
+	connect(this, &MusicSearchEngine::tracksHaveChanged, LibraryNotifier::instance(), &LibraryNotifier::tracksHaveChanged);
+
 	//_timer->setInterval(5000);
 	//connect(_timer, &QTimer::timeout, this, &MusicSearchEngine::watchForChanges);
 
@@ -79,7 +85,21 @@ void MusicSearchEngine::doSearch()
 
 	QStringList suffixes = FileHelper::suffixes(FileHelper::ET_All);
 
+	// Views which follow the library, like smart playlists, are told which files have changed by batches
+	const int batchSize = 500;
+	QStringList changedTracks;
+
+	// Files which are already in the library are read again only if they have changed. The ones which remain were deleted
 	SqlDatabase db;
+	QHash<QString, qint64> knownTracks;
+	QSqlQuery selectTracks("SELECT uri, lastModified FROM cache", db);
+	selectTracks.setForwardOnly(true);
+	if (selectTracks.exec()) {
+		while (selectTracks.next()) {
+			knownTracks.insert(selectTracks.value(0).toString(), selectTracks.value(1).toLongLong());
+		}
+	}
+
 	db.transaction();
 	for (QDir location : locations) {
 		QDirIterator it(location.absolutePath(), QDir::AllEntries | QDir::Hidden | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
@@ -107,10 +127,30 @@ void MusicSearchEngine::doSearch()
 					coverPath = qFileInfo.absoluteFilePath();
 				}
 			} else if (suffixes.contains(qFileInfo.suffix())) {
-				db.saveFileRef(qFileInfo.absoluteFilePath());
+				const QString uri = qFileInfo.absoluteFilePath();
 				atLeastOneAudioFileWasFound = true;
-				lastFileScannedNextToCover = qFileInfo.absoluteFilePath();
+				lastFileScannedNextToCover = uri;
 				isNewDirectory = false;
+				bool isChanged = true;
+				auto knownTrack = knownTracks.find(uri);
+				if (knownTrack == knownTracks.end()) {
+					db.saveFileRef(uri);
+				} else {
+					isChanged = knownTrack.value() != qFileInfo.lastModified().toMSecsSinceEpoch();
+					knownTracks.erase(knownTrack);
+					if (isChanged) {
+						db.updateTrack(uri);
+					}
+				}
+				if (isChanged) {
+					changedTracks.append(uri);
+				}
+				if (changedTracks.size() == batchSize) {
+					db.commit();
+					emit tracksHaveChanged(changedTracks);
+					changedTracks.clear();
+					db.transaction();
+				}
 			}
 
 			if (currentEntry * 100 / entryCount > percent) {
@@ -126,12 +166,44 @@ void MusicSearchEngine::doSearch()
 		}
 		atLeastOneAudioFileWasFound = false;
 	}
+
+	// Files of a location which can't be read right now, like an unmounted drive, are kept
+	for (auto it = knownTracks.cbegin(); it != knownTracks.cend(); ++it) {
+		for (const QDir &location : locations) {
+			if (location.exists() && it.key().startsWith(location.absolutePath() + '/')) {
+				db.removeFileRef(it.key());
+				changedTracks.append(it.key());
+				break;
+			}
+		}
+	}
 	db.commit();
+	if (!changedTracks.isEmpty()) {
+		emit tracksHaveChanged(changedTracks);
+	}
 
 	db.exec("CREATE INDEX IF NOT EXISTS indexArtist ON cache (artistNormalized)");
 	db.exec("CREATE INDEX IF NOT EXISTS indexAlbum ON cache (albumNormalized)");
 	db.exec("CREATE INDEX IF NOT EXISTS indexPath ON cache (uri)");
 
+	// Ranges of smart playlists
+	db.exec("CREATE INDEX IF NOT EXISTS indexRating ON cache (rating)");
+	db.exec("CREATE INDEX IF NOT EXISTS indexYear ON cache (albumYear)");
+
+	// Tracks which were added last
+	db.exec("CREATE INDEX IF NOT EXISTS indexAdded ON cache (added)");
+
+	// Only small pre-scaled covers will be loaded by views
+	ThumbnailCache::generateInBackground();
+
+	// Summaries for seek bars, which are slower to compute
+	WaveformCache::generateInBackground();
+
+	// Optional, it reads every MP3 and FLAC file again
+	if (SettingsPrivate::instance()->isSeekIndexBuilt()) {
+		SeekIndex::generateInBackground();
+	}
+
 	// Resync remote players and remote databases
 	//emit aboutToResyncRemoteSources();
 
@@ -39,6 +39,9 @@ signals:
 	void progressChanged(int);
 
 	void searchHasEnded();
+
+	/** Files which were added, changed or removed since the last signal, once they're committed. Sent during the scan, by batches. */
+	void tracksHaveChanged(const QStringList &uris);
 };
 
 #endif // MUSICSEARCHENGINE_H
@@ -0,0 +1,549 @@
+#include "playlistfile.h"
+#include "filehelper.h"
+
+#include "model/playlistdao.h"
+#include "model/sqldatabase.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QUrl>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+#include <QtDebug>
+
+namespace {
+
+/** Reads entries one after the other. */
+class PlaylistReader
+{
+private:
+	QDir _directory;
+
+public:
+	explicit PlaylistReader(const QString &directory) : _directory(directory) {}
+
+	virtual ~PlaylistReader() {}
+
+	/** Returns false at the end of the file. */
+	virtual bool readNext(PlaylistFile::Entry *entry) = 0;
+
+protected:
+	/** Local files get an absolute path, other URLs are kept as they are. */
+	QString resolve(const QString &location) const
+	{
+		const QUrl url(location);
+		if (url.isLocalFile()) {
+			return QDir::cleanPath(url.toLocalFile());
+		} else if (url.scheme().size() > 1) {
+			// Drive letters on Windows are a single character
+			return location;
+		}
+		QString path = location;
+		path.replace('\\', '/');
+		return QDir::cleanPath(_directory.absoluteFilePath(path));
+	}
+};
+
+/** #EXTM3U header, #EXTINF with the length and "Artist - Title", then the location. */
+class M3uReader : public PlaylistReader
+{
+private:
+	QTextStream _stream;
+
+	PlaylistFile::Entry _info;
+
+public:
+	M3uReader(QIODevice *device, const QString &directory, bool isUtf8)
+		: PlaylistReader(directory)
+		, _stream(device)
+	{
+		if (isUtf8) {
+			_stream.setCodec("UTF-8");
+		}
+	}
+
+	virtual bool readNext(PlaylistFile::Entry *entry) override
+	{
+		QString line;
+		while (_stream.readLineInto(&line)) {
+			line = line.trimmed();
+			if (line.startsWith("#EXTINF:", Qt::CaseInsensitive)) {
+				const int comma = line.indexOf(',');
+				_info.length = line.mid(8, comma < 0 ? -1 : comma - 8).toInt();
+				if (comma >= 0) {
+					const QString artistTitle = line.mid(comma + 1).trimmed();
+					const int separator = artistTitle.indexOf(" - ");
+					if (separator < 0) {
+						_info.title = artistTitle;
+					} else {
+						_info.artist = artistTitle.left(separator);
+						_info.title = artistTitle.mid(separator + 3);
+					}
+				}
+			} else if (!line.isEmpty() && !line.startsWith('#')) {
+				*entry = _info;
+				entry->location = this->resolve(line);
+				_info = PlaylistFile::Entry();
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+/** [playlist] section with FileN, TitleN and LengthN keys. An entry is complete when the next number starts. */
+class PlsReader : public PlaylistReader
+{
+private:
+	QTextStream _stream;
+
+	PlaylistFile::Entry _pending;
+
+	int _index;
+
+public:
+	PlsReader(QIODevice *device, const QString &directory)
+		: PlaylistReader(directory)
+		, _stream(device)
+		, _index(-1)
+	{
+		_stream.setCodec("UTF-8");
+	}
+
+	virtual bool readNext(PlaylistFile::Entry *entry) override
+	{
+		static const QRegularExpression key("^(file|title|length)(\\d+)=(.*)$", QRegularExpression::CaseInsensitiveOption);
+		QString line;
+		while (_stream.readLineInto(&line)) {
+			const QRegularExpressionMatch match = key.match(line.trimmed());
+			if (!match.hasMatch()) {
+				continue;
+			}
+			const int index = match.captured(2).toInt();
+			bool isComplete = index != _index && !_pending.location.isEmpty();
+			if (isComplete) {
+				*entry = _pending;
+				_pending = PlaylistFile::Entry();
+			}
+			_index = index;
+
+			const QString name = match.captured(1).toLower();
+			const QString value = match.captured(3).trimmed();
+			if (name == "file") {
+				_pending.location = this->resolve(value);
+			} else if (name == "title") {
+				_pending.title = value;
+			} else {
+				_pending.length = value.toInt();
+			}
+			if (isComplete) {
+				return true;
+			}
+		}
+		if (!_pending.location.isEmpty()) {
+			*entry = _pending;
+			_pending = PlaylistFile::Entry();
+			return true;
+		}
+		return false;
+	}
+};
+
+/** XML Shareable Playlist Format: each <track> has a <location> URI, and optionally <title>, <creator>, <album>, <duration>. */
+class XspfReader : public PlaylistReader
+{
+private:
+	QXmlStreamReader _xml;
+
+public:
+	XspfReader(QIODevice *device, const QString &directory)
+		: PlaylistReader(directory)
+		, _xml(device)
+	{}
+
+	virtual bool readNext(PlaylistFile::Entry *entry) override
+	{
+		bool isInTrack = false;
+		PlaylistFile::Entry track;
+		while (!_xml.atEnd()) {
+			const QXmlStreamReader::TokenType token = _xml.readNext();
+			if (token == QXmlStreamReader::StartElement) {
+				const QStringRef name = _xml.name();
+				if (name == "track") {
+					isInTrack = true;
+					track = PlaylistFile::Entry();
+				} else if (!isInTrack) {
+					continue;
+				} else if (name == "location" && track.location.isEmpty()) {
+					track.location = this->resolve(_xml.readElementText().trimmed());
+				} else if (name == "title") {
+					track.title = _xml.readElementText().trimmed();
+				} else if (name == "creator") {
+					track.artist = _xml.readElementText().trimmed();
+				} else if (name == "album") {
+					track.album = _xml.readElementText().trimmed();
+				} else if (name == "duration") {
+					track.length = int(_xml.readElementText().toLongLong() / 1000);
+				}
+			} else if (token == QXmlStreamReader::EndElement && _xml.name() == "track") {
+				isInTrack = false;
+				if (!track.location.isEmpty()) {
+					*entry = track;
+					return true;
+				}
+			}
+		}
+		if (_xml.hasError()) {
+			qDebug() << Q_FUNC_INFO << _xml.errorString();
+		}
+		return false;
+	}
+};
+
+/** Writes entries one after the other. */
+class PlaylistWriter
+{
+public:
+	virtual ~PlaylistWriter() {}
+
+	virtual void write(const PlaylistFile::Entry &entry) = 0;
+
+	/** Closes what must be closed at the end of the file. */
+	virtual void finish() {}
+};
+
+class M3uWriter : public PlaylistWriter
+{
+private:
+	QTextStream _stream;
+
+public:
+	M3uWriter(QIODevice *device, bool isUtf8)
+		: _stream(device)
+	{
+		if (isUtf8) {
+			_stream.setCodec("UTF-8");
+		}
+		_stream << "#EXTM3U\n";
+	}
+
+	virtual void write(const PlaylistFile::Entry &entry) override
+	{
+		_stream << "#EXTINF:" << entry.length << ',';
+		if (!entry.artist.isEmpty()) {
+			_stream << entry.artist << " - ";
+		}
+		_stream << entry.title << '\n' << QDir::toNativeSeparators(entry.location) << '\n';
+	}
+
+	virtual void finish() override
+	{
+		_stream.flush();
+	}
+};
+
+class PlsWriter : public PlaylistWriter
+{
+private:
+	QTextStream _stream;
+
+	int _count;
+
+public:
+	explicit PlsWriter(QIODevice *device)
+		: _stream(device)
+		, _count(0)
+	{
+		_stream.setCodec("UTF-8");
+		_stream << "[playlist]\n";
+	}
+
+	virtual void write(const PlaylistFile::Entry &entry) override
+	{
+		_count++;
+		_stream << "File" << _count << '=' << QDir::toNativeSeparators(entry.location) << '\n';
+		_stream << "Title" << _count << '=' << entry.title << '\n';
+		_stream << "Length" << _count << '=' << entry.length << '\n';
+	}
+
+	/** The number of entries is known at the end only, which most players accept. */
+	virtual void finish() override
+	{
+		_stream << "NumberOfEntries=" << _count << "\nVersion=2\n";
+		_stream.flush();
+	}
+};
+
+class XspfWriter : public PlaylistWriter
+{
+private:
+	QXmlStreamWriter _xml;
+
+public:
+	XspfWriter(QIODevice *device, const QString &title)
+		: _xml(device)
+	{
+		_xml.setAutoFormatting(true);
+		_xml.writeStartDocument();
+		_xml.writeStartElement("playlist");
+		_xml.writeAttribute("version", "1");
+		_xml.writeDefaultNamespace("http://xspf.org/ns/0/");
+		_xml.writeTextElement("title", title);
+		_xml.writeStartElement("trackList");
+	}
+
+	virtual void write(const PlaylistFile::Entry &entry) override
+	{
+		const QUrl url(entry.location);
+		_xml.writeStartElement("track");
+		if (url.scheme().size() > 1) {
+			_xml.writeTextElement("location", url.toString(QUrl::FullyEncoded));
+		} else {
+			_xml.writeTextElement("location", QUrl::fromLocalFile(entry.location).toString(QUrl::FullyEncoded));
+		}
+		if (!entry.title.isEmpty()) {
+			_xml.writeTextElement("title", entry.title);
+		}
+		if (!entry.artist.isEmpty()) {
+			_xml.writeTextElement("creator", entry.artist);
+		}
+		if (!entry.album.isEmpty()) {
+			_xml.writeTextElement("album", entry.album);
+		}
+		if (entry.length > 0) {
+			_xml.writeTextElement("duration", QString::number(qint64(entry.length) * 1000));
+		}
+		_xml.writeEndElement();
+	}
+
+	virtual void finish() override
+	{
+		_xml.writeEndElement();
+		_xml.writeEndElement();
+		_xml.writeEndDocument();
+	}
+};
+
+/** Reads tags of local files which were imported without being in the library. */
+class PlaylistTagJob : public QRunnable
+{
+private:
+	uint _playlistId;
+
+public:
+	explicit PlaylistTagJob(uint playlistId) : QRunnable(), _playlistId(playlistId) {}
+
+	virtual void run() override
+	{
+		SqlDatabase db;
+		QSqlQuery selectTracks(db);
+		selectTracks.setForwardOnly(true);
+		selectTracks.prepare("SELECT DISTINCT url FROM playlistTracks WHERE playlistId = ? AND id IS NULL");
+		selectTracks.addBindValue(_playlistId);
+		if (!selectTracks.exec()) {
+			return;
+		}
+		QSqlQuery updateTrack(db);
+		updateTrack.prepare("UPDATE playlistTracks SET trackNumber = ?, title = ?, album = ?, length = ?, artist = ?, year = ? " \
+							"WHERE playlistId = ? AND url = ?");
+		while (selectTracks.next()) {
+			const QString uri = selectTracks.value(0).toString();
+			FileHelper fh(uri);
+			if (!fh.isValid() || !fh.file()) {
+				continue;
+			}
+			updateTrack.addBindValue(fh.trackNumber().toInt());
+			updateTrack.addBindValue(fh.title().isEmpty() ? fh.fileInfo().baseName() : fh.title());
+			updateTrack.addBindValue(fh.album());
+			updateTrack.addBindValue(fh.length().toInt());
+			updateTrack.addBindValue(fh.artist());
+			updateTrack.addBindValue(fh.year().toInt());
+			updateTrack.addBindValue(_playlistId);
+			updateTrack.addBindValue(uri);
+			updateTrack.exec();
+		}
+	}
+};
+
+/** Resolves a chunk of entries with one query, and inserts them in one transaction. Returns the total length in seconds. */
+qint64 insertChunk(SqlDatabase *db, uint playlistId, const QList<PlaylistFile::Entry> &chunk, bool *hasUnknownFiles)
+{
+	// Columns of the playlist, for each track of the library
+	QHash<QString, QVariantList> knownTracks;
+	QStringList placeholders;
+	for (int i = 0; i < chunk.size(); i++) {
+		placeholders.append("?");
+	}
+	QSqlQuery selectTracks(*db);
+	selectTracks.setForwardOnly(true);
+	selectTracks.prepare("SELECT uri, trackNumber, trackTitle, album, trackLength, artist, rating, albumYear, rowid " \
+						 "FROM cache WHERE uri IN (" + placeholders.join(",") + ")");
+	for (const PlaylistFile::Entry &entry : chunk) {
+		selectTracks.addBindValue(entry.location);
+	}
+	if (selectTracks.exec()) {
+		while (selectTracks.next()) {
+			QVariantList columns;
+			for (int i = 1; i <= 8; i++) {
+				columns.append(selectTracks.value(i));
+			}
+			knownTracks.insert(selectTracks.value(0).toString(), columns);
+		}
+	} else {
+		qDebug() << Q_FUNC_INFO << selectTracks.lastError();
+	}
+
+	qint64 length = 0;
+	db->transaction();
+	QSqlQuery insert(*db);
+	insert.prepare("INSERT INTO playlistTracks (trackNumber, title, album, length, artist, rating, year, " \
+				   "icon, host, id, url, playlistId) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+	for (const PlaylistFile::Entry &entry : chunk) {
+		const QVariantList columns = knownTracks.value(entry.location);
+		if (columns.isEmpty()) {
+			// Tags are read later, if it's a local file
+			insert.addBindValue(QVariant());
+			insert.addBindValue(entry.title.isEmpty() ? QFileInfo(entry.location).completeBaseName() : entry.title);
+			insert.addBindValue(entry.album);
+			insert.addBindValue(entry.length >= 0 ? QVariant(entry.length) : QVariant());
+			insert.addBindValue(entry.artist);
+			insert.addBindValue(QVariant());
+			insert.addBindValue(QVariant());
+			length += qMax(0, entry.length);
+			*hasUnknownFiles = *hasUnknownFiles || QFileInfo::exists(entry.location);
+		} else {
+			for (int i = 0; i < 7; i++) {
+				insert.addBindValue(columns.at(i));
+			}
+			length += columns.at(3).toInt();
+		}
+		insert.addBindValue(QVariant());
+		insert.addBindValue(QVariant());
+		insert.addBindValue(columns.isEmpty() ? QVariant() : columns.at(7));
+		insert.addBindValue(entry.location);
+		insert.addBindValue(playlistId);
+		if (!insert.exec()) {
+			qDebug() << Q_FUNC_INFO << insert.lastError();
+		}
+	}
+	db->commit();
+	return length;
+}
+
+}
+
+/** Writes a playlist of the database to a file. The format is given by the suffix. */
+bool PlaylistFile::exportPlaylist(SqlDatabase *db, uint playlistId, const QString &path)
+{
+	const Format format = PlaylistFile::format(path);
+	QSaveFile file(path);
+	if (format == UnknownFormat || !file.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+
+	QScopedPointer<PlaylistWriter> writer;
+	if (format == M3U) {
+		writer.reset(new M3uWriter(&file, QFileInfo(path).suffix().toLower() == "m3u8"));
+	} else if (format == PLS) {
+		writer.reset(new PlsWriter(&file));
+	} else {
+		writer.reset(new XspfWriter(&file, db->selectPlaylist(playlistId).title()));
+	}
+
+	QSqlQuery selectTracks(*db);
+	selectTracks.setForwardOnly(true);
+	selectTracks.prepare("SELECT url, title, artist, album, length FROM playlistTracks WHERE playlistId = ? ORDER BY rowid");
+	selectTracks.addBindValue(playlistId);
+	if (!selectTracks.exec()) {
+		file.cancelWriting();
+		return false;
+	}
+	while (selectTracks.next()) {
+		Entry entry;
+		entry.location = selectTracks.value(0).toString();
+		entry.title = selectTracks.value(1).toString();
+		entry.artist = selectTracks.value(2).toString();
+		entry.album = selectTracks.value(3).toString();
+		entry.length = selectTracks.isNull(4) ? -1 : selectTracks.value(4).toInt();
+		writer->write(entry);
+	}
+	writer->finish();
+	return file.commit();
+}
+
+/** From the suffix: m3u, m3u8, pls or xspf. */
+PlaylistFile::Format PlaylistFile::format(const QString &path)
+{
+	const QString suffix = QFileInfo(path).suffix().toLower();
+	if (suffix == "m3u" || suffix == "m3u8") {
+		return M3U;
+	} else if (suffix == "pls") {
+		return PLS;
+	} else if (suffix == "xspf") {
+		return XSPF;
+	}
+	return UnknownFormat;
+}
+
+/** Reads a file into a new playlist, named after the file. Returns its id, or 0 if the file can't be read. */
+uint PlaylistFile::importPlaylist(SqlDatabase *db, const QString &path)
+{
+	const Format format = PlaylistFile::format(path);
+	QFile file(path);
+	if (format == UnknownFormat || !file.open(QIODevice::ReadOnly)) {
+		return 0;
+	}
+
+	const QFileInfo fileInfo(path);
+	QScopedPointer<PlaylistReader> reader;
+	if (format == M3U) {
+		reader.reset(new M3uReader(&file, fileInfo.absolutePath(), fileInfo.suffix().toLower() == "m3u8"));
+	} else if (format == PLS) {
+		reader.reset(new PlsReader(&file, fileInfo.absolutePath()));
+	} else {
+		reader.reset(new XspfReader(&file, fileInfo.absolutePath()));
+	}
+
+	PlaylistDAO playlist;
+	playlist.setTitle(fileInfo.completeBaseName());
+	const uint playlistId = db->insertIntoTablePlaylists(playlist, std::list<TrackDAO>(), false);
+	if (playlistId == 0) {
+		return 0;
+	}
+
+	// Only one chunk is in memory at a time
+	QList<Entry> chunk;
+	chunk.reserve(chunkSize);
+	qint64 length = 0;
+	bool hasUnknownFiles = false;
+	Entry entry;
+	while (reader->readNext(&entry)) {
+		chunk.append(entry);
+		if (chunk.size() == chunkSize) {
+			length += insertChunk(db, playlistId, chunk, &hasUnknownFiles);
+			chunk.clear();
+		}
+	}
+	if (!chunk.isEmpty()) {
+		length += insertChunk(db, playlistId, chunk, &hasUnknownFiles);
+	}
+
+	QSqlQuery updateDuration(*db);
+	updateDuration.prepare("UPDATE playlists SET duration = ? WHERE id = ?");
+	updateDuration.addBindValue(length);
+	updateDuration.addBindValue(playlistId);
+	updateDuration.exec();
+
+	if (hasUnknownFiles) {
+		QThreadPool::globalInstance()->start(new PlaylistTagJob(playlistId));
+	}
+	return playlistId;
+}
@@ -0,0 +1,58 @@
+#ifndef PLAYLISTFILE_H
+#define PLAYLISTFILE_H
+
+#include <QString>
+
+#include "miamcore_global.h"
+
+/// Forward declarations
+class SqlDatabase;
+
+/**
+ * \brief		The PlaylistFile class imports and exports playlists as M3U/M3U8, PLS and XSPF files.
+ * \details		Files are read and written one entry at a time, so memory doesn't grow with the size of the playlist. Imported entries
+ *				are resolved against table "cache" by chunks, with a single query on the index of "uri" for each chunk, and inserted
+ *				in table "playlistTracks" in one transaction per chunk. Local files which aren't in the library keep what the
+ *				playlist says about them, and their tags are read later in a thread of the global pool.
+ *				Relative paths and file URLs are resolved against the folder of the playlist. Exported locations are absolute.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY PlaylistFile
+{
+public:
+	enum Format : int
+	{
+		UnknownFormat	= 0,
+		M3U				= 1,
+		PLS				= 2,
+		XSPF			= 3
+	};
+
+	/** One track of a playlist file, with what the file says about it. */
+	struct Entry
+	{
+		QString location;
+		QString title;
+		QString artist;
+		QString album;
+		/** In seconds, or -1 if it's unknown. */
+		int length;
+
+		Entry() : length(-1) {}
+	};
+
+	/** Entries which are resolved with one query. SQLite accepts at most 999 parameters. */
+	static const int chunkSize = 500;
+
+	/** Writes a playlist of the database to a file. The format is given by the suffix. */
+	static bool exportPlaylist(SqlDatabase *db, uint playlistId, const QString &path);
+
+	/** From the suffix: m3u, m3u8, pls or xspf. */
+	static Format format(const QString &path);
+
+	/** Reads a file into a new playlist, named after the file. Returns its id, or 0 if the file can't be read. */
+	static uint importPlaylist(SqlDatabase *db, const QString &path);
+};
+
+#endif // PLAYLISTFILE_H
@@ -15,6 +15,10 @@ SettingsPrivate* SettingsPrivate::settings = nullptr;
 SettingsPrivate::SettingsPrivate(const QString &organization, const QString &application)
 	: QSettings(IniFormat, UserScope, organization, application)
 {
+	this->refreshLibrarySnapshot();
+	connect(this, &SettingsPrivate::insertPolicyHasChanged, this, &SettingsPrivate::refreshLibrarySnapshot);
+	connect(this, &SettingsPrivate::libraryArticlesHaveChanged, this, &SettingsPrivate::refreshLibrarySnapshot);
+	connect(this, &SettingsPrivate::librarySearchModeHasChanged, this, &SettingsPrivate::refreshLibrarySnapshot);
 }
 
 /** Singleton pattern to be able to easily use SettingsPrivate everywhere in the app. */
@@ -126,6 +130,12 @@ bool SettingsPrivate::isReorderArtistsArticle() const
 	return value("reorderArtistsArticle", false).toBool();
 }
 
+/** Returns true if the scanner should index frames of MP3 and FLAC files, for fast seeks in long tracks. */
+bool SettingsPrivate::isSeekIndexBuilt() const
+{
+	return value("buildSeekIndexes", false).toBool();
+}
+
 /** Returns true if a user has modified one of defaults theme. */
 bool SettingsPrivate::isButtonThemeCustomized() const
 {
@@ -300,6 +310,17 @@ bool SettingsPrivate::initLanguage(const QString &lang)
 	return b;
 }
 
+void SettingsPrivate::refreshLibrarySnapshot()
+{
+	LibrarySnapshot snapshot;
+	snapshot.insertPolicy = this->insertPolicy();
+	snapshot.librarySearchMode = this->librarySearchMode();
+	if (this->isLibraryFilteredByArticles()) {
+		snapshot.articles = this->libraryFilteredByArticles();
+	}
+	_librarySnapshot = snapshot;
+}
+
 void SettingsPrivate::setDefaultLocationFileExplorer(const QString &location)
 {
 	setValue("defaultLocationFileExplorer", location);
@@ -309,6 +330,7 @@ void SettingsPrivate::setDefaultLocationFileExplorer(const QString &location)
 void SettingsPrivate::setInsertPolicy(SettingsPrivate::InsertPolicy ip)
 {
 	setValue("insertPolicy", ip);
+	emit insertPolicyHasChanged();
 }
 
 /// SLOTS
@@ -360,6 +382,7 @@ void SettingsPrivate::setExtendedSearchVisible(bool b)
 void SettingsPrivate::setIsLibraryFilteredByArticles(bool b)
 {
 	setValue("isLibraryFilteredByArticles", b);
+	emit libraryArticlesHaveChanged();
 }
 
 /** Save the last active playlist header state. */
@@ -376,6 +399,7 @@ void SettingsPrivate::setLibraryFilteredByArticles(const QStringList &tagList)
 	} else {
 		setValue("libraryFilteredByArticles", tagList);
 	}
+	emit libraryArticlesHaveChanged();
 }
 
 /** Sets if MiamPlayer should launch background process to keep library up-to-date. */
@@ -418,6 +442,11 @@ void SettingsPrivate::setSearchAndExcludeLibrary(bool b)
 	emit librarySearchModeHasChanged();
 }
 
+void SettingsPrivate::setSeekIndexBuilt(bool b)
+{
+	setValue("buildSeekIndexes", b);
+}
+
 void SettingsPrivate::setPlaybackRestorePlaylistsAtStartup(bool b)
 {
 	setValue("playbackRestorePlaylistsAtStartup", b);
@@ -58,6 +58,15 @@ public:
 								 PDA_SaveOnClose		= 1,
 								 PDA_DiscardOnClose		= 2};
 
+	/** Settings which are read by the library in hot paths, like sorting or filtering thousands of items. */
+	struct LibrarySnapshot
+	{
+		InsertPolicy insertPolicy;
+		LibrarySearchMode librarySearchMode;
+		/** Empty if the library is not filtered by articles. */
+		QStringList articles;
+	};
+
 	QTranslator playerTranslator, defaultQtTranslator;
 
 	/** Singleton Pattern to easily use Settings everywhere in the app. */
@@ -102,6 +111,9 @@ public:
 	/** Returns true if the article should be displayed after artist's name. */
 	bool isReorderArtistsArticle() const;
 
+	/** Returns true if the scanner should index frames of MP3 and FLAC files, for fast seeks in long tracks. */
+	bool isSeekIndexBuilt() const;
+
 	/** Returns true if a user has modified one of defaults theme. */
 	bool isButtonThemeCustomized() const;
 
@@ -120,6 +132,9 @@ public:
 
 	LibrarySearchMode librarySearchMode() const;
 
+	/** Returns a copy of settings used by the library, which doesn't require any lookup in the settings file. */
+	inline const LibrarySnapshot& librarySnapshot() const { return _librarySnapshot; }
+
 	/** Returns all music locations. */
 	QStringList musicLocations() const;
 
@@ -157,8 +172,14 @@ public:
 	int volumeBarHideAfter() const;
 
 private:
+	/** Copy of library settings, refreshed each time one of them has changed. */
+	LibrarySnapshot _librarySnapshot;
+
 	bool initLanguage(const QString &lang);
 
+private slots:
+	void refreshLibrarySnapshot();
+
 public:
 	void setDefaultLocationFileExplorer(const QString &location);
 
@@ -205,6 +226,8 @@ public slots:
 
 	void setSearchAndExcludeLibrary(bool b);
 
+	void setSeekIndexBuilt(bool b);
+
 	void setTabsOverlappingLength(int l);
 
 	void setTabsRect(bool b);
@@ -220,6 +243,10 @@ signals:
 
 	void fontHasChanged(FontFamily, const QFont &font);
 
+	void insertPolicyHasChanged();
+
+	void libraryArticlesHaveChanged();
+
 	void librarySearchModeHasChanged();
 
 	void monitorFileSystemChanged(bool);
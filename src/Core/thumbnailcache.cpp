@@ -0,0 +1,258 @@
+#include "thumbnailcache.h"
+
+#include "cover.h"
+#include "coverprobe.h"
+#include "filehelper.h"
+#include "model/sqldatabase.h"
+#include "thumbnailjob.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QSqlQuery>
+
+#include <QtDebug>
+
+namespace {
+
+const int buckets[] = { 64, 128, 256, 512 };
+
+}
+
+ThumbnailCache::ThumbnailCache(SqlDatabase *db)
+	: _db(db)
+{
+	// Next to the database file
+	_directory = QFileInfo(db->databaseName()).absolutePath() + "/thumbnails";
+	QDir().mkpath(_directory);
+}
+
+/** Generates missing thumbnails of the whole library in background, unless they're being generated already. */
+void ThumbnailCache::generateInBackground()
+{
+	QMetaObject::invokeMethod(ThumbnailJob::instance(), "start", Qt::QueuedConnection);
+}
+
+/** Reads the cover of a source, or returns nullptr if there is none. */
+Cover* ThumbnailCache::readCover(const QString &source)
+{
+	QFileInfo fileInfo(source);
+	if (FileHelper::suffixes(FileHelper::ET_All).contains(fileInfo.suffix().toLower())) {
+		// Location which was found by the scanner, if the file hasn't changed since
+		QSqlQuery selectLocation(*_db);
+		selectLocation.setForwardOnly(true);
+		selectLocation.prepare("SELECT c.offset, c.size, c.mimeType FROM covers c JOIN thumbnails t ON t.uri = c.uri AND t.hash = c.hash " \
+							   "WHERE c.uri = ? AND c.offset IS NOT NULL AND t.lastModified = ?");
+		selectLocation.addBindValue(source);
+		selectLocation.addBindValue(fileInfo.lastModified().toMSecsSinceEpoch());
+		if (selectLocation.exec() && selectLocation.next()) {
+			const qint64 offset = selectLocation.value(0).toLongLong();
+			const qint64 size = selectLocation.value(1).toLongLong();
+			const QString mimeType = selectLocation.value(2).toString();
+			selectLocation.finish();
+			QFile file(source);
+			if (file.open(QIODevice::ReadOnly) && file.seek(offset)) {
+				const QByteArray picture = file.read(size);
+				if (picture.size() == size) {
+					return new Cover(picture, mimeType);
+				}
+			}
+		}
+		selectLocation.finish();
+
+		// Seek to the picture instead of parsing every tag
+		CoverProbe probe(source);
+		if (probe.isValid()) {
+			return probe.hasCover() ? new Cover(probe.readPicture(), probe.mimeType()) : nullptr;
+		}
+		FileHelper fh(source);
+		return fh.isValid() ? fh.extractCover() : nullptr;
+	}
+	Cover *cover = new Cover(source);
+	if (cover->byteArray().isEmpty()) {
+		delete cover;
+		cover = nullptr;
+	}
+	return cover;
+}
+
+/** Smallest bucket which is at least this size. */
+int ThumbnailCache::sizeBucket(int size)
+{
+	for (int bucket : buckets) {
+		if (size <= bucket) {
+			return bucket;
+		}
+	}
+	return buckets[3];
+}
+
+/** Generates thumbnails of a source in every bucket, if they don't exist yet. */
+void ThumbnailCache::generate(const QString &source)
+{
+	Cover *cover = nullptr;
+	QString hash = this->hash(source, &cover);
+	if (!hash.isEmpty()) {
+		for (int bucket : buckets) {
+			QString path = QString("%1/%2_%3.jpg").arg(_directory, hash).arg(bucket);
+			if (QFile::exists(path)) {
+				continue;
+			}
+			if (cover == nullptr) {
+				cover = this->readCover(source);
+			}
+			if (cover == nullptr || !this->writeThumbnail(cover, bucket, path)) {
+				break;
+			}
+		}
+	}
+	delete cover;
+}
+
+/** Returns the cover of a source scaled to this size, from a thumbnail if possible. */
+QImage ThumbnailCache::image(const QString &source, const QSize &size)
+{
+	QImage image;
+	QString path = this->thumbnail(source, qMax(size.width(), size.height()));
+	if (!path.isEmpty()) {
+		QFile file(path);
+		if (file.open(QIODevice::ReadOnly)) {
+			image = ThumbnailCache::decode(&file, size);
+		}
+	}
+
+	// No size was requested, or the thumbnail can't be written: decode the original picture
+	if (image.isNull()) {
+		if (Cover *cover = this->readCover(source)) {
+			image = cover->image(size);
+			delete cover;
+		}
+	}
+	return image;
+}
+
+/** Returns the path to the thumbnail of a source, which is generated if needed, or an empty string if there is no cover. */
+QString ThumbnailCache::thumbnail(const QString &source, int size)
+{
+	if (size <= 0) {
+		return QString();
+	}
+
+	QString path;
+	Cover *cover = nullptr;
+	QString hash = this->hash(source, &cover);
+	if (!hash.isEmpty()) {
+		int bucket = ThumbnailCache::sizeBucket(size);
+		path = QString("%1/%2_%3.jpg").arg(_directory, hash).arg(bucket);
+		if (!QFile::exists(path)) {
+			if (cover == nullptr) {
+				cover = this->readCover(source);
+			}
+			if (cover == nullptr || !this->writeThumbnail(cover, bucket, path)) {
+				path.clear();
+			}
+		}
+	}
+	delete cover;
+	return path;
+}
+
+/** Decodes a thumbnail, and scales it while decoding if it's larger than this size. */
+QImage ThumbnailCache::decode(QIODevice *device, const QSize &size)
+{
+	QImageReader reader(device);
+	QSize imageSize = reader.size();
+	if (imageSize.isValid() && size.isValid() && !size.isEmpty() &&
+			(imageSize.width() > size.width() || imageSize.height() > size.height())) {
+		// Decoders like JPEG can scale while decoding, which is much faster than scaling afterwards
+		reader.setScaledSize(imageSize.scaled(size, Qt::KeepAspectRatio));
+	}
+	return reader.read();
+}
+
+/** Returns the hash of the cover of a source, and reads the cover only if the source has changed since last time. */
+QString ThumbnailCache::hash(const QString &source, Cover **cover)
+{
+	QFileInfo fileInfo(source);
+	if (!fileInfo.exists()) {
+		return QString();
+	}
+	qint64 lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+
+	QSqlQuery selectHash(*_db);
+	selectHash.setForwardOnly(true);
+	selectHash.prepare("SELECT lastModified, hash FROM thumbnails WHERE uri = ?");
+	selectHash.addBindValue(source);
+	QString previousHash;
+	if (selectHash.exec() && selectHash.next()) {
+		if (selectHash.value(0).toLongLong() == lastModified) {
+			return selectHash.value(1).toString();
+		}
+		previousHash = selectHash.value(1).toString();
+	}
+	selectHash.finish();
+
+	// New or modified file
+	*cover = this->readCover(source);
+	QString hash;
+	if (*cover == nullptr) {
+		QSqlQuery deleteHash(*_db);
+		deleteHash.prepare("DELETE FROM thumbnails WHERE uri = ?");
+		deleteHash.addBindValue(source);
+		deleteHash.exec();
+	} else {
+		hash = QCryptographicHash::hash((*cover)->byteArray(), QCryptographicHash::Md5).toHex();
+		QSqlQuery updateHash(*_db);
+		updateHash.prepare("INSERT OR REPLACE INTO thumbnails (uri, lastModified, hash) VALUES (?, ?, ?)");
+		updateHash.addBindValue(source);
+		updateHash.addBindValue(lastModified);
+		updateHash.addBindValue(hash);
+		if (!updateHash.exec()) {
+			qDebug() << Q_FUNC_INFO << "cannot save hash of" << source;
+		}
+	}
+
+	// Thumbnails of the previous cover are removed, unless another source still has the same cover
+	if (!previousHash.isEmpty() && previousHash != hash) {
+		this->removeThumbnails(previousHash);
+	}
+	return hash;
+}
+
+/** Deletes files of a cover in every bucket, if no source references it anymore. */
+void ThumbnailCache::removeThumbnails(const QString &hash)
+{
+	QSqlQuery selectSource(*_db);
+	selectSource.setForwardOnly(true);
+	selectSource.prepare("SELECT 1 FROM thumbnails WHERE hash = ? LIMIT 1");
+	selectSource.addBindValue(hash);
+	if (!selectSource.exec() || selectSource.next()) {
+		return;
+	}
+	for (int bucket : buckets) {
+		QFile::remove(QString("%1/%2_%3.jpg").arg(_directory, hash).arg(bucket));
+	}
+}
+
+/** Returns false if the cover can't be decoded. */
+bool ThumbnailCache::writeThumbnail(const Cover *cover, int bucket, const QString &path) const
+{
+	QImage image = cover->image(QSize(bucket, bucket));
+	if (image.isNull()) {
+		return false;
+	}
+
+	// Several threads can generate the same thumbnail: the file is replaced at once
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	if (!image.save(&file, "JPG", 85)) {
+		file.cancelWriting();
+		return false;
+	}
+	return file.commit();
+}
@@ -0,0 +1,66 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QImage>
+#include <QString>
+
+#include "miamcore_global.h"
+
+/// Forward declarations
+class Cover;
+class QIODevice;
+class SqlDatabase;
+
+/**
+ * \brief		The ThumbnailCache class stores pre-scaled covers on disk, next to the database.
+ * \details		A source is a track with an embedded picture, or a picture next to tracks. Thumbnails are named after the hash of
+ *				the cover and a size bucket (64, 128, 256 or 512 pixels), so identical covers are only stored once. Hashes of sources
+ *				are kept in table "thumbnails" with their last modification time: a cover is read again only if its file has changed.
+ *				When the cover of a source has changed, thumbnails of the previous one are deleted if no other source shares them.
+ *				Thumbnails of the whole library are generated in background after each scan, by ThumbnailJob.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY ThumbnailCache
+{
+private:
+	SqlDatabase *_db;
+
+	QString _directory;
+
+public:
+	explicit ThumbnailCache(SqlDatabase *db);
+
+	/** Generates missing thumbnails of the whole library in background, unless they're being generated already. */
+	static void generateInBackground();
+
+	/** Reads the cover of a source, or returns nullptr if there is none. */
+	Cover* readCover(const QString &source);
+
+	/** Smallest bucket which is at least this size. */
+	static int sizeBucket(int size);
+
+	/** Generates thumbnails of a source in every bucket, if they don't exist yet. */
+	void generate(const QString &source);
+
+	/** Returns the cover of a source scaled to this size, from a thumbnail if possible. */
+	QImage image(const QString &source, const QSize &size);
+
+	/** Returns the path to the thumbnail of a source, which is generated if needed, or an empty string if there is no cover. */
+	QString thumbnail(const QString &source, int size);
+
+private:
+	/** Decodes a thumbnail, and scales it while decoding if it's larger than this size. */
+	static QImage decode(QIODevice *device, const QSize &size);
+
+	/** Returns the hash of the cover of a source, and reads the cover only if the source has changed since last time. */
+	QString hash(const QString &source, Cover **cover);
+
+	/** Deletes files of a cover in every bucket, if no source references it anymore. */
+	void removeThumbnails(const QString &hash);
+
+	/** Returns false if the cover can't be decoded. */
+	bool writeThumbnail(const Cover *cover, int bucket, const QString &path) const;
+};
+
+#endif // THUMBNAILCACHE_H
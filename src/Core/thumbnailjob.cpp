@@ -0,0 +1,87 @@
+#include "thumbnailjob.h"
+
+#include "model/sqldatabase.h"
+#include "thumbnailcache.h"
+
+#include <QCoreApplication>
+#include <QRunnable>
+#include <QThreadStorage>
+
+namespace {
+
+/** Generates thumbnails of one source, if they don't exist yet. */
+class ThumbnailTask : public QRunnable
+{
+private:
+	ThumbnailJob *_job;
+	QString _source;
+
+public:
+	ThumbnailTask(ThumbnailJob *job, const QString &source)
+		: QRunnable()
+		, _job(job)
+		, _source(source)
+	{}
+
+	virtual void run() override
+	{
+		if (!_job->isCanceled()) {
+			ThumbnailCache thumbnailCache(ThumbnailTask::database());
+			thumbnailCache.generate(_source);
+		}
+		_job->taskHasFinished();
+	}
+
+private:
+	/** Connection of the current thread of the pool, which is closed when the thread expires. */
+	static SqlDatabase* database()
+	{
+		static QThreadStorage<SqlDatabase*> databases;
+		if (!databases.hasLocalData()) {
+			databases.setLocalData(new SqlDatabase);
+		}
+		return databases.localData();
+	}
+};
+
+}
+
+ThumbnailJob::ThumbnailJob(QObject *parent)
+	: BackgroundJob(parent)
+{
+	moveToThread(QCoreApplication::instance()->thread());
+
+	// Views read thumbnails meanwhile
+	this->setThreadCount(1);
+}
+
+ThumbnailJob::~ThumbnailJob()
+{
+	this->cancel();
+}
+
+/** Can be called from any thread. It's canceled and destroyed with the application. */
+ThumbnailJob* ThumbnailJob::instance()
+{
+	static ThumbnailJob *job = [] () {
+		qAddPostRoutine([] () { delete ThumbnailJob::instance(); });
+		return new ThumbnailJob;
+	}();
+	return job;
+}
+
+/** Tasks have written their thumbnails already. */
+void ThumbnailJob::flushResults()
+{}
+
+void ThumbnailJob::start()
+{
+	if (this->isRunning()) {
+		return;
+	}
+	QList<QRunnable*> tasks;
+	for (const QString &source : this->database()->selectCoverSources()) {
+		tasks.append(new ThumbnailTask(this, source));
+	}
+	this->startTasks(tasks);
+}
@@ -0,0 +1,36 @@
+#ifndef THUMBNAILJOB_H
+#define THUMBNAILJOB_H
+
+#include "audio/backgroundjob.h"
+
+/**
+ * \brief		The ThumbnailJob class generates missing thumbnails of the whole library after each scan.
+ * \details		Each source is read by a task of the pool of the job, one at a time. Tasks write thumbnails and hashes of sources
+ *				themselves, with a connection to the database which is opened once in each thread of the pool. Sources are read
+ *				before the first cover is decoded.
+ *				There is only one job, which lives in the main thread: a scan which ends while it's running doesn't start another one,
+ *				and it's canceled when the application quits.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class MIAMCORE_LIBRARY ThumbnailJob : public BackgroundJob
+{
+	Q_OBJECT
+private:
+	explicit ThumbnailJob(QObject *parent = nullptr);
+
+public:
+	virtual ~ThumbnailJob();
+
+	/** Can be called from any thread. It's canceled and destroyed with the application. */
+	static ThumbnailJob* instance();
+
+protected:
+	/** Tasks have written their thumbnails already. */
+	virtual void flushResults() override;
+
+public slots:
+	void start();
+};
+
+#endif // THUMBNAILJOB_H
@@ -3,9 +3,13 @@ QT += quick quickcontrols2 multimedia sql websockets
 TEMPLATE = app
 
 SOURCES += \
-    main.cpp
+    coverimageprovider.cpp \
+    main.cpp \
+    waveformimageprovider.cpp
 
-HEADERS +=
+HEADERS += \
+    coverimageprovider.h \
+    waveformimageprovider.h
 
 FORMS +=
 
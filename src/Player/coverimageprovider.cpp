@@ -0,0 +1,96 @@
+#include "coverimageprovider.h"
+
+#include <model/sqldatabase.h>
+#include <thumbnailcache.h>
+
+#include <QThreadStorage>
+
+#include <QtDebug>
+
+CoverImageResponse::CoverImageResponse(CoverImageProvider *provider, uint albumId, const QSize &requestedSize)
+	: QQuickImageResponse()
+	, _provider(provider)
+	, _albumId(albumId)
+	, _requestedSize(requestedSize)
+{
+	// Responses are deleted by the QML engine
+	setAutoDelete(false);
+}
+
+QQuickTextureFactory *CoverImageResponse::textureFactory() const
+{
+	return QQuickTextureFactory::textureFactoryForImage(_image);
+}
+
+void CoverImageResponse::run()
+{
+	const QString key = QString("%1/%2x%3").arg(_albumId).arg(_requestedSize.width()).arg(_requestedSize.height());
+	_image = _provider->cachedImage(key);
+	if (!_image.isNull()) {
+		emit finished();
+		return;
+	}
+
+	// Each thread of the pool has its own connection to the database
+	static QThreadStorage<SqlDatabase*> databases;
+	if (!databases.hasLocalData()) {
+		databases.setLocalData(new SqlDatabase);
+	}
+
+	// Small pre-scaled thumbnails are read from disk instead of decoding the original cover
+	SqlDatabase *db = databases.localData();
+	QString source = db->selectCoverSourceFromAlbumId(_albumId);
+	if (!source.isEmpty()) {
+		ThumbnailCache thumbnailCache(db);
+		_image = thumbnailCache.image(source, _requestedSize);
+		if (_image.isNull()) {
+			qDebug() << Q_FUNC_INFO << "cannot decode cover for album" << _albumId;
+		} else {
+			_provider->insertImage(key, _image);
+		}
+	}
+	emit finished();
+}
+
+CoverImageProvider::CoverImageProvider(int maxCacheBytes)
+	: QQuickAsyncImageProvider()
+	, _cache(maxCacheBytes)
+{}
+
+CoverImageProvider::~CoverImageProvider()
+{
+	_pool.clear();
+	_pool.waitForDone();
+}
+
+/** Id is like "<albumId>/<size>". If sourceSize is set in QML, it takes precedence over the size in the URL. */
+QQuickImageResponse *CoverImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+	const QStringList parts = id.split('/');
+	uint albumId = parts.value(0).toUInt();
+	QSize size = requestedSize;
+	if (!size.isValid() || size.isEmpty()) {
+		int s = parts.value(1).toInt();
+		size = QSize(s, s);
+	}
+	CoverImageResponse *response = new CoverImageResponse(this, albumId, size);
+	_pool.start(response);
+	return response;
+}
+
+/** Returns a cached cover, or a null image. Can be called from any thread. */
+QImage CoverImageProvider::cachedImage(const QString &key)
+{
+	QMutexLocker locker(&_mutex);
+	if (QImage *image = _cache.object(key)) {
+		return *image;
+	}
+	return QImage();
+}
+
+/** Can be called from any thread. */
+void CoverImageProvider::insertImage(const QString &key, const QImage &image)
+{
+	QMutexLocker locker(&_mutex);
+	_cache.insert(key, new QImage(image), image.byteCount());
+}
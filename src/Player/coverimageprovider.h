@@ -0,0 +1,71 @@
+#ifndef COVERIMAGEPROVIDER_H
+#define COVERIMAGEPROVIDER_H
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QQuickAsyncImageProvider>
+#include <QRunnable>
+#include <QThreadPool>
+
+/// Forward declaration
+class CoverImageProvider;
+
+/**
+ * \brief		The CoverImageResponse class loads one cover in a thread of the pool.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class CoverImageResponse : public QQuickImageResponse, public QRunnable
+{
+	Q_OBJECT
+private:
+	CoverImageProvider *_provider;
+
+	uint _albumId;
+
+	QSize _requestedSize;
+
+	QImage _image;
+
+public:
+	CoverImageResponse(CoverImageProvider *provider, uint albumId, const QSize &requestedSize);
+
+	virtual QQuickTextureFactory *textureFactory() const override;
+
+	virtual void run() override;
+};
+
+/**
+ * \brief		The CoverImageProvider class loads album covers for QML, like "image://cover/<albumId>/<size>".
+ * \details		Covers are loaded in a thread pool, from thumbnails on disk or scaled while decoding to the requested size (or the size
+ *				in the URL).
+ *				Scaled images are kept in a cache bounded by bytes, so scrolling back to an album doesn't decode its cover again.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class CoverImageProvider : public QQuickAsyncImageProvider
+{
+private:
+	QThreadPool _pool;
+
+	QMutex _mutex;
+
+	/** Least recently used covers are removed first. Cost of an image is its size in bytes. */
+	QCache<QString, QImage> _cache;
+
+public:
+	explicit CoverImageProvider(int maxCacheBytes = 32 * 1024 * 1024);
+
+	virtual ~CoverImageProvider();
+
+	virtual QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+
+	/** Returns a cached cover, or a null image. Can be called from any thread. */
+	QImage cachedImage(const QString &key);
+
+	/** Can be called from any thread. */
+	void insertImage(const QString &key, const QImage &image);
+};
+
+#endif // COVERIMAGEPROVIDER_H
@@ -1,28 +1,210 @@
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QGuiApplication>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
 #include <QQuickStyle>
 #include <QSettings>
+#include <QSqlQuery>
+#include <QStandardPaths>
+#include <QtDebug>
 
 #define COMPANY "MmeMiamMiam"
 #define SOFT "MiamPlayerQML"
 #define VERSION "0.1"
 
+#include <audio/dspchain.h>
+#include <audio/transcodingjob.h>
 #include <library/libraryitemmodel.h>
+#include <model/smartplaylistmodel.h>
+#include <model/sqldatabase.h>
 #include <musiclocationsmodel.h>
+#include "coverimageprovider.h"
+#include "waveformimageprovider.h"
+
+#include <algorithm>
+
+/** Converts tracks and playlists without the user interface, then quits. Returns 1 if a track couldn't be converted. */
+static int transcode(QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts tracks for devices, like: --transcode opus --bitrate 128 --output /media/phone --playlist 3");
+    parser.addHelpOption();
+    parser.addOption({ "transcode", "Target profile: opus, aac, mp3 or flac.", "profile" });
+    parser.addOption({ "bitrate", "Bit rate in kbps, instead of the default of the profile.", "kbps" });
+    parser.addOption({ "output", "Directory of converted tracks.", "directory" });
+    parser.addOption({ "playlist", "Id of a playlist to convert, can be repeated.", "id" });
+    parser.addOption({ "jobs", "Number of parallel encodes, one per core by default.", "count" });
+    parser.addPositionalArgument("tracks", "Tracks to convert.", "[tracks...]");
+    parser.process(app);
+
+    TranscodingJob::Profile profile = TranscodingJob::profile(parser.value("transcode"));
+    if (profile.isNull() || !parser.isSet("output")) {
+        qWarning() << "an output directory and a profile among opus, aac, mp3 and flac are required";
+        return 1;
+    }
+
+    TranscodingJob job;
+    job.setProfile(profile);
+    job.setBitRate(parser.value("bitrate").toInt() * 1000);
+    job.setOutputDirectory(parser.value("output"));
+    job.setThreadCount(parser.value("jobs").toInt());
+    QObject::connect(&job, &TranscodingJob::progressChanged, [&job](int convertedTracks, int totalTracks) {
+        qInfo("%d / %d tracks, %.1fx realtime", convertedTracks, totalTracks, job.stats().realtimeMultiple());
+    });
+    QObject::connect(&job, &TranscodingJob::error, [](const QString &uri) {
+        qWarning() << "cannot convert" << uri;
+    });
+    QObject::connect(&job, &TranscodingJob::finished, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+
+    job.addTracks(parser.positionalArguments());
+    for (const QString &playlistId : parser.values("playlist")) {
+        if (!job.addPlaylist(playlistId.toUInt())) {
+            qWarning() << "playlist" << playlistId << "is empty or doesn't exist";
+        }
+    }
+    if (!job.isRunning()) {
+        return 0;
+    }
+    app.exec();
+
+    const TranscodingJob::Stats stats = job.stats();
+    qInfo("%d converted, %d up to date, %d failed, %.1fx realtime", stats.transcodedTracks, stats.skippedTracks,
+          stats.failedTracks, stats.realtimeMultiple());
+    return stats.failedTracks > 0 ? 1 : 0;
+}
+
+/** Runs the DSP chain on noise with each instruction set supported by the CPU, and prints the time spent, then quits. */
+static int benchmarkDsp(QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the DSP chain without any device, like: --benchmark-dsp --channels 6");
+    parser.addHelpOption();
+    parser.addOption({ "benchmark-dsp", "Runs the benchmark." });
+    parser.addOption({ "channels", "Number of channels, 2 by default.", "count", "2" });
+    parser.addOption({ "rate", "Sample rate in Hz, 44100 by default.", "hz", "44100" });
+    parser.addOption({ "block", "Frames in each block, 1024 by default.", "frames", "1024" });
+    parser.addOption({ "blocks", "Number of blocks, 10000 by default.", "count", "10000" });
+    parser.process(app);
+
+    const int channels = qBound(1, parser.value("channels").toInt(), 8);
+    const int sampleRate = qMax(8000, parser.value("rate").toInt());
+    const int blockFrames = qMax(1, parser.value("block").toInt());
+    const int blockCount = qMax(1, parser.value("blocks").toInt());
+    const char *names[] = { "scalar", "sse2", "avx2" };
+    qInfo("%d channels, %d Hz, %d blocks of %d frames", channels, sampleRate, blockCount, blockFrames);
+    for (int i = DspChain::Scalar; i <= DspChain::supportedInstructions(); i++) {
+        const DspChain::Stats stats = DspChain::benchmark(DspChain::Instructions(i), channels, sampleRate, blockFrames, blockCount);
+        qInfo("%-6s %8lld ns per block, %8lld ns at most, %.4f load", names[i], stats.averageNs(), stats.maxNs, stats.load());
+    }
+    return 0;
+}
+
+/** Loads the library from a generated cache in a temporary database, and prints the time spent, then quits. */
+static int benchmarkLibrary(QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures how long the library takes to load, like: --benchmark-library --tracks 100000");
+    parser.addHelpOption();
+    parser.addOption({ "benchmark-library", "Runs the benchmark." });
+    parser.addOption({ "tracks", "Number of tracks, 100000 by default.", "count", "100000" });
+    parser.addOption({ "runs", "Number of loads, 5 by default.", "count", "5" });
+    parser.process(app);
+
+    const int trackCount = qMax(1, parser.value("tracks").toInt());
+    const int runs = qMax(1, parser.value("runs").toInt());
+
+    // The database of the user is never touched: paths of the test mode are used instead
+    QStandardPaths::setTestModeEnabled(true);
+    QString databaseName;
+    {
+        SqlDatabase db;
+        databaseName = db.databaseName();
+        db.exec("DELETE FROM cache");
+
+        // 10 tracks per album, 5 albums per artist, and some artists have an article
+        QElapsedTimer timer;
+        timer.start();
+        db.transaction();
+        QSqlQuery insertTrack(db);
+        insertTrack.prepare("INSERT INTO cache (uri, trackNumber, trackTitle, artist, artistNormalized, album, albumNormalized, " \
+                            "albumYear, artistAlbum, trackLength, disc, rating, artistHasWord, albumHasWord, albumId, lastModified, added) " \
+                            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        for (int i = 0; i < trackCount; i++) {
+            const QString artist = QString("%1Artist %2").arg(i % 7 == 0 ? "The " : "").arg(i / 50, 5, 10, QChar('0'));
+            const QString album = QString("Album %1").arg(i / 10, 6, 10, QChar('0'));
+            const QString artistNorm = SqlDatabase::normalizeField(artist);
+            const QString albumNorm = SqlDatabase::normalizeField(album);
+            insertTrack.addBindValue(QString("/benchmark/%1/%2/%3.mp3").arg(artist, album).arg(i % 10 + 1));
+            insertTrack.addBindValue(i % 10 + 1);
+            insertTrack.addBindValue(QString("Track %1").arg(i));
+            insertTrack.addBindValue(artist);
+            insertTrack.addBindValue(artistNorm);
+            insertTrack.addBindValue(album);
+            insertTrack.addBindValue(albumNorm);
+            insertTrack.addBindValue(1960 + i / 10 % 60);
+            insertTrack.addBindValue(artist);
+            insertTrack.addBindValue(180 + i % 240);
+            insertTrack.addBindValue(1);
+            insertTrack.addBindValue(i % 6 - 1);
+            insertTrack.addBindValue(SqlDatabase::hasWordCharacter(artistNorm));
+            insertTrack.addBindValue(SqlDatabase::hasWordCharacter(albumNorm));
+            insertTrack.addBindValue(SqlDatabase::albumId(artistNorm, albumNorm));
+            insertTrack.addBindValue(0);
+            insertTrack.addBindValue(i);
+            insertTrack.exec();
+        }
+        db.commit();
+        qInfo("%d tracks generated in %lld ms", trackCount, timer.elapsed());
+    }
+
+    QList<qint64> times;
+    for (int i = 0; i < runs; i++) {
+        LibraryItemModel model;
+        QElapsedTimer timer;
+        timer.start();
+        model.load();
+        times.append(timer.elapsed());
+        qInfo("run %d: %lld ms, %d top level rows", i + 1, times.last(), model.proxy()->rowCount());
+    }
+    std::sort(times.begin(), times.end());
+    qInfo("best %lld ms, median %lld ms", times.first(), times.at(times.size() / 2));
+
+    QFile::remove(databaseName);
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
     QGuiApplication::setOrganizationName(COMPANY);
     QGuiApplication::setApplicationName(SOFT);
     QGuiApplication::setApplicationVersion(VERSION);
+
+    // Headless batch conversion and benchmarks, from scripts or a server
+    for (int i = 1; i < argc; i++) {
+        if (QString(argv[i]).startsWith("--transcode")) {
+            QCoreApplication app(argc, argv);
+            return transcode(app);
+        } else if (QString(argv[i]) == "--benchmark-dsp") {
+            QCoreApplication app(argc, argv);
+            return benchmarkDsp(app);
+        } else if (QString(argv[i]) == "--benchmark-library") {
+            QCoreApplication app(argc, argv);
+            return benchmarkLibrary(app);
+        }
+    }
+
     QGuiApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
     QGuiApplication app(argc, argv);
 
     qmlRegisterType<MusicLocationsModel>("org.miamplayer.qml", 1, 0, "MusicLocationsModel");
     qmlRegisterType<LibraryItemModel>("org.miamplayer.qml", 1, 0, "LibraryItemModel");
+    qmlRegisterType<SmartPlaylistModel>("org.miamplayer.qml", 1, 0, "SmartPlaylistModel");
 
     QQmlApplicationEngine engine;
+    engine.addImageProvider("cover", new CoverImageProvider);
+    engine.addImageProvider("waveform", new WaveformImageProvider);
 
     QSettings appSettings;
     QString style = QQuickStyle::name();
@@ -33,6 +33,7 @@ Page {
         anchors.fill: parent
 
         TreeView {
+            id: treeView
             //selectionMode: SelectionMode.ExtendedSelection
             alternatingRowColors: false
             TableViewColumn {
@@ -57,7 +58,7 @@ Page {
                     }
                 }
             }
-            model: libraryItemModel
+            model: libraryItemModel.proxy
             anchors.top: parent.top
             anchors.bottom: parent.bottom
             anchors.left: parent.left
@@ -71,6 +72,10 @@ Page {
 
                 }
             }
+
+            // The model knows which rows are expanded, to find separators in the flat list of the view
+            onExpanded: libraryItemModel.setExpanded(index, true)
+            onCollapsed: libraryItemModel.setExpanded(index, false)
         }
 
         Rectangle {
@@ -111,6 +116,12 @@ Page {
                             onExited: {
                                 parent.background.color = appSettings.menuPaneColor
                             }
+                            onClicked: {
+                                var row = libraryItemModel.flatRowForLetter(parent.text)
+                                if (row >= 0) {
+                                    treeView.flickableItem.positionViewAtIndex(row, ListView.Beginning)
+                                }
+                            }
                         }
                     }
                 }
@@ -0,0 +1,92 @@
+#include "waveformimageprovider.h"
+
+#include <audio/waveformcache.h>
+#include <model/sqldatabase.h>
+
+#include <QPainter>
+#include <QThreadStorage>
+
+#include <QtDebug>
+
+WaveformImageResponse::WaveformImageResponse(uint trackId, const QSize &requestedSize)
+	: QQuickImageResponse()
+	, _trackId(trackId)
+	, _requestedSize(requestedSize)
+{
+	// Responses are deleted by the QML engine
+	setAutoDelete(false);
+}
+
+QQuickTextureFactory *WaveformImageResponse::textureFactory() const
+{
+	return QQuickTextureFactory::textureFactoryForImage(_image);
+}
+
+void WaveformImageResponse::run()
+{
+	// Each thread of the pool has its own connection to the database
+	static QThreadStorage<SqlDatabase*> databases;
+	if (!databases.hasLocalData()) {
+		databases.setLocalData(new SqlDatabase);
+	}
+
+	WaveformCache waveformCache(databases.localData());
+	const WaveformCache::Waveform waveform = waveformCache.waveform(_trackId);
+	const WaveformCache::Level *level = WaveformCache::levelForWidth(waveform, _requestedSize.width());
+	if (!level || _requestedSize.isEmpty()) {
+		qDebug() << Q_FUNC_INFO << "no waveform for track" << _trackId;
+		emit finished();
+		return;
+	}
+
+	_image = QImage(_requestedSize, QImage::Format_ARGB32_Premultiplied);
+	_image.fill(Qt::transparent);
+	QPainter painter(&_image);
+	painter.setPen(QColor(Qt::white));
+
+	// Each column shows the extent of all pairs which are under it
+	const int width = _requestedSize.width();
+	const float middle = (_requestedSize.height() - 1) / 2.0f;
+	const int count = level->count();
+	for (int x = 0; x < width; x++) {
+		int first = qint64(x) * count / width;
+		int last = qMax(first + 1, int(qint64(x + 1) * count / width));
+		qint8 low = 127;
+		qint8 high = -127;
+		for (int i = first; i < last && i < count; i++) {
+			low = qMin(low, static_cast<qint8>(level->peaks.at(2 * i)));
+			high = qMax(high, static_cast<qint8>(level->peaks.at(2 * i + 1)));
+		}
+		if (low > high) {
+			continue;
+		}
+		painter.drawLine(x, qRound(middle - high * middle / 127.0f), x, qRound(middle - low * middle / 127.0f));
+	}
+	painter.end();
+	emit finished();
+}
+
+WaveformImageProvider::WaveformImageProvider()
+	: QQuickAsyncImageProvider()
+{}
+
+WaveformImageProvider::~WaveformImageProvider()
+{
+	_pool.clear();
+	_pool.waitForDone();
+}
+
+/** Id is like "<trackId>/<width>x<height>". If sourceSize is set in QML, it takes precedence over the size in the URL. */
+QQuickImageResponse *WaveformImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+	const QStringList parts = id.split('/');
+	uint trackId = parts.value(0).toUInt();
+	QSize size = requestedSize;
+	if (!size.isValid() || size.isEmpty()) {
+		const QStringList dimensions = parts.value(1).split('x');
+		size = QSize(dimensions.value(0).toInt(), dimensions.value(1).toInt());
+	}
+	WaveformImageResponse *response = new WaveformImageResponse(trackId, size);
+	_pool.start(response);
+	return response;
+}
@@ -0,0 +1,52 @@
+#ifndef WAVEFORMIMAGEPROVIDER_H
+#define WAVEFORMIMAGEPROVIDER_H
+
+#include <QImage>
+#include <QQuickAsyncImageProvider>
+#include <QRunnable>
+#include <QThreadPool>
+
+/**
+ * \brief		The WaveformImageResponse class draws the waveform of one track in a thread of the pool.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class WaveformImageResponse : public QQuickImageResponse, public QRunnable
+{
+	Q_OBJECT
+private:
+	uint _trackId;
+
+	QSize _requestedSize;
+
+	QImage _image;
+
+public:
+	WaveformImageResponse(uint trackId, const QSize &requestedSize);
+
+	virtual QQuickTextureFactory *textureFactory() const override;
+
+	virtual void run() override;
+};
+
+/**
+ * \brief		The WaveformImageProvider class draws waveforms of tracks for seek bars, like "image://waveform/<trackId>/<width>x<height>".
+ * \details		Peaks are read from summaries which were computed after the last scan, so a track is never decoded to draw its
+ *				waveform, unless its summary is missing. The coarsest level which still has one pair of peaks for each pixel is used.
+ * \author      Matthieu Bachelier
+ * \copyright   GNU General Public License v3
+ */
+class WaveformImageProvider : public QQuickAsyncImageProvider
+{
+private:
+	QThreadPool _pool;
+
+public:
+	explicit WaveformImageProvider();
+
+	virtual ~WaveformImageProvider();
+
+	virtual QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+};
+
+#endif // WAVEFORMIMAGEPROVIDER_H